@@ -43,6 +43,7 @@
 	#define CH2_MASK	0x80
 
 	/* Access mode */
+	#define AM_LATCH	0x00
 	#define AM_LOW		0x10
 	#define AM_HIGH		0x20
 	#define AM_LOW_HIGH	0x30
@@ -65,5 +66,7 @@
 
 	void init_PIT(void);
 
+	uint16_t pit_get_count(void);
+
 #endif /* ARCH_X86_PIT */
 
@@ -38,6 +38,10 @@
 
 	extern void outw(uint16_t value, uint16_t port);
 
+	extern void insw(uint16_t port, void *buffer, uint32_t count);
+
+	extern void outsw(uint16_t port, const void *buffer, uint32_t count);
+
 	extern uint32_t inl(uint16_t port);
 
 	extern void outl(uint32_t value, uint16_t port);
@@ -46,11 +50,17 @@
 
 	extern void sti(void);
 
+	extern uint32_t irq_save(void);
+
+	extern void irq_restore(uint32_t flags);
+
 	extern uint32_t read_cr0();
 
 	extern void write_cr0(uint32_t value);
 
 	extern void write_cr3(uint32_t value);
 
+	extern void invlpg(uint32_t addr);
+
 #endif /* ARCH_X86_IO_H */
 
@@ -63,8 +63,12 @@
 
 	uint32_t alloc_page(zone_t zone);
 
+	uint32_t alloc_contig_pages(zone_t zone, uint32_t npages);
+
 	void free_page(uint32_t page_e);
 
+	uint32_t get_free_pages(void);
+
 	void *kmalloc_e(uint32_t size);
 
 #endif /* ARCH_X86_MM_H */
@@ -47,6 +47,8 @@
 	#define PAGE_PRESENT		0x01
 	#define PAGE_WRITABLE		0x02
 	#define PAGE_USER			0x04
+	#define PAGE_WRITE_THROUGH	0x08
+	#define PAGE_CACHE_DISABLE	0x10
 
 #endif /* ARCH_X86_PAGE_H */
 
@@ -45,6 +45,7 @@ void karch(unsigned long magic, unsigned long addr)
 	karch_t kinf;
 	multiboot_info_t *mboot_info;
 	memory_map_t *mmap;
+	module_t *mod;
 	uint32_t i, type;
 	char8_t *mtypes[] = { "Avaliable", "Reserved", "ACPI", "ACPI NVS", "Unknown" };
 
@@ -102,6 +103,26 @@ void karch(unsigned long magic, unsigned long addr)
 		kinf.cmdline[0] = '\0';
 	}
 
+	/* Modules (mapped by init_pg) */
+	kinf.mods_count = 0;
+	if( (mboot_info->flags & FLAG_MODS) ) {
+		mod = (module_t *)VIRADDR((void*)mboot_info->mods_addr);
+
+		for(i=0; i<mboot_info->mods_count && i<MBOOT_MODS_MAX; i++, mod++) {
+			kinf.mods[i].start = mod->mod_start;
+			kinf.mods[i].end   = mod->mod_end;
+			kinf.mods[i].vaddr = NULL;
+			if(mod->string != 0) {
+				strncpy((char *)kinf.mods[i].cmdline,
+						(const char *)VIRADDR((void*)mod->string), MBOOT_MOD_CMDLINE - 1);
+				kinf.mods[i].cmdline[MBOOT_MOD_CMDLINE - 1] = '\0';
+			} else {
+				kinf.mods[i].cmdline[0] = '\0';
+			}
+		}
+		kinf.mods_count = i;
+	}
+
 	/* Still here we use the GDT trick to translate the virtual
 	   into physical address, now the first thing to do it's
 	   enable the paging system and reload the GDT with
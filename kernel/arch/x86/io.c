@@ -53,6 +53,24 @@ inline void outw(uint16_t value, uint16_t port)
 }
 
 
+/**
+ * Read count words from port to buffer (rep insw).
+ */
+inline void insw(uint16_t port, void *buffer, uint32_t count)
+{
+	asm volatile("cld; rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+
+/**
+ * Write count words from buffer to port (rep outsw).
+ */
+inline void outsw(uint16_t port, const void *buffer, uint32_t count)
+{
+	asm volatile("cld; rep outsw" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+
 inline uint32_t inl(uint16_t port)
 {
 	uint32_t value;
@@ -79,6 +97,31 @@ inline void sti(void)
 }
 
 
+/**
+ * Disable interrupts, returning the previous state (EFLAGS), so
+ * code that can run with interrupts enabled or disabled can make
+ * a critical section.
+ */
+inline uint32_t irq_save(void)
+{
+	uint32_t flags;
+	asm volatile("pushfl\n\t"
+				 "popl %0\n\t"
+				 "cli" : "=r" (flags) : : "memory");
+	return(flags);
+}
+
+
+/**
+ * Restore the interrupts state saved by irq_save().
+ */
+inline void irq_restore(uint32_t flags)
+{
+	asm volatile("pushl %0\n\t"
+				 "popfl" : : "r" (flags) : "memory", "cc");
+}
+
+
 inline uint32_t read_cr0() {
 	uint32_t cr0;
 	asm volatile("movl %%cr0, %0" : "=r" (cr0));
@@ -97,3 +140,9 @@ inline void write_cr3(uint32_t value)
 	asm volatile("movl %0, %%cr3" : : "r" (value));
 }
 
+
+inline void invlpg(uint32_t addr)
+{
+	asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
@@ -39,3 +39,21 @@ void init_PIT(void)
 	pit_delay();
 }
 
+
+/**
+ * Read the current value of channel 0 counter.
+ * The counter goes down from PIT_DIVIDER to 1 on each system tick.
+ */
+uint16_t pit_get_count(void)
+{
+	uint16_t count;
+
+	outb((CH0_MASK | AM_LATCH), CM_PORT);
+	pit_delay();
+	count  = inb(CH0_PORT);
+	pit_delay();
+	count |= (inb(CH0_PORT) << 0x08);
+
+	return count;
+}
+
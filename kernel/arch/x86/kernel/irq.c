@@ -92,6 +92,7 @@ int request_irq(uint16_t irq, void (*handler)(int, pt_regs *),
 	irq_queue_t *queue;
 	irq_handler_t *newh, *htmp;
 	llist *tmp;
+	uint32_t iflags;
 
 	if(irq < N_IRQ) {
 		queue = &irq_list[irq];
@@ -125,6 +126,9 @@ int request_irq(uint16_t irq, void (*handler)(int, pt_regs *),
 
 	newh->handler = handler;
 
+	/* Drivers can be initialized at the same time */
+	iflags = irq_save();
+
 	/* Generate a ID */
 	tmp = queue->queue;
 	if(tmp == NULL) {
@@ -137,12 +141,15 @@ int request_irq(uint16_t irq, void (*handler)(int, pt_regs *),
 		if(htmp != NULL) {
 			newh->id = htmp->id + 1;
 		} else {
+			irq_restore(iflags);
+			kfree(newh);
 			return(-1);
 		}
 	}
 
 	/* Install handler */
 	llist_add(&queue->queue, newh);
+	irq_restore(iflags);
 
 	return(1);
 }
@@ -86,6 +86,8 @@ static uint32_t free_phy_addr;
 static uint32_t *stack_pages;
 static uint32_t stack_top;
 static uint32_t stack_max_top;
+/** Number of pages pushed into stack */
+static uint32_t stack_npages;
 
 /** Kernel pages directory */
 volatile pagedir_t *kerneldir;
@@ -112,6 +114,21 @@ void init_pg(karch_t *kinf)
 	   translation are done by GDT trick */
 	free_phy_addr = (uint32_t)KERNEL_END_ADDR;
 
+	/* Bootloader loads modules after the kernel. Keep them into
+	   kernel region, so they get mapped and their pages are never
+	   given to anyone else */
+	for(i=0; i<kinf->mods_count; i++) {
+		if(kinf->mods[i].start < GET_PHYADDR(KERNEL_END_ADDR)) {
+			/* Not mapped (vaddr stays NULL) */
+			continue;
+		}
+		m_end = VIRADDR(PAGE_ALIGN(kinf->mods[i].end));
+		if(m_end > free_phy_addr) {
+			free_phy_addr = m_end;
+		}
+		kinf->mods[i].vaddr = (void *)VIRADDR(kinf->mods[i].start);
+	}
+
 	/* Start Kernel pages directory */
 	kerneldir = make_kerneldir();
 
@@ -162,7 +179,7 @@ void init_pg(karch_t *kinf)
 		address  += PAGE_SIZE;
 		kpages++;
 
-		if (l < TABLE_SIZE) {
+		if (l < (TABLE_SIZE - 1)) {
 			l++;
 		} else {
 			l = 0;
@@ -170,7 +187,7 @@ void init_pg(karch_t *kinf)
 			table2 = kerneldir->tables[k];
 		}
 
-		if(i < TABLE_SIZE) {
+		if(i < (TABLE_SIZE - 1)) {
 			i++;
 		} else {
 			i = 0;
@@ -226,7 +243,8 @@ void init_pg(karch_t *kinf)
 			}
 		}
 	}
-	stack_top = 0;
+	stack_npages = stack_top;
+	stack_top    = 0;
 
 	/* Enable Paging System */
 	write_cr3(kerneldir->dir_phy_addr);
@@ -300,7 +318,7 @@ uint32_t get_kernel_size(void)
  */
 uint32_t alloc_page(zone_t zone)
 {
-	if(stack_top >= stack_max_top)
+	if(stack_top >= stack_npages)
 		return(0);
 
 	if(zone == DMA_ZONE || zone == NORMAL_ZONE) {
@@ -310,6 +328,47 @@ uint32_t alloc_page(zone_t zone)
 }
 
 
+/**
+ * Return npages free pages that are physically contiguous, or 0 if
+ * they could not be found.
+ *
+ * \param zone DMA_ZONE or NORMAL_ZONE
+ * \param npages Number of pages.
+ * \return Physical address of the first page.
+ * \note Pages are freed (one by one) with free_page. The stack starts
+ * with pages in ascending order, so contiguous pages are searched
+ * among neighbour entries.
+ */
+uint32_t alloc_contig_pages(zone_t zone, uint32_t npages)
+{
+	uint32_t i, k, tmp;
+
+	if (npages == 0 || (zone != DMA_ZONE && zone != NORMAL_ZONE))
+		return(0);
+
+	for (i = stack_top; (i + npages) <= stack_npages; i++) {
+		for (k = 1; k < npages; k++) {
+			if (stack_pages[i + k] != stack_pages[i] + (k * PAGE_SIZE))
+				break;
+		}
+		if (k < npages)
+			continue;
+
+		/* Move pages to the top of the stack and take them */
+		for (k = 0; k < npages; k++) {
+			tmp                        = stack_pages[stack_top + k];
+			stack_pages[stack_top + k] = stack_pages[i + k];
+			stack_pages[i + k]         = tmp;
+		}
+		tmp        = stack_pages[stack_top];
+		stack_top += npages;
+		return(tmp);
+	}
+
+	return(0);
+}
+
+
 /**
  * Free the page entry allocated with alloc_page
  */
@@ -320,6 +379,15 @@ void free_page(uint32_t page_e)
 }
 
 
+/**
+ * Return the number of free pages
+ */
+uint32_t get_free_pages(void)
+{
+	return(stack_npages - stack_top);
+}
+
+
 /**
  * This is our kmalloc_e (early), which aims to be used before
  * enabling paging system. The variable free_phy_addr points to
@@ -7,3 +7,8 @@
 
 obj-y += ata_generic.o
 
+obj-y += ahci.o
+
+obj-y += virtio_blk.o
+
+obj-y += ramdisk.o
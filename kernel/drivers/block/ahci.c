@@ -0,0 +1,1007 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: ahci.c
+ * Desc: Driver for AHCI (SATA) controllers
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/delay.h>
+#include <tempos/wait.h>
+#include <fs/device.h>
+#include <fs/dev_numbers.h>
+#include <fs/partition.h>
+#include <fs/elevator.h>
+#include <drv/ahci.h>
+#include <drv/pci.h>
+#include <arch/irq.h>
+#include <arch/io.h>
+#include <string.h>
+
+/** Polling timeout (in 10us steps) used at initialization */
+#define AHCI_POLL_TIMEOUT	100000
+
+/** AHCI registers */
+static ahci_hba_regs_t *hba;
+
+/** Size of the mapped registers */
+static uint32_t hba_size;
+
+/** SATA disks found */
+static ahci_disk_t *ahci_disks[AHCI_MAX_DISKS];
+
+/** Number of disks found */
+static uint32_t ahci_ndisks;
+
+/** Driver structure */
+dev_blk_driver_t ahci_drv;
+
+
+static int ahci_probe(pci_device_t *pdev, const pci_device_id_t *id);
+
+static void ahci_handler(int id, pt_regs *regs);
+
+static int ahci_port_stop(ahci_port_regs_t *regs);
+
+static int ahci_port_start(ahci_port_regs_t *regs);
+
+static int ahci_port_reset(ahci_port_regs_t *regs);
+
+static int ahci_port_recover(ahci_disk_t *disk);
+
+static ahci_disk_t *ahci_port_init(uint32_t port);
+
+static int ahci_identify(ahci_disk_t *disk);
+
+static void ahci_build_cmd(ahci_disk_t *disk, uint32_t slot, uchar8_t command,
+		uint64_t addr, uint16_t count, char write);
+
+static int ahci_add_prd(ahci_disk_t *disk, uint32_t slot, void *data, uint32_t size);
+
+static int ahci_issue(ahci_disk_t *disk, blk_request_t *op);
+
+static void ahci_complete(ahci_disk_t *disk, uint32_t slot, char status);
+
+static void ahci_dispatch(ahci_disk_t *disk);
+
+static void ahci_port_irq(ahci_disk_t *disk);
+
+static int ahci_queue_op(int major, int device, char op, buff_header_t **bufs, int count);
+
+static void ahci_poll(void *arg);
+
+static void ahci_wait_buffer(int device, buff_header_t *buf);
+
+static int ahci_flush(int major, int device);
+
+
+/** AHCI block device operations (Read/Write) */
+struct _blk_dev_op ahci_ops = {
+	.read_sync_block    = read_sync_ahci_sector,
+	.read_async_block   = read_async_ahci_sector,
+	.write_async_block  = write_async_ahci_sector,
+	.write_sync_block   = write_sync_ahci_sector,
+	.write_async_blocks = write_async_ahci_sectors,
+	.read_async_blocks  = read_async_ahci_sectors,
+	.flush              = ahci_flush,
+};
+
+/** Devices handled by the driver: any SATA controller in AHCI mode */
+static const pci_device_id_t ahci_ids[] = {
+	{PCI_ANY_ID, PCI_ANY_ID, PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA},
+	{0, 0, 0, 0}
+};
+
+/** PCI driver */
+static pci_driver_t ahci_pci_drv = {
+	.name     = "ahci",
+	.id_table = ahci_ids,
+	.probe    = ahci_probe,
+};
+
+
+/**
+ * Initialize the AHCI driver. Controllers are found through PCI bus.
+ */
+void init_ahci(void)
+{
+	uint32_t i;
+	char devstr[4];
+
+	kprintf(KERN_INFO "Initializing AHCI controller...\n");
+
+	hba         = NULL;
+	ahci_ndisks = 0;
+
+	if (pci_register_driver(&ahci_pci_drv) == 0 || ahci_ndisks == 0) {
+		kprintf(KERN_INFO " No SATA disks found.\n");
+		return;
+	}
+
+	/* Register the driver (all disks share the major number) */
+	ahci_drv.major   = DEVMAJOR_SCSI_DISK;
+	ahci_drv.size         = ahci_disks[0]->sectors;
+	ahci_drv.max_sectors  = BCACHE_CLUSTER_MAX;
+	ahci_drv.max_segments = AHCI_MAX_PRDS;
+	ahci_drv.dev_ops      = &ahci_ops;
+
+	if (register_block_driver(&ahci_drv) < 0) {
+		kprintf(KERN_ERROR "Could not register a driver for AHCI disks!\n");
+		return;
+	}
+
+	/* Now, parse partition table for each disk */
+	for (i = 0; i < ahci_ndisks; i++) {
+		devstr[0] = 's';
+		devstr[1] = 'd';
+		devstr[2] = 'a' + i;
+		devstr[3] = '\0';
+
+		if (blk_add_disk(&ahci_drv, (i << AHCI_DISK_SHIFT), ahci_disks[i]->sectors) < 0) {
+			kprintf(KERN_ERROR "Could not add disk %d:%d\n",
+					DEVMAJOR_SCSI_DISK, (i << AHCI_DISK_SHIFT));
+			continue;
+		}
+
+		ahci_disks[i]->ptable = parse_mbr(ahci_drv, (i << AHCI_DISK_SHIFT));
+		if (ahci_disks[i]->ptable == NULL) {
+			kprintf(KERN_INFO "No partitions found on disk %d:%d\n",
+					DEVMAJOR_SCSI_DISK, (i << AHCI_DISK_SHIFT));
+		} else {
+			kprintf(" Found: ");
+			print_partition_table(ahci_disks[i]->ptable, devstr);
+			kprintf("\n");
+			blk_add_partitions(&ahci_drv, (i << AHCI_DISK_SHIFT), ahci_disks[i]->ptable,
+					(1 << AHCI_DISK_SHIFT));
+		}
+	}
+}
+
+
+/**
+ * Take an AHCI controller found at PCI bus.
+ *
+ * \param pdev PCI device.
+ * \param id Matching ID.
+ * \return 0 on success, -1 otherwise.
+ */
+static int ahci_probe(pci_device_t *pdev, const pci_device_id_t *id)
+{
+	pci_bar_t *abar;
+	uint32_t port, pi;
+	ahci_disk_t *disk;
+
+	/* Only one controller is supported */
+	if (hba != NULL) {
+		return -1;
+	}
+
+	abar = &pdev->bars[AHCI_ABAR];
+	if (abar->type != PCI_BAR_TYPE_MEM) {
+		return -1;
+	}
+
+	hba_size = abar->size;
+	hba      = (ahci_hba_regs_t *)kmap_phys(abar->base, hba_size);
+	if (hba == NULL) {
+		kprintf(KERN_ERROR " ahci: Could not map registers.\n");
+		return -1;
+	}
+	pci_enable_device(pdev, PCI_CMD_MEMORY | PCI_CMD_MASTER);
+
+	/* AHCI mode, interrupts disabled until ports are ready */
+	hba->ghc |= AHCI_GHC_AE;
+	hba->ghc &= ~AHCI_GHC_IE;
+
+	kprintf(KERN_INFO " ahci: %d slots%s, ports %x\n", AHCI_CAP_NCS(hba->cap),
+			((hba->cap & AHCI_CAP_SNCQ) ? ", NCQ" : ""), hba->pi);
+
+	pi = hba->pi;
+	for (port = 0; port < AHCI_MAX_PORTS && ahci_ndisks < AHCI_MAX_DISKS; port++) {
+		if ((pi & (1 << port)) == 0) {
+			continue;
+		}
+		if ((disk = ahci_port_init(port)) != NULL) {
+			ahci_disks[ahci_ndisks++] = disk;
+		}
+	}
+
+	if (ahci_ndisks == 0) {
+		kunmap_phys((void*)hba, hba_size);
+		hba = NULL;
+		return -1;
+	}
+
+	/* Enable interrupts */
+	if (request_irq(pdev->irq, ahci_handler, SA_SHIRQ, "ahci") < 0) {
+		kprintf(KERN_ERROR "Error on register IRQ %d\n", pdev->irq);
+	}
+	hba->is   = 0xFFFFFFFF;
+	hba->ghc |= AHCI_GHC_IE;
+
+	return 0;
+}
+
+
+/**
+ * Stop command processing of a port.
+ *
+ * \param regs Port registers.
+ * \return 0 on success, -1 if port did not stop.
+ */
+static int ahci_port_stop(ahci_port_regs_t *regs)
+{
+	uint32_t i;
+
+	regs->cmd &= ~(AHCI_PXCMD_ST | AHCI_PXCMD_FRE);
+
+	for (i = 0; i < AHCI_POLL_TIMEOUT; i++) {
+		if ((regs->cmd & (AHCI_PXCMD_CR | AHCI_PXCMD_FR)) == 0) {
+			return 0;
+		}
+		udelay(10);
+	}
+	return -1;
+}
+
+
+/**
+ * Start command processing of a port.
+ *
+ * \param regs Port registers.
+ * \return 0 on success, -1 if port (or device) is still busy.
+ */
+static int ahci_port_start(ahci_port_regs_t *regs)
+{
+	uint32_t i;
+
+	for (i = 0; i < AHCI_POLL_TIMEOUT; i++) {
+		if ((regs->cmd & AHCI_PXCMD_CR) == 0 &&
+				(regs->tfd & (AHCI_TFD_BSY | AHCI_TFD_DRQ)) == 0) {
+			break;
+		}
+		udelay(10);
+	}
+	if (i == AHCI_POLL_TIMEOUT) {
+		return -1;
+	}
+
+	regs->cmd |= AHCI_PXCMD_FRE;
+	regs->cmd |= AHCI_PXCMD_ST;
+	return 0;
+}
+
+
+/**
+ * Reset a port (COMRESET), used when its command engine does not
+ * stop. Command processing should be stopped (ST cleared).
+ *
+ * \param regs Port registers.
+ * \return 0 on success, -1 if the device is not back.
+ */
+static int ahci_port_reset(ahci_port_regs_t *regs)
+{
+	uint32_t i;
+
+	regs->sctl = (regs->sctl & ~AHCI_SCTL_DET_MASK) | AHCI_SCTL_DET_INIT;
+	udelay(1000);
+	regs->sctl = (regs->sctl & ~AHCI_SCTL_DET_MASK);
+
+	for (i = 0; i < AHCI_POLL_TIMEOUT; i++) {
+		if ((regs->ssts & AHCI_SSTS_DET_MASK) == AHCI_SSTS_DET_OK) {
+			regs->serr = 0xFFFFFFFF;
+			return 0;
+		}
+		udelay(10);
+	}
+	return -1;
+}
+
+
+/**
+ * Restart a port after an error. If the command engine does not
+ * stop, the port is reset. A port that can't be recovered is marked
+ * as dead, so its requests fail instead of waiting forever.
+ *
+ * \param disk The disk.
+ * \return 0 on success, -1 otherwise.
+ * \note Should be called with interrupts disabled.
+ */
+static int ahci_port_recover(ahci_disk_t *disk)
+{
+	ahci_port_regs_t *regs = disk->regs;
+
+	if (ahci_port_stop(regs) < 0) {
+		kprintf(KERN_ERROR "AHCI: port %d does not stop, resetting it.\n", disk->port);
+		if (ahci_port_reset(regs) < 0 || ahci_port_stop(regs) < 0) {
+			goto dead;
+		}
+	}
+
+	regs->serr = 0xFFFFFFFF;
+	regs->is   = 0xFFFFFFFF;
+	if (ahci_port_start(regs) < 0) {
+		goto dead;
+	}
+	return 0;
+
+dead:
+	kprintf(KERN_ERROR "AHCI: port %d could not be recovered.\n", disk->port);
+	disk->dead = 1;
+	return -1;
+}
+
+
+/**
+ * Initialize a port and the disk attached to it.
+ *
+ * \param port Port number.
+ * \return ahci_disk_t The disk, NULL if there is no (usable) disk.
+ */
+static ahci_disk_t *ahci_port_init(uint32_t port)
+{
+	ahci_port_regs_t *regs = &hba->ports[port];
+	ahci_disk_t *disk;
+	char *tables;
+	uint32_t i, ntpages;
+
+	if ((regs->ssts & AHCI_SSTS_DET_MASK) != AHCI_SSTS_DET_OK ||
+			regs->sig != AHCI_SIG_ATA) {
+		return NULL;
+	}
+
+	if (ahci_port_stop(regs) < 0) {
+		kprintf(KERN_ERROR " ahci: port %d does not stop.\n", port);
+		return NULL;
+	}
+
+	disk = (ahci_disk_t *)kmalloc(sizeof(ahci_disk_t), GFP_NORMAL_Z);
+	if (disk == NULL) {
+		return NULL;
+	}
+	memset(disk, 0, sizeof(ahci_disk_t));
+	disk->port = port;
+	disk->regs = regs;
+	blk_queue_init(&disk->queue, &elv_noop, DEVMAJOR_SCSI_DISK,
+			(ahci_ndisks << AHCI_DISK_SHIFT));
+	blk_poll_init(&disk->poll);
+
+	/* Command list (1KB) and FIS receive area (256 bytes) share a page,
+	   each command table lives inside a page */
+	ntpages = (AHCI_MAX_SLOTS * AHCI_CMD_TABLE_SIZE) >> PAGE_SHIFT;
+	disk->clist = (ahci_cmd_header_t *)kmalloc_pages(1, GFP_NORMAL_Z);
+	tables      = (char *)kmalloc_pages(ntpages, GFP_NORMAL_Z);
+	if (disk->clist == NULL || tables == NULL) {
+		if (disk->clist != NULL) {
+			kfree_pages((void*)disk->clist, 1);
+		}
+		if (tables != NULL) {
+			kfree_pages(tables, ntpages);
+		}
+		kfree(disk);
+		return NULL;
+	}
+	memset((void*)disk->clist, 0, PAGE_SIZE);
+
+	for (i = 0; i < AHCI_MAX_SLOTS; i++) {
+		disk->tables[i] = (ahci_cmd_table_t *)&tables[i * AHCI_CMD_TABLE_SIZE];
+		disk->clist[i].ctba  = kmem_phys_addr(disk->tables[i]);
+		disk->clist[i].ctbau = 0;
+	}
+
+	regs->clb  = kmem_phys_addr((void*)disk->clist);
+	regs->clbu = 0;
+	regs->fb   = regs->clb + 1024;
+	regs->fbu  = 0;
+	regs->serr = 0xFFFFFFFF;
+	regs->is   = 0xFFFFFFFF;
+	regs->ie   = 0;
+
+	if (ahci_port_start(regs) < 0) {
+		kprintf(KERN_ERROR " ahci: port %d does not start.\n", port);
+		ahci_port_stop(regs);
+		kfree_pages((void*)disk->clist, 1);
+		kfree_pages(tables, ntpages);
+		kfree(disk);
+		return NULL;
+	}
+
+	/* Queue depth */
+	disk->ncq   = 0;
+	disk->depth = 1;
+
+	if (ahci_identify(disk) < 0) {
+		kprintf(KERN_ERROR " ahci: port %d: Could not identify disk.\n", port);
+		ahci_port_stop(regs);
+		kfree_pages((void*)disk->clist, 1);
+		kfree_pages(tables, ntpages);
+		kfree(disk);
+		return NULL;
+	}
+
+	if (disk->depth > AHCI_CAP_NCS(hba->cap)) {
+		disk->depth = AHCI_CAP_NCS(hba->cap);
+	}
+
+	kprintf(KERN_INFO " sd%c: port %d, %d sectors", 'a' + ahci_ndisks, port,
+			(uint32_t)disk->sectors);
+	if (disk->ncq) {
+		kprintf(KERN_INFO ", NCQ depth %d", disk->depth);
+	}
+	kprintf(KERN_INFO "\n");
+
+	/* Interrupts: command done (D2H or set device bits FIS) and errors */
+	regs->ie = AHCI_PXIS_DHRS | AHCI_PXIS_SDBS | AHCI_PXIS_DSS | AHCI_PXIS_PSS | AHCI_PXIS_ERRORS;
+
+	return disk;
+}
+
+
+/**
+ * Send IDENTIFY DEVICE (polling) to get disk size and features.
+ *
+ * \param disk The disk.
+ * \return 0 on success, -1 otherwise.
+ */
+static int ahci_identify(ahci_disk_t *disk)
+{
+	uint16_t *info;
+	uint32_t i;
+	int ret = -1;
+
+	if ((info = (uint16_t *)kmalloc(512, GFP_NORMAL_Z)) == NULL) {
+		return -1;
+	}
+
+	ahci_build_cmd(disk, 0, AHCI_ATA_IDENTIFY, 0, 0, 0);
+	ahci_add_prd(disk, 0, info, 512);
+	disk->regs->ci = 1;
+
+	for (i = 0; i < AHCI_POLL_TIMEOUT; i++) {
+		if ((disk->regs->is & AHCI_PXIS_TFES)) {
+			break;
+		}
+		if ((disk->regs->ci & 1) == 0) {
+			ret = 0;
+			break;
+		}
+		udelay(10);
+	}
+	disk->regs->is = 0xFFFFFFFF;
+
+	if (ret == 0) {
+		/* LBA48 size (words 100-103), LBA28 size (words 60-61) otherwise */
+		disk->sectors = info[100] | ((uint32_t)info[101] << 16) |
+				((uint64_t)info[102] << 32) | ((uint64_t)info[103] << 48);
+		if (disk->sectors == 0) {
+			disk->sectors = info[60] | ((uint32_t)info[61] << 16);
+		}
+
+		/* NCQ: word 76 bit 8, queue depth at word 75 */
+		if ((hba->cap & AHCI_CAP_SNCQ) && (info[76] & 0x0100)) {
+			disk->ncq   = 1;
+			disk->depth = (info[75] & 0x1F) + 1;
+		}
+	}
+
+	kfree(info);
+	return ret;
+}
+
+
+/**
+ * Fill command header and command FIS of a slot.
+ *
+ * \param disk The disk.
+ * \param slot Command slot.
+ * \param command ATA command.
+ * \param addr LBA 48bit sector address.
+ * \param count Number of sectors.
+ * \param write Data goes to device.
+ */
+static void ahci_build_cmd(ahci_disk_t *disk, uint32_t slot, uchar8_t command,
+		uint64_t addr, uint16_t count, char write)
+{
+	ahci_cmd_header_t *hdr = &disk->clist[slot];
+	ahci_cmd_table_t *tbl  = disk->tables[slot];
+	fis_reg_h2d_t *fis;
+
+	memset(tbl, 0, sizeof(ahci_cmd_table_t));
+
+	fis = (fis_reg_h2d_t *)tbl->cfis;
+	fis->type    = FIS_TYPE_REG_H2D;
+	fis->flags   = FIS_H2D_CMD;
+	fis->command = command;
+	fis->device  = 0x40; /* LBA */
+	fis->lba0    = (uchar8_t)(addr & 0xFF);
+	fis->lba1    = (uchar8_t)((addr >> 8) & 0xFF);
+	fis->lba2    = (uchar8_t)((addr >> 16) & 0xFF);
+	fis->lba3    = (uchar8_t)((addr >> 24) & 0xFF);
+	fis->lba4    = (uchar8_t)((addr >> 32) & 0xFF);
+	fis->lba5    = (uchar8_t)((addr >> 40) & 0xFF);
+
+	if (command == AHCI_ATA_READ_FPDMA || command == AHCI_ATA_WRITE_FPDMA) {
+		/* Sector count goes at features, tag at count */
+		fis->feature_low  = count & 0xFF;
+		fis->feature_high = (count >> 8) & 0xFF;
+		fis->count_low    = (slot << 3);
+	} else {
+		fis->count_low    = count & 0xFF;
+		fis->count_high   = (count >> 8) & 0xFF;
+	}
+
+	hdr->flags = (sizeof(fis_reg_h2d_t) / sizeof(uint32_t)) & AHCI_CMD_CFL_MASK;
+	if (write) {
+		hdr->flags |= AHCI_CMD_WRITE;
+	}
+	hdr->prdtl = 0;
+	hdr->prdbc = 0;
+}
+
+
+/**
+ * Add a piece of memory to the PRD table of a slot. Physically
+ * contiguous pieces share the same entry.
+ *
+ * \param disk The disk.
+ * \param slot Command slot.
+ * \param data Memory (it should not cross a page).
+ * \param size Size in bytes (even).
+ * \return 0 on success, -1 if PRD table is full.
+ */
+static int ahci_add_prd(ahci_disk_t *disk, uint32_t slot, void *data, uint32_t size)
+{
+	ahci_cmd_header_t *hdr = &disk->clist[slot];
+	struct _ahci_prd *prd;
+	uint32_t phys;
+
+	phys = kmem_phys_addr(data);
+
+	if (hdr->prdtl > 0) {
+		prd = &disk->tables[slot]->prdt[hdr->prdtl - 1];
+		if ((prd->dba + prd->dbc + 1) == phys) {
+			prd->dbc += size;
+			return 0;
+		}
+	}
+
+	if (hdr->prdtl >= AHCI_MAX_PRDS) {
+		return -1;
+	}
+
+	prd = &disk->tables[slot]->prdt[hdr->prdtl++];
+	prd->dba  = phys;
+	prd->dbau = 0;
+	prd->dbc  = size - 1;
+
+	return 0;
+}
+
+
+/**
+ * Send a request to disk, if there is a free slot.
+ *
+ * \param disk The disk.
+ * \param op The request.
+ * \return 0 on success, -1 if there is no free slot.
+ * \note Should be called with interrupts disabled.
+ */
+static int ahci_issue(ahci_disk_t *disk, blk_request_t *op)
+{
+	uint32_t slot;
+	uchar8_t command;
+	int i;
+
+	for (slot = 0; slot < disk->depth; slot++) {
+		if ((disk->active & (1 << slot)) == 0) {
+			break;
+		}
+	}
+	if (slot == disk->depth) {
+		return -1;
+	}
+
+	if (op->op == BLK_FLUSH) {
+		command = AHCI_ATA_FLUSH_EXT;
+	} else if (disk->ncq) {
+		command = (op->op == BLK_READ ? AHCI_ATA_READ_FPDMA : AHCI_ATA_WRITE_FPDMA);
+	} else {
+		command = (op->op == BLK_READ ? AHCI_ATA_READ_DMA_EXT : AHCI_ATA_WRITE_DMA_EXT);
+	}
+
+	ahci_build_cmd(disk, slot, command, op->sector, op->count, (op->op == BLK_WRITE));
+	for (i = 0; i < op->count; i++) {
+		ahci_add_prd(disk, slot, op->buffs[i]->data, BUFF_SIZE);
+	}
+
+	disk->slots[slot] = op;
+	disk->active     |= (1 << slot);
+
+	if (disk->ncq && op->op != BLK_FLUSH) {
+		disk->regs->sact = (1 << slot);
+	}
+	disk->regs->ci = (1 << slot);
+
+	return 0;
+}
+
+
+/**
+ * Finish the request of a slot.
+ *
+ * \param disk The disk.
+ * \param slot Command slot.
+ * \param status New status of the buffers.
+ * \note Should be called with interrupts disabled.
+ */
+static void ahci_complete(ahci_disk_t *disk, uint32_t slot, char status)
+{
+	blk_request_t *op = disk->slots[slot];
+
+	disk->slots[slot] = NULL;
+	disk->active     &= ~(1 << slot);
+	if (op == disk->flush) {
+		disk->flush = NULL;
+	}
+	blk_end_request(op, status);
+}
+
+
+/**
+ * Send queued requests to disk while there are free slots. A flush
+ * (FLUSH CACHE EXT) is not a queued command: it waits for the slots
+ * in use to drain and runs alone.
+ *
+ * \param disk The disk.
+ * \note Should be called with interrupts disabled.
+ */
+static void ahci_dispatch(ahci_disk_t *disk)
+{
+	blk_request_t *op;
+	uint32_t all;
+
+	if (disk->dead) {
+		/* Port is gone: fail what is queued */
+		while ((op = blk_next_request(&disk->queue)) != NULL) {
+			blk_end_request(op, BUFF_ST_UNLOCKED);
+		}
+		return;
+	}
+
+	all = (disk->depth == AHCI_MAX_SLOTS ? 0xFFFFFFFF : ((1 << disk->depth) - 1));
+	while (disk->active != all) {
+		if (disk->flush == NULL) {
+			if ((op = blk_next_request(&disk->queue)) == NULL) {
+				break;
+			}
+			if (op->op != BLK_FLUSH) {
+				ahci_issue(disk, op);
+				continue;
+			}
+			disk->flush = op;
+		}
+
+		if (disk->active == 0) {
+			ahci_issue(disk, disk->flush);
+		}
+		break;
+	}
+}
+
+
+/**
+ * Handle interrupts of a port: finish requests that are done and
+ * send the pending ones.
+ *
+ * \param disk The disk.
+ */
+static void ahci_port_irq(ahci_disk_t *disk)
+{
+	ahci_port_regs_t *regs = disk->regs;
+	uint32_t pis, done, slot;
+
+	pis      = regs->is;
+	regs->is = pis;
+
+	if ((pis & AHCI_PXIS_ERRORS)) {
+		kprintf(KERN_ERROR "AHCI ERROR: port %d, status %x, task file %x\n",
+				disk->port, pis, regs->tfd);
+
+		/* Fail all requests and restart port */
+		for (slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+			if ((disk->active & (1 << slot))) {
+				ahci_complete(disk, slot, BUFF_ST_UNLOCKED);
+			}
+		}
+		ahci_port_recover(disk);
+	} else {
+		/* Slots that are not active on device anymore are done */
+		done = disk->active & ~(regs->sact | regs->ci);
+		for (slot = 0; done != 0; slot++, done >>= 1) {
+			if ((done & 1)) {
+				ahci_complete(disk, slot, BUFF_ST_VALID);
+			}
+		}
+	}
+
+	/* Send requests waiting for a slot */
+	ahci_dispatch(disk);
+}
+
+
+/**
+ * Interrupt handler.
+ */
+static void ahci_handler(int id, pt_regs *regs)
+{
+	uint32_t is, i;
+
+	cli();
+
+	if (hba == NULL || (is = hba->is) == 0) {
+		/* Not for us */
+		sti();
+		return;
+	}
+
+	for (i = 0; i < ahci_ndisks; i++) {
+		if ((is & (1 << ahci_disks[i]->port))) {
+			ahci_port_irq(ahci_disks[i]);
+		}
+	}
+	hba->is = is;
+
+	sti();
+	wakeup(WAIT_INT_AHCI);
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+}
+
+
+/**
+ * Put a request into the queue of a disk.
+ *
+ * \param major Major number.
+ * \param device Device number (disk or partition).
+ * \param op Operation: BLK_READ or BLK_WRITE.
+ * \param bufs Buffers (holding consecutive sectors).
+ * \param count Number of buffers.
+ * \return 0 on success, -1 otherwise.
+ */
+static int ahci_queue_op(int major, int device, char op, buff_header_t **bufs, int count)
+{
+	ahci_disk_t *disk;
+	uint64_t addr;
+	int i, ndisk;
+
+	if (major != DEVMAJOR_SCSI_DISK || count < 1 || count > BCACHE_CLUSTER_MAX) {
+		return -1;
+	}
+
+	/* Partition (or disk) to disk address */
+	if ((ndisk = blk_map_sector(&ahci_drv, device, bufs[0]->addr, count, &addr)) < 0) {
+		return -1;
+	}
+	disk = ahci_disks[ndisk >> AHCI_DISK_SHIFT];
+
+	cli();
+	if (blk_queue_bufs(&disk->queue, op, device, addr, bufs, count) < 0) {
+		sti();
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		bufs[i]->status = BUFF_ST_BUSY;
+	}
+
+	/* Send now if there is a free slot, otherwise it waits */
+	ahci_dispatch(disk);
+	sti();
+
+	return 0;
+}
+
+
+/**
+ * Finish the requests done by disk, without waiting for its
+ * interrupt (used by polled completion).
+ *
+ * \param arg The disk.
+ */
+static void ahci_poll(void *arg)
+{
+	ahci_disk_t *disk = (ahci_disk_t *)arg;
+	uint32_t active;
+
+	cli();
+	active = disk->active;
+	ahci_port_irq(disk);
+	if (disk->active == active) {
+		/* Nothing done yet */
+		sti();
+		return;
+	}
+	sti();
+
+	/* Interrupt could find nothing left to do, so wake up here */
+	wakeup(WAIT_INT_AHCI);
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+}
+
+
+/**
+ * Wait for the transfer of a buffer, polling the disk while it's
+ * worth it.
+ *
+ * \param device Device number (disk or partition).
+ * \param buf The buffer (already queued).
+ */
+static void ahci_wait_buffer(int device, buff_header_t *buf)
+{
+	ahci_disk_t *disk = ahci_disks[(uint32_t)device >> AHCI_DISK_SHIFT];
+
+	blk_poll_wait(&disk->poll, &buf->status, ahci_poll, disk, WAIT_INT_AHCI);
+}
+
+
+/**
+ * Flush the write cache of a disk. The flush is a barrier: it's sent
+ * after all writes queued before it (and before all requests queued
+ * after it).
+ *
+ * \param major Major number.
+ * \param device Device number (disk or partition), -1 for all disks.
+ * \return 0 on success, -1 otherwise.
+ * \note This function will sleep until the cache gets flushed.
+ */
+static int ahci_flush(int major, int device)
+{
+	ahci_disk_t *disk;
+	uint64_t addr;
+	uint32_t i;
+	int ndisk;
+	volatile char status;
+
+	if (device < 0) {
+		for (i = 0; i < ahci_ndisks; i++) {
+			if (ahci_flush(major, (i << AHCI_DISK_SHIFT)) < 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if ((ndisk = blk_map_sector(&ahci_drv, device, 0, 0, &addr)) < 0) {
+		return -1;
+	}
+	disk = ahci_disks[ndisk >> AHCI_DISK_SHIFT];
+
+	cli();
+	status = BUFF_ST_BUSY;
+	if (blk_queue_flush(&disk->queue, device, &status) < 0) {
+		sti();
+		return -1;
+	}
+	ahci_dispatch(disk);
+	sti();
+
+	blk_poll_wait(&disk->poll, &status, ahci_poll, disk, WAIT_INT_AHCI);
+
+	return (status == BUFF_ST_VALID ? 0 : -1);
+}
+
+
+/**
+ * Read a sector from disk asynchronously.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ */
+int read_async_ahci_sector(int major, int device, buff_header_t *buf)
+{
+	return ahci_queue_op(major, device, BLK_READ, &buf, 1);
+}
+
+
+/**
+ * Read a sector from disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ * \note This function will sleep until the block becomes available.
+ */
+int read_sync_ahci_sector(int major, int device, buff_header_t *buf)
+{
+	int res;
+
+	res = ahci_queue_op(major, device, BLK_READ, &buf, 1);
+
+	if (res == 0) {
+		ahci_wait_buffer(device, buf);
+	}
+
+	return res;
+}
+
+
+/**
+ * Write a sector to disk asynchronously.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ */
+int write_async_ahci_sector(int major, int device, buff_header_t *buf)
+{
+	return ahci_queue_op(major, device, BLK_WRITE, &buf, 1);
+}
+
+
+/**
+ * Write a sector to disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ * \note This function will sleep until the block is written.
+ */
+int write_sync_ahci_sector(int major, int device, buff_header_t *buf)
+{
+	int res;
+
+	res = ahci_queue_op(major, device, BLK_WRITE, &buf, 1);
+
+	if (res == 0) {
+		ahci_wait_buffer(device, buf);
+	}
+
+	return res;
+}
+
+
+/**
+ * Write consecutive sectors to disk asynchronously, with one command.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ */
+int write_async_ahci_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ahci_queue_op(major, device, BLK_WRITE, bufs, count);
+}
+
+
+/**
+ * Read consecutive sectors from disk asynchronously, with one command.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ */
+int read_async_ahci_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ahci_queue_op(major, device, BLK_READ, bufs, count);
+}
+
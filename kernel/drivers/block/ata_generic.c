@@ -28,14 +28,17 @@
 #include <tempos/jiffies.h>
 #include <tempos/delay.h>
 #include <tempos/wait.h>
+#include <tempos/sched.h>
+#include <tempos/probe.h>
 #include <fs/device.h>
 #include <fs/dev_numbers.h>
 #include <fs/partition.h>
+#include <fs/elevator.h>
 #include <drv/ata_generic.h>
+#include <drv/pci.h>
 #include <drv/i8042.h>
 #include <arch/irq.h>
 #include <arch/io.h>
-#include <linkedl.h>
 
 #define SECTOR_HALF_SIZE (SECTOR_SIZE / 2)
 
@@ -77,12 +80,57 @@
 #define CMD_WRITE_SECTORS_EXT	0x34
 #define CMD_FLUSH_CACHE			0xE7
 #define CMD_FLUSH_CACHE_EXT		0xEA
-
-#define OP_READ		0x01
-#define OP_WRITE	0x02
-
-#define ATA_DISCARD_NEXT_IRQ  0x01
-#define ATA_HANDLE_NEXT_IRQ   0x00
+#define CMD_READ_MULTIPLE_EXT	0x29
+#define CMD_WRITE_MULTIPLE_EXT	0x39
+#define CMD_SET_MULTIPLE		0xC6
+#define CMD_SET_FEATURES		0xEF
+#define CMD_READ_DMA_EXT		0x25
+#define CMD_WRITE_DMA_EXT		0x35
+
+#define ERR_BIT		0x01
+
+/* SET FEATURES subcommands */
+#define FEAT_ENABLE_WCACHE		0x02
+#define FEAT_DISABLE_WCACHE		0x82
+
+/* Bus master IDE registers (offset from channel base) */
+#define BM_CMD		0
+#define BM_STATUS	2
+#define BM_PRD		4
+
+/* Bus master IDE channels are 8 ports apart */
+#define BM_CHANNEL_PORTS	8
+
+#define BM_CMD_START	0x01
+#define BM_CMD_READ		0x08
+
+#define BM_ST_ACTIVE	0x01
+#define BM_ST_ERR		0x02
+#define BM_ST_IRQ		0x04
+
+/** Last entry of PRD table */
+#define PRD_EOT		0x8000
+
+/* Channel states */
+/** No command in progress */
+#define ATA_ST_IDLE		0
+/** PIO write sent, waiting DRQ for the first block (no interrupt) */
+#define ATA_ST_DRQ_WAIT	1
+/** Waiting interrupt: PIO read block ready */
+#define ATA_ST_PIO_IN	2
+/** Waiting interrupt: device ready for the next PIO write block */
+#define ATA_ST_PIO_OUT	3
+/** Waiting interrupt: DMA transfer done */
+#define ATA_ST_DMA		4
+/** Waiting interrupt: write cache flushed */
+#define ATA_ST_FLUSH	5
+
+/** Time (in jiffies) a command can take */
+#define ATA_CMD_TIMEOUT	(10 * HZ)
+
+/** Reads of alternate status waiting for DRQ before leaving it to the
+    timer (each read takes about 1us) */
+#define ATA_DRQ_SPINS	64
 
 /** ATA devices information */
 static ata_dev_info ata_devices[4];
@@ -91,29 +139,69 @@ static ata_dev_info ata_devices[4];
 part_table_st *ptable[4];
 
 /**
- * Block operation structure
+ * Physical region descriptor: a piece of memory that bus master
+ * transfers (it must not cross a 64KB boundary).
  */
-struct _block_op {
-	/** Type of operation: Read (OP_READ) or Write (OP_WRITE) */
-	char op;
-	/** Device */
-	int device;
-	/** Buffer */
-	buff_header_t *buff;
-};
+struct _ata_prd {
+	/** Physical address */
+	uint32_t addr;
+	/** Size in bytes (0 means 64KB) */
+	uint16_t count;
+	/** PRD_EOT at the last entry */
+	uint16_t flags;
+} __attribute__ ((packed));
 
 /**
- * Linked list to blocks operation requests.
- * There is one list for each device:
+ * Queues of block requests (sorted by I/O scheduler).
+ * There is one queue for each device:
  * 0 - hda
  * 1 - hdb
  * 2 - hdc
  * 3 - hdd
  */
-static llist *blk_queue[4];
+static blk_queue_t blk_queue[4];
+
+/**
+ * State of a channel (bus). Both devices of the bus share its
+ * registers and its IRQ, so only one of them has a command at a time.
+ */
+struct _ata_channel {
+	/** Major number */
+	int major;
+	/** ATA_ST_IDLE, ATA_ST_DRQ_WAIT, ATA_ST_PIO_IN, ... */
+	char state;
+	/** Request being transferred (NULL when idle) */
+	blk_request_t *active;
+	/** Device (index of ata_devices) of the last request */
+	int dev;
+	/** Device selected at the bus (-1 if unknown) */
+	int selected;
+	/** Active command should be done until this time (jiffies) */
+	uint32_t deadline;
+	/** Timeout (and DRQ wait) timer */
+	ktimer_t timer;
+};
+
+/** Channels: primary and secondary bus */
+static struct _ata_channel channels[2];
 
-/** Indicate when we should discard a IRQ */
-static char discard_irq[2];
+/** Minor number of each device (whole disk) */
+static const int ata_minors[4] = {DEVNUM_HDA, DEVNUM_HDB, DEVNUM_HDC, DEVNUM_HDD};
+
+/** Devices with data written since the last cache flush */
+static char wcache_dirty[4];
+
+/* Result of the probe of a device */
+#define ATA_PROBE_NONE		0
+#define ATA_PROBE_ATAPI		1
+#define ATA_PROBE_DISK		2
+#define ATA_PROBE_ERROR		3
+
+/** Result of the probe of each device (ATA_PROBE_*) */
+static char ata_probe_res[4];
+
+/** Write cache of devices is disabled (ata_writethrough=1) */
+static int ata_writethrough;
 
 /** Driver structure */
 dev_blk_driver_t ata_bus_drv[2];
@@ -126,6 +214,26 @@ static uint16_t pio_ports[2][9] = {
 		{0x170, 0x171, 0x172, 0x173, 0x174, 0x175, 0x176, 0x177, 0x376}
 };
 
+/** IRQ of each bus */
+static uchar8_t ata_irqs[2] = {ATA_PRI_IRQ, ATA_SEC_IRQ};
+
+/** IDE controller at PCI bus (NULL if not found) */
+static pci_device_t *ata_pci;
+
+/** Bus master IDE ports of each bus (0 if there is no bus master) */
+static uint16_t bm_ports[2];
+
+/** PRD table of each bus (one page, it never crosses 64KB) */
+static struct _ata_prd *prd_table[2];
+
+
+static void ata_pci_setup(void);
+
+static void ata_probe_bus(void *arg);
+
+static void ata_probe_device(int i);
+
+static void id_string(char *str, uint16_t *words, int len);
 
 static void send_cmd(uchar8_t bus, uchar8_t command);
 
@@ -139,17 +247,56 @@ static void ata_handler1(int id, pt_regs *regs);
 
 static void ata_handler2(int id, pt_regs *regs);
 
-static int read_hd_sector(int major, int device, uint64_t addr);
+static void ata_handle_irq(uchar8_t bus);
+
+static int get_sector_location(int major, int device, uint64_t addr, uint32_t count,
+		uchar8_t *bus, uchar8_t *dev, uint64_t *diskaddr);
+
+static void set_sectors(uchar8_t bus, uint64_t addr, uint16_t count);
+
+static void ata_delay400ns(uchar8_t bus);
+
+static void ata_select(uchar8_t bus, int dev);
+
+static int ata_wait_drq(uchar8_t bus);
+
+static void ata_reset(uchar8_t bus);
+static void set_multiple(uchar8_t bus, ata_dev_info *devinfo);
+
+static void set_write_cache(uchar8_t bus, ata_dev_info *devinfo, int enable);
+
+static void transfer_data_in(uchar8_t bus, blk_request_t *bop, int drq);
+
+static void transfer_data_out(uchar8_t bus, blk_request_t *bop, int drq);
+
+static void dma_hd_sectors(uchar8_t bus, blk_request_t *bop);
+
+static int dma_done(uchar8_t bus);
+
+static void ata_issue(uchar8_t bus, int dev, blk_request_t *bop);
 
-static int write_hd_sector(int major, int device, uint64_t addr, char *sector);
+static void ata_complete(uchar8_t bus, char status);
+
+static void ata_timer(void *arg);
+
+static void ata_start_op(uchar8_t bus);
+
+static void ata_wait_buffer(int major, int device, buff_header_t *buf);
+
+static int ata_queue_op(int major, int device, char op, buff_header_t **bufs, int count);
+
+static int ata_flush(int major, int device);
 
 
 /** ATA block device operations (Read/Write) */
 struct _blk_dev_op ata_ops = {
-	.read_sync_block   = read_sync_ata_sector,
-	.read_async_block  = read_async_ata_sector,
-	.write_async_block = write_async_ata_sector,
-	.write_sync_block  = write_sync_ata_sector,
+	.read_sync_block    = read_sync_ata_sector,
+	.read_async_block   = read_async_ata_sector,
+	.write_async_block  = write_async_ata_sector,
+	.write_sync_block   = write_sync_ata_sector,
+	.write_async_blocks = write_async_ata_sectors,
+	.read_async_blocks  = read_async_ata_sectors,
+	.flush              = ata_flush,
 };
 
 
@@ -161,178 +308,248 @@ struct _blk_dev_op ata_ops = {
 void init_ata_generic(void)
 {
 	int i;
-	char drvl = 'a';
-	uint64_t size;
-	uchar8_t dev, bus;
-	uchar8_t sc, saddr1, saddr2, saddr3, status;
+	char drvl;
+	char devstr[4];
+	uchar8_t bus;
+	task_t *probe_th[2];
+	char *wt;
 	
 	kprintf(KERN_INFO "Initializing generic ATA controller...\n");
 
+	/* ata_writethrough=1 disables write cache of all devices */
+	wt = cmdline_get_value("ata_writethrough");
+	ata_writethrough = (wt != NULL && wt[0] == '1');
+
 
 	/* Probe primary and secondary bus */
 	/* We use polling just on initialization. Data transfers will use IRQ. */
 
-	/* NOTE: The correct way it's use PCI bus to get the information about
-	   ATA bus (PIO ports and so on), but we don't have PCI support yet :-( */
+	/* Get ports and IRQs from PCI (when controller is found there) */
+	ata_pci_setup();
+
+	/* Both buses are probed at the same time, devices of a bus one
+	   after another (they share its registers) */
+	for (bus = PRI_BUS; bus <= SEC_BUS; bus++) {
+		probe_th[bus] = NULL;
+		if (async_probe_enabled) {
+			probe_th[bus] = kernel_thread_create(DEFAULT_PRIORITY,
+					ata_probe_bus, (void *)(uint32_t)bus);
+		}
+		if (probe_th[bus] == NULL) {
+			ata_probe_bus((void *)(uint32_t)bus);
+		}
+	}
+	for (bus = PRI_BUS; bus <= SEC_BUS; bus++) {
+		if (probe_th[bus] != NULL) {
+			kernel_thread_wait(probe_th[bus]);
+		}
+	}
+
+	/* Show devices (in order) */
+	for (i = 0, drvl = 'a'; i < 4; i++, drvl++) {
+		switch (ata_probe_res[i]) {
+			case ATA_PROBE_ATAPI:
+				kprintf(KERN_INFO " hd%c: CD/DVD-ROM detected.\n", drvl);
+				continue;
+
+			case ATA_PROBE_ERROR:
+				kprintf(KERN_WARNING "Error on get device information\n");
+				continue;
 
-	/* Device IDENTIFY */
-	bus = PRI_BUS;
-	for(i=0; i<4; i++, drvl++) {
-		ata_devices[i].flags = 0;
+			case ATA_PROBE_DISK:
+				break;
 
-		if(i >= 2) {
-			/* Secondary BUS */
-			bus = SEC_BUS;
+			default:
+				kprintf(KERN_INFO " hd%c: Device not found.\n", drvl);
+				continue;
 		}
 
-		/* Select device */
-		if(i == 0 || i == 2) {
-			dev = MASTER_DEV;
-		} else {
-			dev = SLAVE_DEV;
+		kprintf(KERN_INFO " hd%c: Device found: %s%s, %ld sectors\n", drvl,
+				((ata_devices[i].flags & LBA48) ? "LBA48" : "LBA"),
+				((ata_devices[i].capabilities[0] & SUPPORT_DMA) ? ", DMA" : ""),
+				ata_devices[i].sectors);
+		kprintf(KERN_INFO "       Model: %s\n", ata_devices[i].model);
+		if ((ata_devices[i].flags & USE_DMA)) {
+			kprintf(KERN_INFO "       Bus master DMA transfers\n");
+		} else if (ata_devices[i].drq_block > 1) {
+			kprintf(KERN_INFO "       %d sectors per interrupt\n", ata_devices[i].drq_block);
+		}
+		if (ata_writethrough) {
+			kprintf(KERN_INFO "       Write cache disabled (write-through)\n");
 		}
-		set_device(bus, dev);
+	}
 
-		/* Reset */
-		send_cmd(bus, CMD_RESET);
-		wait_bus(bus);
+	/* Block requests queues */
+	for (i = 0; i < 4; i++) {
+		blk_queue_init(&blk_queue[i], &elv_deadline,
+				(i < 2 ? DEVMAJOR_ATA_PRI : DEVMAJOR_ATA_SEC), ata_minors[i]);
+	}
+	for (bus = PRI_BUS; bus <= SEC_BUS; bus++) {
+		channels[bus].major    = (bus == PRI_BUS ? DEVMAJOR_ATA_PRI : DEVMAJOR_ATA_SEC);
+		channels[bus].state    = ATA_ST_IDLE;
+		channels[bus].active   = NULL;
+		channels[bus].dev      = (bus * 2) + 1;
+		channels[bus].selected = -1;
+		init_ktimer(&channels[bus].timer, ata_timer, (void *)(uint32_t)bus);
+	}
 
-		/* Check driver type */
-		sc     = inb(pio_ports[bus][REG_SC]);
-		saddr1 = inb(pio_ports[bus][REG_SADDR1]);
-		saddr2 = inb(pio_ports[bus][REG_SADDR2]);
-		saddr3 = inb(pio_ports[bus][REG_SADDR3]);
-		status = inb(pio_ports[bus][REG_ASTATUS]);
+	/* Register IRQs */
+	if( request_irq(ata_irqs[PRI_BUS], ata_handler1, SA_SHIRQ, "ata-primary") < 0) {
+		kprintf(KERN_ERROR "Error on register IRQ %d\n", ata_irqs[PRI_BUS]);
+	}
+	if( request_irq(ata_irqs[SEC_BUS], ata_handler2, SA_SHIRQ, "ata-secondary") < 0) {
+		kprintf(KERN_ERROR "Error on register IRQ %d\n", ata_irqs[SEC_BUS]);
+	}
 
-                /* TODO: Maybe we need to support other kind of ATAs. */
-		if(sc != 0x01 && saddr1 != 0x01 && status == 0) {
-			kprintf(" hd%c: Device not found.\n", drvl);
+	wcache_dirty[0] = wcache_dirty[1] = 0;
+	wcache_dirty[2] = wcache_dirty[3] = 0;
+
+	/* Register a driver for each bus with devices and parse
+	   partition table of each device. Both devices of a bus share
+	   its IRQ, only one of them has a command at a time. */
+	for (i = 0; i < 4; i++) {
+		if ((ata_devices[i].flags & PRESENT) == 0) {
+			continue;
+		}
+		bus = (i < 2 ? PRI_BUS : SEC_BUS);
+
+		if (ata_bus_drv[bus].dev_ops == NULL) {
+			ata_bus_drv[bus].major        = (bus == PRI_BUS ? DEVMAJOR_ATA_PRI : DEVMAJOR_ATA_SEC);
+			ata_bus_drv[bus].size         = ata_devices[i].sectors;
+			ata_bus_drv[bus].max_sectors  = BCACHE_CLUSTER_MAX;
+			ata_bus_drv[bus].max_segments = BCACHE_CLUSTER_MAX;
+			ata_bus_drv[bus].dev_ops      = &ata_ops;
+
+			if (register_block_driver(&ata_bus_drv[bus]) < 0) {
+				panic("Could not register a driver for the bus!");
+			}
+		}
+
+		devstr[0] = 'h';
+		devstr[1] = 'd';
+		devstr[2] = 'a' + i;
+		devstr[3] = '\0';
+
+		if (blk_add_disk(&ata_bus_drv[bus], ata_minors[i], ata_devices[i].sectors) < 0) {
+			kprintf(KERN_ERROR "Could not add disk %d:%d\n",
+					ata_bus_drv[bus].major, ata_minors[i]);
 			continue;
 		}
 
-		if(saddr2 == 0x14 && saddr3 == 0xEB) {
-			kprintf(KERN_INFO " hd%c: CD/DVD-ROM detected.\n", drvl);
+		if ((ptable[i] = parse_mbr(ata_bus_drv[bus], ata_minors[i])) == NULL) {
+			kprintf(KERN_INFO "No partitions found on disk %d:%d\n",
+					ata_bus_drv[bus].major, ata_minors[i]);
 		} else {
-			/* Identify */
-			send_cmd(bus, CMD_IDENTIFY);
-			wait_bus(bus);
+			kprintf(" Found: ");
+			print_partition_table(ptable[i], devstr);
+			kprintf("\n");
+			blk_add_partitions(&ata_bus_drv[bus], ata_minors[i], ptable[i],
+					(DEVNUM_HDB - DEVNUM_HDA));
+		}
+	}
+}
 
-			if( (pio_ports[bus][REG_ASTATUS] & 0x01) != 0 ||
-				(pio_ports[bus][REG_FERR] & ABRT_BIT) != 0 ) {
 
-					kprintf(KERN_INFO " hd%c: Device not found.\n", drvl);
-					continue;
-			}
+/**
+ * Probe the devices (master and slave) of a bus.
+ *
+ * \param arg Bus - Primary or Secondary IDE.
+ * \note It runs in a kernel thread (one for each bus) when
+ * asynchronous probing is enabled.
+ */
+static void ata_probe_bus(void *arg)
+{
+	uchar8_t bus = (uchar8_t)(uint32_t)arg;
 
+	ata_probe_device(bus * 2);
+	ata_probe_device((bus * 2) + 1);
+}
 
-			if( get_dev_info(bus, &ata_devices[i]) ) {
 
-				if( (ata_devices[i].type & ATA_DEVICE) != 0 ) {
-					kprintf(KERN_INFO " hd%c: Device not found.\n", drvl);
-					continue;
-				}
+/**
+ * Probe a device: check its type, read its information (IDENTIFY)
+ * and set it up. The result is kept at ata_probe_res.
+ *
+ * \param i Index of the device (0 = hda, 1 = hdb, 2 = hdc, 3 = hdd).
+ */
+static void ata_probe_device(int i)
+{
+	uint64_t size;
+	uchar8_t bus, dev;
+	uchar8_t sc, saddr1, saddr2, saddr3, status;
+	int res;
 
-				/* Check for LBA */
-				if( (ata_devices[i].capabilities[0] & SUPPORT_LBA) == 0 ) {
-					kprintf(KERN_INFO " hd%c: Device not found.\n", drvl);
-					continue;
-				} else {
-					kprintf(KERN_INFO " hd%c: Device found: ", drvl);
-
-					/* Check for LBA48 */
-					if( (ata_devices[i].cmds_supported[1] & SUPPORT_LBA48) != 0 ) {
-						kprintf(KERN_INFO "LBA48");
-						ata_devices[i].flags |= LBA48;
-
-						size  = ata_devices[i].max_lba48[0];
-						size |= (ata_devices[i].max_lba48[1] << 16);
-						size |= ((uint64_t)ata_devices[i].max_lba48[2] << 32);
-						size |= ((uint64_t)ata_devices[i].max_lba48[3] << 48);
-					} else {
-						kprintf(KERN_INFO "LBA");
-
-						size  = ata_devices[i].max_secs[0];
-						size |= (ata_devices[i].max_secs[1] << 16);
-					}
-					ata_devices[i].sectors = size;
-				}
+	ata_devices[i].flags = 0;
+	ata_probe_res[i]     = ATA_PROBE_NONE;
 
-				/* Check for DMA */
-				if( (ata_devices[i].capabilities[0] & SUPPORT_DMA) != 0 ) {
-					kprintf(KERN_INFO ", DMA");
-				}
-				kprintf(KERN_INFO ", %ld sectors\n", ata_devices[i].sectors);
+	bus = (i < 2 ? PRI_BUS : SEC_BUS);
+	dev = ((i & 0x01) == 0 ? MASTER_DEV : SLAVE_DEV);
 
-				ata_devices[i].flags |= PRESENT;
+	/* Select device */
+	set_device(bus, dev);
 
-				/* Show information */
-				kprintf(KERN_INFO "       Model: %s\n", ata_devices[i].model);
-			} else {
-				kprintf(KERN_WARNING "Error on get device information\n");
-				continue;
-			}
-		}
-	}
+	/* Reset */
+	send_cmd(bus, CMD_RESET);
+	wait_bus(bus);
 
-	/* Block requests lists */
-	for (i = 0; i < 4; i++) {
-		llist_create(&blk_queue[i]);
+	/* Check driver type */
+	sc     = inb(pio_ports[bus][REG_SC]);
+	saddr1 = inb(pio_ports[bus][REG_SADDR1]);
+	saddr2 = inb(pio_ports[bus][REG_SADDR2]);
+	saddr3 = inb(pio_ports[bus][REG_SADDR3]);
+	status = inb(pio_ports[bus][REG_ASTATUS]);
+
+	/* TODO: Maybe we need to support other kind of ATAs. */
+	if(sc != 0x01 && saddr1 != 0x01 && status == 0) {
+		return;
 	}
 
-	/* Register IRQs */
-	if( request_irq(ATA_PRI_IRQ, ata_handler1, SA_SHIRQ, "ata-primary") < 0) {
-		kprintf(KERN_ERROR "Error on register IRQ %d\n", ATA_PRI_IRQ);
+	if(saddr2 == 0x14 && saddr3 == 0xEB) {
+		ata_probe_res[i] = ATA_PROBE_ATAPI;
+		return;
 	}
-	if( request_irq(ATA_SEC_IRQ, ata_handler2, SA_SHIRQ, "ata-secondary") < 0) {
-		kprintf(KERN_ERROR "Error on register IRQ %d\n", ATA_SEC_IRQ);
+
+	/* Identify */
+	send_cmd(bus, CMD_IDENTIFY);
+	if ((res = get_dev_info(bus, &ata_devices[i])) <= 0) {
+		/* Command aborted: there is no (ATA) device */
+		ata_probe_res[i] = (res < 0 ? ATA_PROBE_NONE : ATA_PROBE_ERROR);
+		return;
 	}
 
-	discard_irq[0] = ATA_HANDLE_NEXT_IRQ;
-	discard_irq[1] = ATA_HANDLE_NEXT_IRQ;
+	/* Check for ATA device and LBA */
+	if( (ata_devices[i].type & ATA_DEVICE) != 0 ||
+		(ata_devices[i].capabilities[0] & SUPPORT_LBA) == 0 ) {
+		return;
+	}
 
-	/* Now, parse partition table for each found device */
-	/** FIXME: TempOS supports only one device per bus.
-	 *  To support more devices we need to check PCI bus to
-	 *  know which device generates the interrupt */
-	if ((ata_devices[0].flags & PRESENT) != 0) {
+	/* Check for LBA48 */
+	if( (ata_devices[i].cmds_supported[1] & SUPPORT_LBA48) != 0 ) {
+		ata_devices[i].flags |= LBA48;
 
-		/* Register primary bus driver */
-		ata_bus_drv[0].major   = DEVMAJOR_ATA_PRI;
-		ata_bus_drv[0].size    = ata_devices[0].sectors;
-		ata_bus_drv[0].dev_ops = &ata_ops; 
+		size  = ata_devices[i].max_lba48[0];
+		size |= (ata_devices[i].max_lba48[1] << 16);
+		size |= ((uint64_t)ata_devices[i].max_lba48[2] << 32);
+		size |= ((uint64_t)ata_devices[i].max_lba48[3] << 48);
+	} else {
+		size  = ata_devices[i].max_secs[0];
+		size |= (ata_devices[i].max_secs[1] << 16);
+	}
+	ata_devices[i].sectors = size;
 
-		if (register_block_driver(&ata_bus_drv[0]) < 0) {
-			panic("Could not register a driver for the bus!");
-		} else {
-			if ((ptable[0] = parse_mbr(ata_bus_drv[0], DEVNUM_HDA)) == NULL) {
-				kprintf(KERN_ERROR "No partitions found on disk %d:%d\n", DEVMAJOR_ATA_PRI, DEVNUM_HDA);
-			} else {
-				kprintf(" Found: ");
-				print_partition_table(ptable[0], "hda");
-				kprintf("\n");
-			}
-		}
+	/* Check for DMA */
+	if( (ata_devices[i].capabilities[0] & SUPPORT_DMA) != 0 && bm_ports[bus] != 0 ) {
+		ata_devices[i].flags |= USE_DMA;
 	}
 
-	if ((ata_devices[2].flags & PRESENT) != 0) {
-		
-		/* Register secondary bus driver */
-		ata_bus_drv[1].major   = DEVMAJOR_ATA_SEC;
-		ata_bus_drv[1].size    = ata_devices[2].sectors;
-		ata_bus_drv[1].dev_ops = &ata_ops; 
+	ata_devices[i].flags |= PRESENT;
+	ata_probe_res[i]      = ATA_PROBE_DISK;
 
-		if (register_block_driver(&ata_bus_drv[1]) < 0) {
-			panic("Could not register a driver for the bus!");
-		} else {
-			if ((ptable[2] = parse_mbr(ata_bus_drv[1], DEVNUM_HDC)) == NULL) {
-				kprintf(KERN_INFO "No partitions found on disk %d:%d\n", DEVMAJOR_ATA_SEC, DEVNUM_HDC);
-			} else {
-				kprintf(" Found: ");
-				print_partition_table(ptable[2], "hdb");
-				kprintf("\n");
-			}
-		}
-	}
+	/* Transfer several sectors per interrupt */
+	set_multiple(bus, &ata_devices[i]);
+
+	/* Write cache policy */
+	set_write_cache(bus, &ata_devices[i], !ata_writethrough);
 }
 
 
@@ -350,14 +567,17 @@ static void send_cmd(uchar8_t bus, uchar8_t command)
 
 
 /**
- * Wait while bus is busy (polling)
+ * Wait while bus is busy (polling, only at initialization)
  */
 static void wait_bus(uchar8_t bus)
 {
 	int32_t timeout = TIMEOUT;
 
+	/* Only used while probing: let other probes run meanwhile */
 	while( (inb(pio_ports[bus][REG_CMD]) & BSY_BIT) &&
-					!time_after(jiffies, timeout) );
+					!time_after(jiffies, timeout) ) {
+		schedule();
+	}
 }
 
 
@@ -384,525 +604,870 @@ static void set_device(uchar8_t bus, uchar8_t device)
 		break;
 
 	}
-	udelay(400);
+	ata_delay400ns(bus);
 }
 
 
 /**
- * Get and parse device information
+ * Wait 400ns (for the device to update its status), reading
+ * alternate status register.
+ *
+ * \param bus Bus - Primary or Secondary IDE
  */
-static int get_dev_info(uchar8_t bus, ata_dev_info *devinfo)
+static void ata_delay400ns(uchar8_t bus)
 {
-	int i, p;
-	uint16_t tmp;
+	/* Each read takes (at least) 100ns */
+	inb(pio_ports[bus][REG_ASTATUS]);
+	inb(pio_ports[bus][REG_ASTATUS]);
+	inb(pio_ports[bus][REG_ASTATUS]);
+	inb(pio_ports[bus][REG_ASTATUS]);
+}
 
-	/* Type */
-	wait_bus(bus);
-	devinfo->type = inw(pio_ports[bus][REG_DATA]);
 
-	/* Not used */
-	for(i=1; i<=9; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
+/**
+ * Select a device of the bus for the next command (only when it's
+ * not selected already).
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param dev Index of the device (0 = hda, 1 = hdb, 2 = hdc, 3 = hdd).
+ */
+static void ata_select(uchar8_t bus, int dev)
+{
+	if (channels[bus].selected != dev) {
+		set_device(bus, (dev & 0x01));
+		channels[bus].selected = dev;
 	}
+}
 
-	/* Serial */
-	p = 0;
-	for(i=10; i<=19; i++) {
-		wait_bus(bus);
-		tmp = inw(pio_ports[bus][REG_DATA]);
 
-		devinfo->serial[p] = (uchar8_t)(tmp >> 8);
-		p++;
-		devinfo->serial[p] = (uchar8_t)(tmp & 0x00FF);
-		p++;
+/**
+ * Wait (a few microseconds) for the device to request the first
+ * block of a PIO write.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \return 1 if device is ready for data, 0 if not yet, -1 on error.
+ */
+static int ata_wait_drq(uchar8_t bus)
+{
+	uchar8_t status;
+	int i;
+
+	for (i = 0; i < ATA_DRQ_SPINS; i++) {
+		status = inb(pio_ports[bus][REG_ASTATUS]);
+		if ((status & BSY_BIT) == 0) {
+			if ((status & (ERR_BIT | DF_BIT))) {
+				return -1;
+			} else if ((status & DRQ_BIT)) {
+				return 1;
+			}
+		}
 	}
-	devinfo->serial[19] = '\0';
+	return 0;
+}
 
-	/* Not used */
-	for(i=20; i<=22; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
+
+/**
+ * Software reset of the devices of a bus (after a command timeout
+ * or a failed DMA transfer).
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ */
+static void ata_reset(uchar8_t bus)
+{
+	if (bm_ports[bus] != 0) {
+		outb(0, bm_ports[bus] + BM_CMD);
 	}
 
-	/* Firmware revision */
-	p = 0;
-	for(i=23; i<=26; i++) {
-		wait_bus(bus);
-		tmp = inw(pio_ports[bus][REG_DATA]);
+	/* Device control register: SRST for 5us */
+	outb(0x04, pio_ports[bus][REG_ASTATUS]);
+	udelay(5);
+	outb(0x00, pio_ports[bus][REG_ASTATUS]);
+
+	channels[bus].selected = -1;
+}
 
-		devinfo->firmware_rev[p] = (uchar8_t)(tmp >> 8);
-		p++;
-		devinfo->firmware_rev[p] = (uchar8_t)(tmp & 0x00FF);
 
-		p++;
-	}
-	devinfo->firmware_rev[7] = '\0';
-
-	/* Model */
-	p = 0;
-	for(i=27; i<=46; i++) {
-		wait_bus(bus);
-		tmp = inw(pio_ports[bus][REG_DATA]);
-
-		devinfo->model[p] = (uchar8_t)(tmp >> 8);
-		p++;
-		devinfo->model[p] = (uchar8_t)(tmp & 0x00FF);
-		p++;
+/**
+ * Get and parse device information (IDENTIFY command should be sent).
+ *
+ * \return 1 on success, -1 if command was aborted, 0 on timeout.
+ */
+static int get_dev_info(uchar8_t bus, ata_dev_info *devinfo)
+{
+	uint16_t id[SECTOR_HALF_SIZE];
+	int res;
+
+	/* Wait for the data, then read all words at once */
+	wait_bus(bus);
+	if ((res = ata_wait_drq(bus)) <= 0) {
+		return(res);
 	}
-	devinfo->model[39] = '\0';
+	insw(pio_ports[bus][REG_DATA], id, SECTOR_HALF_SIZE);
+
+	devinfo->type = id[0];
+	id_string(devinfo->serial, &id[10], sizeof(devinfo->serial));
+	id_string(devinfo->firmware_rev, &id[23], sizeof(devinfo->firmware_rev));
+	id_string(devinfo->model, &id[27], sizeof(devinfo->model));
 
 	/* Maximum number of sectors that shall be transferred 
 	   per interrupt on READ/WRITE MULTIPLE commands */
-	wait_bus(bus);
-	devinfo->mult_secs = inw(pio_ports[bus][REG_DATA]);
-
-	/* Reserved */
-	wait_bus(bus);
-	inw(pio_ports[bus][REG_DATA]);
+	devinfo->mult_secs = id[47];
 
 	/* Capabilities */
-	for(i=49; i<=50; i++) {
-		wait_bus(bus);
-		devinfo->capabilities[i - 49] = inw(pio_ports[bus][REG_DATA]);
-	}
-
-	/* Not used */
-	for(i=51; i<=58; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
-	}
+	devinfo->capabilities[0] = id[49];
+	devinfo->capabilities[1] = id[50];
 
 	/* Multiple sector setting */
-	wait_bus(bus);
-	devinfo->mult_sec = inw(pio_ports[bus][REG_DATA]);
+	devinfo->mult_sec = id[59];
 
 	/* Total number of user addressable sectors */
-	wait_bus(bus);
-	devinfo->max_secs[0] = inw(pio_ports[bus][REG_DATA]);
-	wait_bus(bus);
-	devinfo->max_secs[1] = inw(pio_ports[bus][REG_DATA]);
-
-	/* 62: Note used */
-	wait_bus(bus);
-	inw(pio_ports[bus][REG_DATA]);
+	devinfo->max_secs[0] = id[60];
+	devinfo->max_secs[1] = id[61];
 
 	/* Multiword DMA */
-	wait_bus(bus);
-	devinfo->mword_dma = inw(pio_ports[bus][REG_DATA]);
-
-	/* Not used */
-	for(i=64; i<=79; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
-	}
-
-	/* Major version number */
-	wait_bus(bus);
-	devinfo->major_ver = inw(pio_ports[bus][REG_DATA]);
+	devinfo->mword_dma = id[63];
 
-	/* Minor version number */
-	wait_bus(bus);
-	devinfo->minor_ver = inw(pio_ports[bus][REG_DATA]);
+	/* Major and minor version number */
+	devinfo->major_ver = id[80];
+	devinfo->minor_ver = id[81];
 
 	/* Command set supported */
-	for(i=82; i<=87; i++) {
-		wait_bus(bus);
-		devinfo->cmds_supported[i - 82] = inw(pio_ports[bus][REG_DATA]);
-	}
+	memcpy(devinfo->cmds_supported, &id[82], sizeof(devinfo->cmds_supported));
 
 	/* Ultra DMA */
-	wait_bus(bus);
-	devinfo->ultra_dma = inw(pio_ports[bus][REG_DATA]);
-
-	/* Not used */
-	for(i=89; i<=99; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
-	}
+	devinfo->ultra_dma = id[88];
 
 	/* LBA48 max */
-	for(i=100; i<=103; i++) {
-		wait_bus(bus);
-		devinfo->max_lba48[i - 100] = inw(pio_ports[bus][REG_DATA]);
-	}
-
-	/* Not used */
-	for(i=104; i<=255; i++) {
-		wait_bus(bus);
-		inw(pio_ports[bus][REG_DATA]);
-	}
+	memcpy(devinfo->max_lba48, &id[100], sizeof(devinfo->max_lba48));
 
 	return(1);
 }
 
 
 /**
- * Read a sector from device (low level function)
- *
- * \param major Bus - Primary or Secondary IDE
- * \param device Master or Slave
- * \param addr LBA 48bit sector address
+ * Copy a string of IDENTIFY data (two characters per word, the
+ * first one at the high byte).
  *
- * \note This function will just request to read the sector.
- * ATA controller will generate a interrupt when it's done.
+ * \param str Destination (len bytes, the last one is the terminator).
+ * \param words First word of the string.
+ * \param len Size of the destination.
  */
-static int read_hd_sector(int major, int device, uint64_t addr)
+static void id_string(char *str, uint16_t *words, int len)
 {
-	uchar8_t dc;
-	uchar8_t bus, dev;
-	uint64_t newaddr;
+	int i;
 
-	newaddr = addr;
+	for (i = 0; i < (len / 2); i++) {
+		str[i * 2]       = (char)(words[i] >> 8);
+		str[(i * 2) + 1] = (char)(words[i] & 0x00FF);
+	}
+	str[len - 1] = '\0';
+}
 
-	if (major == DEVMAJOR_ATA_PRI) {
-		bus = PRI_BUS;
-		
-		if (device >= DEVNUM_HDA && device < DEVNUM_HDB) {
-			dev = 0;
-
-			if (device != DEVNUM_HDA) {
-				if (translate_part_address(&newaddr, ptable[0], device, addr) < 0)
-					return -1;
-			}
-		} else if (device >= DEVNUM_HDB) {
-			dev = 1;
 
-			if (device != DEVNUM_HDB) {
-				if (translate_part_address(&newaddr, ptable[1], device, addr) < 0)
-					return -1;
-			}
-		} else {
-			return -1;
-		}
-		
-	} else if(major == DEVMAJOR_ATA_SEC) {
-		bus = SEC_BUS;
+/**
+ * Look for the IDE controller at PCI bus. Channels in native mode
+ * have their ports and IRQ given by PCI, the others keep using
+ * the legacy (ISA compatible) ones. When controller has a bus
+ * master (BAR 4), transfers can be done by DMA.
+ */
+static void ata_pci_setup(void)
+{
+	uchar8_t bus, reg;
+	pci_bar_t *cmd, *ctl, *bm;
 
-		if (device >= DEVNUM_HDC && device < DEVNUM_HDD) {
-			dev = 2;
-		} else if (device >= DEVNUM_HDD) {
-			dev = 3;
-		} else {
-			return -1;
-		}
+	bm_ports[PRI_BUS] = 0;
+	bm_ports[SEC_BUS] = 0;
 
-	} else {
-		return -1;
+	if ((ata_pci = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, NULL)) == NULL) {
+		kprintf(KERN_INFO " IDE controller not found at PCI bus, using legacy ports.\n");
+		return;
 	}
+	pci_enable_device(ata_pci, PCI_CMD_IO);
 
-	set_device(bus, dev);
-
-	outb(0x00, pio_ports[bus][REG_SC]);
-	outb(LBA_BYTE(newaddr, 3), pio_ports[bus][REG_SADDR1]);
-	outb(LBA_BYTE(newaddr, 4), pio_ports[bus][REG_SADDR2]);
-	outb(LBA_BYTE(newaddr, 5), pio_ports[bus][REG_SADDR3]);
+	for (bus = PRI_BUS; bus <= SEC_BUS; bus++) {
+		/* Bit 0 (primary) or 2 (secondary) of prog_if: native mode */
+		if ((ata_pci->prog_if & (0x01 << (bus * 2))) == 0) {
+			continue;
+		}
 
-	outb(0x01, pio_ports[bus][REG_SC]);
-	outb(LBA_BYTE(newaddr, 0), pio_ports[bus][REG_SADDR1]);
-	outb(LBA_BYTE(newaddr, 1), pio_ports[bus][REG_SADDR2]);
-	outb(LBA_BYTE(newaddr, 2), pio_ports[bus][REG_SADDR3]);
+		cmd = &ata_pci->bars[bus * 2];
+		ctl = &ata_pci->bars[(bus * 2) + 1];
+		if (cmd->type != PCI_BAR_TYPE_IO || ctl->type != PCI_BAR_TYPE_IO) {
+			continue;
+		}
 
-	dc = (inb(pio_ports[bus][REG_DC]) & 0xF0) | 0x40;
-	outb(dc, pio_ports[bus][REG_DC]);
+		for (reg = 0; reg < 8; reg++) {
+			pio_ports[bus][reg] = cmd->base + reg;
+		}
+		pio_ports[bus][8] = ctl->base + 2;
+		ata_irqs[bus]     = ata_pci->irq;
 
-	send_cmd(bus, CMD_READ_SECTORS_EXT);
-	wait_bus(bus);
+		kprintf(KERN_INFO " IDE channel %d in native mode: ports %x/%x, IRQ %d\n",
+				bus, cmd->base, ctl->base + 2, ata_irqs[bus]);
+	}
 
-	if((inb(pio_ports[bus][REG_ASTATUS]) & DF_BIT) != 0 ||
-			inb(pio_ports[bus][REG_FERR] & ABRT_BIT) != 0) {
-		kprintf(KERN_ERROR "ATA_DRIVER ERROR: Could not read sectors\n");
+	/* Bus master IDE */
+	bm = &ata_pci->bars[4];
+	if (bm->type != PCI_BAR_TYPE_IO) {
+		kprintf(KERN_INFO " IDE controller has no bus master, using PIO.\n");
+		return;
 	}
+	pci_enable_device(ata_pci, PCI_CMD_IO | PCI_CMD_MASTER);
 
-	return 0;
+	for (bus = PRI_BUS; bus <= SEC_BUS; bus++) {
+		prd_table[bus] = (struct _ata_prd *)kmalloc_pages(1, GFP_NORMAL_Z);
+		if (prd_table[bus] == NULL) {
+			kprintf(KERN_ERROR " Could not allocate PRD table, using PIO.\n");
+			continue;
+		}
+		bm_ports[bus] = bm->base + (bus * BM_CHANNEL_PORTS);
+	}
 }
 
 
 /**
- * Write sectors to device (low level function)
- *
- * \param major Bus - Primary or Secondary IDE
- * \param device Master or Slave
- * \param addr LBA 48bit sector address
+ * Enable READ/WRITE MULTIPLE commands (if supported by device), so it
+ * transfers several sectors per interrupt.
  *
- * \note This function write a sector to device.
+ * \param bus Bus of the device (device should be selected).
+ * \param devinfo Device information.
  */
-static int write_hd_sector(int major, int device, uint64_t addr, char *sector)
+static void set_multiple(uchar8_t bus, ata_dev_info *devinfo)
 {
-	int i;
-	uint16_t bword;
-	uchar8_t dc;
-	uchar8_t bus, dev;
+	uint16_t count = 1;
+	uint16_t max   = (devinfo->mult_secs & 0xFF);
 
-	if (major == DEVMAJOR_ATA_PRI) {
-		bus = PRI_BUS;
+	devinfo->drq_block = 1;
 
-		switch(device) {
-			case DEVNUM_HDA:
-				dev = MASTER_DEV;
-				break;
+	/* Sectors per block shall be a power of 2 */
+	if (max > BCACHE_CLUSTER_MAX) {
+		max = BCACHE_CLUSTER_MAX;
+	}
+	while ((count << 1) <= max) {
+		count <<= 1;
+	}
+	if (count < 2) {
+		return;
+	}
 
-			case DEVNUM_HDB:
-				dev = SLAVE_DEV;
-				break;
+	outb(count, pio_ports[bus][REG_SC]);
+	send_cmd(bus, CMD_SET_MULTIPLE);
+	wait_bus(bus);
 
-			default:
-				return -1;
-		}
-	} else if(major == DEVMAJOR_ATA_SEC) {
-		bus = SEC_BUS;
+	if ((inb(pio_ports[bus][REG_ASTATUS]) & ERR_BIT) == 0) {
+		devinfo->drq_block = count;
+	}
+}
 
-		switch(device) {
-			case DEVNUM_HDC:
-				dev = MASTER_DEV;
-				break;
 
-			case DEVNUM_HDD:
-				dev = SLAVE_DEV;
-				break;
+/**
+ * Enable or disable the write cache of the device (selected).
+ * Without write cache every write reaches the media before its
+ * interrupt, so the device never needs to be flushed.
+ *
+ * \param bus Bus - Primary or Secondary IDE.
+ * \param devinfo Device information.
+ * \param enable 1 to enable write cache, 0 to disable (write-through).
+ */
+static void set_write_cache(uchar8_t bus, ata_dev_info *devinfo, int enable)
+{
+	outb((enable ? FEAT_ENABLE_WCACHE : FEAT_DISABLE_WCACHE), pio_ports[bus][REG_FERR]);
+	send_cmd(bus, CMD_SET_FEATURES);
+	wait_bus(bus);
 
-			default:
-				return -1;
-		}
-	} else {
-		return -1;
+	if ((inb(pio_ports[bus][REG_ASTATUS]) & ERR_BIT) != 0) {
+		kprintf(KERN_WARNING "       Could not change write cache\n");
 	}
+}
+
+
+/**
+ * Find out the bus, the device and the disk address of a sector.
+ *
+ * \param major Bus - Primary or Secondary IDE
+ * \param device Device number (disk or partition)
+ * \param addr Sector address (relative to the partition)
+ * \param count Number of sectors (from addr).
+ * \param bus Bus of the device.
+ * \param dev Index of the device (0 = hda, 1 = hdb, 2 = hdc, 3 = hdd).
+ * \param diskaddr LBA 48bit sector address into the disk.
+ * \return 0 on success, -1 otherwise.
+ */
+static int get_sector_location(int major, int device, uint64_t addr, uint32_t count,
+		uchar8_t *bus, uchar8_t *dev, uint64_t *diskaddr)
+{
+	int disk;
+
+	if (major == DEVMAJOR_ATA_PRI) {
+		*bus = PRI_BUS;
+	} else if(major == DEVMAJOR_ATA_SEC) {
+		*bus = SEC_BUS;
+	} else {
+		return -1;
+	}
+
+	/* Only present devices (and their partitions) are at the table */
+	if ((disk = blk_map_sector(&ata_bus_drv[*bus], device, addr, count, diskaddr)) < 0) {
+		return -1;
+	}
+	*dev = (*bus * 2) + (disk == ata_minors[*bus * 2] ? 0 : 1);
+
+	return 0;
+}
 
-	set_device(bus, dev);
 
-	outb(0x00, pio_ports[bus][REG_SC]);
+/**
+ * Write sector address and sector count registers (LBA 48bit).
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param addr LBA 48bit sector address
+ * \param count Number of sectors
+ */
+static void set_sectors(uchar8_t bus, uint64_t addr, uint16_t count)
+{
+	uchar8_t dc;
+
+	outb((count >> 8) & 0xFF, pio_ports[bus][REG_SC]);
 	outb(LBA_BYTE(addr, 3), pio_ports[bus][REG_SADDR1]);
 	outb(LBA_BYTE(addr, 4), pio_ports[bus][REG_SADDR2]);
 	outb(LBA_BYTE(addr, 5), pio_ports[bus][REG_SADDR3]);
 
-	outb(0x01, pio_ports[bus][REG_SC]);
+	outb(count & 0xFF, pio_ports[bus][REG_SC]);
 	outb(LBA_BYTE(addr, 0), pio_ports[bus][REG_SADDR1]);
 	outb(LBA_BYTE(addr, 1), pio_ports[bus][REG_SADDR2]);
 	outb(LBA_BYTE(addr, 2), pio_ports[bus][REG_SADDR3]);
 
 	dc = (inb(pio_ports[bus][REG_DC]) & 0xF0) | 0x40;
 	outb(dc, pio_ports[bus][REG_DC]);
+}
 
-	send_cmd(bus, CMD_WRITE_SECTORS_EXT);
-	wait_bus(bus);
 
-	if((inb(pio_ports[bus][REG_ASTATUS]) & DF_BIT) != 0 ||
-			inb(pio_ports[bus][REG_FERR] & ABRT_BIT) != 0) {
-		kprintf(KERN_ERROR "ATA_DRIVER ERROR: Could not write sectors\n");
-		return -1;
+/**
+ * Read the next block of sectors (up to drq sectors) of an operation
+ * from the device.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param bop Block operation.
+ * \param drq Sectors per interrupt (DRQ block).
+ */
+static void transfer_data_in(uchar8_t bus, blk_request_t *bop, int drq)
+{
+	int n;
+
+	for (n = 0; n < drq && bop->done < bop->count; n++, bop->done++) {
+		insw(pio_ports[bus][REG_DATA], bop->buffs[bop->done]->data, SECTOR_HALF_SIZE);
 	}
-	
-	for(i=0; i<SECTOR_SIZE; i+=2) {
-		bword = (sector[i+1] << 8) | sector[i];
-		wait_bus(bus);
-		outw(bword, pio_ports[bus][REG_DATA]);
-		udelay(1);
+}
+
+
+/**
+ * Start a DMA transfer of all sectors of an operation (the device
+ * should be selected).
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param bop Block operation.
+ *
+ * \note Bus master will generate only one interrupt, when the
+ * whole transfer is done.
+ */
+static void dma_hd_sectors(uchar8_t bus, blk_request_t *bop)
+{
+	uint32_t phys;
+	uint16_t bm;
+	struct _ata_prd *prd;
+	int i, n;
+
+	bm  = bm_ports[bus];
+	prd = prd_table[bus];
+
+	/* One region for each run of physically contiguous buffers */
+	n = -1;
+	for (i = 0; i < bop->count; i++) {
+		phys = kmem_phys_addr(bop->buffs[i]->data);
+		if (n >= 0 && (prd[n].addr + prd[n].count) == phys && (phys & 0xFFFF) != 0) {
+			prd[n].count += SECTOR_SIZE;
+		} else {
+			n++;
+			prd[n].addr  = phys;
+			prd[n].count = SECTOR_SIZE;
+			prd[n].flags = 0;
+		}
 	}
-	
-	/** Flush cache will generate a IRQ, that shall be discarded */
-	send_cmd(bus, CMD_FLUSH_CACHE_EXT);
-	wait_bus(bus);
-	udelay(1);
+	prd[n].flags = PRD_EOT;
+
+	/* Program bus master */
+	outb(0, bm + BM_CMD);
+	outl(kmem_phys_addr(prd), bm + BM_PRD);
+	outb(inb(bm + BM_STATUS) | BM_ST_IRQ | BM_ST_ERR, bm + BM_STATUS);
+	outb((bop->op == BLK_READ ? BM_CMD_READ : 0), bm + BM_CMD);
+
+	/* Send command to device and start the transfer */
+	set_sectors(bus, bop->sector, bop->count);
+	send_cmd(bus, (bop->op == BLK_READ ? CMD_READ_DMA_EXT : CMD_WRITE_DMA_EXT));
+	outb(inb(bm + BM_CMD) | BM_CMD_START, bm + BM_CMD);
+}
+
+
+/**
+ * Stop bus master after a DMA transfer.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \return 0 on success, 1 if the interrupt was not raised by bus
+ * master (transfer is not done), -1 on error.
+ */
+static int dma_done(uchar8_t bus)
+{
+	uint16_t bm = bm_ports[bus];
+	uchar8_t status, st;
 
+	status = inb(bm + BM_STATUS);
+	if ((status & (BM_ST_IRQ | BM_ST_ERR)) == 0) {
+		return 1;
+	}
+
+	outb(inb(bm + BM_CMD) & ~BM_CMD_START, bm + BM_CMD);
+	outb(status | BM_ST_IRQ | BM_ST_ERR, bm + BM_STATUS);
+
+	/* Reading the status register acknowledges device interrupt,
+	   so it's always read (even on a bus master error) */
+	st = inb(pio_ports[bus][REG_CMD]);
+	if ((status & BM_ST_ERR) || (st & (ERR_BIT | DF_BIT))) {
+		return -1;
+	}
 	return 0;
 }
 
 
+/**
+ * Write the next block of sectors (up to drq sectors) of an operation
+ * to the device.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param bop Block operation.
+ * \param drq Sectors per interrupt (DRQ block).
+ */
+static void transfer_data_out(uchar8_t bus, blk_request_t *bop, int drq)
+{
+	int n;
+
+	for (n = 0; n < drq && bop->done < bop->count; n++, bop->done++) {
+		outsw(pio_ports[bus][REG_DATA], bop->buffs[bop->done]->data, SECTOR_HALF_SIZE);
+	}
+}
+
+
 /**
  * Handler for disk controller interrupts.
- * This function just receive the block from controller, remove
- * it from blocks queue and if necessary, tell the controller
- * to read the next block of the list.
- * \note If you are going to implement a arm's disk algorithm, DO NOT change
- * this function, but do it in read_ata_sector, so you can rearrange the list
- * on each block read request. This way makes more sense, and it's more sane.
+ * This function just receive the block from controller, finish
+ * the request and if necessary, tell the controller to transfer
+ * the next request.
+ * \note Requests order is chosen by the I/O scheduler of the queue
+ * (see fs/elevator.c), DO NOT rearrange them here.
  */
 static void ata_handler1(int id, pt_regs *regs)
 {
-	uint16_t data, i;
-	buff_header_t *buf;
-	struct _block_op *bop;
+	ata_handle_irq(PRI_BUS);
+}
+
+static void ata_handler2(int id, pt_regs *regs)
+{
+	ata_handle_irq(SEC_BUS);
+}
+
+
+/**
+ * Handle an interrupt from a bus: acknowledge it, move the data of
+ * the active request and, when it's done, send the next one. It
+ * never waits for the device.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ */
+static void ata_handle_irq(uchar8_t bus)
+{
+	struct _ata_channel *ch = &channels[bus];
+	blk_request_t *bop;
+	uchar8_t st;
+	char status;
+	int dev;
 
 	cli();
 
-	/* Check if we need to handle this IRQ */
-	if (discard_irq[0] == ATA_DISCARD_NEXT_IRQ) {
-		discard_irq[0] = ATA_HANDLE_NEXT_IRQ;
+	bop = ch->active;
+	if (bop == NULL || ch->state == ATA_ST_DRQ_WAIT) {
+		/* Nothing was requested (or device should not interrupt yet) */
 		sti();
 		return;
-	} 
-
-	/* DRQ bit is set when disk has PIO data to transfer */
-	
-	/* Primary */
-	bop = (struct _block_op *)blk_queue[0]->element;
-	buf = bop->buff;
-
-	if (bop->op == OP_READ) {
-		/* Read block */
-
-		for(i=0; i<SECTOR_SIZE; i+=2) {
-			wait_bus(PRI_BUS);
-			data = inw(pio_ports[PRI_BUS][REG_DATA]);
-			buf->data[i+1] = (uchar8_t)((data >> 0x08) & 0xFF);
-			buf->data[i]   = (uchar8_t)(data & 0xFF);
+	}
+	dev    = ch->dev;
+	status = BUFF_ST_VALID;
+
+	if (ch->state == ATA_ST_DMA) {
+		/* Bus master transferred all sectors at once */
+		switch (dma_done(bus)) {
+			case 1:
+				sti();
+				return;
+			case -1:
+				kprintf(KERN_ERROR "ATA_DRIVER ERROR: DMA transfer failed\n");
+				/* Device may still hold the failed command */
+				ata_reset(bus);
+				status = BUFF_ST_UNLOCKED;
+				break;
 		}
-	} else if (bop->op == OP_WRITE) {
-		/* Write is done. Just ignore next IRQ */
-		wait_bus(PRI_BUS);
-		discard_irq[0] = ATA_DISCARD_NEXT_IRQ;
+		bop->done = bop->count;
 	} else {
-		kprintf(KERN_CRIT "Unknown ATA operation (should be Read or Write).");
-	}
-	buf->status = BUFF_ST_VALID; 
-	llist_remove(&blk_queue[0], bop);
-	kfree(bop);
+		/* Reading status acknowledges the interrupt */
+		st = inb(pio_ports[bus][REG_CMD]);
+		if ((st & BSY_BIT)) {
+			/* Not from our device */
+			sti();
+			return;
+		}
 
-	/* Process the next block on queue */
-	if (blk_queue[0] != NULL) {
-		bop = (struct _block_op*)blk_queue[0]->element;
-		buf = bop->buff; 
-
-		if (bop->op == OP_READ) {
-			read_hd_sector(DEVMAJOR_ATA_PRI, bop->device, buf->addr);
-		} else if (bop->op == OP_WRITE) {
-			write_hd_sector(DEVMAJOR_ATA_PRI, bop->device, buf->addr, buf->data);
-		} else {
-			kprintf(KERN_CRIT "Unknown ATA operation (should be Read or Write).");
+		if ((st & (ERR_BIT | DF_BIT))) {
+			kprintf(KERN_ERROR "ATA_DRIVER ERROR: hd%c: command failed (status %x, error %x)\n",
+					'a' + dev, st, inb(pio_ports[bus][REG_FERR]));
+			status = BUFF_ST_UNLOCKED;
+		} else if (ch->state == ATA_ST_PIO_IN) {
+			/* Block of sectors is ready (DRQ) */
+			transfer_data_in(bus, bop, ata_devices[dev].drq_block);
+			if (bop->done < bop->count) {
+				sti();
+				return;
+			}
+		} else if (ch->state == ATA_ST_PIO_OUT) {
+			if (bop->done < bop->count) {
+				/* Device is ready for the next block of sectors */
+				transfer_data_out(bus, bop, ata_devices[dev].drq_block);
+				sti();
+				return;
+			}
 		}
+		/* ATA_ST_FLUSH: cache was flushed, nothing to transfer */
 	}
 
+	ata_complete(bus, status);
+
 	/* Wakeup process waiting for this interrupt */
 	sti();
-	wakeup(WAIT_INT_IDE_PRI);
+	wakeup(WAIT_INT_IDE_HDA + dev);
+
+	/* Buffers are not busy anymore */
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
 }
 
-static void ata_handler2(int id, pt_regs *regs)
+
+/**
+ * Finish the active request of a bus and send the next one.
+ *
+ * \param bus Bus - Primary or Secondary IDE
+ * \param status New status of the buffers.
+ * \note Should be called with interrupts disabled.
+ */
+static void ata_complete(uchar8_t bus, char status)
 {
-	uint16_t data, i;
-	buff_header_t *buf;
-	struct _block_op *bop;
+	struct _ata_channel *ch = &channels[bus];
+	blk_request_t *bop = ch->active;
 
-	cli();
+	ch->active = NULL;
+	ch->state  = ATA_ST_IDLE;
+	del_ktimer(&ch->timer);
 
-	/* Check if we need to handle this IRQ */
-	if (discard_irq[1] == ATA_DISCARD_NEXT_IRQ) {
-		discard_irq[1] = ATA_HANDLE_NEXT_IRQ;
-		sti();
+	blk_end_request(bop, status);
+
+	/* Process the next block on queue */
+	ata_start_op(bus);
+}
+
+
+/**
+ * Timer of a bus: sends the first block of a PIO write when the
+ * device wasn't ready at command time, retries to send a request
+ * when bus was busy and fails commands that timed out.
+ *
+ * \param arg Bus - Primary or Secondary IDE
+ * \note Called from timer interrupt, with interrupts disabled.
+ */
+static void ata_timer(void *arg)
+{
+	uchar8_t bus = (uchar8_t)(uint32_t)arg;
+	struct _ata_channel *ch = &channels[bus];
+	int dev;
+
+	if (ch->active == NULL) {
+		/* Bus was busy */
+		ata_start_op(bus);
 		return;
-	} 
+	}
+	dev = ch->dev;
+
+	if (ch->state == ATA_ST_DRQ_WAIT) {
+		switch (ata_wait_drq(bus)) {
+			case 1:
+				ch->state = ATA_ST_PIO_OUT;
+				transfer_data_out(bus, ch->active, ata_devices[dev].drq_block);
+				mod_ktimer(&ch->timer, ch->deadline);
+				return;
+			case 0:
+				if (!time_after(jiffies, ch->deadline)) {
+					mod_ktimer(&ch->timer, jiffies + 1);
+					return;
+				}
+				break;
+			case -1:
+				kprintf(KERN_ERROR "ATA_DRIVER ERROR: hd%c: write command failed\n", 'a' + dev);
+				ata_complete(bus, BUFF_ST_UNLOCKED);
+				goto wakeup_waiting;
+		}
+	} else if (!time_after(jiffies, ch->deadline)) {
+		/* Command was sent after the timer was armed */
+		mod_ktimer(&ch->timer, ch->deadline);
+		return;
+	}
 
-	/* DRQ bit is set when disk has PIO data to transfer */
-	
-	/* Secondary */
-	bop = (struct _block_op *)blk_queue[2]->element;
-	buf = bop->buff;
-
-	if (bop->op == OP_READ) {
-		/* Read block */
-
-		for(i=0; i<SECTOR_SIZE; i+=2) {
-			wait_bus(SEC_BUS);
-			data = inw(pio_ports[SEC_BUS][REG_DATA]);
-			buf->data[i+1] = (uchar8_t)((data >> 0x08) & 0xFF);
-			buf->data[i]   = (uchar8_t)(data & 0xFF);  
+	kprintf(KERN_ERROR "ATA_DRIVER ERROR: hd%c: command timeout\n", 'a' + dev);
+	ata_reset(bus);
+	ata_complete(bus, BUFF_ST_UNLOCKED);
+
+wakeup_waiting:
+	wakeup(WAIT_INT_IDE_HDA + dev);
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+}
+
+
+/**
+ * Send the command of a request to its device, the request becomes
+ * the active one of the bus.
+ *
+ * \param bus Bus - Primary or Secondary IDE.
+ * \param dev Index of the device (0 = hda, 1 = hdb, 2 = hdc, 3 = hdd).
+ * \param bop The request.
+ * \note Should be called with interrupts disabled.
+ */
+static void ata_issue(uchar8_t bus, int dev, blk_request_t *bop)
+{
+	struct _ata_channel *ch = &channels[bus];
+	int drq = ata_devices[dev].drq_block;
+
+	ch->active   = bop;
+	ch->dev      = dev;
+	ch->deadline = jiffies + ATA_CMD_TIMEOUT;
+
+	ata_select(bus, dev);
+
+	if (bop->op == BLK_FLUSH) {
+		ch->state = ATA_ST_FLUSH;
+		if ((ata_devices[dev].flags & LBA48)) {
+			send_cmd(bus, CMD_FLUSH_CACHE_EXT);
+		} else {
+			send_cmd(bus, CMD_FLUSH_CACHE);
 		}
-	} else if (bop->op == OP_WRITE) {
-		/* Write is done. Just ignore next IRQ */
-		wait_bus(SEC_BUS);
-		discard_irq[1] = ATA_DISCARD_NEXT_IRQ;
+	} else if ((ata_devices[dev].flags & USE_DMA)) {
+		ch->state = ATA_ST_DMA;
+		dma_hd_sectors(bus, bop);
+	} else if (bop->op == BLK_READ) {
+		ch->state = ATA_ST_PIO_IN;
+		set_sectors(bus, bop->sector, bop->count);
+		send_cmd(bus, (drq > 1 ? CMD_READ_MULTIPLE_EXT : CMD_READ_SECTORS_EXT));
 	} else {
-		kprintf(KERN_CRIT "Unknown ATA operation (should be Read or Write).");
+		ch->state = ATA_ST_DRQ_WAIT;
+		set_sectors(bus, bop->sector, bop->count);
+		send_cmd(bus, (drq > 1 ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_SECTORS_EXT));
+		ata_delay400ns(bus);
+
+		/* Device is (usually) ready for the first block of sectors
+		   right away, otherwise (or on error) timer takes care */
+		if (ata_wait_drq(bus) == 1) {
+			ch->state = ATA_ST_PIO_OUT;
+			transfer_data_out(bus, bop, drq);
+		}
 	}
-	buf->status = BUFF_ST_VALID;
-	llist_remove(&blk_queue[2], bop);
-	kfree(bop);
 
-	/* Process the next block on queue */
-	if (blk_queue[2] != NULL) {
-		bop = (struct _block_op*)blk_queue[2]->element;
-		buf = bop->buff;
-
-		if (bop->op == OP_READ) {
-			read_hd_sector(DEVMAJOR_ATA_SEC, bop->device, buf->addr);
-		} else if (bop->op == OP_WRITE) {
-			write_hd_sector(DEVMAJOR_ATA_SEC, bop->device, buf->addr, buf->data);
-		} else {
-			kprintf(KERN_CRIT "Unknown ATA operation (should be Read or Write).");
+	mod_ktimer(&ch->timer,
+			(ch->state == ATA_ST_DRQ_WAIT ? jiffies + 1 : ch->deadline));
+}
+
+
+/**
+ * Send the next request of the bus to its device. Devices of the
+ * bus take turns (when both have requests), the request of each
+ * one is chosen by the I/O scheduler of its queue.
+ *
+ * \param bus Bus - Primary or Secondary IDE.
+ * \note Should be called with interrupts disabled.
+ */
+static void ata_start_op(uchar8_t bus)
+{
+	struct _ata_channel *ch = &channels[bus];
+	blk_request_t *bop;
+	int dev;
+
+	if (ch->active != NULL) {
+		return;
+	}
+
+	dev = (bus * 2) + ((ch->dev + 1) & 0x01);
+	if (blk_queue_empty(&blk_queue[dev])) {
+		dev ^= 0x01;
+		if (blk_queue_empty(&blk_queue[dev])) {
+			return;
 		}
 	}
 
-	/* Wakeup process waiting for this interrupt */
+	if ((inb(pio_ports[bus][REG_ASTATUS]) & BSY_BIT)) {
+		/* Bus is busy (after a reset), try again later */
+		mod_ktimer(&ch->timer, jiffies + 1);
+		return;
+	}
+
+	if ((bop = blk_next_request(&blk_queue[dev])) != NULL) {
+		ata_issue(bus, dev, bop);
+	}
+}
+
+
+/**
+ * Put a block operation into the queue of the device.
+ *
+ * \param major Bus - Primary or Secondary IDE.
+ * \param device Device number.
+ * \param op Operation: BLK_READ or BLK_WRITE.
+ * \param bufs Buffers (holding consecutive sectors).
+ * \param count Number of buffers (only one for reads).
+ * \return 0 on success, -1 otherwise.
+ */
+static int ata_queue_op(int major, int device, char op, buff_header_t **bufs, int count)
+{
+	uchar8_t bus, dev;
+	uint64_t addr;
+	int i;
+
+	if (count < 1 || count > BCACHE_CLUSTER_MAX) {
+		return -1;
+	}
+
+	if (get_sector_location(major, device, bufs[0]->addr, count, &bus, &dev, &addr) < 0) {
+		return -1;
+	}
+
+	cli();
+	/* I/O scheduler sorts (or merges) the request */
+	if (blk_queue_bufs(&blk_queue[dev], op, device, addr, bufs, count) < 0) {
+		sti();
+		return -1;
+	}
+
+	/* Mark blocks as busy */
+	for (i = 0; i < count; i++) {
+		bufs[i]->status = BUFF_ST_BUSY;
+	}
+	if (op == BLK_WRITE) {
+		wcache_dirty[dev] = 1;
+	}
+
+	/* If device is idle we can process the request now! Otherwise
+	   it will be processed later, by interrupt handler */
+	ata_start_op(bus);
 	sti();
-	wakeup(WAIT_INT_IDE_SEC);
+
+	return 0;
 }
 
 /**
- * Read a sector from hard disk.
+ * Wait for the transfer of a buffer (sleeping on the address of
+ * its device).
  *
  * \param major Bus - Primary or Secondary IDE.
  * \param device Device number.
- * \param buf Buffer structure that should contains block address, 
- *            and space for block data.
+ * \param buf The buffer.
  */
-int read_async_ata_sector(int major, int device, buff_header_t *buf)
+static void ata_wait_buffer(int major, int device, buff_header_t *buf)
 {
-	uchar8_t dev;
-	struct _block_op *bop;
+	uchar8_t bus, dev;
+	uint64_t addr;
 
-	if (major == DEVMAJOR_ATA_PRI) {
-		
-		if (device >= DEVNUM_HDA && device < DEVNUM_HDB) {
-			dev = 0;
-		} else if (device >= DEVNUM_HDB) {
-			dev = 1;
-		} else {
-			return -1;
-		}
-		
-	} else if(major == DEVMAJOR_ATA_SEC) {
+	if (get_sector_location(major, device, buf->addr, 1, &bus, &dev, &addr) < 0) {
+		return;
+	}
 
-		if (device >= DEVNUM_HDC && device < DEVNUM_HDD) {
-			dev = 2;
-		} else if (device >= DEVNUM_HDD) {
-			dev = 3;
-		} else {
-			return -1;
+	while (buf->status == BUFF_ST_BUSY) {
+		sleep_on(WAIT_INT_IDE_HDA + dev);
+	}
+}
+
+
+/**
+ * Flush the write cache of a device. The flush is a barrier: it's
+ * sent after all writes queued before it (and before all requests
+ * queued after it). Devices not written since the last flush are
+ * skipped.
+ *
+ * \param major Bus - Primary or Secondary IDE.
+ * \param device Device number (disk or partition), -1 for all devices
+ *               of the bus.
+ * \return 0 on success, -1 otherwise.
+ * \note This function will sleep until the cache gets flushed.
+ */
+static int ata_flush(int major, int device)
+{
+	uchar8_t bus, dev;
+	uint64_t addr;
+	volatile char status;
+
+	if (device < 0) {
+		bus = (major == DEVMAJOR_ATA_PRI ? PRI_BUS : SEC_BUS);
+		for (dev = (bus * 2); dev < (bus * 2) + 2; dev++) {
+			if ((ata_devices[dev].flags & PRESENT) &&
+					ata_flush(major, ata_minors[dev]) < 0) {
+				return -1;
+			}
 		}
+		return 0;
+	}
 
-	} else {
+	if (get_sector_location(major, device, 0, 0, &bus, &dev, &addr) < 0) {
 		return -1;
 	}
 
-
 	cli();
-	/* First, mark block as busy */
-	buf->status = BUFF_ST_BUSY;
+	if (!wcache_dirty[dev]) {
+		sti();
+		return 0;
+	}
 
-	bop = kmalloc(sizeof(struct _block_op), GFP_NORMAL_Z);
-	if (bop == NULL) {
+	status = BUFF_ST_BUSY;
+	if (blk_queue_flush(&blk_queue[dev], ata_minors[dev], &status) < 0) {
 		sti();
 		return -1;
-	} else {
-		bop->op     = OP_READ;
-		bop->buff   = buf;
-		bop->device = device;
 	}
+	wcache_dirty[dev] = 0;
+	ata_start_op(bus);
+	sti();
 
-	if (blk_queue[dev] == NULL) {
-		/** The queue is empty, so we can process this block now! */
-		llist_add(&blk_queue[dev], bop); 
-		read_hd_sector(major, device, buf->addr);
-	} else {
-		/** The queue is not empty, we will just add the block to the queue,
-		 *  so it will be process later, by interrupt handler */
-		llist_add(&blk_queue[dev], bop);
+	while (status == BUFF_ST_BUSY) {
+		sleep_on(WAIT_INT_IDE_HDA + dev);
 	}
-	sti();
 
-	return 0;
+	return (status == BUFF_ST_VALID ? 0 : -1);
+}
+
+
+/**
+ * Read a sector from hard disk.
+ *
+ * \param major Bus - Primary or Secondary IDE.
+ * \param device Device number.
+ * \param buf Buffer structure that should contains block address, 
+ *            and space for block data.
+ */
+int read_async_ata_sector(int major, int device, buff_header_t *buf)
+{
+	return ata_queue_op(major, device, BLK_READ, &buf, 1);
 }
 
+
 /**
  * Read a sector from hard disk.
  *
@@ -919,12 +1484,8 @@ int read_sync_ata_sector(int major, int device, buff_header_t *buf)
 	res = read_async_ata_sector(major, device, buf);
 
 	/** Wait block to become available */
-	if (major == DEVMAJOR_ATA_PRI) {
-		while(buf->status == BUFF_ST_BUSY)
-			sleep_on(WAIT_INT_IDE_PRI);
-	} else {
-		while(buf->status == BUFF_ST_BUSY)
-			sleep_on(WAIT_INT_IDE_SEC);
+	if (res == 0) {
+		ata_wait_buffer(major, device, buf);
 	}
 
 	return res;
@@ -942,65 +1503,39 @@ int read_sync_ata_sector(int major, int device, buff_header_t *buf)
  */
 int write_async_ata_sector(int major, int device, buff_header_t *buf)
 {
-	uchar8_t dev;
-	struct _block_op *bop;
-
-	if (major == DEVMAJOR_ATA_PRI) {
-		switch(device) {
-			case DEVNUM_HDA:
-				dev = 0;
-				break;
-
-			case DEVNUM_HDB:
-				dev = 1;
-				break;
-
-			default:
-				return -1;
-		}
-	} else if(major == DEVMAJOR_ATA_SEC) {
-		switch(device) {
-			case DEVNUM_HDC:
-				dev = 2;
-				break;
-
-			case DEVNUM_HDD:
-				dev = 3;
-				break;
+	return ata_queue_op(major, device, BLK_WRITE, &buf, 1);
+}
 
-			default:
-				return -1;
-		}
-	} else {
-		return -1;
-	}
 
+/** 
+ * Write consecutive sectors to hard disk asynchronously, with
+ * only one command.
+ *
+ * \param major Bus - Primary or Secondary IDE
+ * \param device Device number
+ * \param bufs Buffers holding consecutive sectors (addresses and data).
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ * \note This function will return as soon as possible, even if the write
+ *       operation was not yet completed by the kernel.
+ */
+int write_async_ata_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ata_queue_op(major, device, BLK_WRITE, bufs, count);
+}
 
-	cli();
-	/* First, mark block as busy */
-	buf->status = BUFF_ST_BUSY;
 
-	bop = kmalloc(sizeof(struct _block_op), GFP_NORMAL_Z);
-	if (bop == NULL) {
-		sti();
-		return -1;
-	} else {
-		bop->op   = OP_WRITE;
-		bop->buff = buf; 
-	}
-
-	if (blk_queue[dev] == NULL) {
-		/** The queue is empty, so we can process this block now! */
-		llist_add(&blk_queue[dev], bop); 
-		write_hd_sector(major, device, buf->addr, buf->data);
-	} else {
-		/** The queue is not empty, we will just add the block to the queue,
-		 *  so it will be process later, by interrupt handler */
-		llist_add(&blk_queue[dev], bop);
-	}
-	sti();
-	
-	return 0;
+/**
+ * Read consecutive sectors from hard disk asynchronously, with
+ * only one command.
+ *
+ * \param major Bus - Primary or Secondary IDE
+ * \param device Device number
+ * \param bufs Buffers of consecutive sectors (with addresses).
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ */
+int read_async_ata_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ata_queue_op(major, device, BLK_READ, bufs, count);
 }
 
 
@@ -1020,12 +1555,8 @@ int write_sync_ata_sector(int major, int device, buff_header_t *buf)
 	res = write_async_ata_sector(major, device, buf);
 
 	/** Wait block to become available */
-	if (major == DEVMAJOR_ATA_PRI) {
-		while(buf->status == BUFF_ST_BUSY)
-			sleep_on(WAIT_INT_IDE_PRI);
-	} else {
-		while(buf->status == BUFF_ST_BUSY)
-			sleep_on(WAIT_INT_IDE_SEC);
+	if (res == 0) {
+		ata_wait_buffer(major, device, buf);
 	}
 
 	return res;
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: ramdisk.c
+ * Desc: RAM disk driver (disk images loaded by bootloader or
+ *       memory reserved at boot).
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/mm.h>
+#include <fs/device.h>
+#include <fs/dev_numbers.h>
+#include <fs/bio.h>
+#include <drv/ramdisk.h>
+#include <arch/io.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** RAM disks */
+static ramdisk_t ramdisks[RAMDISK_MAX];
+
+/** Number of RAM disks */
+static uint32_t nramdisks;
+
+/** Driver structure */
+dev_blk_driver_t ramdisk_drv;
+
+
+static int ramdisk_transfer(int device, char op, buff_header_t **bufs, int count);
+
+
+/** RAM disk operations (Read/Write) */
+struct _blk_dev_op ramdisk_ops = {
+	.read_sync_block    = read_sync_ramdisk_sector,
+	.read_async_block   = read_async_ramdisk_sector,
+	.write_async_block  = write_async_ramdisk_sector,
+	.write_sync_block   = write_sync_ramdisk_sector,
+	.write_async_blocks = write_async_ramdisk_sectors,
+	.read_async_blocks  = read_async_ramdisk_sectors,
+};
+
+
+/**
+ * Initialize RAM disks. Each module loaded by bootloader becomes a
+ * RAM disk (ram0, ram1, ...) with the image it holds. Besides them,
+ * ramdisk_size=<KB> at command line creates an empty RAM disk.
+ */
+void init_ramdisk(void)
+{
+	kmodule_t *mod;
+	char *opt;
+	uint32_t i, kbytes, npages;
+
+	kprintf(KERN_INFO "Initializing RAM disks...\n");
+
+	nramdisks = 0;
+
+	/* Disk images loaded by bootloader */
+	for (i = 0; i < kinfo.mods_count; i++) {
+		mod = &kinfo.mods[i];
+
+		if (mod->vaddr == NULL || mod->end <= mod->start) {
+			kprintf(KERN_WARNING " Module %s: not mapped, ignored.\n", mod->cmdline);
+			continue;
+		}
+
+		ramdisks[nramdisks].data    = (char *)mod->vaddr;
+		ramdisks[nramdisks].sectors = (mod->end - mod->start) / BUFF_SIZE;
+		kprintf(KERN_INFO " ram%d: %d sectors (module %s)\n",
+				nramdisks, ramdisks[nramdisks].sectors, mod->cmdline);
+		nramdisks++;
+	}
+
+	/* Memory reserved at boot */
+	opt = cmdline_get_value("ramdisk_size");
+	if (opt != NULL && (kbytes = atoi(opt)) > 0) {
+		npages = (kbytes * 1024) / PAGE_SIZE;
+		if (npages == 0) {
+			npages = 1;
+		}
+
+		ramdisks[nramdisks].data = (char *)kmalloc_pages(npages, GFP_NORMAL_Z);
+		if (ramdisks[nramdisks].data == NULL) {
+			kprintf(KERN_ERROR " Could not alloc %d KB for RAM disk.\n", kbytes);
+		} else {
+			memset(ramdisks[nramdisks].data, 0, npages * PAGE_SIZE);
+			ramdisks[nramdisks].sectors = (npages * PAGE_SIZE) / BUFF_SIZE;
+			kprintf(KERN_INFO " ram%d: %d sectors (reserved memory)\n",
+					nramdisks, ramdisks[nramdisks].sectors);
+			nramdisks++;
+		}
+	}
+
+	if (nramdisks == 0) {
+		kprintf(KERN_INFO " No RAM disks.\n");
+		return;
+	}
+
+	/* Register the driver (all disks share the major number) */
+	ramdisk_drv.major        = DEVMAJOR_RAMDISK;
+	ramdisk_drv.size         = ramdisks[0].sectors;
+	ramdisk_drv.max_sectors  = BCACHE_CLUSTER_MAX;
+	ramdisk_drv.max_segments = BCACHE_CLUSTER_MAX;
+	ramdisk_drv.dev_ops      = &ramdisk_ops;
+
+	if (register_block_driver(&ramdisk_drv) < 0) {
+		kprintf(KERN_ERROR "Could not register a driver for RAM disks!\n");
+	}
+}
+
+
+/**
+ * Copy consecutive sectors from (or to) a RAM disk. There is nothing
+ * to wait for, buffers are done when this function returns.
+ *
+ * \param device Device number (RAM disk).
+ * \param op BLK_READ or BLK_WRITE.
+ * \param bufs Buffers (holding consecutive sectors).
+ * \param count Number of buffers.
+ * \return 0 on success, -1 otherwise (no buffer is touched).
+ */
+static int ramdisk_transfer(int device, char op, buff_header_t **bufs, int count)
+{
+	ramdisk_t *rd;
+	char *sector;
+	int i;
+
+	if (device < 0 || (uint32_t)device >= nramdisks || count < 1) {
+		return -1;
+	}
+	rd = &ramdisks[device];
+
+	if (bufs[0]->addr >= rd->sectors || (bufs[0]->addr + count) > rd->sectors) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		sector = rd->data + ((uint32_t)bufs[i]->addr * BUFF_SIZE);
+
+		if (op == BLK_READ) {
+			memcpy(bufs[i]->data, sector, BUFF_SIZE);
+		} else {
+			memcpy(sector, bufs[i]->data, BUFF_SIZE);
+		}
+
+		cli();
+		bufs[i]->status = BUFF_ST_VALID;
+		if (bufs[i]->bio != NULL) {
+			bio_sector_done(bufs[i]->bio, 0);
+		}
+		sti();
+	}
+
+	return 0;
+}
+
+
+/**
+ * Read a sector from RAM disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ */
+int read_sync_ramdisk_sector(int major, int device, buff_header_t *buf)
+{
+	return ramdisk_transfer(device, BLK_READ, &buf, 1);
+}
+
+
+/**
+ * Read a sector from RAM disk (done when function returns).
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ */
+int read_async_ramdisk_sector(int major, int device, buff_header_t *buf)
+{
+	return ramdisk_transfer(device, BLK_READ, &buf, 1);
+}
+
+
+/**
+ * Write a sector to RAM disk (done when function returns).
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ */
+int write_async_ramdisk_sector(int major, int device, buff_header_t *buf)
+{
+	return ramdisk_transfer(device, BLK_WRITE, &buf, 1);
+}
+
+
+/**
+ * Write a sector to RAM disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ */
+int write_sync_ramdisk_sector(int major, int device, buff_header_t *buf)
+{
+	return ramdisk_transfer(device, BLK_WRITE, &buf, 1);
+}
+
+
+/**
+ * Write consecutive sectors to RAM disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers.
+ */
+int write_async_ramdisk_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ramdisk_transfer(device, BLK_WRITE, bufs, count);
+}
+
+
+/**
+ * Read consecutive sectors from RAM disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers.
+ */
+int read_async_ramdisk_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return ramdisk_transfer(device, BLK_READ, bufs, count);
+}
+
@@ -0,0 +1,727 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: virtio_blk.c
+ * Desc: Driver for virtio block devices (legacy PCI interface)
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/wait.h>
+#include <fs/device.h>
+#include <fs/dev_numbers.h>
+#include <fs/partition.h>
+#include <fs/elevator.h>
+#include <drv/virtio_blk.h>
+#include <drv/pci.h>
+#include <arch/irq.h>
+#include <arch/io.h>
+#include <string.h>
+
+/** Keep compiler from reordering accesses to rings shared with device */
+#define vring_barrier()	asm volatile("" : : : "memory")
+
+/** Disks found */
+static virtio_blk_disk_t *vblk_disks[VIRTIO_BLK_MAX_DISKS];
+
+/** Number of disks found */
+static uint32_t vblk_ndisks;
+
+/** Driver structure */
+dev_blk_driver_t virtio_blk_drv;
+
+
+static int virtio_blk_probe(pci_device_t *pdev, const pci_device_id_t *id);
+
+static void virtio_blk_handler(int id, pt_regs *regs);
+
+static void vblk_submit(virtio_blk_disk_t *disk, blk_request_t *rq);
+
+static void vblk_dispatch(virtio_blk_disk_t *disk);
+
+static void vblk_kick(virtio_blk_disk_t *disk);
+
+static void vblk_free_chain(virtio_blk_disk_t *disk, uint16_t head);
+
+static void vblk_process_used(virtio_blk_disk_t *disk);
+
+static int vblk_queue_op(int major, int device, char op, buff_header_t **bufs, int count);
+
+static void vblk_poll(void *arg);
+
+static void vblk_wait_buffer(int device, buff_header_t *buf);
+
+static int vblk_flush(int major, int device);
+
+
+/** Virtio block device operations (Read/Write) */
+struct _blk_dev_op virtio_blk_ops = {
+	.read_sync_block    = read_sync_virtio_sector,
+	.read_async_block   = read_async_virtio_sector,
+	.write_async_block  = write_async_virtio_sector,
+	.write_sync_block   = write_sync_virtio_sector,
+	.write_async_blocks = write_async_virtio_sectors,
+	.read_async_blocks  = read_async_virtio_sectors,
+	.flush              = vblk_flush,
+};
+
+/** Devices handled by the driver */
+static const pci_device_id_t virtio_blk_ids[] = {
+	{VIRTIO_PCI_VENDOR, VIRTIO_PCI_BLK_DEVICE, PCI_ANY_ID, PCI_ANY_ID},
+	{0, 0, 0, 0}
+};
+
+/** PCI driver */
+static pci_driver_t virtio_blk_pci_drv = {
+	.name     = "virtio-blk",
+	.id_table = virtio_blk_ids,
+	.probe    = virtio_blk_probe,
+};
+
+
+/**
+ * Initialize virtio block driver. Devices are found through PCI bus.
+ */
+void init_virtio_blk(void)
+{
+	uint32_t i;
+	char devstr[4];
+
+	kprintf(KERN_INFO "Initializing virtio block devices...\n");
+
+	vblk_ndisks = 0;
+
+	if (pci_register_driver(&virtio_blk_pci_drv) == 0) {
+		kprintf(KERN_INFO " No virtio block devices found.\n");
+		return;
+	}
+
+	/* Register the driver (all disks share the major number) */
+	virtio_blk_drv.major        = DEVMAJOR_VIRTIO_BLK;
+	virtio_blk_drv.size         = vblk_disks[0]->sectors;
+	virtio_blk_drv.max_sectors  = BCACHE_CLUSTER_MAX;
+	virtio_blk_drv.max_segments = BCACHE_CLUSTER_MAX;
+	virtio_blk_drv.dev_ops      = &virtio_blk_ops;
+
+	if (register_block_driver(&virtio_blk_drv) < 0) {
+		kprintf(KERN_ERROR "Could not register a driver for virtio disks!\n");
+		return;
+	}
+
+	/* Now, parse partition table for each disk */
+	for (i = 0; i < vblk_ndisks; i++) {
+		devstr[0] = 'v';
+		devstr[1] = 'd';
+		devstr[2] = 'a' + i;
+		devstr[3] = '\0';
+
+		if (blk_add_disk(&virtio_blk_drv, (i << VIRTIO_BLK_DISK_SHIFT), vblk_disks[i]->sectors) < 0) {
+			kprintf(KERN_ERROR "Could not add disk %d:%d\n",
+					DEVMAJOR_VIRTIO_BLK, (i << VIRTIO_BLK_DISK_SHIFT));
+			continue;
+		}
+
+		vblk_disks[i]->ptable = parse_mbr(virtio_blk_drv, (i << VIRTIO_BLK_DISK_SHIFT));
+		if (vblk_disks[i]->ptable == NULL) {
+			kprintf(KERN_INFO "No partitions found on disk %d:%d\n",
+					DEVMAJOR_VIRTIO_BLK, (i << VIRTIO_BLK_DISK_SHIFT));
+		} else {
+			kprintf(" Found: ");
+			print_partition_table(vblk_disks[i]->ptable, devstr);
+			kprintf("\n");
+			blk_add_partitions(&virtio_blk_drv, (i << VIRTIO_BLK_DISK_SHIFT), vblk_disks[i]->ptable,
+					(1 << VIRTIO_BLK_DISK_SHIFT));
+		}
+	}
+}
+
+
+/**
+ * Take a virtio block device found at PCI bus.
+ *
+ * \param pdev PCI device.
+ * \param id Matching ID.
+ * \return 0 on success, -1 otherwise.
+ */
+static int virtio_blk_probe(pci_device_t *pdev, const pci_device_id_t *id)
+{
+	virtio_blk_disk_t *disk;
+	uint16_t iobase;
+	uint32_t i, ring_size, rpages, features;
+	char *mem;
+
+	if (vblk_ndisks >= VIRTIO_BLK_MAX_DISKS || pdev->bars[0].type != PCI_BAR_TYPE_IO) {
+		return -1;
+	}
+	iobase = pdev->bars[0].base;
+	pci_enable_device(pdev, PCI_CMD_IO | PCI_CMD_MASTER);
+
+	/* Reset device and tell it we know how to drive it */
+	outb(0, iobase + VIRTIO_PCI_STATUS);
+	outb(VIRTIO_STATUS_ACK, iobase + VIRTIO_PCI_STATUS);
+	outb(VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER, iobase + VIRTIO_PCI_STATUS);
+
+	/* Only cache flush is used */
+	features = inl(iobase + VIRTIO_PCI_HOST_FEATURES) & VIRTIO_BLK_F_FLUSH;
+	outl(features, iobase + VIRTIO_PCI_GUEST_FEATURES);
+
+	/* Request queue */
+	outw(0, iobase + VIRTIO_PCI_QUEUE_SEL);
+	i = inw(iobase + VIRTIO_PCI_QUEUE_NUM);
+	if (i < (BCACHE_CLUSTER_MAX + VIRTIO_BLK_EXTRA_DESCS) || inl(iobase + VIRTIO_PCI_QUEUE_PFN) != 0) {
+		outb(VIRTIO_STATUS_FAILED, iobase + VIRTIO_PCI_STATUS);
+		return -1;
+	}
+
+	disk = (virtio_blk_disk_t *)kmalloc(sizeof(virtio_blk_disk_t), GFP_NORMAL_Z);
+	if (disk == NULL) {
+		outb(VIRTIO_STATUS_FAILED, iobase + VIRTIO_PCI_STATUS);
+		return -1;
+	}
+	memset(disk, 0, sizeof(virtio_blk_disk_t));
+	disk->iobase = iobase;
+	disk->qsize  = i;
+	disk->wcache = (features != 0);
+	blk_queue_init(&disk->queue, &elv_noop, DEVMAJOR_VIRTIO_BLK,
+			(vblk_ndisks << VIRTIO_BLK_DISK_SHIFT));
+	blk_poll_init(&disk->poll);
+
+	/* Descriptors and available ring, then used ring at the next page.
+	   Device sees the whole queue as physically contiguous memory. */
+	ring_size = (sizeof(struct _vring_desc) * disk->qsize) +
+		(sizeof(uint16_t) * (3 + disk->qsize));
+	ring_size = PAGE_ALIGN(ring_size) +
+		PAGE_ALIGN(sizeof(struct _vring_used_elem) * disk->qsize + (sizeof(uint16_t) * 3));
+	disk->qpages = ring_size >> PAGE_SHIFT;
+
+	rpages     = PAGE_ALIGN(sizeof(struct _virtio_blk_req) * disk->qsize) >> PAGE_SHIFT;
+	mem        = (char *)kmalloc_pages(disk->qpages, GFP_NORMAL_Z | GFP_CONTIG);
+	disk->reqs = (struct _virtio_blk_req *)kmalloc_pages(rpages, GFP_NORMAL_Z);
+	if (mem == NULL || disk->reqs == NULL) {
+		kprintf(KERN_ERROR " virtio-blk: Could not allocate queue.\n");
+		if (mem != NULL) {
+			kfree_pages(mem, disk->qpages);
+		}
+		if (disk->reqs != NULL) {
+			kfree_pages(disk->reqs, rpages);
+		}
+		kfree(disk);
+		outb(VIRTIO_STATUS_FAILED, iobase + VIRTIO_PCI_STATUS);
+		return -1;
+	}
+	memset(mem, 0, ring_size);
+	memset(disk->reqs, 0, sizeof(struct _virtio_blk_req) * disk->qsize);
+
+	disk->desc  = (struct _vring_desc *)mem;
+	disk->avail = (struct _vring_avail *)&mem[sizeof(struct _vring_desc) * disk->qsize];
+	disk->used  = (struct _vring_used *)&mem[PAGE_ALIGN((sizeof(struct _vring_desc) * disk->qsize) +
+				(sizeof(uint16_t) * (3 + disk->qsize)))];
+
+	/* All descriptors are free */
+	for (i = 0; i < disk->qsize; i++) {
+		disk->desc[i].next = i + 1;
+	}
+	disk->free_head = 0;
+	disk->num_free  = disk->qsize;
+	disk->last_used = 0;
+
+	outl(kmem_phys_addr(mem) >> PAGE_SHIFT, iobase + VIRTIO_PCI_QUEUE_PFN);
+
+	/* Disk size is the first field of device configuration */
+	disk->sectors  = inl(iobase + VIRTIO_PCI_CONFIG);
+	disk->sectors |= ((uint64_t)inl(iobase + VIRTIO_PCI_CONFIG + 4) << 32);
+
+	vblk_disks[vblk_ndisks++] = disk;
+
+	if (request_irq(pdev->irq, virtio_blk_handler, SA_SHIRQ, "virtio-blk") < 0) {
+		kprintf(KERN_ERROR "Error on register IRQ %d\n", pdev->irq);
+	}
+
+	outb(VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK,
+			iobase + VIRTIO_PCI_STATUS);
+
+	kprintf(KERN_INFO " vd%c: %d sectors, queue size %d, IRQ %d\n", 'a' + vblk_ndisks - 1,
+			(uint32_t)disk->sectors, disk->qsize, pdev->irq);
+
+	return 0;
+}
+
+
+/**
+ * Put a request into the available ring, as a chain of descriptors:
+ * header, data buffers (physically contiguous buffers share a
+ * descriptor) and status.
+ *
+ * \param disk The disk.
+ * \param rq The request.
+ * \note Should be called with interrupts disabled, and there should be
+ * enough free descriptors. Device is not notified, see vblk_kick.
+ */
+static void vblk_submit(virtio_blk_disk_t *disk, blk_request_t *rq)
+{
+	struct _virtio_blk_req *req;
+	struct _vring_desc *desc, *prev;
+	uint16_t head, idx, used;
+	uint32_t phys;
+	int i;
+
+	head = idx = disk->free_head;
+	used = 0;
+
+	req = &disk->reqs[head];
+	if (rq->op == BLK_FLUSH) {
+		req->hdr.type = VIRTIO_BLK_T_FLUSH;
+	} else {
+		req->hdr.type = (rq->op == BLK_READ ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT);
+	}
+	req->hdr.ioprio = 0;
+	req->hdr.sector = rq->sector;
+	req->status     = 0xFF;
+	req->rq         = rq;
+
+	/* Header */
+	desc        = &disk->desc[idx];
+	desc->addr  = kmem_phys_addr(&req->hdr);
+	desc->len   = sizeof(struct _virtio_blk_outhdr);
+	desc->flags = VRING_DESC_F_NEXT;
+	prev        = NULL;
+	idx         = desc->next;
+	used++;
+
+	/* Data */
+	for (i = 0; i < rq->count; i++) {
+		phys = kmem_phys_addr(rq->buffs[i]->data);
+		if (prev != NULL && (prev->addr + prev->len) == phys) {
+			prev->len += BUFF_SIZE;
+			continue;
+		}
+
+		desc        = &disk->desc[idx];
+		desc->addr  = phys;
+		desc->len   = BUFF_SIZE;
+		desc->flags = VRING_DESC_F_NEXT | (rq->op == BLK_READ ? VRING_DESC_F_WRITE : 0);
+		prev        = desc;
+		idx         = desc->next;
+		used++;
+	}
+
+	/* Status */
+	desc        = &disk->desc[idx];
+	desc->addr  = kmem_phys_addr((void*)&req->status);
+	desc->len   = sizeof(uchar8_t);
+	desc->flags = VRING_DESC_F_WRITE;
+	used++;
+
+	disk->free_head  = desc->next;
+	disk->num_free  -= used;
+
+	disk->avail->ring[disk->avail->idx & (disk->qsize - 1)] = head;
+	vring_barrier();
+	disk->avail->idx++;
+}
+
+
+/**
+ * Send queued requests while there are enough free descriptors
+ * (device is notified once). A flush only covers the writes already
+ * completed, so it waits for the ring to drain and runs alone.
+ *
+ * \param disk The disk.
+ * \note Should be called with interrupts disabled.
+ */
+static void vblk_dispatch(virtio_blk_disk_t *disk)
+{
+	blk_request_t *rq;
+	char kick = 0;
+
+	while (disk->num_free >= (BCACHE_CLUSTER_MAX + VIRTIO_BLK_EXTRA_DESCS)) {
+		if (disk->flush == NULL) {
+			if ((rq = blk_next_request(&disk->queue)) == NULL) {
+				break;
+			}
+			if (rq->op != BLK_FLUSH) {
+				vblk_submit(disk, rq);
+				kick = 1;
+				continue;
+			}
+			disk->flush = rq;
+		}
+
+		if (disk->num_free == disk->qsize) {
+			vblk_submit(disk, disk->flush);
+			kick = 1;
+		}
+		break;
+	}
+
+	if (kick) {
+		vblk_kick(disk);
+	}
+}
+
+
+/**
+ * Notify device about new requests, unless it said it's not
+ * needed (device is still working on the ring).
+ *
+ * \param disk The disk.
+ */
+static void vblk_kick(virtio_blk_disk_t *disk)
+{
+	vring_barrier();
+	if ((disk->used->flags & VRING_USED_F_NO_NOTIFY) == 0) {
+		outw(0, disk->iobase + VIRTIO_PCI_QUEUE_NOTIFY);
+	}
+}
+
+
+/**
+ * Return a chain of descriptors to the free list.
+ *
+ * \param disk The disk.
+ * \param head First descriptor of the chain.
+ */
+static void vblk_free_chain(virtio_blk_disk_t *disk, uint16_t head)
+{
+	uint16_t idx = head;
+
+	disk->num_free++;
+	while ((disk->desc[idx].flags & VRING_DESC_F_NEXT)) {
+		idx = disk->desc[idx].next;
+		disk->num_free++;
+	}
+
+	disk->desc[idx].next = disk->free_head;
+	disk->free_head      = head;
+}
+
+
+/**
+ * Finish requests at the used ring and send pending requests.
+ * Device interrupts are suppressed while the ring is drained.
+ *
+ * \param disk The disk.
+ * \note Should be called with interrupts disabled.
+ */
+static void vblk_process_used(virtio_blk_disk_t *disk)
+{
+	volatile struct _vring_used_elem *elem;
+	struct _virtio_blk_req *req;
+	blk_request_t *rq;
+	char status;
+
+	do {
+		disk->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+
+		while (disk->last_used != disk->used->idx) {
+			vring_barrier();
+			elem = &disk->used->ring[disk->last_used & (disk->qsize - 1)];
+			req  = &disk->reqs[elem->id];
+			rq   = req->rq;
+
+			req->rq = NULL;
+			vblk_free_chain(disk, elem->id);
+			disk->last_used++;
+
+			if (rq == NULL) {
+				continue;
+			}
+			if (rq == disk->flush) {
+				disk->flush = NULL;
+			}
+
+			if (req->status == VIRTIO_BLK_S_OK) {
+				status = BUFF_ST_VALID;
+			} else {
+				kprintf(KERN_ERROR "virtio-blk ERROR: request failed (status %d)\n", req->status);
+				status = BUFF_ST_UNLOCKED;
+			}
+			blk_end_request(rq, status);
+		}
+
+		disk->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+		vring_barrier();
+
+		/* Requests completed after the last check won't interrupt */
+	} while (disk->last_used != disk->used->idx);
+
+	/* Send requests waiting for descriptors */
+	vblk_dispatch(disk);
+}
+
+
+/**
+ * Interrupt handler.
+ */
+static void virtio_blk_handler(int id, pt_regs *regs)
+{
+	uint32_t i;
+	char done = 0;
+
+	cli();
+
+	for (i = 0; i < vblk_ndisks; i++) {
+		/* Reading ISR acknowledges the interrupt */
+		if ((inb(vblk_disks[i]->iobase + VIRTIO_PCI_ISR) & 0x01)) {
+			vblk_process_used(vblk_disks[i]);
+			done = 1;
+		}
+	}
+
+	sti();
+
+	if (done) {
+		wakeup(WAIT_INT_VIRTIO);
+		wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+		wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+	}
+}
+
+
+/**
+ * Put a request into the queue of a disk.
+ *
+ * \param major Major number.
+ * \param device Device number (disk or partition).
+ * \param op Operation: BLK_READ or BLK_WRITE.
+ * \param bufs Buffers (holding consecutive sectors).
+ * \param count Number of buffers.
+ * \return 0 on success, -1 otherwise.
+ */
+static int vblk_queue_op(int major, int device, char op, buff_header_t **bufs, int count)
+{
+	virtio_blk_disk_t *disk;
+	uint64_t addr;
+	int i, ndisk;
+
+	if (major != DEVMAJOR_VIRTIO_BLK || count < 1 || count > BCACHE_CLUSTER_MAX) {
+		return -1;
+	}
+
+	/* Partition (or disk) to disk address */
+	if ((ndisk = blk_map_sector(&virtio_blk_drv, device, bufs[0]->addr, count, &addr)) < 0) {
+		return -1;
+	}
+	disk = vblk_disks[ndisk >> VIRTIO_BLK_DISK_SHIFT];
+
+	cli();
+	if (blk_queue_bufs(&disk->queue, op, device, addr, bufs, count) < 0) {
+		sti();
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		bufs[i]->status = BUFF_ST_BUSY;
+	}
+
+	/* Send now if there are free descriptors, otherwise it waits */
+	vblk_dispatch(disk);
+	sti();
+
+	return 0;
+}
+
+
+/**
+ * Finish the requests done by disk, without waiting for its
+ * interrupt (used by polled completion).
+ *
+ * \param arg The disk.
+ */
+static void vblk_poll(void *arg)
+{
+	virtio_blk_disk_t *disk = (virtio_blk_disk_t *)arg;
+
+	cli();
+	if (disk->last_used == disk->used->idx) {
+		/* Nothing done yet */
+		sti();
+		return;
+	}
+	vblk_process_used(disk);
+	sti();
+
+	/* Interrupt could find nothing left to do, so wake up here */
+	wakeup(WAIT_INT_VIRTIO);
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	wakeup(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+}
+
+
+/**
+ * Wait for the transfer of a buffer, polling the disk while it's
+ * worth it.
+ *
+ * \param device Device number (disk or partition).
+ * \param buf The buffer (already queued).
+ */
+static void vblk_wait_buffer(int device, buff_header_t *buf)
+{
+	virtio_blk_disk_t *disk = vblk_disks[(uint32_t)device >> VIRTIO_BLK_DISK_SHIFT];
+
+	blk_poll_wait(&disk->poll, &buf->status, vblk_poll, disk, WAIT_INT_VIRTIO);
+}
+
+
+/**
+ * Flush the write cache of a disk. The flush is a barrier: it's sent
+ * after all writes queued before it (and before all requests queued
+ * after it). Disks without write cache have nothing to flush.
+ *
+ * \param major Major number.
+ * \param device Device number (disk or partition), -1 for all disks.
+ * \return 0 on success, -1 otherwise.
+ * \note This function will sleep until the cache gets flushed.
+ */
+static int vblk_flush(int major, int device)
+{
+	virtio_blk_disk_t *disk;
+	uint64_t addr;
+	uint32_t i;
+	int ndisk;
+	volatile char status;
+
+	if (device < 0) {
+		for (i = 0; i < vblk_ndisks; i++) {
+			if (vblk_flush(major, (i << VIRTIO_BLK_DISK_SHIFT)) < 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if ((ndisk = blk_map_sector(&virtio_blk_drv, device, 0, 0, &addr)) < 0) {
+		return -1;
+	}
+	disk = vblk_disks[ndisk >> VIRTIO_BLK_DISK_SHIFT];
+	if (!disk->wcache) {
+		return 0;
+	}
+
+	cli();
+	status = BUFF_ST_BUSY;
+	if (blk_queue_flush(&disk->queue, device, &status) < 0) {
+		sti();
+		return -1;
+	}
+	vblk_dispatch(disk);
+	sti();
+
+	blk_poll_wait(&disk->poll, &status, vblk_poll, disk, WAIT_INT_VIRTIO);
+
+	return (status == BUFF_ST_VALID ? 0 : -1);
+}
+
+
+/**
+ * Read a sector from disk asynchronously.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ */
+int read_async_virtio_sector(int major, int device, buff_header_t *buf)
+{
+	return vblk_queue_op(major, device, BLK_READ, &buf, 1);
+}
+
+
+/**
+ * Read a sector from disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address).
+ * \note This function will sleep until the block becomes available.
+ */
+int read_sync_virtio_sector(int major, int device, buff_header_t *buf)
+{
+	int res;
+
+	res = vblk_queue_op(major, device, BLK_READ, &buf, 1);
+
+	if (res == 0) {
+		vblk_wait_buffer(device, buf);
+	}
+
+	return res;
+}
+
+
+/**
+ * Write a sector to disk asynchronously.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ */
+int write_async_virtio_sector(int major, int device, buff_header_t *buf)
+{
+	return vblk_queue_op(major, device, BLK_WRITE, &buf, 1);
+}
+
+
+/**
+ * Write a sector to disk.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param buf Buffer (with block address and data).
+ * \note This function will sleep until the block is written.
+ */
+int write_sync_virtio_sector(int major, int device, buff_header_t *buf)
+{
+	int res;
+
+	res = vblk_queue_op(major, device, BLK_WRITE, &buf, 1);
+
+	if (res == 0) {
+		vblk_wait_buffer(device, buf);
+	}
+
+	return res;
+}
+
+
+/**
+ * Write consecutive sectors to disk asynchronously, with one request.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ */
+int write_async_virtio_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return vblk_queue_op(major, device, BLK_WRITE, bufs, count);
+}
+
+
+/**
+ * Read consecutive sectors from disk asynchronously, with one request.
+ *
+ * \param major Major number.
+ * \param device Device number.
+ * \param bufs Buffers of consecutive sectors.
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ */
+int read_async_virtio_sectors(int major, int device, buff_header_t **bufs, int count)
+{
+	return vblk_queue_op(major, device, BLK_READ, bufs, count);
+}
+
@@ -0,0 +1,9 @@
+##
+# Copyright (C) 2009 Renê de Souza Pinto
+# TempOS - Tempos is an Educational and multi purpose Operating System
+#
+# TBS - Build configuration file
+#
+
+obj-y += pci.o
+
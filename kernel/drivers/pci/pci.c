@@ -0,0 +1,465 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: pci.c
+ * Desc: PCI bus enumeration and configuration space access
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <drv/pci.h>
+#include <arch/io.h>
+#include <string.h>
+
+
+/** PCI functions found on the system */
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+
+/** Number of PCI functions found */
+static uint32_t pci_ndevices;
+
+
+static uint32_t pci_conf_read(uchar8_t bus, uchar8_t dev, uchar8_t func, uchar8_t reg);
+
+static void pci_conf_write(uchar8_t bus, uchar8_t dev, uchar8_t func, uchar8_t reg, uint32_t value);
+
+static void pci_scan_function(uchar8_t bus, uchar8_t dev, uchar8_t func);
+
+static void pci_decode_bars(pci_device_t *pdev);
+
+static const pci_device_id_t *pci_match_id(const pci_device_id_t *ids, pci_device_t *pdev);
+
+static void pci_probe_driver(pci_driver_t *driver, pci_device_t *pdev);
+
+
+/**
+ * Initialize the PCI layer: scan all buses and decode base
+ * address registers of each function found.
+ */
+void init_pci(void)
+{
+	uint32_t bus, dev, func;
+	uint32_t id;
+	uchar8_t htype;
+
+	kprintf(KERN_INFO "Initializing PCI bus...\n");
+
+	pci_ndevices = 0;
+
+	/* Check if configuration mechanism #1 is there */
+	outl(PCI_CONFIG_ENABLE, PCI_CONFIG_ADDRESS);
+	if (inl(PCI_CONFIG_ADDRESS) != PCI_CONFIG_ENABLE) {
+		kprintf(KERN_INFO " pci: Configuration mechanism #1 not available.\n");
+		return;
+	}
+
+	for (bus = 0; bus < PCI_MAX_BUS; bus++) {
+		for (dev = 0; dev < PCI_MAX_DEV; dev++) {
+			id = pci_conf_read(bus, dev, 0, PCI_VENDOR_ID);
+			if ((id & 0xFFFF) == 0xFFFF) {
+				/* No device */
+				continue;
+			}
+
+			pci_scan_function(bus, dev, 0);
+
+			/* Multi function device? */
+			htype = (pci_conf_read(bus, dev, 0, PCI_HEADER_TYPE) >> 16) & 0xFF;
+			if ((htype & PCI_HEADER_MULTI) == 0) {
+				continue;
+			}
+
+			for (func = 1; func < PCI_MAX_FUNC; func++) {
+				id = pci_conf_read(bus, dev, func, PCI_VENDOR_ID);
+				if ((id & 0xFFFF) != 0xFFFF) {
+					pci_scan_function(bus, dev, func);
+				}
+			}
+		}
+	}
+
+	kprintf(KERN_INFO " pci: %d functions found.\n", pci_ndevices);
+}
+
+
+/**
+ * Read a double word from configuration space.
+ *
+ * \param bus Bus number.
+ * \param dev Device number.
+ * \param func Function number.
+ * \param reg Register (aligned to 4 bytes).
+ */
+static uint32_t pci_conf_read(uchar8_t bus, uchar8_t dev, uchar8_t func, uchar8_t reg)
+{
+	uint32_t flags, value;
+
+	/* Address and data ports are shared by all drivers */
+	flags = irq_save();
+	outl(PCI_CONFIG_ENABLE | (bus << 16) | (dev << 11) | (func << 8) | (reg & 0xFC),
+			PCI_CONFIG_ADDRESS);
+	value = inl(PCI_CONFIG_DATA);
+	irq_restore(flags);
+
+	return value;
+}
+
+
+/**
+ * Write a double word to configuration space.
+ *
+ * \param bus Bus number.
+ * \param dev Device number.
+ * \param func Function number.
+ * \param reg Register (aligned to 4 bytes).
+ * \param value Value to write.
+ */
+static void pci_conf_write(uchar8_t bus, uchar8_t dev, uchar8_t func, uchar8_t reg, uint32_t value)
+{
+	uint32_t flags;
+
+	flags = irq_save();
+	outl(PCI_CONFIG_ENABLE | (bus << 16) | (dev << 11) | (func << 8) | (reg & 0xFC),
+			PCI_CONFIG_ADDRESS);
+	outl(value, PCI_CONFIG_DATA);
+	irq_restore(flags);
+}
+
+
+/**
+ * Read a double word from configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register (aligned to 4 bytes).
+ */
+uint32_t pci_read_config_dword(pci_device_t *pdev, uchar8_t reg)
+{
+	return pci_conf_read(pdev->bus, pdev->dev, pdev->func, reg);
+}
+
+
+/**
+ * Read a word from configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register (aligned to 2 bytes).
+ */
+uint16_t pci_read_config_word(pci_device_t *pdev, uchar8_t reg)
+{
+	return (pci_read_config_dword(pdev, reg) >> ((reg & 0x02) * 8)) & 0xFFFF;
+}
+
+
+/**
+ * Read a byte from configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register.
+ */
+uchar8_t pci_read_config_byte(pci_device_t *pdev, uchar8_t reg)
+{
+	return (pci_read_config_dword(pdev, reg) >> ((reg & 0x03) * 8)) & 0xFF;
+}
+
+
+/**
+ * Write a double word to configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register (aligned to 4 bytes).
+ * \param value Value to write.
+ */
+void pci_write_config_dword(pci_device_t *pdev, uchar8_t reg, uint32_t value)
+{
+	pci_conf_write(pdev->bus, pdev->dev, pdev->func, reg, value);
+}
+
+
+/**
+ * Write a word to configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register (aligned to 2 bytes).
+ * \param value Value to write.
+ */
+void pci_write_config_word(pci_device_t *pdev, uchar8_t reg, uint16_t value)
+{
+	uint32_t dword, shift;
+
+	shift = (reg & 0x02) * 8;
+	dword = pci_read_config_dword(pdev, reg);
+	dword = (dword & ~(0xFFFF << shift)) | ((uint32_t)value << shift);
+	pci_write_config_dword(pdev, reg, dword);
+}
+
+
+/**
+ * Write a byte to configuration space of a device.
+ *
+ * \param pdev PCI device.
+ * \param reg Register.
+ * \param value Value to write.
+ */
+void pci_write_config_byte(pci_device_t *pdev, uchar8_t reg, uchar8_t value)
+{
+	uint32_t dword, shift;
+
+	shift = (reg & 0x03) * 8;
+	dword = pci_read_config_dword(pdev, reg);
+	dword = (dword & ~(0xFF << shift)) | ((uint32_t)value << shift);
+	pci_write_config_dword(pdev, reg, dword);
+}
+
+
+/**
+ * Add a PCI function to the list of devices.
+ *
+ * \param bus Bus number.
+ * \param dev Device number.
+ * \param func Function number.
+ */
+static void pci_scan_function(uchar8_t bus, uchar8_t dev, uchar8_t func)
+{
+	pci_device_t *pdev;
+	uint32_t id, class;
+
+	if (pci_ndevices >= PCI_MAX_DEVICES) {
+		kprintf(KERN_WARNING " pci: Too many devices, %x:%x.%x ignored.\n", bus, dev, func);
+		return;
+	}
+	pdev = &pci_devices[pci_ndevices++];
+	memset(pdev, 0, sizeof(pci_device_t));
+
+	id    = pci_conf_read(bus, dev, func, PCI_VENDOR_ID);
+	class = pci_conf_read(bus, dev, func, PCI_REVISION);
+
+	pdev->bus         = bus;
+	pdev->dev         = dev;
+	pdev->func        = func;
+	pdev->vendor_id   = id & 0xFFFF;
+	pdev->device_id   = (id >> 16) & 0xFFFF;
+	pdev->revision    = class & 0xFF;
+	pdev->prog_if     = (class >> 8) & 0xFF;
+	pdev->subclass    = (class >> 16) & 0xFF;
+	pdev->class_code  = (class >> 24) & 0xFF;
+	pdev->header_type = pci_read_config_byte(pdev, PCI_HEADER_TYPE) & PCI_HEADER_MASK;
+	pdev->irq         = pci_read_config_byte(pdev, PCI_INTERRUPT_LINE);
+	pdev->driver      = NULL;
+
+	if (pdev->header_type == PCI_HEADER_NORMAL) {
+		pci_decode_bars(pdev);
+	}
+
+	kprintf(KERN_INFO " pci %x:%x.%x: %x:%x class %x.%x.%x irq %d\n",
+			bus, dev, func, pdev->vendor_id, pdev->device_id,
+			pdev->class_code, pdev->subclass, pdev->prog_if, pdev->irq);
+}
+
+
+/**
+ * Find out type, base address and size of each base address
+ * register of a device.
+ *
+ * \param pdev PCI device (with a normal header).
+ */
+static void pci_decode_bars(pci_device_t *pdev)
+{
+	uint32_t i, reg, orig, size;
+	uint16_t cmd;
+
+	/* Device must not decode addresses while BARs are sized */
+	cmd = pci_read_config_word(pdev, PCI_COMMAND);
+	pci_write_config_word(pdev, PCI_COMMAND, cmd & ~(PCI_CMD_IO | PCI_CMD_MEMORY));
+
+	for (i = 0; i < PCI_NUM_BARS; i++) {
+		reg  = PCI_BAR0 + (i * 4);
+		orig = pci_read_config_dword(pdev, reg);
+		pci_write_config_dword(pdev, reg, 0xFFFFFFFF);
+		size = pci_read_config_dword(pdev, reg);
+		pci_write_config_dword(pdev, reg, orig);
+
+		if (size == 0 || size == 0xFFFFFFFF) {
+			/* Not implemented */
+			continue;
+		}
+
+		if ((orig & PCI_BAR_IO)) {
+			pdev->bars[i].type = PCI_BAR_TYPE_IO;
+			pdev->bars[i].base = orig & PCI_BAR_IO_MASK;
+			size &= (PCI_BAR_IO_MASK & 0xFFFF);
+		} else {
+			pdev->bars[i].type     = PCI_BAR_TYPE_MEM;
+			pdev->bars[i].base     = orig & PCI_BAR_MEM_MASK;
+			pdev->bars[i].prefetch = ((orig & PCI_BAR_PREFETCH) != 0);
+			size &= PCI_BAR_MEM_MASK;
+		}
+
+		/* Size is given by the lowest writable bit */
+		pdev->bars[i].size = size & (~size + 1);
+
+		if (pdev->bars[i].type == PCI_BAR_TYPE_MEM &&
+				(orig & PCI_BAR_MEM_TYPE) == PCI_BAR_MEM_64) {
+			/* Upper half is at the next register. Only memory
+			   below 4GB can be used */
+			i++;
+			if (i < PCI_NUM_BARS && pci_read_config_dword(pdev, PCI_BAR0 + (i * 4)) != 0) {
+				pdev->bars[i - 1].type = PCI_BAR_NONE;
+			}
+		}
+	}
+
+	pci_write_config_word(pdev, PCI_COMMAND, cmd);
+}
+
+
+/**
+ * Find a device by its vendor and device IDs.
+ *
+ * \param vendor_id Vendor ID (or PCI_ANY_ID).
+ * \param device_id Device ID (or PCI_ANY_ID).
+ * \param from Start the search after this device (NULL to start at the first one).
+ * \return pci_device_t The device, NULL if not found.
+ */
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *from)
+{
+	uint32_t i;
+
+	i = (from == NULL ? 0 : (from - pci_devices) + 1);
+	for (; i < pci_ndevices; i++) {
+		if ((vendor_id == PCI_ANY_ID || pci_devices[i].vendor_id == vendor_id) &&
+				(device_id == PCI_ANY_ID || pci_devices[i].device_id == device_id)) {
+			return &pci_devices[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Find a device by its class.
+ *
+ * \param class_code Class code.
+ * \param subclass Sub class.
+ * \param from Start the search after this device (NULL to start at the first one).
+ * \return pci_device_t The device, NULL if not found.
+ */
+pci_device_t *pci_find_class(uchar8_t class_code, uchar8_t subclass, pci_device_t *from)
+{
+	uint32_t i;
+
+	i = (from == NULL ? 0 : (from - pci_devices) + 1);
+	for (; i < pci_ndevices; i++) {
+		if (pci_devices[i].class_code == class_code &&
+				pci_devices[i].subclass == subclass) {
+			return &pci_devices[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Enable address decoding (and/or bus mastering) of a device.
+ *
+ * \param pdev PCI device.
+ * \param flags PCI_CMD_IO, PCI_CMD_MEMORY and/or PCI_CMD_MASTER.
+ */
+void pci_enable_device(pci_device_t *pdev, uint16_t flags)
+{
+	uint16_t cmd;
+
+	cmd = pci_read_config_word(pdev, PCI_COMMAND);
+	if ((cmd & flags) != flags) {
+		pci_write_config_word(pdev, PCI_COMMAND, cmd | flags);
+	}
+}
+
+
+/**
+ * Check if a device matches a table of IDs.
+ *
+ * \param ids Table of IDs.
+ * \param pdev PCI device.
+ * \return pci_device_id_t The entry that matches, NULL if none.
+ */
+static const pci_device_id_t *pci_match_id(const pci_device_id_t *ids, pci_device_t *pdev)
+{
+	for (; ids->vendor_id != 0 || ids->device_id != 0 ||
+			ids->class_code != 0 || ids->subclass != 0; ids++) {
+		if ((ids->vendor_id == PCI_ANY_ID || ids->vendor_id == pdev->vendor_id) &&
+				(ids->device_id == PCI_ANY_ID || ids->device_id == pdev->device_id) &&
+				(ids->class_code == PCI_ANY_ID || ids->class_code == pdev->class_code) &&
+				(ids->subclass == PCI_ANY_ID || ids->subclass == pdev->subclass)) {
+			return ids;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Offer a device to a driver.
+ *
+ * \param driver The driver.
+ * \param pdev PCI device (without driver).
+ */
+static void pci_probe_driver(pci_driver_t *driver, pci_device_t *pdev)
+{
+	const pci_device_id_t *id;
+
+	if ((id = pci_match_id(driver->id_table, pdev)) == NULL) {
+		return;
+	}
+
+	if (driver->probe(pdev, id) == 0) {
+		pdev->driver = driver;
+		kprintf(KERN_INFO " pci %x:%x.%x: owned by %s\n",
+				pdev->bus, pdev->dev, pdev->func, driver->name);
+	}
+}
+
+
+/**
+ * Register a PCI driver. The driver is probed for each device
+ * (without driver) that matches its ID table.
+ *
+ * \param driver The driver.
+ * \return Number of devices taken by the driver.
+ */
+int pci_register_driver(pci_driver_t *driver)
+{
+	uint32_t i;
+	int count = 0;
+
+	if (driver == NULL || driver->id_table == NULL || driver->probe == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < pci_ndevices; i++) {
+		if (pci_devices[i].driver == NULL) {
+			pci_probe_driver(driver, &pci_devices[i]);
+			if (pci_devices[i].driver == driver) {
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
@@ -5,5 +5,5 @@
 # TBS - Build configuration file
 #
 
-obj-y += binfmt_elf32.o bhash.o vfs.o namei.o mount.o devices.o partition.o
+obj-y += binfmt_elf32.o bhash.o pagecache.o vfs.o namei.o mount.o devices.o partition.o elevator.o bio.o blkpoll.o blktrace.o iobench.o dcache.o dirindex.o
 
@@ -25,288 +25,474 @@
 #include <fs/bhash.h>
 #include <fs/device.h>
 #include <tempos/wait.h>
+#include <tempos/timer.h>
 #include <arch/io.h>
 
+/** Hash function: position of a block into hash table */
+#define BCACHE_HASH(major, device, blocknum) \
+	(((uint32_t)(blocknum) ^ ((uint32_t)(device) << 5) ^ ((uint32_t)(major) << 10)) & (BCACHE_HASH_SIZE - 1))
+
+/** Pages used by each chunk of buffers (headers and data slab) */
+#define BCACHE_CHUNK_PAGES	((PAGE_ALIGN(sizeof(bcache_chunk_t) + sizeof(mregion)) >> PAGE_SHIFT) + \
+								BCACHE_CHUNK_DATA_PAGES)
+
+/** The buffer cache (shared by all block devices) */
+static bcache_t bcache;
+
+/** Statistics of invalid device numbers (they are just thrown away) */
+static bcache_stats_t bstats_nodev;
+
+/** Buffers of invalid device numbers (never used, see bcache_nbufs_of) */
+static uint32_t bcache_nbufs_nodev;
+
 /* Prototypes */
-static buff_header_t *search_blk(buff_hashq_t *queue, int device, uint64_t blocknum);
-static void blk_remove_from_freelist(buff_hashq_t *queue, int device, uint64_t blocknum);
-static buff_header_t *get_free_blk(buff_hashq_t *queue, int device, uint64_t blocknum);
-static void add_to_buff_queue(buff_hashq_t *queue, buff_header_t *buff, int device, uint64_t blocknum);
-static buff_header_t *getblk(int major, int device, uint64_t blocknum);
+static int bcache_grow(void);
+static int bcache_chunk_is_free(bcache_chunk_t *chunk);
+static buff_header_t *search_blk(int major, int device, uint64_t blocknum);
+static void blk_add_to_freelist(buff_header_t *buff, char at_tail);
+static void blk_remove_from_freelist(buff_header_t *buff);
+static void blk_remove_from_hash(buff_header_t *buff);
+static uint32_t *bcache_nbufs_of(int major, int device);
+static buff_header_t *get_free_blk(int major, int device);
+static void add_to_buff_queue(buff_header_t *buff, int major, int device, uint64_t blocknum);
+static int bwrite_cluster(buff_header_t *buff);
+static bcache_stats_t *bstats_of(int major, int device);
+static void bstats_add_latency(uint32_t *histogram, uint32_t usecs);
 
 
 /**
- * Creates a buffer queue (cache of blocks) to a specific disk.
- * \param size The size (in sectors) of the device.
- * \return int -1 on error. Otherwise the number of the queue. 
- * \note The returned number should be used as argument to cache 
- *  block functions (getblk, etc).
+ * Initialize the buffer cache. The cache starts with
+ * BCACHE_MIN_BUFFERS buffers and grows on demand.
  */
-buff_hashq_t *create_hash_queue(uint64_t size)
+void init_bcache(void)
 {
-	uint64_t i, ht_entries;
-	buff_hashq_t *hash_queue;
-	buff_header_t *head, *prev, *nblock;
+	uint32_t i;
 
-	/* Alloc memory for blocks and structures */
-	hash_queue = (buff_hashq_t*)kmalloc(sizeof(buff_hashq_t), GFP_NORMAL_Z);
-	if (hash_queue == NULL) {
-		return NULL;
+	memset(&bcache, 0, sizeof(bcache_t));
+
+	/* Free list head */
+	bcache.freelist_head.status    = BUFF_ST_HEAD;
+	bcache.freelist_head.free_prev = &bcache.freelist_head;
+	bcache.freelist_head.free_next = &bcache.freelist_head;
+
+	for (i = 0; i < BCACHE_HASH_SIZE; i++) {
+		bcache.hashtable[i] = NULL;
 	}
- 
-	/* Alloc memory for hashtable */
-	ht_entries = 4; /*(size / 4);*/
-	hash_queue->hashtable = (buff_header_t**)kmalloc(ht_entries * sizeof(buff_header_t*), GFP_NORMAL_Z);
 
-	if (hash_queue->hashtable == NULL) {
-		kfree(hash_queue);
-		return NULL;
+	/* Memory that cache will leave to the rest of the system */
+	bcache.reserve = get_free_pages() >> BCACHE_RESERVE_SHIFT;
+
+	for (i = 0; i < BCACHE_MIN_BUFFERS; i += BCACHE_CHUNK_BUFFERS) {
+		if (bcache_grow() < 0) {
+			panic("Could not allocate memory to block buffer cache.");
+		}
 	}
 
-	/* Initialize all blocks (put them into freelist)*/
-	memset(hash_queue, 0, sizeof(buff_hashq_t));
+	if (register_shrinker(bcache_shrink) < 0) {
+		kprintf(KERN_WARNING "Buffer cache: could not register shrinker.\n");
+	}
 
-	for (i = 0; i < ht_entries; i++) {
-		hash_queue->hashtable[i] = NULL;
+	kprintf(KERN_INFO "Buffer cache: %d buffers, %d pages reserved.\n",
+			bcache.nbuffers, bcache.reserve);
+}
+
+
+/**
+ * Alloc a new chunk of buffers and put them at the beginning
+ * of free list.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+static int bcache_grow(void)
+{
+	bcache_chunk_t *chunk;
+	int i;
+
+	bcache.resizing = 1;
+	chunk = (bcache_chunk_t*)kmalloc(sizeof(bcache_chunk_t), GFP_NORMAL_Z);
+	if (chunk != NULL) {
+		memset(chunk, 0, sizeof(bcache_chunk_t));
+		chunk->data = (char*)kmalloc_pages(BCACHE_CHUNK_DATA_PAGES, GFP_NORMAL_Z);
+		if (chunk->data == NULL) {
+			kfree(chunk);
+			chunk = NULL;
+		}
 	}
+	bcache.resizing = 0;
 
-	/* Free list head */
-	head = &hash_queue->blocks[0];
-	head->free_prev = head;
-	head->free_next = head;
-	head->status = BUFF_ST_HEAD;
-
-	/* Add each block to the "tail" of Free list */
-	hash_queue->freelist_head = head;
-	prev = hash_queue->freelist_head;
-	for (i = 1; i < BUFF_QUEUE_SIZE; i++) {
-		nblock = &hash_queue->blocks[i];
-		nblock->free_prev = prev;
-		nblock->free_next = head;
-		head->free_prev = nblock;
-		prev->free_next = nblock;
-		prev = nblock;
-	}
-
-	return hash_queue;
+	if (chunk == NULL) {
+		return -1;
+	}
+
+	cli();
+	for (i = 0; i < BCACHE_CHUNK_BUFFERS; i++) {
+		chunk->blocks[i].data = &chunk->data[i * BUFF_SIZE];
+		blk_add_to_freelist(&chunk->blocks[i], 0);
+	}
+	chunk->next      = bcache.chunks;
+	bcache.chunks    = chunk;
+	bcache.nbuffers += BCACHE_CHUNK_BUFFERS;
+	sti();
+
+	wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
+	return 0;
 }
 
 
 /**
- * Search for a block on hash queue.
+ * Check if all buffers of a chunk are free (and don't need
+ * to be written to device).
  *
- * \param queue The hash queue.
- * \param blocknum Block number.
- * \param device Device number.
- * \return buff_header_t The block (if was found), NULL otherwise.
+ * \param chunk The chunk.
+ * \return 1 if chunk can be released, 0 otherwise.
+ * \note Should be called with interrupts disabled.
  */
-static buff_header_t *search_blk(buff_hashq_t *queue, int device, uint64_t blocknum)
+static int bcache_chunk_is_free(bcache_chunk_t *chunk)
 {
-	struct _buffer_header_t *head, *tmp;
-	uint64_t pos;
+	int i;
 
-	/* Find position based on block number.
-	   The hash algorithm is: (BLOCKNUM % 4) */
-	pos = blocknum % 4;
-	head = queue->hashtable[pos];
+	for (i = 0; i < BCACHE_CHUNK_BUFFERS; i++) {
+		if (chunk->blocks[i].free_next == NULL ||
+				chunk->blocks[i].status == BUFF_ST_FLUSH ||
+				chunk->blocks[i].status == BUFF_ST_BUSY) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
-	if (head == NULL) {
-		return NULL;
+
+/**
+ * Release chunks of free buffers to give memory back to the system.
+ * The cache is never shrunk below BCACHE_MIN_BUFFERS buffers.
+ *
+ * \param npages Number of pages needed.
+ * \return Number of pages released.
+ * \note Called by kmalloc, maybe with interrupts disabled.
+ */
+uint32_t bcache_shrink(uint32_t npages)
+{
+	bcache_chunk_t *chunk, *prev, *next;
+	buff_header_t *buff;
+	uint32_t freed = 0;
+	uint32_t iflags;
+	int i;
+
+	if (bcache.resizing || bcache.chunks == NULL) {
+		return 0;
 	}
-	
-	/* Search for the block */
-	tmp = head;
-	while (tmp != NULL) {
-		if (tmp->addr == blocknum && tmp->device == device) {
-			break;
+	bcache.resizing = 1;
+
+	prev  = NULL;
+	chunk = bcache.chunks;
+	while (chunk != NULL && freed < npages &&
+			bcache.nbuffers >= (BCACHE_MIN_BUFFERS + BCACHE_CHUNK_BUFFERS)) {
+		next = chunk->next;
+
+		iflags = irq_save();
+		if (!bcache_chunk_is_free(chunk)) {
+			irq_restore(iflags);
+			prev  = chunk;
+			chunk = next;
+			continue;
 		}
-		tmp = tmp->next;
+
+		/* Take all buffers out of the cache */
+		for (i = 0; i < BCACHE_CHUNK_BUFFERS; i++) {
+			buff = &chunk->blocks[i];
+			blk_remove_from_freelist(buff);
+			blk_remove_from_hash(buff);
+		}
+
+		if (prev == NULL) {
+			bcache.chunks = next;
+		} else {
+			prev->next = next;
+		}
+		bcache.nbuffers -= BCACHE_CHUNK_BUFFERS;
+		irq_restore(iflags);
+
+		kfree_pages(chunk->data, BCACHE_CHUNK_DATA_PAGES);
+		kfree(chunk);
+		freed += BCACHE_CHUNK_PAGES;
+		chunk  = next;
 	}
 
-	return tmp;
+	bcache.resizing = 0;
+	return freed;
 }
 
+
 /**
- * Remove a block from free list
+ * Search for a block on hash table.
  *
- * \param queue The hash queue.
- * \param blocknum Block number.
+ * \param major Major number of the device.
  * \param device Device number.
+ * \param blocknum Block number.
  * \return buff_header_t The block (if was found), NULL otherwise.
  */
-static void blk_remove_from_freelist(buff_hashq_t *queue, int device, uint64_t blocknum)
+static buff_header_t *search_blk(int major, int device, uint64_t blocknum)
 {
-	struct _buffer_header_t *head, *tmp, *prev, *next;
+	struct _buffer_header_t *tmp;
 
-	/* Search for the block */
-	head = queue->freelist_head; 
-	tmp = head->free_next;
-	while (tmp != head) {
-		if (tmp->addr == blocknum && tmp->device == device) {
+	tmp = bcache.hashtable[BCACHE_HASH(major, device, blocknum)];
+	while (tmp != NULL) {
+		if (tmp->addr == blocknum && tmp->device == device && tmp->major == major) {
 			break;
 		}
-		tmp = tmp->free_next;
+		tmp = tmp->next;
+	}
+
+	return tmp;
+}
+
+
+/**
+ * Insert a buffer into free list.
+ *
+ * \param buff The buffer.
+ * \param at_tail If not zero, buffer is put at the end of free list,
+ * otherwise at the beginning.
+ * \note Should be called with interrupts disabled.
+ */
+static void blk_add_to_freelist(buff_header_t *buff, char at_tail)
+{
+	struct _buffer_header_t *head, *tmp;
+
+	if (buff->free_next != NULL) {
+		/* Already on free list */
+		return;
+	}
+
+	head = &bcache.freelist_head;
+	if (at_tail) {
+		tmp = head->free_prev;
+		buff->free_prev = tmp;
+		buff->free_next = head;
+		head->free_prev = buff;
+		tmp->free_next  = buff;
+	} else {
+		tmp = head->free_next;
+		buff->free_next = tmp;
+		buff->free_prev = head;
+		head->free_next = buff;
+		tmp->free_prev  = buff;
 	}
-	if (tmp == head) {
+}
+
+
+/**
+ * Remove a buffer from free list.
+ *
+ * \param buff The buffer.
+ * \note Should be called with interrupts disabled.
+ */
+static void blk_remove_from_freelist(buff_header_t *buff)
+{
+	struct _buffer_header_t *prev, *next;
+
+	if (buff->free_next == NULL) {
 		/* Block is not on free list */
 		return;
 	}
-	
-	/* Remove the block */
-	cli();
-	prev = tmp->free_prev;
-	next = tmp->free_next;
 
-	next->prev = prev;
-	prev->next = next;
-	sti();
-	return;
+	prev = buff->free_prev;
+	next = buff->free_next;
+	prev->free_next = next;
+	next->free_prev = prev;
+
+	buff->free_next = NULL;
+	buff->free_prev = NULL;
 }
 
 
 /**
- * Search and get a free block from free list.
+ * Remove a buffer from hash table, the block it holds goes away.
  *
- * \param queue The hash queue.
- * \param device Device number.
- * \param blocknum Try to find (and retrieve) a particular block (blocknum) on the list.
+ * \param buff The buffer.
+ * \note Should be called with interrupts disabled.
  */
-static buff_header_t *get_free_blk(buff_hashq_t *queue, int device, uint64_t blocknum)
+static void blk_remove_from_hash(buff_header_t *buff)
 {
-	struct _buffer_header_t *head, *tmp, *prev, *next;
+	uint32_t *nbufs;
 
-	/* Search for the block */
-	head = queue->freelist_head; 
-	tmp = head->free_next;
+	if (!(buff->flags & BUFF_FL_HASHED)) {
+		return;
+	}
+
+	if (buff->prev == NULL) {
+		bcache.hashtable[BCACHE_HASH(buff->major, buff->device, buff->addr)] = buff->next;
+	} else {
+		buff->prev->next = buff->next;
+	}
+	if (buff->next != NULL) {
+		buff->next->prev = buff->prev;
+	}
+	buff->prev   = NULL;
+	buff->next   = NULL;
+	buff->flags &= ~BUFF_FL_HASHED;
+
+	nbufs = bcache_nbufs_of(buff->major, buff->device);
+	if (*nbufs > 0) {
+		if (--(*nbufs) == 0) {
+			bcache.ndevices--;
+		}
+	}
+}
+
+
+/**
+ * Number of buffers holding blocks of a device.
+ *
+ * \param major Major number of the device.
+ * \param device Minor number (device number).
+ * \return uint32_t Counter of buffers of the device (invalid devices
+ * share a dummy counter).
+ * \note Should be called with interrupts disabled.
+ */
+static uint32_t *bcache_nbufs_of(int major, int device)
+{
+	dev_blk_driver_t *driver;
+
+	if (major < 0 || major >= MAX_DEVBLOCK_DRIVERS ||
+			device < 0 || device >= MAX_MINOR_DEVICES) {
+		return &bcache_nbufs_nodev;
+	}
+
+	driver = block_dev_drivers[major];
+	if (driver == NULL || driver->bcache_nbufs == NULL) {
+		return &bcache_nbufs_nodev;
+	}
+
+	return &driver->bcache_nbufs[device];
+}
+
+
+/**
+ * Choose a buffer from free list to hold a new block (the buffer is
+ * not removed from the list). Least recently used buffers are
+ * preferred, but a device that holds more than its fair share of
+ * the cache loses its buffers first, so one busy device can't flush
+ * all blocks cached by the others.
+ *
+ * \param major Major number of the device which needs the buffer.
+ * \param device Minor number of the device which needs the buffer.
+ * \return buff_header_t The buffer, NULL if there is no free buffer.
+ * \note Should be called with interrupts disabled.
+ */
+static buff_header_t *get_free_blk(int major, int device)
+{
+	struct _buffer_header_t *head, *tmp;
+	uint32_t *nbufs, *owner;
+	uint32_t share, ndevs;
+	int i;
 
-	if (tmp == head) {
+	head = &bcache.freelist_head;
+	if (head->free_next == head) {
 		/* there are no free buffers on the list */
 		return NULL;
 	}
 
-	/* try to find the block on the free list */
-	while (tmp != head) {
-		if (tmp->addr == blocknum && tmp->device == device) {
-			break;
+	nbufs = bcache_nbufs_of(major, device);
+	ndevs = bcache.ndevices + (*nbufs == 0 ? 1 : 0);
+	share = bcache.nbuffers / ndevs;
+
+	tmp = head->free_next;
+	for (i = 0; i < BCACHE_VICTIM_SCAN && tmp != head; i++, tmp = tmp->free_next) {
+		if (tmp->status == BUFF_ST_BUSY) {
+			/* Being written to device */
+			continue;
+		}
+
+		if (!(tmp->flags & BUFF_FL_HASHED)) {
+			/* Empty buffer */
+			return tmp;
+		}
+
+		owner = bcache_nbufs_of(tmp->major, tmp->device);
+		if (owner == &bcache_nbufs_nodev || owner == nbufs || *owner > share) {
+			return tmp;
 		}
-		tmp = tmp->free_next;
-	}
-	if (tmp == head) {
-		/* Block is not on free list, pick up any block */
-		tmp = head->free_next;
 	}
-	
-	/* remove block from free list */
-	cli();
-	prev = tmp->free_prev;
-	next = tmp->free_next;
-	prev->free_next = next;
-	next->free_prev = prev;
-	sti();
 
-	return tmp;
+	/* Nobody exceeds its share, pick up the least recently used */
+	for (tmp = head->free_next; tmp != head; tmp = tmp->free_next) {
+		if (tmp->status != BUFF_ST_BUSY) {
+			return tmp;
+		}
+	}
+	return NULL;
 }
 
 
 /**
  * Remove buffer from old hash queue and insert onto new hash queue
  *
- * \param queue The new hash queue.
  * \param buff The Buffer.
+ * \param major Major number of the device.
  * \param device Device number.
  * \param blocknum New block number.
+ * \note Should be called with interrupts disabled.
  */
-static void add_to_buff_queue(buff_hashq_t *queue, buff_header_t *buff, int device, uint64_t blocknum)
+static void add_to_buff_queue(buff_header_t *buff, int major, int device, uint64_t blocknum)
 {
-	struct _buffer_header_t *head, *tmp, *prev, *next;
-	uint64_t pos;
-
-	pos = buff->addr % 4;
-	head = queue->hashtable[pos];
-	if (head != NULL) {
-		if (search_blk(queue, device, buff->addr) != NULL) {
-			/* Remove from old hash queue */
-			tmp = head;
-			if (tmp->next == NULL) {
-				queue->hashtable[pos] = NULL;
-			} else {
-				while(tmp->next != NULL) {
-					if (tmp->addr == buff->addr && tmp->device == device) {
-						cli();
-						prev = tmp->prev;
-						if (tmp->next == NULL) {
-							next = NULL;
-						} else {
-							next = tmp->next;
-							next->prev = prev;
-						}
-						prev->next = next;
-						sti();
-					}
-					tmp = tmp->next;
-				}
-			}
-		}
-	}
-	
+	uint32_t pos, *nbufs;
+
+	/* Remove from old hash queue */
+	blk_remove_from_hash(buff);
+
 	/* Add to new hash queue */
-	pos  = blocknum % 4;
-	head = queue->hashtable[pos];
 	buff->addr   = blocknum;
 	buff->device = device;
+	buff->major  = major;
 
-	if (head == NULL) {
-		buff->next = NULL;
-		buff->prev = buff;
-		queue->hashtable[pos] = buff; 
-		return;
-	} else if (head->next == NULL) {
-		cli(); 
-		head->next = buff;
-		head->prev = NULL;
-		buff->next = NULL;
-		buff->prev = head;
-		sti();
-		return;
+	pos = BCACHE_HASH(major, device, blocknum);
+	buff->prev = NULL;
+	buff->next = bcache.hashtable[pos];
+	if (buff->next != NULL) {
+		buff->next->prev = buff;
 	}
+	bcache.hashtable[pos] = buff;
+	buff->flags |= BUFF_FL_HASHED;
 
-	tmp = head;
-	while(tmp->next != NULL)
-		tmp = tmp->next;
-
-	cli();
-	buff->prev = tmp;
-	buff->next = NULL;
-	tmp->next  = buff;
-	sti();
+	nbufs = bcache_nbufs_of(major, device);
+	if ((*nbufs)++ == 0) {
+		bcache.ndevices++;
+	}
 }
 
 
 /**
- * Each disk has a buffer queue of blocks. This function will search for a
- * specific block in the disk's buffer queue.
+ * All block devices share the same buffer cache. This function will
+ * search for a specific block of a device in the cache. The buffer
+ * is returned locked, and its data is not read from device (callers
+ * that overwrite the whole block don't need bread).
  *
  * \param major Major number of the device
  * \param device Minor number (device number)
  * \param blocknum Block number (address)
  * \return buff_header_t* Pointer to the block
  */
-static buff_header_t *getblk(int major, int device, uint64_t blocknum)
+buff_header_t *getblk(int major, int device, uint64_t blocknum)
 {
 	buff_header_t *buff;
 	dev_blk_driver_t *driver;
+	bcache_stats_t *bstats, *owner;
+	uint32_t fpages;
 
 	driver = block_dev_drivers[major]; 
 
 	if (driver == NULL) {
 		return NULL;
 	}
+	bstats = bstats_of(major, device);
 
 	while(1) {
 	
-		if ( (buff = search_blk(driver->buffer_queue, device, blocknum)) != NULL ) {
+		if ( (buff = search_blk(major, device, blocknum)) != NULL ) {
 			/* Block is in hash queue */
 			if (buff->status == BUFF_ST_BUSY) {
+				bstats->sleeps_busy++;
 				sleep_on(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
 				continue;
 			}
@@ -314,31 +500,70 @@ static buff_header_t *getblk(int major, int device, uint64_t blocknum)
 			/* Remove buffer from free list and set as busy */
 			cli();
 			buff->status = BUFF_ST_BUSY;
+			blk_remove_from_freelist(buff);
 			sti();
-			blk_remove_from_freelist(driver->buffer_queue, device, blocknum);
 			return buff;
 		} else {
 			/* Block is not on hash queue */
-			
+
+			/* Give memory back if system is running out of it */
+			fpages = get_free_pages();
+			if (fpages < (bcache.reserve >> 1)) {
+				bcache_shrink(bcache.reserve - fpages);
+			}
+
+			cli();
+			buff = get_free_blk(major, device);
+			sti();
+
+			/* Don't throw cached blocks away while there is free memory */
+			if ((buff == NULL || (buff->flags & BUFF_FL_HASHED)) &&
+					get_free_pages() > (bcache.reserve + BCACHE_CHUNK_PAGES)) {
+				if (bcache_grow() == 0) {
+					continue;
+				}
+			}
+
 			/* There are no free buffers on free list */
-			if ( (buff = get_free_blk(driver->buffer_queue, device, blocknum)) == NULL ) {
+			if (buff == NULL) {
+				bstats->sleeps_free++;
 				sleep_on(WAIT_BLOCK_BUFFER_GET_FREE);
 				continue;
-			} else {
+			}
 
-				/* Buffer should be flushed to disk */
-				if (buff->status == BUFF_ST_FLUSH) {
-					/* asynchronous write buffer to disk */
-					driver->dev_ops->write_async_block(major, device, buff);
-					continue;
-				}
+			cli();
+			if (buff->free_next == NULL || search_blk(major, device, blocknum) != NULL) {
+				/* Someone took the buffer (or the block) meanwhile */
+				sti();
+				continue;
+			}
+			owner = bstats_of(buff->major, buff->device);
+
+			/* Buffer should be flushed to disk */
+			if (buff->status == BUFF_ST_FLUSH) {
+				sti();
+				/* asynchronous write buffer (and its neighbours) to disk */
+				owner->flush_evictions++;
+				bwrite_cluster(buff);
+				continue;
+			}
 
-				/* Remove buffer from old hash queue and put block
-				   onto new hash queue */
-				add_to_buff_queue(driver->buffer_queue, buff, device, blocknum);
+			blk_remove_from_freelist(buff);
+			sti();
 
-				return buff;
+			/* Buffer holds another block, which is going away */
+			if ((buff->flags & BUFF_FL_HASHED)) {
+				owner->evictions++;
 			}
+			buff->flags &= ~BUFF_FL_READAHEAD;
+
+			/* Remove buffer from old hash queue and put block
+			   onto new hash queue */
+			cli();
+			add_to_buff_queue(buff, major, device, blocknum);
+			sti();
+
+			return buff;
 		}
 	}
 }
@@ -354,7 +579,6 @@ static buff_header_t *getblk(int major, int device, uint64_t blocknum)
 void brelse(int major, int device, buff_header_t *buff)
 {
 	dev_blk_driver_t *driver;
-	buff_header_t *head, *tmp;
 
 	driver = block_dev_drivers[major];
 
@@ -367,28 +591,20 @@ void brelse(int major, int device, buff_header_t *buff)
 	}
 
 	cli();
-
-	head = driver->buffer_queue->freelist_head;
-	
-	if (buff->status == BUFF_ST_VALID) {
-		/* enqueue buffer at end of free list */
-		tmp = head->free_prev;
-		buff->free_prev = tmp;
-		buff->free_next = head;
-		head->free_prev = buff;
-		tmp->free_next  = buff;
+	/* Block could not be read (I/O error): forget it, so it will be
+	   read again instead of being found (as valid) in the cache */
+	if (buff->status == BUFF_ST_UNLOCKED && !(buff->flags & BUFF_FL_DIRTY)) {
+		blk_remove_from_hash(buff);
+	}
+	/* valid blocks go to the end of free list, the others to the beginning */
+	blk_add_to_freelist(buff, (buff->status == BUFF_ST_VALID));
+	if ((buff->flags & BUFF_FL_DIRTY)) {
+		/* Block was changed (delayed write) while it was held */
+		buff->status = BUFF_ST_FLUSH;
 	} else {
-		/* enqueue buffer at beginning of free list */
-		tmp = head->free_next;
-		buff->free_next = tmp;
-		buff->free_prev = head;
-		head->free_next = buff;
-		tmp->free_prev  = buff;
+		buff->status = BUFF_ST_UNLOCKED;
 	}
-
 	sti();
-
-	buff->status = BUFF_ST_UNLOCKED;
 }
 
 
@@ -404,12 +620,15 @@ buff_header_t *bread(int major, int device, uint64_t blocknum)
 {
 	buff_header_t *buff;
 	dev_blk_driver_t *driver;
+	bcache_stats_t *bstats;
+	uint32_t start;
 
 	driver = block_dev_drivers[major];
 
         if (driver == NULL) {
                 return NULL;
         }
+	bstats = bstats_of(major, device);
 
 	if ((buff = getblk(major, device, blocknum)) == NULL) {
 		kprintf(KERN_ERROR "bread(): Error on get cached block.\n");
@@ -420,11 +639,24 @@ buff_header_t *bread(int major, int device, uint64_t blocknum)
 		buff->status = BUFF_ST_VALID;
 	}
 
+	if ((buff->flags & BUFF_FL_READAHEAD)) {
+		/* Block was read ahead and now it's used */
+		bstats->ra_hits++;
+		buff->flags &= ~BUFF_FL_READAHEAD;
+	}
+
 	if (buff->status != BUFF_ST_VALID) {
+		bstats->misses++;
+		bstats->dev_reads++;
+
 		/* Read from device (synchronous) */
+		start = get_usecs();
 		if (driver->dev_ops->read_sync_block(major, device, buff) < 0) {
 			kprintf(KERN_ERROR "Error on reading block from device: MAJOR = %d | MINOR = %d", major, device);
 		}
+		bstats_add_latency(bstats->read_lat, get_usecs() - start);
+	} else {
+		bstats->hits++;
 	}
 
 	return buff;
@@ -446,8 +678,10 @@ buff_header_t *breada(int major, int device, uint64_t blocknum1, uint64_t blockn
 {
 	buff_header_t *buff2;
 	dev_blk_driver_t *driver;
+	bcache_stats_t *bstats;
 
 	driver = block_dev_drivers[major]; 
+	bstats = bstats_of(major, device);
 
 	/**
 	 * First, we read block 1 
@@ -468,6 +702,9 @@ buff_header_t *breada(int major, int device, uint64_t blocknum1, uint64_t blockn
 	}
 
 	if (buff2->status != BUFF_ST_VALID) {
+		bstats->ra_issued++;
+		buff2->flags |= BUFF_FL_READAHEAD;
+
 		/* Read from device (synchronous) */
 		if (driver->dev_ops->read_async_block(major, device, buff2) < 0) {
 			kprintf(KERN_ERROR "Error on reading block from device: MAJOR = %d | MINOR = %d", major, device);
@@ -479,6 +716,89 @@ buff_header_t *breada(int major, int device, uint64_t blocknum1, uint64_t blockn
 	return NULL;
 }
 
+/**
+ * Read consecutive blocks from device (handling the cache). Blocks that
+ * are not cached are read with as few requests as possible.
+ *
+ * \param major Major number of the device
+ * \param device Minor number (device number)
+ * \param blocknum Block number (address) of the first block.
+ * \param count Number of blocks (up to BCACHE_CLUSTER_MAX).
+ * \param buffs Returns the (locked) buffers of the blocks.
+ * \return 0 on success, -1 otherwise.
+ * \note Each buffer should be released with brelse.
+ */
+int breadn(int major, int device, uint64_t blocknum, int count, buff_header_t **buffs)
+{
+	dev_blk_driver_t *driver;
+	bcache_stats_t *bstats;
+	uint32_t start;
+	int i, j, first;
+
+	driver = block_dev_drivers[major];
+
+	if (driver == NULL || count < 1 || count > BCACHE_CLUSTER_MAX) {
+		return -1;
+	}
+	bstats = bstats_of(major, device);
+
+	for (i = 0; i < count; i++) {
+		if ((buffs[i] = getblk(major, device, blocknum + i)) == NULL) {
+			kprintf(KERN_ERROR "breadn(): Error on get cached block.\n");
+			while (i-- > 0) {
+				brelse(major, device, buffs[i]);
+			}
+			return -1;
+		}
+
+		if (buffs[i]->status == BUFF_ST_BUSY) {
+			buffs[i]->status = BUFF_ST_VALID;
+		}
+
+		if ((buffs[i]->flags & BUFF_FL_READAHEAD)) {
+			/* Block was read ahead and now it's used */
+			bstats->ra_hits++;
+			buffs[i]->flags &= ~BUFF_FL_READAHEAD;
+		}
+	}
+
+	/* Read each run of blocks that are not cached */
+	i = 0;
+	while (i < count) {
+		if (buffs[i]->status == BUFF_ST_VALID) {
+			bstats->hits++;
+			i++;
+			continue;
+		}
+
+		first = i;
+		while (i < count && buffs[i]->status != BUFF_ST_VALID) {
+			i++;
+		}
+		bstats->misses += (i - first);
+		bstats->dev_reads++;
+
+		start = get_usecs();
+		if (driver->dev_ops->read_async_blocks != NULL &&
+				driver->dev_ops->read_async_blocks(major, device, &buffs[first], i - first) == 0) {
+			/* All blocks of the request are done at once */
+			while (buffs[i - 1]->status == BUFF_ST_BUSY) {
+				sleep_on(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+			}
+		} else {
+			for (j = first; j < i; j++) {
+				if (driver->dev_ops->read_sync_block(major, device, buffs[j]) < 0) {
+					kprintf(KERN_ERROR "Error on reading block from device: MAJOR = %d | MINOR = %d", major, device);
+				}
+			}
+		}
+		bstats_add_latency(bstats->read_lat, get_usecs() - start);
+	}
+
+	return 0;
+}
+
+
 /**
  * Write block back to device.
  *
@@ -491,8 +811,10 @@ buff_header_t *breada(int major, int device, uint64_t blocknum1, uint64_t blockn
  */
 int bwrite(int major, int device, buff_header_t *buff, char type)
 {
-	buff_header_t *head, *tmp;
 	dev_blk_driver_t *driver = block_dev_drivers[major]; 
+	bcache_stats_t *bstats = bstats_of(major, device);
+	uint32_t start;
+	int ret;
 
 	if (buff == NULL) {
 		return 0;
@@ -503,20 +825,23 @@ int bwrite(int major, int device, buff_header_t *buff, char type)
 			cli();
 			/* mark for delayed write */
 			buff->status = BUFF_ST_FLUSH;
+			buff->flags |= BUFF_FL_DIRTY;
 			/* put at the head of free list */
-			head = driver->buffer_queue->freelist_head;
-			tmp = head->free_next;
-			buff->free_next = tmp;
-			buff->free_prev = head;
-			head->free_next = buff;
-			tmp->free_prev  = buff;
+			blk_add_to_freelist(buff, 0);
 			sti();
+			wakeup(WAIT_BLOCK_BUFFER_GET_FREE);
 			return 1;
 	
 		case BWRITE_SYNC:
-			return driver->dev_ops->write_sync_block(major, device, buff);
+			buff->flags &= ~BUFF_FL_DIRTY;
+			bstats->dev_writes++;
+			start = get_usecs();
+			ret   = driver->dev_ops->write_sync_block(major, device, buff);
+			bstats_add_latency(bstats->write_lat, get_usecs() - start);
+			return ret;
 
 		case BWRITE_ASYNC:
+			buff->flags &= ~BUFF_FL_DIRTY;
 			return driver->dev_ops->write_async_block(major, device, buff);
 
 		default:
@@ -524,3 +849,342 @@ int bwrite(int major, int device, buff_header_t *buff, char type)
 	}
 }
 
+
+/**
+ * Write a delayed write buffer to device together with the delayed
+ * write buffers holding the blocks around it, so a run of consecutive
+ * dirty blocks goes to the device with only one request.
+ *
+ * \param buff The buffer (marked for delayed write).
+ * \return Number of buffers written, -1 on error.
+ */
+static int bwrite_cluster(buff_header_t *buff)
+{
+	buff_header_t *cluster[BCACHE_CLUSTER_MAX], *tmp;
+	dev_blk_driver_t *driver;
+	bcache_stats_t *bstats;
+	uint64_t first;
+	int major, device, max, i, n, ret;
+
+	major  = buff->major;
+	device = buff->device;
+	driver = block_dev_drivers[major];
+	if (driver == NULL) {
+		return -1;
+	}
+
+	/* Can the driver write several blocks at once? */
+	if (driver->dev_ops->write_async_blocks != NULL) {
+		max = BCACHE_CLUSTER_MAX;
+	} else {
+		max = 1;
+	}
+
+	cli();
+	if (buff->status != BUFF_ST_FLUSH) {
+		/* Someone got it first */
+		sti();
+		return 0;
+	}
+
+	/* Look for dirty blocks before this one */
+	first = buff->addr;
+	while (first > 0 && (buff->addr - first) < (max - 1)) {
+		tmp = search_blk(major, device, first - 1);
+		if (tmp == NULL || tmp->status != BUFF_ST_FLUSH) {
+			break;
+		}
+		first--;
+	}
+
+	/* Gather the run of dirty blocks */
+	for (n = 0; n < max; n++) {
+		tmp = search_blk(major, device, first + n);
+		if (tmp == NULL || tmp->status != BUFF_ST_FLUSH) {
+			break;
+		}
+		tmp->status = BUFF_ST_BUSY;
+		tmp->flags &= ~BUFF_FL_DIRTY;
+		cluster[n] = tmp;
+	}
+	sti();
+
+	bstats = bstats_of(major, device);
+	bstats->wb_writes++;
+	bstats->wb_blocks += n;
+
+	/* Buffers stay on free list while they are written (as busy) */
+	if (n > 1) {
+		ret = driver->dev_ops->write_async_blocks(major, device, cluster, n);
+	} else {
+		ret = driver->dev_ops->write_async_block(major, device, cluster[0]);
+	}
+
+	if (ret < 0) {
+		kprintf(KERN_ERROR "Error on writing blocks to device: MAJOR = %d | MINOR = %d\n", major, device);
+
+		/* Data is still queued for writing, but eviction should
+		   try other buffers before these ones */
+		cli();
+		for (i = 0; i < n; i++) {
+			cluster[i]->status = BUFF_ST_FLUSH;
+			cluster[i]->flags |= BUFF_FL_DIRTY;
+			if (cluster[i]->free_next != NULL) {
+				blk_remove_from_freelist(cluster[i]);
+				blk_add_to_freelist(cluster[i], 1);
+			}
+		}
+		sti();
+		return -1;
+	}
+
+	return n;
+}
+
+
+/**
+ * Write all delayed write buffers of a device. Consecutive blocks are
+ * written together.
+ *
+ * \param major Major number of the device
+ * \param device Minor number (device number)
+ * \return Number of buffers written.
+ */
+int bflush(int major, int device)
+{
+	buff_header_t *head, *tmp;
+	int n, total = 0;
+
+	head = &bcache.freelist_head;
+
+	while (1) {
+		cli();
+		for (tmp = head->free_next; tmp != head; tmp = tmp->free_next) {
+			if (tmp->status == BUFF_ST_FLUSH &&
+					tmp->major == major && tmp->device == device) {
+				break;
+			}
+		}
+		sti();
+
+		if (tmp == head || (n = bwrite_cluster(tmp)) <= 0) {
+			break;
+		}
+		total += n;
+	}
+
+	return total;
+}
+
+
+/**
+ * Write all delayed write buffers of a device and flush its write
+ * cache, so data reaches the media.
+ *
+ * \param major Major number of the device
+ * \param device Minor number (device number)
+ * \return 0 on success, -1 otherwise.
+ */
+int bsync(int major, int device)
+{
+	dev_blk_driver_t *driver;
+
+	driver = block_dev_drivers[major];
+	if (driver == NULL) {
+		return -1;
+	}
+
+	bflush(major, device);
+
+	if (driver->dev_ops->flush != NULL) {
+		return driver->dev_ops->flush(major, device);
+	}
+	return 0;
+}
+
+
+/**
+ * Write all delayed write buffers (of all devices) and flush the
+ * write cache of all block devices.
+ */
+void bsync_all(void)
+{
+	buff_header_t *head, *tmp;
+	int i;
+
+	head = &bcache.freelist_head;
+
+	while (1) {
+		cli();
+		for (tmp = head->free_next; tmp != head; tmp = tmp->free_next) {
+			if (tmp->status == BUFF_ST_FLUSH) {
+				break;
+			}
+		}
+		sti();
+
+		if (tmp == head || bwrite_cluster(tmp) <= 0) {
+			break;
+		}
+	}
+
+	/* Flush caches after the writes (flush is a barrier) */
+	for (i = 0; i < MAX_DEVBLOCK_DRIVERS; i++) {
+		if (block_dev_drivers[i] != NULL &&
+				block_dev_drivers[i]->dev_ops->flush != NULL) {
+			block_dev_drivers[i]->dev_ops->flush(i, -1);
+		}
+	}
+}
+
+
+/**
+ * Statistics of a block device.
+ *
+ * \param major Major number of the device.
+ * \param device Minor number (device number).
+ * \return bcache_stats_t Statistics of the device (statistics of
+ * invalid devices go to a dummy structure).
+ */
+static bcache_stats_t *bstats_of(int major, int device)
+{
+	dev_blk_driver_t *driver;
+
+	if (major < 0 || major >= MAX_DEVBLOCK_DRIVERS ||
+			device < 0 || device >= MAX_MINOR_DEVICES) {
+		return &bstats_nodev;
+	}
+
+	driver = block_dev_drivers[major];
+	if (driver == NULL || driver->bstats == NULL) {
+		return &bstats_nodev;
+	}
+
+	return &driver->bstats[device];
+}
+
+
+/**
+ * Account an operation into a latency histogram.
+ *
+ * \param histogram The histogram (BSTATS_HIST_SLOTS slots).
+ * \param usecs Time spent by the operation (in microseconds).
+ */
+static void bstats_add_latency(uint32_t *histogram, uint32_t usecs)
+{
+	int slot = 0;
+
+	while ((usecs >>= 1) != 0 && slot < (BSTATS_HIST_SLOTS - 1)) {
+		slot++;
+	}
+	histogram[slot]++;
+}
+
+
+/**
+ * Get a copy of buffer cache statistics of a block device.
+ *
+ * \param major Major number of the device.
+ * \param device Minor number (device number).
+ * \param stats Where statistics will be copied.
+ * \return 0 on success, -1 if there is no such device.
+ */
+int bcache_get_stats(int major, int device, bcache_stats_t *stats)
+{
+	bcache_stats_t *bstats;
+
+	bstats = bstats_of(major, device);
+	if (bstats == &bstats_nodev || stats == NULL) {
+		return -1;
+	}
+
+	cli();
+	memcpy(stats, bstats, sizeof(bcache_stats_t));
+	sti();
+
+	return 0;
+}
+
+
+/**
+ * Reset buffer cache statistics of a block device.
+ *
+ * \param major Major number of the device.
+ * \param device Minor number (device number).
+ */
+void bcache_reset_stats(int major, int device)
+{
+	bcache_stats_t *bstats;
+
+	bstats = bstats_of(major, device);
+	if (bstats != &bstats_nodev) {
+		cli();
+		memset(bstats, 0, sizeof(bcache_stats_t));
+		sti();
+	}
+}
+
+
+/**
+ * Print a latency histogram (only non empty slots).
+ */
+static void bstats_print_histogram(const char *name, uint32_t *histogram)
+{
+	int i;
+
+	kprintf(KERN_INFO "  %s latency (us):", name);
+	for (i = 0; i < BSTATS_HIST_SLOTS; i++) {
+		if (histogram[i] != 0) {
+			if (i == (BSTATS_HIST_SLOTS - 1)) {
+				kprintf(KERN_INFO " >=%d:%d", (1 << i), histogram[i]);
+			} else {
+				kprintf(KERN_INFO " %d-%d:%d", (1 << i), (1 << (i + 1)) - 1, histogram[i]);
+			}
+		}
+	}
+	kprintf(KERN_INFO "\n");
+}
+
+
+/**
+ * Show buffer cache statistics of a block device. Devices that were
+ * never used are not shown.
+ *
+ * \param major Major number of the device.
+ * \param device Minor number (device number).
+ */
+void bcache_print_stats(int major, int device)
+{
+	bcache_stats_t st;
+	uint32_t hits, lookups, ratio;
+
+	if (bcache_get_stats(major, device, &st) < 0) {
+		return;
+	}
+
+	lookups = st.hits + st.misses;
+	if (lookups == 0 && st.dev_writes == 0 && st.wb_writes == 0) {
+		return;
+	}
+
+	/* Scale down, so hits * 100 fits in 32 bits */
+	hits = st.hits;
+	while (lookups > (0xFFFFFFFFU / 100)) {
+		hits    >>= 1;
+		lookups >>= 1;
+	}
+	ratio = (lookups == 0 ? 0 : ((hits * 100) / lookups));
+
+	kprintf(KERN_INFO "Buffer cache (device %d:%d): %u hits, %u misses, hit rate %u percent\n",
+			major, device, st.hits, st.misses, ratio);
+	kprintf(KERN_INFO "  %d evictions, %d flushed on evict, %d sleeps (free list), %d sleeps (busy)\n",
+			st.evictions, st.flush_evictions, st.sleeps_free, st.sleeps_busy);
+	kprintf(KERN_INFO "  read ahead: %d issued, %d used\n", st.ra_issued, st.ra_hits);
+	kprintf(KERN_INFO "  device: %d reads, %d writes\n", st.dev_reads, st.dev_writes);
+	kprintf(KERN_INFO "  writeback: %d blocks in %d requests\n", st.wb_blocks, st.wb_writes);
+	kprintf(KERN_INFO "  %d buffers (of %d in the cache)\n",
+			*bcache_nbufs_of(major, device), bcache.nbuffers);
+	bstats_print_histogram("read", st.read_lat);
+	bstats_print_histogram("write", st.write_lat);
+}
+
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: bio.c
+ * Desc: Block I/O with scatter-gather segments.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/wait.h>
+#include <tempos/mm.h>
+#include <fs/device.h>
+#include <fs/bio.h>
+#include <arch/io.h>
+#include <string.h>
+
+
+/**
+ * Initialize a block I/O (without segments).
+ *
+ * \param bio The block I/O.
+ * \param op BLK_READ or BLK_WRITE.
+ * \param major Major number.
+ * \param device Device number (disk or partition).
+ * \param sector First sector.
+ */
+void bio_init(bio_t *bio, char op, int major, int device, uint64_t sector)
+{
+	memset(bio, 0, sizeof(bio_t));
+	bio->op     = op;
+	bio->major  = major;
+	bio->device = device;
+	bio->sector = sector;
+}
+
+
+/**
+ * Add a segment to a block I/O. It's merged with the last segment
+ * when they are contiguous.
+ *
+ * \param bio The block I/O.
+ * \param page Page (virtual address).
+ * \param offset Offset into the page (word aligned).
+ * \param len Size in bytes (multiple of BUFF_SIZE, inside the page).
+ * \return 0 on success, -1 otherwise.
+ */
+int bio_add_page(bio_t *bio, void *page, uint32_t offset, uint32_t len)
+{
+	bio_vec_t *last;
+
+	if (len == 0 || (len % BUFF_SIZE) != 0 || (offset & 0x03) != 0 ||
+			(offset + len) > PAGE_SIZE) {
+		return -1;
+	}
+
+	if (bio->nvecs > 0) {
+		last = &bio->vecs[bio->nvecs - 1];
+		if (last->page == (char *)page && (last->offset + last->len) == offset) {
+			last->len     += len;
+			bio->nsectors += len / BUFF_SIZE;
+			return 0;
+		}
+	}
+
+	if (bio->nvecs == BIO_MAX_VECS) {
+		return -1;
+	}
+
+	last = &bio->vecs[bio->nvecs++];
+	last->page     = (char *)page;
+	last->offset   = offset;
+	last->len      = len;
+	bio->nsectors += len / BUFF_SIZE;
+
+	return 0;
+}
+
+
+/**
+ * Submit a block I/O to the driver of the device. It's split in
+ * requests up to the limits of the driver (maximum sectors and
+ * segments per request).
+ *
+ * \param bio The block I/O.
+ * \return 0 on success, -1 otherwise.
+ * \note end_io is called when all sectors are done (this can happen
+ * before this function returns, if the driver fails some request).
+ */
+int submit_bio(bio_t *bio)
+{
+	dev_blk_driver_t *driver;
+	buff_header_t **bufs;
+	char *data;
+	uint32_t i, j, k, n, nsegs, nsectors, max_sectors, max_segs;
+	int (*op_blocks)(int, int, buff_header_t **, int);
+	int (*op_block)(int, int, buff_header_t *);
+	int major, device, res;
+
+	driver = block_dev_drivers[bio->major];
+	if (driver == NULL || bio->nsectors == 0) {
+		return -1;
+	}
+
+	if (bio->op == BLK_READ) {
+		op_blocks = driver->dev_ops->read_async_blocks;
+		op_block  = driver->dev_ops->read_async_block;
+	} else {
+		op_blocks = driver->dev_ops->write_async_blocks;
+		op_block  = driver->dev_ops->write_async_block;
+	}
+
+	/* One header for each sector, followed by pointers to them */
+	bio->hdrs = (buff_header_t *)kmalloc(bio->nsectors *
+			(sizeof(buff_header_t) + sizeof(buff_header_t *)), GFP_NORMAL_Z);
+	if (bio->hdrs == NULL) {
+		return -1;
+	}
+	bufs = (buff_header_t **)&bio->hdrs[bio->nsectors];
+
+	k = 0;
+	for (i = 0; i < bio->nvecs; i++) {
+		data = bio->vecs[i].page + bio->vecs[i].offset;
+		for (j = 0; j < bio->vecs[i].len; j += BUFF_SIZE, k++) {
+			memset(&bio->hdrs[k], 0, sizeof(buff_header_t));
+			bio->hdrs[k].addr   = bio->sector + k;
+			bio->hdrs[k].device = bio->device;
+			bio->hdrs[k].major  = bio->major;
+			bio->hdrs[k].status = BUFF_ST_UNLOCKED;
+			bio->hdrs[k].data   = &data[j];
+			bio->hdrs[k].bio    = bio;
+			bufs[k] = &bio->hdrs[k];
+		}
+	}
+	bio->error     = 0;
+	bio->remaining = bio->nsectors;
+
+	/* Driver limits */
+	max_sectors = driver->max_sectors;
+	if (op_blocks == NULL || max_sectors == 0) {
+		max_sectors = 1;
+	} else if (max_sectors > BCACHE_CLUSTER_MAX) {
+		max_sectors = BCACHE_CLUSTER_MAX;
+	}
+	max_segs = (driver->max_segments == 0 ? max_sectors : driver->max_segments);
+
+	/* Submit requests. NOTE: bio (and its headers) can be released as
+	   soon as the last request is submitted, so it's not touched after
+	   that (everything needed is copied to local variables) */
+	major    = bio->major;
+	device   = bio->device;
+	nsectors = bio->nsectors;
+	for (k = 0; k < nsectors; k += n) {
+		nsegs = 1;
+		for (n = 1; (k + n) < nsectors && n < max_sectors; n++) {
+			if (bufs[k + n]->data != (bufs[k + n - 1]->data + BUFF_SIZE) &&
+					++nsegs > max_segs) {
+				break;
+			}
+		}
+
+		if (n == 1) {
+			res = op_block(major, device, bufs[k]);
+		} else {
+			res = op_blocks(major, device, &bufs[k], n);
+		}
+
+		if (res < 0) {
+			/* Sectors of a failed request are not done yet, so
+			   bio is still there */
+			kprintf(KERN_ERROR "submit_bio(): request failed: MAJOR = %d | MINOR = %d\n",
+					major, device);
+			cli();
+			for (j = 0; j < n; j++) {
+				bio_sector_done(bio, -1);
+			}
+			sti();
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Wait for a block I/O (without completion callback) to be done.
+ *
+ * \param bio The block I/O (already submitted).
+ * \return 0 on success, -1 if any sector failed.
+ */
+int bio_wait(bio_t *bio)
+{
+	while (bio->remaining > 0) {
+		sleep_on(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+	}
+	return bio->error;
+}
+
+
+/**
+ * Finish a sector of a block I/O (called by drivers, through
+ * blk_end_request).
+ *
+ * \param bio The block I/O.
+ * \param error 0 on success, otherwise the sector failed.
+ * \note Should be called with interrupts disabled.
+ */
+void bio_sector_done(bio_t *bio, int error)
+{
+	if (error) {
+		bio->error = -1;
+	}
+
+	if (--bio->remaining == 0) {
+		kfree(bio->hdrs);
+		bio->hdrs = NULL;
+		if (bio->end_io != NULL) {
+			bio->end_io(bio, bio->error);
+		}
+	}
+}
+
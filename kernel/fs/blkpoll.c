@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: blkpoll.c
+ * Desc: Hybrid (polled or interrupt) completion of block requests.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/wait.h>
+#include <tempos/timer.h>
+#include <fs/bhash.h>
+#include <fs/blkpoll.h>
+#include <string.h>
+
+
+/**
+ * Initialize polling statistics of a device. Polling is enabled
+ * unless blk_poll=0 is at command line.
+ *
+ * \param ps Polling statistics.
+ */
+void blk_poll_init(blk_poll_t *ps)
+{
+	char *opt;
+
+	memset(ps, 0, sizeof(blk_poll_t));
+
+	opt = cmdline_get_value("blk_poll");
+	if (opt != NULL && strcmp(opt, "0") == 0) {
+		ps->mode = BLK_POLL_OFF;
+	} else {
+		ps->mode = BLK_POLL_AUTO;
+	}
+}
+
+
+/**
+ * Wait for the completion of a request. For fast devices, the
+ * caller spins checking device status for about twice the estimated
+ * latency, since sleeping and being woken up by the interrupt costs
+ * more than the request itself. When the device is slower, or polling
+ * times out, it sleeps waiting for the interrupt.
+ *
+ * \param ps Polling statistics of the device.
+ * \param status Status of the request (BUFF_ST_BUSY while not done).
+ * \param poll Driver function that finishes the requests done by
+ *             device (without waiting for interrupt).
+ * \param arg Argument to poll.
+ * \param sleep_addr Where to sleep waiting for the interrupt.
+ */
+void blk_poll_wait(blk_poll_t *ps, volatile char *status,
+		void (*poll)(void *), void *arg, int sleep_addr)
+{
+	uint32_t start, elapsed, budget, sample;
+
+	if (*status != BUFF_ST_BUSY) {
+		return;
+	}
+
+	if (ps->mode == BLK_POLL_AUTO &&
+			(ps->lat_usecs <= BLK_POLL_MAX_USECS || ps->skipped >= BLK_POLL_PROBE)) {
+
+		/* Probes (of a slow device) get the maximum time */
+		if (ps->lat_usecs <= BLK_POLL_MAX_USECS) {
+			budget = (ps->lat_usecs * 2) + BLK_POLL_MIN_USECS;
+		} else {
+			budget = BLK_POLL_MAX_USECS;
+		}
+		ps->skipped = 0;
+
+		start = get_usecs();
+		do {
+			poll(arg);
+			elapsed = get_usecs() - start;
+		} while (*status == BUFF_ST_BUSY && elapsed < budget);
+
+		if (*status != BUFF_ST_BUSY) {
+			ps->nr_hits++;
+			sample = elapsed;
+		} else {
+			/* Too slow (this time), count it as not worth polling */
+			ps->nr_misses++;
+			sample = BLK_POLL_MAX_USECS * 2;
+		}
+		ps->lat_usecs = ((ps->lat_usecs * 7) + sample) / 8;
+	} else {
+		ps->skipped++;
+		ps->nr_sleeps++;
+	}
+
+	while (*status == BUFF_ST_BUSY) {
+		sleep_on(sleep_addr);
+	}
+}
+
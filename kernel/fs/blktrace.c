@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: blktrace.c
+ * Desc: Block I/O tracing: events of requests (queue, merge, dispatch
+ *       and completion) and latency histograms of each device.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/timer.h>
+#include <fs/elevator.h>
+#include <fs/blktrace.h>
+#include <string.h>
+
+/** Tracing is enabled */
+char blktrace_enabled = 0;
+
+/** Ring buffer of events */
+static blk_trace_event_t bt_ring[BLKTRACE_EVENTS];
+
+/** Position of the next event (never wraps the ring, only the counter) */
+static volatile uint32_t bt_head;
+
+/** Position of the next event to be dumped */
+static uint32_t bt_tail;
+
+/** Queues being traced */
+static blk_queue_t *bt_queues;
+
+
+static void bt_event(blk_queue_t *q, char action, char op, int device,
+		uint64_t sector, int count, char status, uint32_t now);
+
+static void bt_hist_latency(uint32_t *histogram, uint32_t usecs);
+
+static void bt_print_hist(blk_queue_t *q, const char *name, uint32_t *histogram);
+
+
+/**
+ * Initialize block I/O tracing (blktrace=1 at command line enables it).
+ */
+void init_blktrace(void)
+{
+	char *opt;
+
+	bt_head   = 0;
+	bt_tail   = 0;
+	bt_queues = NULL;
+
+	opt = cmdline_get_value("blktrace");
+	blktrace_enabled = (opt != NULL && strcmp(opt, "1") == 0);
+	if (blktrace_enabled) {
+		kprintf(KERN_INFO "Block I/O tracing enabled.\n");
+	}
+}
+
+
+/**
+ * Write an event into the ring buffer. The slot is reserved with an
+ * atomic increment, so interrupt handlers can write events at any
+ * time (oldest events are overwritten when dump doesn't keep up).
+ */
+static void bt_event(blk_queue_t *q, char action, char op, int device,
+		uint64_t sector, int count, char status, uint32_t now)
+{
+	blk_trace_event_t *ev;
+	uint32_t pos;
+
+	pos = __sync_fetch_and_add(&bt_head, 1);
+	ev  = &bt_ring[pos & (BLKTRACE_EVENTS - 1)];
+
+	ev->seq    = 0;
+	ev->time   = now;
+	ev->sector = (uint32_t)sector;
+	ev->major  = (uint16_t)q->major;
+	ev->device = (uint16_t)device;
+	ev->action = action;
+	ev->op     = op;
+	ev->count  = (uchar8_t)count;
+	ev->status = status;
+	__sync_synchronize();
+	ev->seq    = pos + 1;
+}
+
+
+/**
+ * Account a latency into a histogram.
+ *
+ * \param histogram The histogram (BLKTRACE_HIST_SLOTS slots).
+ * \param usecs Latency (in microseconds).
+ */
+static void bt_hist_latency(uint32_t *histogram, uint32_t usecs)
+{
+	int slot = 0;
+
+	while ((usecs >>= 1) != 0 && slot < (BLKTRACE_HIST_SLOTS - 1)) {
+		slot++;
+	}
+	histogram[slot]++;
+}
+
+
+/**
+ * Trace a new request.
+ *
+ * \param q The queue.
+ * \param rq The request (just queued).
+ * \note Should be called with interrupts disabled.
+ */
+void blktrace_queue(blk_queue_t *q, blk_request_t *rq)
+{
+	uint32_t depth;
+
+	if (!q->traced) {
+		/* First request: histograms of the queue will be dumped */
+		q->traced     = 1;
+		q->trace_next = bt_queues;
+		bt_queues     = q;
+	}
+	rq->queued_at = _get_usecs();
+
+	depth = q->nr_requests + q->trace.in_flight;
+	if (depth >= BLKTRACE_HIST_SLOTS) {
+		depth = BLKTRACE_HIST_SLOTS - 1;
+	}
+	q->trace.depth[depth]++;
+
+	bt_event(q, BT_QUEUE, rq->op, rq->device, rq->sector, rq->count, 0, rq->queued_at);
+}
+
+
+/**
+ * Trace buffers merged into a queued request.
+ *
+ * \param q The queue.
+ * \param op BLK_READ or BLK_WRITE.
+ * \param device Device number.
+ * \param sector Disk address of the first sector.
+ * \param count Number of sectors.
+ */
+void blktrace_merge(blk_queue_t *q, char op, int device, uint64_t sector, int count)
+{
+	bt_event(q, BT_MERGE, op, device, sector, count, 0, _get_usecs());
+}
+
+
+/**
+ * Trace a request sent to device.
+ *
+ * \param q The queue.
+ * \param rq The request.
+ * \note Should be called with interrupts disabled.
+ */
+void blktrace_dispatch(blk_queue_t *q, blk_request_t *rq)
+{
+	rq->dispatched_at = _get_usecs();
+	q->trace.in_flight++;
+
+	bt_event(q, BT_DISPATCH, rq->op, rq->device, rq->sector, rq->count, 0, rq->dispatched_at);
+}
+
+
+/**
+ * Trace a completed request and account its latencies.
+ *
+ * \param rq The request (traced, so rq->queue is set).
+ * \param status Status of the request.
+ * \note Should be called with interrupts disabled.
+ */
+void blktrace_complete(blk_request_t *rq, char status)
+{
+	blk_queue_t *q = rq->queue;
+	uint32_t now;
+
+	now = _get_usecs();
+
+	bt_hist_latency(q->trace.q2c, now - rq->queued_at);
+	if (rq->dispatched_at != 0) {
+		bt_hist_latency(q->trace.d2c, now - rq->dispatched_at);
+		q->trace.in_flight--;
+	}
+
+	bt_event(q, BT_COMPLETE, rq->op, rq->device, rq->sector, rq->count, status, now);
+}
+
+
+/**
+ * Print a histogram of a queue.
+ */
+static void bt_print_hist(blk_queue_t *q, const char *name, uint32_t *histogram)
+{
+	int i;
+
+	kprintf("blkhist: %d,%d %s", q->major, q->disk, name);
+	for (i = 0; i < BLKTRACE_HIST_SLOTS; i++) {
+		kprintf(" %u", histogram[i]);
+	}
+	kprintf("\n");
+}
+
+
+/**
+ * Dump events traced since the last dump and histograms of all
+ * queues to the console (see scripts/blkparse.sh to decode them).
+ */
+void blktrace_dump(void)
+{
+	blk_trace_event_t ev, *slot;
+	blk_queue_t *q;
+	uint32_t head, seq;
+
+	if (!blktrace_enabled) {
+		return;
+	}
+
+	head = bt_head;
+	if ((head - bt_tail) > BLKTRACE_EVENTS) {
+		kprintf("blklost: %u\n", (head - bt_tail) - BLKTRACE_EVENTS);
+		bt_tail = head - BLKTRACE_EVENTS;
+	}
+
+	for (; bt_tail != head; bt_tail++) {
+		slot = &bt_ring[bt_tail & (BLKTRACE_EVENTS - 1)];
+
+		/* Sequence number is read before and after the copy, so an
+		   event written meanwhile is not taken */
+		seq = slot->seq;
+		__sync_synchronize();
+		memcpy(&ev, slot, sizeof(ev));
+		__sync_synchronize();
+		if (seq != (bt_tail + 1) || *((volatile uint32_t *)&slot->seq) != seq) {
+			/* Overwritten (or being written) */
+			continue;
+		}
+		kprintf("blktrace: %u %u %d,%d %c %c %u %d %d\n", seq, ev.time,
+				ev.major, ev.device, ev.action,
+				(ev.op == BLK_READ ? 'R' : (ev.op == BLK_WRITE ? 'W' : 'F')),
+				ev.sector, ev.count, ev.status);
+	}
+
+	for (q = bt_queues; q != NULL; q = q->trace_next) {
+		bt_print_hist(q, "q2c", q->trace.q2c);
+		bt_print_hist(q, "d2c", q->trace.d2c);
+		bt_print_hist(q, "depth", q->trace.depth);
+	}
+}
+
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: dcache.c
+ * Desc: Directory entry cache (name lookups).
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <fs/dcache.h>
+#include <arch/io.h>
+#include <string.h>
+
+/** Hash function: position of an entry into hash table */
+#define DCACHE_HASH(device, parent, hash) \
+	(((hash) + (parent) * 31 + ((device).minor << 3) + ((device).major << 7)) & (DCACHE_HASH_SIZE - 1))
+
+/** The dentry cache */
+static dcache_t dcache;
+
+/* Prototypes */
+static uint32_t dcache_name_hash(const char *name, uint32_t *len);
+static void dcache_lru_move(dcache_entry_t *entry, char at_tail);
+static dcache_entry_t *dcache_find(dev_t device, uint32_t parent, const char *name,
+		uint32_t hash, uint32_t len);
+static void dcache_hash_add(dcache_entry_t *entry);
+static void dcache_hash_remove(dcache_entry_t *entry);
+
+
+/**
+ * Initialize the dentry cache.
+ */
+void init_dcache(void)
+{
+	uint32_t i;
+
+	memset(&dcache, 0, sizeof(dcache_t));
+
+	dcache.entries = (dcache_entry_t*)kmalloc(sizeof(dcache_entry_t) * DCACHE_MAX_ENTRIES, GFP_NORMAL_Z);
+	if (dcache.entries == NULL) {
+		panic("Could not allocate memory to dentry cache.");
+	}
+	memset(dcache.entries, 0, sizeof(dcache_entry_t) * DCACHE_MAX_ENTRIES);
+
+	/* All entries are at LRU list, unused ones are reused first */
+	dcache.lru_head.lru_prev = &dcache.lru_head;
+	dcache.lru_head.lru_next = &dcache.lru_head;
+	for (i = 0; i < DCACHE_MAX_ENTRIES; i++) {
+		dcache_lru_move(&dcache.entries[i], 1);
+	}
+}
+
+
+/**
+ * Hash a name.
+ *
+ * \param name The name.
+ * \param len Where to return the name length.
+ * \return The hash.
+ */
+static uint32_t dcache_name_hash(const char *name, uint32_t *len)
+{
+	uint32_t hash, i;
+
+	hash = 0;
+	for (i = 0; name[i] != '\0'; i++) {
+		hash = (hash * 31) + (uchar8_t)name[i];
+	}
+	*len = i;
+
+	return hash;
+}
+
+
+/**
+ * Move an entry to one end of the LRU list.
+ *
+ * \param entry The entry.
+ * \param at_tail If not zero, entry is put at the end of list (most
+ * recently used), otherwise at the beginning (reused first).
+ * \note Should be called with interrupts disabled.
+ */
+static void dcache_lru_move(dcache_entry_t *entry, char at_tail)
+{
+	dcache_entry_t *head = &dcache.lru_head;
+	dcache_entry_t *tmp;
+
+	if (entry->lru_next != NULL) {
+		entry->lru_prev->lru_next = entry->lru_next;
+		entry->lru_next->lru_prev = entry->lru_prev;
+	}
+
+	if (at_tail) {
+		tmp = head->lru_prev;
+		entry->lru_prev = tmp;
+		entry->lru_next = head;
+		head->lru_prev  = entry;
+		tmp->lru_next   = entry;
+	} else {
+		tmp = head->lru_next;
+		entry->lru_next = tmp;
+		entry->lru_prev = head;
+		head->lru_next  = entry;
+		tmp->lru_prev   = entry;
+	}
+}
+
+
+/**
+ * Search for an entry on hash table.
+ *
+ * \param device Device of the directory.
+ * \param parent Directory i-node number.
+ * \param name The name.
+ * \param hash Hash of the name.
+ * \param len Name length.
+ * \return dcache_entry_t The entry (if was found), NULL otherwise.
+ * \note Should be called with interrupts disabled.
+ */
+static dcache_entry_t *dcache_find(dev_t device, uint32_t parent, const char *name,
+		uint32_t hash, uint32_t len)
+{
+	dcache_entry_t *tmp;
+
+	tmp = dcache.hashtable[DCACHE_HASH(device, parent, hash)];
+	while (tmp != NULL) {
+		if (tmp->hash == hash && tmp->parent == parent && tmp->len == len &&
+				DEV_CMP(tmp->device, device) && strncmp(tmp->name, name, len) == 0) {
+			break;
+		}
+		tmp = tmp->next;
+	}
+
+	return tmp;
+}
+
+
+/**
+ * Insert an entry into hash table.
+ *
+ * \param entry The entry.
+ * \note Should be called with interrupts disabled.
+ */
+static void dcache_hash_add(dcache_entry_t *entry)
+{
+	uint32_t pos;
+
+	pos = DCACHE_HASH(entry->device, entry->parent, entry->hash);
+	entry->prev = NULL;
+	entry->next = dcache.hashtable[pos];
+	if (entry->next != NULL) {
+		entry->next->prev = entry;
+	}
+	dcache.hashtable[pos] = entry;
+	entry->flags |= DCACHE_FL_HASHED;
+}
+
+
+/**
+ * Remove an entry from hash table. It goes to the beginning of
+ * LRU list, to be reused first.
+ *
+ * \param entry The entry.
+ * \note Should be called with interrupts disabled.
+ */
+static void dcache_hash_remove(dcache_entry_t *entry)
+{
+	if (!(entry->flags & DCACHE_FL_HASHED)) {
+		return;
+	}
+
+	if (entry->prev == NULL) {
+		dcache.hashtable[DCACHE_HASH(entry->device, entry->parent, entry->hash)] = entry->next;
+	} else {
+		entry->prev->next = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	}
+	entry->prev   = NULL;
+	entry->next   = NULL;
+	entry->flags &= ~DCACHE_FL_HASHED;
+
+	dcache_lru_move(entry, 0);
+}
+
+
+/**
+ * Look up a name in a directory.
+ *
+ * \param dir Directory i-node.
+ * \param name The name.
+ * \param inumber Where to return the i-node number of the name
+ * (0 if the directory has no such name).
+ * \return 0 if the name is in the cache, DCACHE_MISS otherwise.
+ */
+int dcache_lookup(vfs_inode *dir, const char *name, uint32_t *inumber)
+{
+	dcache_entry_t *entry;
+	uint32_t hash, len;
+
+	hash = dcache_name_hash(name, &len);
+	if (len >= DCACHE_NAME_LEN) {
+		return DCACHE_MISS;
+	}
+
+	cli();
+	entry = dcache_find(dir->device, dir->number, name, hash, len);
+	if (entry == NULL) {
+		sti();
+		return DCACHE_MISS;
+	}
+	*inumber = entry->inumber;
+	dcache_lru_move(entry, 1);
+	sti();
+
+	return 0;
+}
+
+
+/**
+ * Add (or update) a name of a directory. The least recently used
+ * entry is reused.
+ *
+ * \param dir Directory i-node.
+ * \param name The name.
+ * \param inumber i-node number of the name (0 if the directory has
+ * no such name).
+ */
+void dcache_add(vfs_inode *dir, const char *name, uint32_t inumber)
+{
+	dcache_entry_t *entry;
+	uint32_t hash, len;
+
+	hash = dcache_name_hash(name, &len);
+	if (len >= DCACHE_NAME_LEN) {
+		return;
+	}
+
+	cli();
+	entry = dcache_find(dir->device, dir->number, name, hash, len);
+	if (entry == NULL) {
+		entry = dcache.lru_head.lru_next;
+		dcache_hash_remove(entry);
+
+		entry->device.major = dir->device.major;
+		entry->device.minor = dir->device.minor;
+		entry->parent = dir->number;
+		entry->hash   = hash;
+		entry->len    = len;
+		memcpy(entry->name, name, len);
+		entry->name[len] = '\0';
+		dcache_hash_add(entry);
+	}
+	entry->inumber = inumber;
+	dcache_lru_move(entry, 1);
+	sti();
+}
+
+
+/**
+ * Drop a name of a directory from the cache. Should be called when
+ * a directory entry is created, removed or renamed.
+ *
+ * \param dir Directory i-node.
+ * \param name The name.
+ */
+void dcache_invalidate(vfs_inode *dir, const char *name)
+{
+	dcache_entry_t *entry;
+	uint32_t hash, len;
+
+	hash = dcache_name_hash(name, &len);
+	if (len >= DCACHE_NAME_LEN) {
+		return;
+	}
+
+	cli();
+	entry = dcache_find(dir->device, dir->number, name, hash, len);
+	if (entry != NULL) {
+		dcache_hash_remove(entry);
+	}
+	sti();
+}
+
+
+/**
+ * Drop all names of a directory from the cache.
+ *
+ * \param dir Directory i-node.
+ */
+void dcache_invalidate_dir(vfs_inode *dir)
+{
+	dcache_entry_t *entry;
+	uint32_t i;
+
+	cli();
+	for (i = 0; i < DCACHE_MAX_ENTRIES; i++) {
+		entry = &dcache.entries[i];
+		if (entry->parent == dir->number && DEV_CMP(entry->device, dir->device)) {
+			dcache_hash_remove(entry);
+		}
+	}
+	sti();
+}
+
+
+/**
+ * Drop all names of a device from the cache. Should be called when
+ * a file system is mounted or unmounted.
+ *
+ * \param device The device.
+ */
+void dcache_purge_dev(dev_t device)
+{
+	dcache_entry_t *entry;
+	uint32_t i;
+
+	cli();
+	for (i = 0; i < DCACHE_MAX_ENTRIES; i++) {
+		entry = &dcache.entries[i];
+		if (DEV_CMP(entry->device, device)) {
+			dcache_hash_remove(entry);
+		}
+	}
+	sti();
+}
+
@@ -72,12 +72,21 @@ int register_block_driver(dev_blk_driver_t *driver)
 		return -1;
 	}
 
-	/* Create a block hash queue for the device */
-	driver->buffer_queue = create_hash_queue(driver->size);
-	if (driver->buffer_queue == NULL) {
+	/* Buffer cache is shared by all devices, start with no buffers */
+	driver->bcache_nbufs = (uint32_t *)kmalloc(sizeof(uint32_t) * MAX_MINOR_DEVICES, GFP_NORMAL_Z);
+	driver->bstats = (bcache_stats_t *)kmalloc(sizeof(bcache_stats_t) * MAX_MINOR_DEVICES, GFP_NORMAL_Z);
+	if (driver->bcache_nbufs == NULL || driver->bstats == NULL) {
+		if (driver->bcache_nbufs != NULL) {
+			kfree(driver->bcache_nbufs);
+		}
+		if (driver->bstats != NULL) {
+			kfree(driver->bstats);
+		}
 		return -1;
 	}
-	
+	memset(driver->bcache_nbufs, 0, sizeof(uint32_t) * MAX_MINOR_DEVICES);
+	memset(driver->bstats, 0, sizeof(bcache_stats_t) * MAX_MINOR_DEVICES);
+
 	/* Initialize i-nodes hash queue for this device */
 	for (i = 0; i < MAX_MINOR_DEVICES; i++) {
 		driver->inodes_hash_table[i] = NULL;
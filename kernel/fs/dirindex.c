@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: dirindex.c
+ * Desc: In-memory hash index of directory entries.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <fs/dirindex.h>
+#include <arch/io.h>
+#include <string.h>
+
+/* Prototypes */
+static uint32_t dir_index_hash(const char *name, uint32_t len);
+static int dir_index_add(dir_index_t *idx, uint32_t *size, uint32_t hash, uint32_t block);
+static dir_index_t *dir_index_build(vfs_inode *dir);
+
+
+/**
+ * Hash a name (FNV-1a).
+ *
+ * \param name The name.
+ * \param len Name length.
+ * \return The hash.
+ */
+static uint32_t dir_index_hash(const char *name, uint32_t len)
+{
+	uint32_t hash, i;
+
+	hash = 2166136261U;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ (uchar8_t)name[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+
+/**
+ * Append an entry to the index, growing the entries array when full.
+ *
+ * \param idx The index.
+ * \param size Size (in entries) of entries array.
+ * \param hash Hash of the name.
+ * \param block Directory block (logical) holding the entry.
+ * \return 0 on success, -1 if there is no memory.
+ */
+static int dir_index_add(dir_index_t *idx, uint32_t *size, uint32_t hash, uint32_t block)
+{
+	dir_index_entry_t *entries;
+
+	if (idx->nentries == *size) {
+		entries = (dir_index_entry_t *)kmalloc(sizeof(dir_index_entry_t) * (*size) * 2, GFP_NORMAL_Z);
+		if (entries == NULL) {
+			return -1;
+		}
+		memcpy(entries, idx->entries, sizeof(dir_index_entry_t) * idx->nentries);
+		kfree(idx->entries);
+		idx->entries = entries;
+		*size *= 2;
+	}
+
+	idx->entries[idx->nentries].hash  = hash;
+	idx->entries[idx->nentries].block = block;
+	idx->nentries++;
+
+	return 0;
+}
+
+
+/**
+ * Build the index of a directory, reading all its blocks.
+ *
+ * \param dir Directory i-node.
+ * \return The index, NULL on error.
+ */
+static dir_index_t *dir_index_build(vfs_inode *dir)
+{
+	vfs_superblock *sb = dir->sb;
+	dir_index_t *idx;
+	vfs_bmap_t bmap;
+	char *block;
+	uint32_t blk_size, lblock, pos, size, i, b;
+	uint16_t rec_len;
+
+	blk_size = sb->s_log_block_size;
+
+	idx = (dir_index_t *)kmalloc(sizeof(dir_index_t), GFP_NORMAL_Z);
+	if (idx == NULL) {
+		return NULL;
+	}
+	memset(idx, 0, sizeof(dir_index_t));
+	idx->size  = dir->i_size;
+	idx->mtime = dir->i_mtime;
+
+	size = DIRINDEX_INIT_ENTRIES;
+	idx->entries = (dir_index_entry_t *)kmalloc(sizeof(dir_index_entry_t) * size, GFP_NORMAL_Z);
+	if (idx->entries == NULL) {
+		kfree(idx);
+		return NULL;
+	}
+
+	/* Hash all names of the directory */
+	for (lblock = 0; (lblock * blk_size) < dir->i_size; lblock++) {
+		bmap = vfs_bmap(dir, lblock * blk_size);
+		if (bmap.blk_count == 0) {
+			goto error;
+		} else if (bmap.blk_number == 0) {
+			/* Hole */
+			continue;
+		}
+
+		block = sb->sb_op->get_fs_block(sb, bmap.blk_number);
+		if (block == NULL) {
+			goto error;
+		}
+
+		for (pos = 0; (pos + 8) <= blk_size; pos += rec_len) {
+			rec_len = *(uint16_t *)&block[pos + 4];
+			if (rec_len < 8 || (pos + rec_len) > blk_size) {
+				break;
+			}
+			if (*(uint32_t *)&block[pos] != 0 &&
+					dir_index_add(idx, &size, dir_index_hash(&block[pos + 8],
+							(uchar8_t)block[pos + 6]), lblock) < 0) {
+				kfree(block);
+				goto error;
+			}
+		}
+		kfree(block);
+	}
+
+	/* Buckets: about one entry per bucket */
+	for (idx->nbuckets = 16; idx->nbuckets < idx->nentries; idx->nbuckets <<= 1);
+
+	idx->buckets = (int32_t *)kmalloc(sizeof(int32_t) * idx->nbuckets, GFP_NORMAL_Z);
+	if (idx->buckets == NULL) {
+		goto error;
+	}
+	for (i = 0; i < idx->nbuckets; i++) {
+		idx->buckets[i] = -1;
+	}
+	for (i = 0; i < idx->nentries; i++) {
+		b = idx->entries[i].hash & (idx->nbuckets - 1);
+		idx->entries[i].next = idx->buckets[b];
+		idx->buckets[b] = i;
+	}
+
+	return idx;
+
+error:
+	kfree(idx->entries);
+	kfree(idx);
+	return NULL;
+}
+
+
+/**
+ * Find a name in a directory through its hash index. The index is
+ * built on first lookup (and rebuilt if directory has changed).
+ *
+ * \param dir Directory i-node.
+ * \param name The name.
+ * \param inumber Where to return the i-node number of the name (0 if
+ * directory has no such name).
+ * \return 0 on success, -1 if directory could not be read, VFS_NO_INDEX
+ * if directory is too small to be indexed (or there is no memory).
+ */
+int dir_index_lookup(vfs_inode *dir, const char *name, uint32_t *inumber)
+{
+	vfs_superblock *sb = dir->sb;
+	dir_index_t *idx;
+	dir_index_entry_t *ent;
+	vfs_bmap_t bmap;
+	char *block;
+	uint32_t blk_size, hash, len, last;
+	int32_t e;
+
+	blk_size = sb->s_log_block_size;
+	if (dir->i_size < (DIRINDEX_MIN_BLOCKS * blk_size)) {
+		return VFS_NO_INDEX;
+	}
+
+	idx = dir->dindex;
+	if (idx != NULL && (idx->size != dir->i_size || idx->mtime != dir->i_mtime)) {
+		dir_index_free(dir);
+		idx = NULL;
+	}
+
+	if (idx == NULL) {
+		if ((idx = dir_index_build(dir)) == NULL) {
+			return VFS_NO_INDEX;
+		}
+
+		/* Somebody else could build it meanwhile */
+		cli();
+		if (dir->dindex == NULL) {
+			dir->dindex = idx;
+			sti();
+		} else {
+			sti();
+			kfree(idx->buckets);
+			kfree(idx->entries);
+			kfree(idx);
+			idx = dir->dindex;
+		}
+	}
+
+	len  = strlen(name);
+	hash = dir_index_hash(name, len);
+	last = 0xFFFFFFFF;
+
+	/* Read only blocks that have names with the same hash */
+	*inumber = 0;
+	for (e = idx->buckets[hash & (idx->nbuckets - 1)]; e >= 0; e = ent->next) {
+		ent = &idx->entries[e];
+		if (ent->hash != hash || ent->block == last) {
+			continue;
+		}
+		last = ent->block;
+
+		bmap = vfs_bmap(dir, ent->block * blk_size);
+		if (bmap.blk_number == 0) {
+			return -1;
+		}
+		block = sb->sb_op->get_fs_block(sb, bmap.blk_number);
+		if (block == NULL) {
+			return -1;
+		}
+		*inumber = vfs_dir_find_entry(block, blk_size, name, len);
+		kfree(block);
+
+		if (*inumber != 0) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Release the hash index of a directory. Should be called when the
+ * i-node object is reused.
+ *
+ * \param dir Directory i-node.
+ */
+void dir_index_free(vfs_inode *dir)
+{
+	dir_index_t *idx;
+
+	cli();
+	idx = dir->dindex;
+	dir->dindex = NULL;
+	sti();
+
+	if (idx != NULL) {
+		kfree(idx->buckets);
+		kfree(idx->entries);
+		kfree(idx);
+	}
+}
+
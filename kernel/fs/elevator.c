@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: elevator.c
+ * Desc: Block requests and I/O schedulers.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/jiffies.h>
+#include <tempos/mm.h>
+#include <fs/elevator.h>
+#include <fs/bio.h>
+#include <fs/blktrace.h>
+#include <string.h>
+
+/** FIFO index of an operation */
+#define FIFO_IDX(op)	((op) == BLK_READ ? 0 : 1)
+
+/** Pool of requests */
+static blk_request_t rq_pool[BLK_REQUEST_POOL];
+
+/** Free requests of the pool (linked by sort_next) */
+static blk_request_t *rq_free;
+
+
+static blk_request_t *next_request(blk_queue_t *q);
+
+static void hold_request(blk_queue_t *q, blk_request_t *rq);
+
+static void fifo_add(blk_queue_t *q, int idx, blk_request_t *rq);
+
+static void fifo_remove(blk_queue_t *q, int idx, blk_request_t *rq);
+
+static void sort_add(blk_queue_t *q, blk_request_t *rq);
+
+static void sort_remove(blk_queue_t *q, blk_request_t *rq);
+
+static int rq_merge(blk_queue_t *q, blk_request_t *rq, char op, int device,
+		uint64_t sector, buff_header_t **bufs, int count);
+
+static int noop_merge(blk_queue_t *q, char op, int device, uint64_t sector,
+		buff_header_t **bufs, int count);
+
+static void noop_add_request(blk_queue_t *q, blk_request_t *rq);
+
+static blk_request_t *noop_next_request(blk_queue_t *q);
+
+static int deadline_merge(blk_queue_t *q, char op, int device, uint64_t sector,
+		buff_header_t **bufs, int count);
+
+static void deadline_add_request(blk_queue_t *q, blk_request_t *rq);
+
+static blk_request_t *deadline_next_request(blk_queue_t *q);
+
+
+/** Deadline scheduler */
+elevator_t elv_deadline = {
+	.name         = "deadline",
+	.merge        = deadline_merge,
+	.add_request  = deadline_add_request,
+	.next_request = deadline_next_request,
+};
+
+/** No-op scheduler */
+elevator_t elv_noop = {
+	.name         = "noop",
+	.merge        = noop_merge,
+	.add_request  = noop_add_request,
+	.next_request = noop_next_request,
+};
+
+
+/**
+ * Initialize the pool of block requests.
+ */
+void init_blk_requests(void)
+{
+	int i;
+
+	rq_free = NULL;
+	for (i = BLK_REQUEST_POOL - 1; i >= 0; i--) {
+		rq_pool[i].pooled    = 1;
+		rq_pool[i].sort_next = rq_free;
+		rq_free = &rq_pool[i];
+	}
+}
+
+
+/**
+ * Initialize a request queue.
+ *
+ * \param q The queue.
+ * \param elv I/O scheduler of the queue.
+ * \param major Major number of the device.
+ * \param disk Device number of the disk.
+ */
+void blk_queue_init(blk_queue_t *q, elevator_t *elv, int major, int disk)
+{
+	memset(q, 0, sizeof(blk_queue_t));
+	q->elv   = elv;
+	q->major = major;
+	q->disk  = disk;
+}
+
+
+/**
+ * Get a free request. It comes from the pool, unless the
+ * pool is empty.
+ *
+ * \return The request, or NULL if there is no memory.
+ * \note Should be called with interrupts disabled.
+ */
+blk_request_t *blk_get_request(void)
+{
+	blk_request_t *rq;
+
+	if (rq_free != NULL) {
+		rq      = rq_free;
+		rq_free = rq->sort_next;
+	} else {
+		rq = (blk_request_t *)kmalloc(sizeof(blk_request_t), GFP_NORMAL_Z);
+		if (rq == NULL) {
+			return NULL;
+		}
+		rq->pooled = 0;
+	}
+
+	rq->count      = 0;
+	rq->done       = 0;
+	rq->end_status = NULL;
+	rq->queue      = NULL;
+	rq->queued_at  = rq->dispatched_at = 0;
+	rq->sort_prev = rq->sort_next = NULL;
+	rq->fifo_prev = rq->fifo_next = NULL;
+	return rq;
+}
+
+
+/**
+ * Release a request.
+ *
+ * \param rq The request.
+ * \note Should be called with interrupts disabled.
+ */
+void blk_put_request(blk_request_t *rq)
+{
+	if (rq->pooled) {
+		rq->sort_next = rq_free;
+		rq_free       = rq;
+	} else {
+		kfree(rq);
+	}
+}
+
+
+/**
+ * Finish a request: set the status of its buffers (and notify block
+ * I/Os owning them), then release it.
+ *
+ * \param rq The request.
+ * \param status New status of the buffers: BUFF_ST_VALID on success,
+ * BUFF_ST_UNLOCKED on error.
+ * \note Should be called with interrupts disabled.
+ */
+void blk_end_request(blk_request_t *rq, char status)
+{
+	int i;
+
+	if (rq->queue != NULL) {
+		blktrace_complete(rq, status);
+	}
+
+	for (i = 0; i < rq->count; i++) {
+		rq->buffs[i]->status = status;
+		if (rq->buffs[i]->bio != NULL) {
+			bio_sector_done(rq->buffs[i]->bio, (status != BUFF_ST_VALID));
+		}
+	}
+	if (rq->end_status != NULL) {
+		*rq->end_status = status;
+	}
+	blk_put_request(rq);
+}
+
+
+/**
+ * Queue the transfer of consecutive sectors. Buffers are merged into
+ * a queued request when possible, otherwise a new request is created.
+ *
+ * \param q The queue.
+ * \param op BLK_READ or BLK_WRITE.
+ * \param device Device number (disk or partition).
+ * \param sector Disk address of the first sector.
+ * \param bufs Buffers (holding consecutive sectors).
+ * \param count Number of buffers (up to BCACHE_CLUSTER_MAX).
+ * \return 0 on success, -1 otherwise.
+ * \note Should be called with interrupts disabled.
+ */
+int blk_queue_bufs(blk_queue_t *q, char op, int device, uint64_t sector,
+		buff_header_t **bufs, int count)
+{
+	blk_request_t *rq;
+	int i;
+
+	if (q->barrier == NULL && q->elv->merge(q, op, device, sector, bufs, count)) {
+		q->nr_merges++;
+		if (blktrace_enabled) {
+			blktrace_merge(q, op, device, sector, count);
+		}
+		return 0;
+	}
+
+	if ((rq = blk_get_request()) == NULL) {
+		return -1;
+	}
+	rq->op     = op;
+	rq->device = device;
+	rq->sector = sector;
+	rq->count  = count;
+	for (i = 0; i < count; i++) {
+		rq->buffs[i] = bufs[i];
+	}
+	rq->deadline = jiffies + (op == BLK_READ ? ELV_READ_EXPIRE : ELV_WRITE_EXPIRE);
+
+	if (blktrace_enabled) {
+		rq->queue = q;
+		blktrace_queue(q, rq);
+	}
+
+	if (q->barrier != NULL) {
+		/* It can't pass the barrier */
+		hold_request(q, rq);
+	} else {
+		q->elv->add_request(q, rq);
+		q->nr_requests++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Queue a flush of the device write cache. It's a barrier: the
+ * flush is dispatched when all requests queued before it were
+ * dispatched, requests queued after it wait for its dispatch.
+ *
+ * \param q The queue.
+ * \param device Device number.
+ * \param status Receives the status of the flush when it's done:
+ * BUFF_ST_VALID on success, BUFF_ST_UNLOCKED on error.
+ * \return 0 on success, -1 otherwise.
+ * \note Should be called with interrupts disabled. Drivers should
+ * dispatch a flush only when the device has no request in flight.
+ */
+int blk_queue_flush(blk_queue_t *q, int device, volatile char *status)
+{
+	blk_request_t *rq;
+
+	if ((rq = blk_get_request()) == NULL) {
+		return -1;
+	}
+	rq->op         = BLK_FLUSH;
+	rq->device     = device;
+	rq->sector     = 0;
+	rq->end_status = status;
+
+	if (blktrace_enabled) {
+		rq->queue = q;
+		blktrace_queue(q, rq);
+	}
+
+	if (q->barrier == NULL) {
+		q->barrier = rq;
+	} else {
+		hold_request(q, rq);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Take the next request to be sent to the device.
+ *
+ * \param q The queue.
+ * \return The request (removed from queue), or NULL if queue is empty.
+ * \note Should be called with interrupts disabled.
+ */
+blk_request_t *blk_next_request(blk_queue_t *q)
+{
+	blk_request_t *rq;
+
+	rq = next_request(q);
+	if (rq != NULL && rq->queue != NULL) {
+		blktrace_dispatch(q, rq);
+	}
+	return rq;
+}
+
+
+/**
+ * Remove the next request to be dispatched: from the I/O scheduler
+ * or, when it's empty, the pending barrier.
+ */
+static blk_request_t *next_request(blk_queue_t *q)
+{
+	blk_request_t *rq, *tmp;
+
+	if (q->nr_requests > 0) {
+		rq = q->elv->next_request(q);
+		if (rq != NULL) {
+			q->nr_requests--;
+			q->head_pos = rq->sector + rq->count;
+		}
+		return rq;
+	}
+
+	if ((rq = q->barrier) == NULL) {
+		return NULL;
+	}
+
+	/* All requests before the barrier were dispatched, the ones after
+	   it go to the I/O scheduler (up to the next barrier) */
+	q->barrier = NULL;
+	while ((tmp = q->held_head) != NULL) {
+		q->held_head   = tmp->fifo_next;
+		tmp->fifo_next = NULL;
+
+		if (tmp->op == BLK_FLUSH) {
+			q->barrier = tmp;
+			break;
+		}
+		q->elv->add_request(q, tmp);
+		q->nr_requests++;
+	}
+	if (q->held_head == NULL) {
+		q->held_tail = NULL;
+	}
+
+	return rq;
+}
+
+
+/**
+ * Keep a request queued after a barrier.
+ */
+static void hold_request(blk_queue_t *q, blk_request_t *rq)
+{
+	rq->fifo_next = NULL;
+	if (q->held_tail != NULL) {
+		q->held_tail->fifo_next = rq;
+	} else {
+		q->held_head = rq;
+	}
+	q->held_tail = rq;
+}
+
+
+/**
+ * Append a request to a FIFO list.
+ */
+static void fifo_add(blk_queue_t *q, int idx, blk_request_t *rq)
+{
+	rq->fifo_next = NULL;
+	rq->fifo_prev = q->fifo_tail[idx];
+
+	if (q->fifo_tail[idx] != NULL) {
+		q->fifo_tail[idx]->fifo_next = rq;
+	} else {
+		q->fifo_head[idx] = rq;
+	}
+	q->fifo_tail[idx] = rq;
+}
+
+
+/**
+ * Remove a request from a FIFO list.
+ */
+static void fifo_remove(blk_queue_t *q, int idx, blk_request_t *rq)
+{
+	if (rq->fifo_prev != NULL) {
+		rq->fifo_prev->fifo_next = rq->fifo_next;
+	} else {
+		q->fifo_head[idx] = rq->fifo_next;
+	}
+
+	if (rq->fifo_next != NULL) {
+		rq->fifo_next->fifo_prev = rq->fifo_prev;
+	} else {
+		q->fifo_tail[idx] = rq->fifo_prev;
+	}
+	rq->fifo_prev = rq->fifo_next = NULL;
+}
+
+
+/**
+ * Insert a request into the sorted list.
+ */
+static void sort_add(blk_queue_t *q, blk_request_t *rq)
+{
+	blk_request_t *tmp, *prev;
+
+	prev = NULL;
+	for (tmp = q->sorted; tmp != NULL && tmp->sector <= rq->sector; tmp = tmp->sort_next) {
+		prev = tmp;
+	}
+
+	rq->sort_prev = prev;
+	rq->sort_next = tmp;
+	if (tmp != NULL) {
+		tmp->sort_prev = rq;
+	}
+	if (prev != NULL) {
+		prev->sort_next = rq;
+	} else {
+		q->sorted = rq;
+	}
+}
+
+
+/**
+ * Remove a request from the sorted list.
+ */
+static void sort_remove(blk_queue_t *q, blk_request_t *rq)
+{
+	if (rq->sort_prev != NULL) {
+		rq->sort_prev->sort_next = rq->sort_next;
+	} else {
+		q->sorted = rq->sort_next;
+	}
+
+	if (rq->sort_next != NULL) {
+		rq->sort_next->sort_prev = rq->sort_prev;
+	}
+	rq->sort_prev = rq->sort_next = NULL;
+}
+
+
+/**
+ * Merge buffers at the end (back merge) or at the beginning
+ * (front merge) of a request.
+ *
+ * \return 1 if buffers were merged, 0 otherwise.
+ */
+static int rq_merge(blk_queue_t *q, blk_request_t *rq, char op, int device,
+		uint64_t sector, buff_header_t **bufs, int count)
+{
+	int i;
+
+	if (rq->op != op || rq->device != device || (rq->count + count) > BCACHE_CLUSTER_MAX) {
+		return 0;
+	}
+
+	if ((rq->sector + rq->count) == sector) {
+		for (i = 0; i < count; i++) {
+			rq->buffs[rq->count + i] = bufs[i];
+		}
+		rq->count += count;
+		return 1;
+	} else if ((sector + count) == rq->sector) {
+		for (i = rq->count - 1; i >= 0; i--) {
+			rq->buffs[i + count] = rq->buffs[i];
+		}
+		for (i = 0; i < count; i++) {
+			rq->buffs[i] = bufs[i];
+		}
+		rq->count  += count;
+		rq->sector  = sector;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * No-op scheduler: merge with the last request only.
+ */
+static int noop_merge(blk_queue_t *q, char op, int device, uint64_t sector,
+		buff_header_t **bufs, int count)
+{
+	if (q->fifo_tail[0] == NULL) {
+		return 0;
+	}
+	return rq_merge(q, q->fifo_tail[0], op, device, sector, bufs, count);
+}
+
+
+/**
+ * No-op scheduler: requests are kept in arrival order.
+ */
+static void noop_add_request(blk_queue_t *q, blk_request_t *rq)
+{
+	fifo_add(q, 0, rq);
+}
+
+
+/**
+ * No-op scheduler: dispatch the oldest request.
+ */
+static blk_request_t *noop_next_request(blk_queue_t *q)
+{
+	blk_request_t *rq = q->fifo_head[0];
+
+	if (rq != NULL) {
+		fifo_remove(q, 0, rq);
+	}
+	return rq;
+}
+
+
+/**
+ * Deadline scheduler: merge with any adjacent request.
+ */
+static int deadline_merge(blk_queue_t *q, char op, int device, uint64_t sector,
+		buff_header_t **bufs, int count)
+{
+	blk_request_t *rq;
+
+	for (rq = q->sorted; rq != NULL && rq->sector <= (sector + count); rq = rq->sort_next) {
+		if (rq_merge(q, rq, op, device, sector, bufs, count)) {
+			/* A front merge changes the position in sorted list */
+			if (rq->sort_prev != NULL && rq->sort_prev->sector > rq->sector) {
+				sort_remove(q, rq);
+				sort_add(q, rq);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Deadline scheduler: requests are kept sorted by sector and in
+ * arrival order (one list for reads and other for writes).
+ */
+static void deadline_add_request(blk_queue_t *q, blk_request_t *rq)
+{
+	sort_add(q, rq);
+	fifo_add(q, FIFO_IDX(rq->op), rq);
+}
+
+
+/**
+ * Deadline scheduler: dispatch an expired request (reads first),
+ * otherwise the next one at sector order. Head moves in one
+ * direction and goes back to the lowest sector at the end (C-LOOK).
+ */
+static blk_request_t *deadline_next_request(blk_queue_t *q)
+{
+	blk_request_t *rq;
+	int i;
+
+	rq = NULL;
+	for (i = 0; i < 2; i++) {
+		if (q->fifo_head[i] != NULL && time_after_eq(jiffies, q->fifo_head[i]->deadline)) {
+			rq = q->fifo_head[i];
+			break;
+		}
+	}
+
+	if (rq == NULL) {
+		for (rq = q->sorted; rq != NULL && rq->sector < q->head_pos; rq = rq->sort_next);
+		if (rq == NULL) {
+			rq = q->sorted;
+		}
+	}
+
+	if (rq != NULL) {
+		sort_remove(q, rq);
+		fifo_remove(q, FIFO_IDX(rq->op), rq);
+	}
+	return rq;
+}
+
@@ -66,6 +66,20 @@ int ext2_get_inode(vfs_inode *inode);
 
 char *ext2_get_fs_block(vfs_superblock *sb, uint32_t blocknum);
 
+int ext2_lookup(vfs_inode *dir, const char *name, uint32_t *inumber);
+
+static char *ext2_get_dir_block(vfs_inode *dir, uint32_t lblock);
+
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num, char is_unsigned);
+
+static void tea_transform(uint32_t buf[4], uint32_t const in[4]);
+
+static void half_md4_transform(uint32_t buf[4], uint32_t const in[8]);
+
+static uint32_t dx_hack_hash(const char *name, int len, char is_unsigned);
+
+static uint32_t ext2_dirhash(const char *name, int len, int version, uint32_t *seed);
+
 
 /**
  * This function registers EXT2 file system in VFS.
@@ -78,6 +92,7 @@ void register_ext2(void)
 
 	ext2_sb_ops.get_inode      = ext2_get_inode;
 	ext2_sb_ops.get_fs_block   = ext2_get_fs_block;
+	ext2_sb_ops.lookup         = ext2_lookup;
 
 	register_fs_type(&ext2_fs_type);
 }
@@ -279,7 +294,7 @@ int ext2_get_inode(vfs_inode *inode)
 char *ext2_get_fs_block(vfs_superblock *sb, uint32_t blocknum)
 {
 	/* Maximum blocks = (for 4KB)*/
-	buff_header_t *blk;
+	buff_header_t *blks[BCACHE_CLUSTER_MAX];
 	ext2_fsdriver_t *fs;
 	int i, nb;
 	uint64_t baddr;
@@ -293,16 +308,373 @@ char *ext2_get_fs_block(vfs_superblock *sb, uint32_t blocknum)
 		return NULL;
 	}
 
+	/* All sectors of the block are read at once */
 	nb = get_block_size(*fs->sb) / SECTOR_SIZE;
-	for (i = 0; i < nb; i++, baddr++) {
-		blk = bread(sb->device.major, sb->device.minor, baddr);
-		memcpy(&block[(i * SECTOR_SIZE)], blk->data, SECTOR_SIZE);
-		brelse(sb->device.major, sb->device.minor, blk);
+	if (breadn(sb->device.major, sb->device.minor, baddr, nb, blks) < 0) {
+		kfree(block);
+		return NULL;
+	}
+	for (i = 0; i < nb; i++) {
+		memcpy(&block[(i * SECTOR_SIZE)], blks[i]->data, SECTOR_SIZE);
+		brelse(sb->device.major, sb->device.minor, blks[i]);
 	}
 	
 	return block;
 }
 
+/**
+ * Retrieve a directory block.
+ *
+ * \param dir Directory i-node.
+ * \param lblock Block number into the directory.
+ * \return char* NULL on error, block data (allocated with kmalloc) otherwise.
+ */
+static char *ext2_get_dir_block(vfs_inode *dir, uint32_t lblock)
+{
+	vfs_bmap_t bmap;
+
+	bmap = vfs_bmap(dir, lblock * dir->sb->s_log_block_size);
+	if (bmap.blk_number == 0) {
+		return NULL;
+	}
+
+	return ext2_get_fs_block(dir->sb, bmap.blk_number);
+}
+
+/**
+ * Find a name in a directory through its hashed index (htree). The
+ * index is walked down to the leaf block whose hash range holds the
+ * name, so only one block is read at each level.
+ *
+ * \param dir Directory i-node.
+ * \param name The name.
+ * \param inumber Where to return the i-node number of the name (0 if
+ * directory has no such name).
+ * \return 0 on success, -1 on error, VFS_NO_INDEX if directory has no
+ * (valid) index.
+ */
+int ext2_lookup(vfs_inode *dir, const char *name, uint32_t *inumber)
+{
+	ext2_fsdriver_t *fs;
+	ext2_dx_root_info_t *info;
+	ext2_dx_entry_t *entries, *at, *p, *q, *m;
+	uint32_t blk_size, nblocks, hash, block, count, level, levels;
+	int len, version;
+	char *blk, *leaf;
+
+	fs = (ext2_fsdriver_t*)dir->sb->fs_driver;
+	if ( !(fs->sb->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
+			!(dir->i_flags & EXT2_INDEX_FL) ) {
+		return VFS_NO_INDEX;
+	}
+
+	*inumber = 0;
+	len = strlen(name);
+	if (len > EXT2_NAME_LEN) {
+		return 0;
+	}
+
+	blk_size = dir->sb->s_log_block_size;
+	nblocks  = dir->i_size / blk_size;
+
+	/* Root: "." and ".." entries, followed by index information */
+	if ((blk = ext2_get_dir_block(dir, 0)) == NULL) {
+		return -1;
+	}
+	info = (ext2_dx_root_info_t*)&blk[24];
+	if (info->reserved_zero != 0 || info->info_length != 8 ||
+			info->hash_version > EXT2_HASH_TEA ||
+			info->indirect_levels >= EXT2_HTREE_LEVELS) {
+		kfree(blk);
+		return VFS_NO_INDEX;
+	}
+
+	version = info->hash_version;
+	if (fs->sb->s_flags & EXT2_FLAGS_UNSIGNED_HASH) {
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	}
+	hash    = ext2_dirhash(name, len, version, fs->sb->s_hash_seed);
+	levels  = info->indirect_levels;
+	entries = (ext2_dx_entry_t*)&blk[24 + info->info_length];
+
+	for (level = 0; ; level++) {
+		count = ((ext2_dx_countlimit_t*)entries)->count;
+		if (count == 0 || (char*)&entries[count] > &blk[blk_size]) {
+			kfree(blk);
+			return VFS_NO_INDEX;
+		}
+
+		/* Last entry with hash less or equal to name hash */
+		p = &entries[1];
+		q = &entries[count - 1];
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (m->hash > hash) {
+				q = m - 1;
+			} else {
+				p = m + 1;
+			}
+		}
+		at    = p - 1;
+		block = at->block & 0x0FFFFFFF;
+		if (block >= nblocks) {
+			kfree(blk);
+			return VFS_NO_INDEX;
+		}
+
+		if (level == levels) {
+			break;
+		}
+
+		/* Index node: fake empty entry, followed by index entries */
+		kfree(blk);
+		if ((blk = ext2_get_dir_block(dir, block)) == NULL) {
+			return -1;
+		}
+		entries = (ext2_dx_entry_t*)&blk[8];
+	}
+
+	/* Leaf blocks. Names with same hash can continue at next
+	   leaf, which has the low bit of its hash set */
+	while (1) {
+		if ((leaf = ext2_get_dir_block(dir, block)) == NULL) {
+			kfree(blk);
+			return -1;
+		}
+		*inumber = vfs_dir_find_entry(leaf, blk_size, name, len);
+		kfree(leaf);
+
+		if (*inumber != 0) {
+			break;
+		}
+
+		if (++at == &entries[count]) {
+			if (levels > 0) {
+				/* Continuation could be under the next index
+				   node, fall back to a directory scan */
+				kfree(blk);
+				return VFS_NO_INDEX;
+			}
+			break;
+		}
+		if (!(at->hash & 1) || (at->hash & ~1) != hash) {
+			break;
+		}
+		block = at->block & 0x0FFFFFFF;
+		if (block >= nblocks) {
+			kfree(blk);
+			return VFS_NO_INDEX;
+		}
+	}
+
+	kfree(blk);
+	return 0;
+}
+
+/**
+ * Convert a name into words to feed directory hash functions.
+ * \param msg The name.
+ * \param len Name length.
+ * \param buf Words.
+ * \param num Number of words.
+ * \param is_unsigned Name characters are unsigned.
+ */
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num, char is_unsigned)
+{
+	uint32_t pad, val, c;
+	int i;
+
+	pad  = (uint32_t)len | ((uint32_t)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4) {
+		len = num * 4;
+	}
+	for (i = 0; i < len; i++) {
+		if (is_unsigned) {
+			c = (uchar8_t)msg[i];
+		} else {
+			c = (uint32_t)(int)(signed char)msg[i];
+		}
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0) {
+		*buf++ = val;
+	}
+	while (--num >= 0) {
+		*buf++ = pad;
+	}
+}
+
+/**
+ * TEA block cipher, used as directory hash.
+ * \param buf Hash state.
+ * \param in Input words.
+ */
+static void tea_transform(uint32_t buf[4], uint32_t const in[4])
+{
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += 0x9E3779B9;
+		b0  += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1  += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/* Half MD4 rounds */
+#define MD4_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z)	((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s) \
+	(a += f(b, c, d) + (x), a = (a << (s)) | (a >> (32 - (s))))
+#define MD4_K1	0
+#define MD4_K2	013240474631U
+#define MD4_K3	015666365641U
+
+/**
+ * Half MD4 (only 3 rounds of 8 steps), used as directory hash.
+ * \param buf Hash state.
+ * \param in Input words.
+ */
+static void half_md4_transform(uint32_t buf[4], uint32_t const in[8])
+{
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	MD4_ROUND(MD4_F, a, b, c, d, in[0] + MD4_K1,  3);
+	MD4_ROUND(MD4_F, d, a, b, c, in[1] + MD4_K1,  7);
+	MD4_ROUND(MD4_F, c, d, a, b, in[2] + MD4_K1, 11);
+	MD4_ROUND(MD4_F, b, c, d, a, in[3] + MD4_K1, 19);
+	MD4_ROUND(MD4_F, a, b, c, d, in[4] + MD4_K1,  3);
+	MD4_ROUND(MD4_F, d, a, b, c, in[5] + MD4_K1,  7);
+	MD4_ROUND(MD4_F, c, d, a, b, in[6] + MD4_K1, 11);
+	MD4_ROUND(MD4_F, b, c, d, a, in[7] + MD4_K1, 19);
+
+	MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2,  3);
+	MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2,  5);
+	MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2,  9);
+	MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+	MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2,  3);
+	MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2,  5);
+	MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2,  9);
+	MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+	MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3,  3);
+	MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3,  9);
+	MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+	MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+	MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3,  3);
+	MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3,  9);
+	MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+	MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+/**
+ * Legacy directory hash.
+ * \param name The name.
+ * \param len Name length.
+ * \param is_unsigned Name characters are unsigned.
+ * \return The hash.
+ */
+static uint32_t dx_hack_hash(const char *name, int len, char is_unsigned)
+{
+	uint32_t hash, hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+	int c;
+
+	while (len--) {
+		if (is_unsigned) {
+			c = (uchar8_t)*name++;
+		} else {
+			c = (signed char)*name++;
+		}
+		hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+
+		if (hash & 0x80000000) {
+			hash -= 0x7FFFFFFF;
+		}
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+/**
+ * Compute directory index hash of a name.
+ * \param name The name.
+ * \param len Name length.
+ * \param version Hash version (EXT2_HASH_*).
+ * \param seed Hash seed (from super block).
+ * \return The hash (low bit is always clear).
+ */
+static uint32_t ext2_dirhash(const char *name, int len, int version, uint32_t *seed)
+{
+	uint32_t buf[4], in[8], hash;
+	char is_unsigned;
+	int i;
+
+	buf[0] = 0x67452301;
+	buf[1] = 0xEFCDAB89;
+	buf[2] = 0x98BADCFE;
+	buf[3] = 0x10325476;
+	for (i = 0; i < 4; i++) {
+		if (seed[i] != 0) {
+			memcpy(buf, seed, sizeof(buf));
+			break;
+		}
+	}
+
+	is_unsigned = (version >= EXT2_HASH_LEGACY_UNSIGNED);
+
+	switch (version) {
+		case EXT2_HASH_HALF_MD4:
+		case EXT2_HASH_HALF_MD4_UNSIGNED:
+			for (; len > 0; len -= 32, name += 32) {
+				str2hashbuf(name, len, in, 8, is_unsigned);
+				half_md4_transform(buf, in);
+			}
+			hash = buf[1];
+			break;
+
+		case EXT2_HASH_TEA:
+		case EXT2_HASH_TEA_UNSIGNED:
+			for (; len > 0; len -= 16, name += 16) {
+				str2hashbuf(name, len, in, 4, is_unsigned);
+				tea_transform(buf, in);
+			}
+			hash = buf[0];
+			break;
+
+		default:
+			hash = dx_hack_hash(name, len, is_unsigned);
+			break;
+	}
+
+	hash &= ~1;
+	if (hash == (0x7FFFFFFFU << 1)) {
+		hash = (0x7FFFFFFFU - 1) << 1;
+	}
+
+	return hash;
+}
+
 /**
  * Division a/b with rounded up.
  * \param a Value of a.
@@ -0,0 +1,572 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: iobench.c
+ * Desc: I/O workload generator for block devices: sequential or random
+ *       reads and writes, started from kernel command line.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/timer.h>
+#include <tempos/jiffies.h>
+#include <tempos/sched.h>
+#include <tempos/wait.h>
+#include <tempos/mm.h>
+#include <fs/device.h>
+#include <fs/iobench.h>
+#include <arch/io.h>
+#include <string.h>
+#include <stdlib.h>
+
+/** Default block size (sectors) */
+#define IOBENCH_DEF_BS		8
+/** Default duration (seconds) */
+#define IOBENCH_DEF_SECS	10
+
+
+static int iobench_parse(iobench_t *ib, char *opt);
+
+static char *next_field(char **str);
+
+static uint32_t iobench_sector(iobench_t *ib);
+
+static void iobench_end_io(bio_t *bio, int error);
+
+static void iobench_account(iobench_t *ib, uint32_t usecs, int error);
+
+static int iobench_direct(iobench_t *ib);
+
+static int iobench_bcache(iobench_t *ib);
+
+static void iobench_thread(void *arg);
+
+static uint32_t hist_slot_value(int slot);
+
+static void iobench_report(iobench_t *ib, uint32_t msecs);
+
+
+/**
+ * Run the I/O benchmark selected at kernel command line:
+ *
+ *   iobench=<major>:<device>,<pattern>[,<bs>[,<qd>[,<secs>[,<path>]]]]
+ *
+ * pattern is read, write, randread or randwrite, bs is the block size
+ * in bytes (multiple of 512), qd the number of I/Os in flight, secs the
+ * duration and path is direct (block I/Os to driver) or bcache (bread
+ * and bwrite, qd is always 1). iobench_span=<sectors> limits the area
+ * of the device used (default: whole device), iobench_seed=<n> sets the
+ * seed of random patterns.
+ *
+ * The benchmark runs in a kernel thread, this function returns when
+ * it's done. NOTE: write patterns destroy the data of the device.
+ */
+void run_iobench(void)
+{
+	iobench_t *ib;
+	task_t *th;
+	char *opt;
+
+	if ((opt = cmdline_get_value("iobench")) == NULL) {
+		return;
+	}
+
+	ib = (iobench_t *)kmalloc(sizeof(iobench_t), GFP_NORMAL_Z);
+	if (ib == NULL) {
+		kprintf(KERN_ERROR "iobench: no memory.\n");
+		return;
+	}
+	memset(ib, 0, sizeof(iobench_t));
+
+	if (iobench_parse(ib, opt) < 0) {
+		kfree(ib);
+		return;
+	}
+
+	if ((th = kernel_thread_create(DEFAULT_PRIORITY, iobench_thread, ib)) == NULL) {
+		kprintf(KERN_ERROR "iobench: could not create thread.\n");
+	} else {
+		kernel_thread_wait(th);
+	}
+	kfree(ib);
+}
+
+
+/**
+ * Return the next field of a comma separated list (NULL at the end).
+ */
+static char *next_field(char **str)
+{
+	char *field = *str;
+
+	if (field == NULL || *field == '\0') {
+		return NULL;
+	}
+
+	while (**str != ',' && **str != '\0') {
+		(*str)++;
+	}
+	if (**str == ',') {
+		**str = '\0';
+		(*str)++;
+	}
+	return field;
+}
+
+
+/**
+ * Parse benchmark options.
+ *
+ * \param ib The benchmark.
+ * \param opt Value of iobench option.
+ * \return 0 on success, -1 otherwise.
+ */
+static int iobench_parse(iobench_t *ib, char *opt)
+{
+	dev_blk_driver_t *driver;
+	char str[64], *pos, *field;
+	uint64_t size;
+	int bytes, i;
+
+	strncpy(str, opt, sizeof(str) - 1);
+	str[sizeof(str) - 1] = '\0';
+	pos = str;
+
+	ib->bs   = IOBENCH_DEF_BS;
+	ib->qd   = 1;
+	ib->secs = IOBENCH_DEF_SECS;
+	ib->path = IOBENCH_PATH_DIRECT;
+	ib->seed = 1;
+
+	/* Device */
+	if ((field = next_field(&pos)) == NULL) {
+		goto bad_opt;
+	}
+	for (i = 0; field[i] != ':' && field[i] != '\0'; i++);
+	if (field[i] != ':') {
+		goto bad_opt;
+	}
+	field[i]   = '\0';
+	ib->major  = atoi(field);
+	ib->device = atoi(&field[i + 1]);
+
+	if (ib->major < 0 || ib->major >= MAX_DEVBLOCK_DRIVERS ||
+			(driver = block_dev_drivers[ib->major]) == NULL) {
+		kprintf(KERN_ERROR "iobench: no driver for major %d.\n", ib->major);
+		return -1;
+	}
+
+	/* Pattern */
+	if ((field = next_field(&pos)) == NULL) {
+		goto bad_opt;
+	}
+	if (strcmp(field, "read") == 0) {
+		ib->pattern = IOBENCH_SEQ_READ;
+	} else if (strcmp(field, "write") == 0) {
+		ib->pattern = IOBENCH_SEQ_WRITE;
+	} else if (strcmp(field, "randread") == 0) {
+		ib->pattern = IOBENCH_RAND_READ;
+	} else if (strcmp(field, "randwrite") == 0) {
+		ib->pattern = IOBENCH_RAND_WRITE;
+	} else {
+		goto bad_opt;
+	}
+
+	/* Optional fields */
+	if ((field = next_field(&pos)) != NULL) {
+		bytes = atoi(field);
+		if (bytes <= 0 || (bytes % BUFF_SIZE) != 0) {
+			goto bad_opt;
+		}
+		ib->bs = bytes / BUFF_SIZE;
+	}
+	if ((field = next_field(&pos)) != NULL) {
+		ib->qd = atoi(field);
+	}
+	if ((field = next_field(&pos)) != NULL) {
+		ib->secs = atoi(field);
+	}
+	if ((field = next_field(&pos)) != NULL) {
+		if (strcmp(field, "bcache") == 0) {
+			ib->path = IOBENCH_PATH_BCACHE;
+		} else if (strcmp(field, "direct") != 0) {
+			goto bad_opt;
+		}
+	}
+
+	if (ib->qd < 1 || ib->qd > IOBENCH_MAX_QD || ib->secs < 1) {
+		goto bad_opt;
+	}
+	if (ib->path == IOBENCH_PATH_BCACHE) {
+		if (ib->bs > BCACHE_CLUSTER_MAX) {
+			kprintf(KERN_ERROR "iobench: block size up to %d bytes through bcache.\n",
+					BCACHE_CLUSTER_MAX * BUFF_SIZE);
+			return -1;
+		}
+		ib->qd = 1;
+	} else if (ib->bs > ((BIO_MAX_VECS * PAGE_SIZE) / BUFF_SIZE)) {
+		kprintf(KERN_ERROR "iobench: block size up to %d bytes.\n",
+				BIO_MAX_VECS * PAGE_SIZE);
+		return -1;
+	}
+
+	/* Area of the device (disk or partition) */
+	if (driver->minors != NULL) {
+		if (ib->device < 0 || ib->device >= MAX_MINOR_DEVICES ||
+				driver->minors[ib->device].length == 0) {
+			kprintf(KERN_ERROR "iobench: no device %d:%d.\n", ib->major, ib->device);
+			return -1;
+		}
+		size = driver->minors[ib->device].length;
+	} else {
+		/* RAM disks have no table of minors */
+		size = driver->size;
+	}
+	if (size > 0xFFFFFFFF) {
+		size = 0xFFFFFFFF;
+	}
+
+	ib->span = (uint32_t)size;
+	if ((opt = cmdline_get_value("iobench_span")) != NULL &&
+			(uint32_t)atoi(opt) < ib->span) {
+		ib->span = atoi(opt);
+	}
+	ib->span -= (ib->span % ib->bs);
+	if (ib->span == 0) {
+		kprintf(KERN_ERROR "iobench: device is smaller than block size.\n");
+		return -1;
+	}
+
+	if ((opt = cmdline_get_value("iobench_seed")) != NULL && atoi(opt) != 0) {
+		ib->seed = atoi(opt);
+	}
+
+	return 0;
+
+bad_opt:
+	kprintf(KERN_ERROR "iobench: bad option. Usage: iobench=<major>:<device>,"
+			"<read|write|randread|randwrite>[,<bs>[,<qd>[,<secs>[,<direct|bcache>]]]]\n");
+	return -1;
+}
+
+
+/**
+ * Return the first sector of the next I/O.
+ */
+static uint32_t iobench_sector(iobench_t *ib)
+{
+	uint32_t sector;
+
+	if (IOBENCH_IS_RAND(ib->pattern)) {
+		/* xorshift32 */
+		ib->seed ^= ib->seed << 13;
+		ib->seed ^= ib->seed >> 17;
+		ib->seed ^= ib->seed << 5;
+		return (ib->seed % (ib->span / ib->bs)) * ib->bs;
+	}
+
+	sector = ib->next;
+	ib->next += ib->bs;
+	if (ib->next >= ib->span) {
+		ib->next = 0;
+	}
+	return sector;
+}
+
+
+/**
+ * Account a finished I/O.
+ *
+ * \param ib The benchmark.
+ * \param usecs Latency of the I/O.
+ * \param error 0 on success.
+ */
+static void iobench_account(iobench_t *ib, uint32_t usecs, int error)
+{
+	uint32_t msb;
+	int slot;
+
+	if (error) {
+		ib->errors++;
+		return;
+	}
+	ib->ios++;
+	ib->sectors += ib->bs;
+
+	/* Slot: 8 slots for each power of 2 (values below 8 are exact) */
+	if (usecs < 8) {
+		slot = usecs;
+	} else {
+		for (msb = 3; (usecs >> (msb + 1)) != 0; msb++);
+		slot = ((msb - 2) << 3) + ((usecs >> (msb - 3)) & 0x07);
+	}
+	ib->lat[slot]++;
+}
+
+
+/**
+ * Smallest latency of a slot of the histogram.
+ */
+static uint32_t hist_slot_value(int slot)
+{
+	if (slot < 8) {
+		return slot;
+	}
+	return (uint32_t)(8 + (slot & 0x07)) << ((slot >> 3) - 1);
+}
+
+
+/**
+ * Completion of a block I/O (called with interrupts disabled).
+ */
+static void iobench_end_io(bio_t *bio, int error)
+{
+	iobench_slot_t *slot = (iobench_slot_t *)bio->private;
+	iobench_t *ib = slot->ib;
+
+	iobench_account(ib, _get_usecs() - slot->start, error);
+	slot->busy = 0;
+	ib->in_flight--;
+	ib->completed = 1;
+}
+
+
+/**
+ * Run the benchmark with block I/Os submitted to the driver, keeping
+ * up to ib->qd I/Os in flight.
+ *
+ * \param ib The benchmark.
+ * \return 0 on success, -1 otherwise.
+ */
+static int iobench_direct(iobench_t *ib)
+{
+	iobench_slot_t *slot;
+	uint32_t i, j, npages, len, end;
+	char stop;
+
+	npages = ((ib->bs * BUFF_SIZE) + PAGE_SIZE - 1) / PAGE_SIZE;
+	for (i = 0; i < ib->qd; i++) {
+		slot = &ib->slots[i];
+		slot->ib   = ib;
+		slot->busy = 0;
+		/* Segments must be whole pages (bio_add_page) */
+		slot->data = (char *)kmalloc_pages(npages, GFP_NORMAL_Z);
+		if (slot->data == NULL) {
+			kprintf(KERN_ERROR "iobench: no memory.\n");
+			while (i-- > 0) {
+				kfree_pages(ib->slots[i].data, npages);
+			}
+			return -1;
+		}
+		memset(slot->data, 0xA5, npages * PAGE_SIZE);
+	}
+
+	stop = 0;
+	end  = jiffies + (ib->secs * HZ);
+	for (;;) {
+		if (!stop && time_after_eq(jiffies, end)) {
+			stop = 1;
+		}
+
+		for (i = 0; i < ib->qd && !stop; i++) {
+			slot = &ib->slots[i];
+			if (slot->busy) {
+				continue;
+			}
+
+			bio_init(&slot->bio, (IOBENCH_IS_WRITE(ib->pattern) ? BLK_WRITE : BLK_READ),
+					ib->major, ib->device, iobench_sector(ib));
+			for (j = 0; j < npages; j++) {
+				len = (ib->bs * BUFF_SIZE) - (j * PAGE_SIZE);
+				if (len > PAGE_SIZE) {
+					len = PAGE_SIZE;
+				}
+				bio_add_page(&slot->bio, &slot->data[j * PAGE_SIZE], 0, len);
+			}
+			slot->bio.end_io  = iobench_end_io;
+			slot->bio.private = slot;
+
+			cli();
+			slot->busy  = 1;
+			slot->start = _get_usecs();
+			ib->in_flight++;
+			sti();
+
+			if (submit_bio(&slot->bio) < 0) {
+				cli();
+				iobench_account(ib, 0, 1);
+				slot->busy = 0;
+				ib->in_flight--;
+				sti();
+				stop = 1;
+			}
+		}
+
+		if (ib->in_flight == 0) {
+			if (stop) {
+				break;
+			}
+			continue;
+		}
+
+		/* Drivers wake up buffer waiters on each completion */
+		if (!ib->completed) {
+			sleep_on(WAIT_THIS_BLOCK_BUFFER_GET_FREE);
+		}
+		ib->completed = 0;
+	}
+
+	for (i = 0; i < ib->qd; i++) {
+		kfree_pages(ib->slots[i].data, npages);
+	}
+	return 0;
+}
+
+
+/**
+ * Run the benchmark through the buffer cache (one I/O at a time):
+ * reads with breadn, writes with getblk and delayed writes followed
+ * by bsync.
+ *
+ * \param ib The benchmark.
+ * \return 0 on success, -1 otherwise.
+ */
+static int iobench_bcache(iobench_t *ib)
+{
+	buff_header_t *buffs[BCACHE_CLUSTER_MAX];
+	uint32_t i, sector, start, end;
+	int error;
+
+	end = jiffies + (ib->secs * HZ);
+	while (time_before(jiffies, end)) {
+		sector = iobench_sector(ib);
+		start  = get_usecs();
+
+		if (IOBENCH_IS_WRITE(ib->pattern)) {
+			/* Whole blocks are written, there is nothing to read */
+			error = 0;
+			for (i = 0; i < ib->bs; i++) {
+				if ((buffs[i] = getblk(ib->major, ib->device, sector + i)) == NULL) {
+					error = -1;
+					break;
+				}
+				memset(buffs[i]->data, 0xA5, BUFF_SIZE);
+				bwrite(ib->major, ib->device, buffs[i], BWRITE_DELAYED);
+			}
+			if (bsync(ib->major, ib->device) < 0 && error == 0) {
+				error = 1;
+			}
+		} else {
+			error = breadn(ib->major, ib->device, sector, ib->bs, buffs);
+			if (error == 0) {
+				for (i = 0; i < ib->bs; i++) {
+					if (buffs[i]->status != BUFF_ST_VALID) {
+						error = 1;
+					}
+					brelse(ib->major, ib->device, buffs[i]);
+				}
+			}
+		}
+
+		cli();
+		iobench_account(ib, get_usecs() - start, error);
+		sti();
+		if (error < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Benchmark thread.
+ *
+ * \param arg The benchmark.
+ */
+static void iobench_thread(void *arg)
+{
+	iobench_t *ib = (iobench_t *)arg;
+	static const char *patterns[] = {"read", "write", "randread", "randwrite"};
+	uint32_t start;
+	int res;
+
+	kprintf(KERN_INFO "iobench: %d:%d %s, bs %d, qd %d, %ds, %s, span %u sectors\n",
+			ib->major, ib->device, patterns[ib->pattern], ib->bs * BUFF_SIZE,
+			ib->qd, ib->secs, (ib->path == IOBENCH_PATH_BCACHE ? "bcache" : "direct"),
+			ib->span);
+
+	start = jiffies;
+	if (ib->path == IOBENCH_PATH_BCACHE) {
+		res = iobench_bcache(ib);
+	} else {
+		res = iobench_direct(ib);
+	}
+
+	if (res < 0) {
+		kprintf(KERN_ERROR "iobench: failed.\n");
+	} else {
+		iobench_report(ib, ((jiffies - start) * 1000) / HZ);
+	}
+}
+
+
+/**
+ * Print results: IOPS, throughput and latency percentiles.
+ *
+ * \param ib The benchmark.
+ * \param msecs Elapsed time (milliseconds).
+ */
+static void iobench_report(iobench_t *ib, uint32_t msecs)
+{
+	static const uint32_t pcts[] = {500, 900, 990, 999};
+	uint32_t iops, kbps, target, count;
+	int i, slot;
+
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	iops = ((ib->ios / msecs) * 1000) + (((ib->ios % msecs) * 1000) / msecs);
+	kbps = (((ib->sectors / 2) / msecs) * 1000) + ((((ib->sectors / 2) % msecs) * 1000) / msecs);
+
+	kprintf(KERN_INFO "iobench: %u I/Os in %u ms, %u errors\n", ib->ios, msecs, ib->errors);
+	kprintf(KERN_INFO "iobench: %u IOPS, %u.%u%u MB/s\n", iops, kbps / 1024,
+			((kbps % 1024) * 10) / 1024, (((kbps % 1024) * 100) / 1024) % 10);
+
+	if (ib->ios == 0) {
+		return;
+	}
+
+	kprintf(KERN_INFO "iobench: latency (us)");
+	for (i = 0; i < (int)(sizeof(pcts) / sizeof(pcts[0])); i++) {
+		/* Smallest slot holding at least pcts[i] / 1000 of I/Os */
+		target = ((ib->ios / 1000) * pcts[i]) + (((ib->ios % 1000) * pcts[i] + 999) / 1000);
+		count  = 0;
+		for (slot = 0; slot < IOBENCH_HIST_SLOTS - 1; slot++) {
+			count += ib->lat[slot];
+			if (count >= target) {
+				break;
+			}
+		}
+		kprintf(" p%u.%u=%u", pcts[i] / 10, pcts[i] % 10, hist_slot_value(slot));
+	}
+	kprintf("\n");
+}
+
@@ -27,6 +27,7 @@
 #include <tempos/sched.h>
 #include <fs/vfs.h>
 #include <fs/device.h>
+#include <fs/dcache.h>
 
 /**
  * Mount root file system
@@ -65,11 +66,17 @@ int vfs_mount_root(dev_t device)
 	/* Read file system super block */
 	fs->get_sb(device, &mnt->sb);
 
+	/* Names cached from device before this mount are stale */
+	dcache_purge_dev(device);
+
 	/* Get root i-node */
 	root = vfs_iget(&mnt->sb, 0);
 
 	/* Check if is a directory */
-	if ( !(root->i_mode & S_IFDIR) ) {
+	if (root == NULL) {
+		return 0;
+	} else if ( !(root->i_mode & S_IFDIR) ) {
+		vfs_iput(root);
 		return 0;
 	}
 
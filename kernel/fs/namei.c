@@ -25,25 +25,29 @@
 #include <tempos/kernel.h>
 #include <tempos/sched.h>
 #include <fs/vfs.h>
+#include <fs/dcache.h>
+#include <fs/dirindex.h>
 #include <string.h>
 
 /* Prototypes */
 
-static vfs_inode *_vfs_find_component(vfs_inode *inode, char *component);
+static int _vfs_find_component(vfs_inode *inode, char *component, uint32_t *inumber);
 
 
 /**
  * Convert path name to i-node.
  *
  * \param pathname Path name.
- * \return NULL if path name is invalid, or the i-node (locked) otherwise.
+ * \return NULL if path name is invalid, or the i-node (referenced) otherwise.
+ * \note i-node should be released with vfs_iput.
  */
 vfs_inode *vfs_namei(const char *pathname)
 {
 	char comp[VFS_NAME_LEN], isroot;
-	vfs_inode *inode;
+	vfs_inode *inode, *parent;
 	task_t *current_task;
-	size_t i, start, clen;
+	size_t i, start, clen, plen;
+	uint32_t inumber;
 	
 	current_task = GET_TASK(cur_task);
 
@@ -54,9 +58,11 @@ vfs_inode *vfs_namei(const char *pathname)
 		inode  = current_task->i_cdir;
 		isroot = 0;
 	}
+	vfs_idup(inode);
 
 	start = 1;
-	for (i = 1; i <= strlen(pathname); i++) {
+	plen  = strlen(pathname);
+	for (i = 1; i <= plen; i++) {
 		if (pathname[i] == '/' || pathname[i] == '\0') {
 			clen = i - start;
 			strncpy(comp, &pathname[start], clen);
@@ -71,8 +77,29 @@ vfs_inode *vfs_namei(const char *pathname)
 				continue;
 			}
 
-			/* Find component at i-node directory */
-			if ((inode = _vfs_find_component(inode, comp)) == NULL) {
+			if ( !(inode->i_mode & S_IFDIR) ) {
+				vfs_iput(inode);
+				return NULL;
+			}
+
+			/* Find component at dentry cache, then at i-node directory */
+			if (dcache_lookup(inode, comp, &inumber) == DCACHE_MISS) {
+				if (_vfs_find_component(inode, comp, &inumber) < 0) {
+					vfs_iput(inode);
+					return NULL;
+				}
+				dcache_add(inode, comp, inumber);
+			}
+
+			if (inumber == 0) {
+				vfs_iput(inode);
+				return NULL;
+			}
+
+			parent = inode;
+			inode  = vfs_iget(parent->sb, inumber);
+			vfs_iput(parent);
+			if (inode == NULL) {
 				return NULL;
 			}
 		}
@@ -82,24 +109,27 @@ vfs_inode *vfs_namei(const char *pathname)
 }
 
 /**
- * Find component directory entry in i-node.
+ * Find component directory entry in i-node. The index of the file
+ * system is used when directory has one, otherwise the in-memory hash
+ * index, and small directories are just scanned.
  *
  * \param inode Direcroty i-node to search.
  * \param component Component name.
- * \return Component i-node (if was found), or NULL otherwise.
+ * \param inumber Where to return the component i-node number (0 if
+ * directory has no such component).
+ * \return 0 on success, -1 if directory could not be read.
  */
-static vfs_inode *_vfs_find_component(vfs_inode *inode, char *component)
+static int _vfs_find_component(vfs_inode *inode, char *component, uint32_t *inumber)
 {
-	uint32_t dirsize, blk_size, pos, bpos, oldpos;
+	uint32_t dirsize, blk_size, pos, len;
 	char *block;
-	vfs_directory dir;
 	vfs_superblock *sb;
 	vfs_bmap_t bmap;
-	vfs_inode *newinode;
+	int res;
 
 	/* Check if i-node is a directory */
 	if ( !(inode->i_mode & S_IFDIR) ) {
-		return NULL;
+		return -1;
 	} else {
 		/* Get information */
 		sb       = inode->sb;
@@ -107,55 +137,71 @@ static vfs_inode *_vfs_find_component(vfs_inode *inode, char *component)
 		blk_size = inode->sb->s_log_block_size;
 	}
 
+	/* Try directory indexes */
+	res = VFS_NO_INDEX;
+	if (sb->sb_op->lookup != NULL) {
+		res = sb->sb_op->lookup(inode, component, inumber);
+	}
+	if (res == VFS_NO_INDEX) {
+		res = dir_index_lookup(inode, component, inumber);
+	}
+	if (res != VFS_NO_INDEX) {
+		return res;
+	}
+
 	/* Read directory contents */
-	pos      = 0;
-	bpos     = 0;
-	newinode = NULL;
-	while (pos < dirsize) {
+	len      = strlen(component);
+	*inumber = 0;
+	for (pos = 0; pos < dirsize && *inumber == 0; pos += blk_size) {
 		bmap = vfs_bmap(inode, pos);
+		if (bmap.blk_count == 0) {
+			return -1;
+		} else if (bmap.blk_number == 0) {
+			/* Hole */
+			continue;
+		}
+
 		block = sb->sb_op->get_fs_block(sb, bmap.blk_number);
 		if (block == NULL) {
-			break;
-		} else {
-			bpos = bmap.blk_offset;
+			return -1;
 		}
-		
-		oldpos = bpos;
-		while(bpos < blk_size) {
-			/* Read information */
-			memcpy(&dir.inode, &block[bpos], sizeof(uint32_t));
-			bpos += sizeof(uint32_t);
-			
-			if (dir.inode == 0) {
-				break;
-			}
+		*inumber = vfs_dir_find_entry(block, blk_size, component, len);
+		kfree(block);
+	}
 
-			memcpy(&dir.rec_len, &block[bpos], sizeof(uint16_t));
-			bpos += sizeof(uint16_t);
-			
-			memcpy(&dir.name_len, &block[bpos], sizeof(uchar8_t));
-			/* skip file type, not necessary here */
-			bpos += 2 * sizeof(uchar8_t);
-			
-			memcpy(&dir.name[0], &block[bpos], dir.name_len);
-			dir.name[dir.name_len] = '\0';
-
-			oldpos += dir.rec_len;
-			bpos = oldpos;
-
-			if (strcmp(dir.name, component) == 0) {
-				/* Component found! */
-				newinode = vfs_iget(inode->sb, dir.inode);
-				/* TODO: iput current inode */
-				/* vfs_iput(inode->sb, inode); */
-				break;
-			}
+	return 0;
+}
+
+/**
+ * Find a name in a directory block.
+ *
+ * \param block Directory block data.
+ * \param size Block size.
+ * \param name The name.
+ * \param len Name length.
+ * \return i-node number of the name, 0 if block has no such name.
+ */
+uint32_t vfs_dir_find_entry(const char *block, uint32_t size, const char *name, uint32_t len)
+{
+	uint32_t pos, inumber;
+	uint16_t rec_len;
+
+	/* Entries are 4 bytes aligned: i-node, entry length, name length, type */
+	for (pos = 0; (pos + 8) <= size; pos += rec_len) {
+		inumber = *(uint32_t *)&block[pos];
+		rec_len = *(uint16_t *)&block[pos + 4];
+
+		if (rec_len < 8 || (pos + rec_len) > size) {
+			/* Corrupted entry */
+			break;
 		}
 
-		pos += blk_size;
-		kfree(block);
+		if (inumber != 0 && (uchar8_t)block[pos + 6] == len &&
+				strncmp(&block[pos + 8], name, len) == 0) {
+			return inumber;
+		}
 	}
 
-	return newinode;
+	return 0;
 }
 
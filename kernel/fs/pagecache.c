@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) 2009-2011 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: pagecache.c
+ * Desc: Implements the page cache (file data cached by i-node and page)
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fs/pagecache.h>
+#include <fs/bhash.h>
+#include <tempos/wait.h>
+#include <tempos/sched.h>
+#include <arch/io.h>
+
+/** Hash function: position of a page into hash table */
+#define PCACHE_HASH(device, inumber, index) \
+	(((inumber) * 31 + (index) + ((device).minor << 3) + ((device).major << 7)) & (PCACHE_HASH_SIZE - 1))
+
+/** The page cache */
+static pcache_t pcache;
+
+/* Prototypes */
+static void pcache_list_add(pcache_page_t *head, pcache_page_t *page, char at_tail);
+static void pcache_list_remove(pcache_page_t *page);
+static pcache_page_t *pcache_find(dev_t device, uint32_t inumber, uint32_t index);
+static void pcache_hash_add(pcache_page_t *page);
+static void pcache_hash_remove(pcache_page_t *page);
+static pcache_page_t *pcache_alloc(void);
+static int pcache_fill(pcache_page_t *page);
+static void pcache_readahead(vfs_inode *inode, uint32_t index);
+static void pcache_readahead_thread(void *arg);
+
+
+/**
+ * Initialize the page cache.
+ */
+void init_pcache(void)
+{
+	uint32_t i;
+
+	memset(&pcache, 0, sizeof(pcache_t));
+
+	pcache.pages = (pcache_page_t*)kmalloc(sizeof(pcache_page_t) * PCACHE_MAX_PAGES, GFP_NORMAL_Z);
+	if (pcache.pages == NULL) {
+		panic("Could not allocate memory to page cache.");
+	}
+	memset(pcache.pages, 0, sizeof(pcache_page_t) * PCACHE_MAX_PAGES);
+
+	/* List heads */
+	pcache.lru_head.lru_prev    = &pcache.lru_head;
+	pcache.lru_head.lru_next    = &pcache.lru_head;
+	pcache.unused_head.lru_prev = &pcache.unused_head;
+	pcache.unused_head.lru_next = &pcache.unused_head;
+
+	/* Pages get memory on demand */
+	for (i = 0; i < PCACHE_MAX_PAGES; i++) {
+		pcache_list_add(&pcache.unused_head, &pcache.pages[i], 1);
+	}
+
+	/* Memory that cache will leave to the rest of the system */
+	pcache.reserve = get_free_pages() >> PCACHE_RESERVE_SHIFT;
+
+	if (register_shrinker(pcache_shrink) < 0) {
+		kprintf(KERN_WARNING "Page cache: could not register shrinker.\n");
+	}
+
+	if (kernel_thread_create(DEFAULT_PRIORITY, pcache_readahead_thread, NULL) == NULL) {
+		panic("Could not create page cache read ahead thread.");
+	}
+}
+
+
+/**
+ * Insert a page into a circular list.
+ *
+ * \param head List head.
+ * \param page The page.
+ * \param at_tail If not zero, page is put at the end of list,
+ * otherwise at the beginning.
+ * \note Should be called with interrupts disabled.
+ */
+static void pcache_list_add(pcache_page_t *head, pcache_page_t *page, char at_tail)
+{
+	pcache_page_t *tmp;
+
+	if (page->lru_next != NULL) {
+		/* Already on a list */
+		return;
+	}
+
+	if (at_tail) {
+		tmp = head->lru_prev;
+		page->lru_prev = tmp;
+		page->lru_next = head;
+		head->lru_prev = page;
+		tmp->lru_next  = page;
+	} else {
+		tmp = head->lru_next;
+		page->lru_next = tmp;
+		page->lru_prev = head;
+		head->lru_next = page;
+		tmp->lru_prev  = page;
+	}
+}
+
+
+/**
+ * Remove a page from LRU (or unused) list.
+ *
+ * \param page The page.
+ * \note Should be called with interrupts disabled.
+ */
+static void pcache_list_remove(pcache_page_t *page)
+{
+	if (page->lru_next == NULL) {
+		return;
+	}
+
+	page->lru_prev->lru_next = page->lru_next;
+	page->lru_next->lru_prev = page->lru_prev;
+	page->lru_next = NULL;
+	page->lru_prev = NULL;
+}
+
+
+/**
+ * Search for a page on hash table.
+ *
+ * \param device Device of the i-node.
+ * \param inumber i-node number.
+ * \param index Page index into the file.
+ * \return pcache_page_t The page (if was found), NULL otherwise.
+ * \note Should be called with interrupts disabled.
+ */
+static pcache_page_t *pcache_find(dev_t device, uint32_t inumber, uint32_t index)
+{
+	pcache_page_t *tmp;
+
+	tmp = pcache.hashtable[PCACHE_HASH(device, inumber, index)];
+	while (tmp != NULL) {
+		if (tmp->index == index && tmp->inumber == inumber && DEV_CMP(tmp->device, device)) {
+			break;
+		}
+		tmp = tmp->next;
+	}
+
+	return tmp;
+}
+
+
+/**
+ * Insert a page into hash table.
+ *
+ * \param page The page.
+ * \note Should be called with interrupts disabled.
+ */
+static void pcache_hash_add(pcache_page_t *page)
+{
+	uint32_t pos;
+
+	pos = PCACHE_HASH(page->device, page->inumber, page->index);
+	page->prev = NULL;
+	page->next = pcache.hashtable[pos];
+	if (page->next != NULL) {
+		page->next->prev = page;
+	}
+	pcache.hashtable[pos] = page;
+	page->flags |= PCACHE_FL_HASHED;
+}
+
+
+/**
+ * Remove a page from hash table.
+ *
+ * \param page The page.
+ * \note Should be called with interrupts disabled.
+ */
+static void pcache_hash_remove(pcache_page_t *page)
+{
+	if (!(page->flags & PCACHE_FL_HASHED)) {
+		return;
+	}
+
+	if (page->prev == NULL) {
+		pcache.hashtable[PCACHE_HASH(page->device, page->inumber, page->index)] = page->next;
+	} else {
+		page->prev->next = page->next;
+	}
+	if (page->next != NULL) {
+		page->next->prev = page->prev;
+	}
+	page->prev   = NULL;
+	page->next   = NULL;
+	page->flags &= ~PCACHE_FL_HASHED;
+}
+
+
+/**
+ * Get a page to hold new data. While there is free memory the cache
+ * grows, otherwise the least recently used page is reused.
+ *
+ * \return pcache_page_t The page (out of any list), NULL if all pages are in use.
+ */
+static pcache_page_t *pcache_alloc(void)
+{
+	pcache_page_t *page;
+	char *data;
+
+	if (pcache.unused_head.lru_next != &pcache.unused_head &&
+			(get_free_pages() > pcache.reserve ||
+			 pcache.lru_head.lru_next == &pcache.lru_head)) {
+
+		if ((data = kmalloc_pages(1, GFP_NORMAL_Z)) != NULL) {
+			cli();
+			page = pcache.unused_head.lru_next;
+			if (page != &pcache.unused_head) {
+				pcache_list_remove(page);
+				page->data = data;
+				pcache.npages++;
+				sti();
+				return page;
+			}
+			sti();
+			kfree_pages(data, 1);
+		}
+	}
+
+	/* Reuse the least recently used page */
+	cli();
+	page = pcache.lru_head.lru_next;
+	if (page == &pcache.lru_head) {
+		sti();
+		return NULL;
+	}
+	pcache_list_remove(page);
+	pcache_hash_remove(page);
+	sti();
+
+	return page;
+}
+
+
+/**
+ * Read page data from device. Holes and data beyond the end of file
+ * are filled with zeros.
+ *
+ * \param page The page.
+ * \return 0 on success, -1 otherwise.
+ */
+static int pcache_fill(pcache_page_t *page)
+{
+	vfs_inode *inode = page->inode;
+	vfs_bmap_t bmap;
+	buff_header_t *buffs[BCACHE_CLUSTER_MAX];
+	uint32_t blk_size, spb, start, end, pos, i, n;
+	int major, minor, ret;
+
+	major    = inode->device.major;
+	minor    = inode->device.minor;
+	blk_size = inode->sb->s_log_block_size;
+	spb      = blk_size / BUFF_SIZE;
+
+	start = page->index << PAGE_SHIFT;
+	end   = start + PAGE_SIZE;
+	if (end > inode->i_size) {
+		end = inode->i_size;
+	}
+
+	memset(page->data, 0, PAGE_SIZE);
+
+	ret = 0;
+	for (pos = start; pos < end && ret == 0; pos += n * BUFF_SIZE) {
+		bmap = vfs_bmap(inode, pos);
+		if (bmap.blk_count == 0) {
+			return -1;
+		} else if (bmap.blk_number == 0) {
+			/* Hole */
+			n = spb;
+			continue;
+		}
+
+		/* Sectors of contiguous blocks that are inside the page (and
+		   the file) are read at once */
+		n = (end - pos + BUFF_SIZE - 1) / BUFF_SIZE;
+		if (n > (bmap.blk_count * spb)) {
+			n = bmap.blk_count * spb;
+		}
+		if (n > BCACHE_CLUSTER_MAX) {
+			n = BCACHE_CLUSTER_MAX;
+		}
+
+		if (breadn(major, minor, ((uint64_t)bmap.blk_number * spb), n, buffs) < 0) {
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			/* Buffers that are not valid could not be read */
+			if (buffs[i]->status != BUFF_ST_VALID) {
+				ret = -1;
+			} else if (ret == 0) {
+				memcpy(&page->data[(pos - start) + (i * BUFF_SIZE)], buffs[i]->data, BUFF_SIZE);
+			}
+			brelse(major, minor, buffs[i]);
+		}
+	}
+
+	return ret;
+}
+
+
+/**
+ * Get a page of a file from the cache, reading it from device if needed.
+ * On sequential reads the next pages are read ahead.
+ *
+ * \param inode File i-node.
+ * \param index Page index into the file.
+ * \return pcache_page_t The page (referenced), NULL on error or if page
+ * is beyond the end of file.
+ * \note Page should be released with pcache_put_page.
+ */
+pcache_page_t *pcache_get_page(vfs_inode *inode, uint32_t index)
+{
+	pcache_page_t *page;
+	char seq;
+
+	if (inode == NULL || index >= PCACHE_NPAGES(inode->i_size)) {
+		return NULL;
+	}
+
+	while (1) {
+
+		cli();
+		if ((page = pcache_find(inode->device, inode->number, index)) != NULL) {
+			/* Page is cached */
+			if (page->count++ == 0) {
+				pcache_list_remove(page);
+			}
+			sti();
+
+			while ((page->status & PCACHE_ST_LOCKED)) {
+				sleep_on(WAIT_PCACHE_PAGE_READY);
+			}
+
+			if ((page->status & PCACHE_ST_ERROR)) {
+				pcache_put_page(page);
+				return NULL;
+			}
+
+			if ((page->flags & PCACHE_FL_READAHEAD)) {
+				/* Reader got into read ahead window, move it forward */
+				page->flags &= ~PCACHE_FL_READAHEAD;
+				pcache_readahead(inode, index + 1);
+			}
+			return page;
+		}
+		sti();
+
+		/* Page is not cached */
+		if ((page = pcache_alloc()) == NULL) {
+			/* All pages are in use */
+			sleep_on(WAIT_PCACHE_PAGE_READY);
+			continue;
+		}
+
+		/* i-node is referenced while page is being filled */
+		vfs_idup(inode);
+
+		cli();
+		if (pcache_find(inode->device, inode->number, index) != NULL) {
+			/* Someone read the page meanwhile */
+			pcache_list_add(&pcache.lru_head, page, 0);
+			sti();
+			vfs_iput(inode);
+			continue;
+		}
+		page->device  = inode->device;
+		page->inumber = inode->number;
+		page->index   = index;
+		page->inode   = inode;
+		page->count   = 1;
+		page->status  = PCACHE_ST_LOCKED;
+		page->flags   = 0;
+		pcache_hash_add(page);
+		seq = (index == 0 || pcache_find(inode->device, inode->number, index - 1) != NULL);
+		sti();
+
+		page->status = (pcache_fill(page) < 0 ? PCACHE_ST_ERROR : PCACHE_ST_VALID);
+		page->inode  = NULL;
+		vfs_iput(inode);
+		wakeup(WAIT_PCACHE_PAGE_READY);
+
+		if (page->status == PCACHE_ST_ERROR) {
+			pcache_put_page(page);
+			return NULL;
+		}
+
+		if (seq) {
+			pcache_readahead(inode, index + 1);
+		}
+		return page;
+	}
+}
+
+
+/**
+ * Release a page got by pcache_get_page.
+ *
+ * \param page The page.
+ */
+void pcache_put_page(pcache_page_t *page)
+{
+	if (page == NULL) {
+		return;
+	}
+
+	cli();
+	if (--page->count == 0 && !(page->status & PCACHE_ST_LOCKED)) {
+		if ((page->status & PCACHE_ST_ERROR)) {
+			/* Data is not valid, reuse it first */
+			pcache_hash_remove(page);
+			pcache_list_add(&pcache.lru_head, page, 0);
+		} else {
+			pcache_list_add(&pcache.lru_head, page, 1);
+		}
+	}
+	sti();
+
+	wakeup(WAIT_PCACHE_PAGE_READY);
+}
+
+
+/**
+ * Read file data through the page cache.
+ *
+ * \param inode File i-node.
+ * \param offset File byte offset.
+ * \param buf Where data will be copied.
+ * \param len Number of bytes to read.
+ * \return Number of bytes read.
+ */
+uint32_t pcache_read(vfs_inode *inode, uint32_t offset, char *buf, uint32_t len)
+{
+	pcache_page_t *page;
+	uint32_t pos, count, done;
+
+	if (inode == NULL || offset >= inode->i_size) {
+		return 0;
+	}
+	if (len > (inode->i_size - offset)) {
+		len = inode->i_size - offset;
+	}
+
+	done = 0;
+	while (done < len) {
+		if ((page = pcache_get_page(inode, (offset + done) >> PAGE_SHIFT)) == NULL) {
+			break;
+		}
+
+		pos   = (offset + done) & (PAGE_SIZE - 1);
+		count = PAGE_SIZE - pos;
+		if (count > (len - done)) {
+			count = len - done;
+		}
+		memcpy(&buf[done], &page->data[pos], count);
+		pcache_put_page(page);
+
+		done += count;
+	}
+
+	return done;
+}
+
+
+/**
+ * Queue next pages of a file to be read by read ahead thread.
+ *
+ * \param inode File i-node.
+ * \param index First page to be read ahead.
+ */
+static void pcache_readahead(vfs_inode *inode, uint32_t index)
+{
+	pcache_page_t *page;
+	uint32_t i, last;
+
+	last = PCACHE_NPAGES(inode->i_size);
+	if ((index + PCACHE_READAHEAD) < last) {
+		last = index + PCACHE_READAHEAD;
+	}
+
+	for (i = index; i < last && pcache.ra_count < PCACHE_RA_QUEUE; i++) {
+		cli();
+		page = pcache_find(inode->device, inode->number, i);
+		sti();
+		if (page != NULL) {
+			continue;
+		}
+
+		if ((page = pcache_alloc()) == NULL) {
+			break;
+		}
+
+		/* i-node is referenced until read ahead thread fills the page */
+		vfs_idup(inode);
+
+		cli();
+		if (pcache_find(inode->device, inode->number, i) != NULL ||
+				pcache.ra_count >= PCACHE_RA_QUEUE) {
+			pcache_list_add(&pcache.lru_head, page, 0);
+			sti();
+			vfs_iput(inode);
+			continue;
+		}
+		page->device  = inode->device;
+		page->inumber = inode->number;
+		page->index   = i;
+		page->inode   = inode;
+		page->count   = 0;
+		page->status  = PCACHE_ST_LOCKED;
+		page->flags   = PCACHE_FL_READAHEAD;
+		pcache_hash_add(page);
+
+		pcache.ra_queue[(pcache.ra_first + pcache.ra_count) % PCACHE_RA_QUEUE] = page;
+		pcache.ra_count++;
+		sti();
+	}
+
+	wakeup(WAIT_PCACHE_READAHEAD);
+}
+
+
+/**
+ * Read ahead thread: read queued pages, so readers don't wait for them.
+ *
+ * \param arg Not used.
+ */
+static void pcache_readahead_thread(void *arg)
+{
+	pcache_page_t *page;
+	vfs_inode *inode;
+	char status;
+
+	while (1) {
+		while (pcache.ra_count == 0) {
+			sleep_on(WAIT_PCACHE_READAHEAD);
+		}
+
+		cli();
+		page = pcache.ra_queue[pcache.ra_first];
+		pcache.ra_first = (pcache.ra_first + 1) % PCACHE_RA_QUEUE;
+		pcache.ra_count--;
+		sti();
+
+		status = (pcache_fill(page) < 0 ? PCACHE_ST_ERROR : PCACHE_ST_VALID);
+		inode  = page->inode;
+		page->inode = NULL;
+		vfs_iput(inode);
+
+		cli();
+		page->status = status;
+		if (page->count == 0) {
+			if (status == PCACHE_ST_ERROR) {
+				pcache_hash_remove(page);
+				pcache_list_add(&pcache.lru_head, page, 0);
+			} else {
+				pcache_list_add(&pcache.lru_head, page, 1);
+			}
+		}
+		sti();
+
+		wakeup(WAIT_PCACHE_PAGE_READY);
+	}
+}
+
+
+/**
+ * Release unreferenced pages to give memory back to the system.
+ *
+ * \param npages Number of pages needed.
+ * \return Number of pages released.
+ * \note Called by kmalloc, maybe with interrupts disabled.
+ */
+uint32_t pcache_shrink(uint32_t npages)
+{
+	pcache_page_t *page;
+	uint32_t freed = 0;
+	uint32_t iflags;
+	char *data;
+
+	if (pcache.pages == NULL) {
+		return 0;
+	}
+
+	while (freed < npages) {
+		iflags = irq_save();
+		page = pcache.lru_head.lru_next;
+		if (page == &pcache.lru_head) {
+			irq_restore(iflags);
+			break;
+		}
+		pcache_list_remove(page);
+		pcache_hash_remove(page);
+
+		data       = page->data;
+		page->data = NULL;
+		pcache.npages--;
+		pcache_list_add(&pcache.unused_head, page, 1);
+		irq_restore(iflags);
+
+		kfree_pages(data, 1);
+		freed++;
+	}
+
+	return freed;
+}
+
@@ -43,9 +43,16 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 	part_st *part, *epart;
 	partition_st *partitions;
 	int i;
-	uint32_t fsector, pos, count, exnum;
+	uint32_t fsector, estart, pos, count, exnum;
 
 
+	/* Buffer headers don't hold block data, so give it some space */
+	sec.data = (char*)kmalloc(BUFF_SIZE, GFP_NORMAL_Z);
+	if (sec.data == NULL) {
+		return NULL;
+	}
+	sec.bio = NULL;
+
 	/* Read MBR */
 	sec.addr = 0;
 	blk_drv.dev_ops->read_sync_block(blk_drv.major, device, &sec);
@@ -53,12 +60,14 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 
 	/* Check for boot signature */
 	if (mbr.boot_signature[0] != 0x55 || mbr.boot_signature[1] != 0xaa) {
+		kfree(sec.data);
 		return NULL;
 	}
 	
 	/* Alloc partition table structure */
 	ptable = (part_table_st*)kmalloc(sizeof(part_table_st), GFP_NORMAL_Z);
 	if (ptable == NULL) {
+		kfree(sec.data);
 		return NULL;
 	}
 
@@ -73,8 +82,9 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 		if (part->sysid != 0x00) {
 			if (part->sysid == 0x05 || part->sysid == 0x0f) {
 				/* Extended, read logic partitions  */
-				epart = part;
-				fsector = epart->LBA_first_sector;
+				epart   = part;
+				estart  = epart->LBA_first_sector;
+				fsector = estart;
 				while(epart->sysid != 0) {
 
 					/* Read the first EBR from extended partition */
@@ -84,8 +94,9 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 				
 					count++;
 				
-					epart = &ebr.next_ebr;
-					fsector += epart->LBA_first_sector;
+					/* Next EBR is relative to the extended partition */
+					epart   = &ebr.next_ebr;
+					fsector = estart + epart->LBA_first_sector;
 				}
 			}
 			count++;
@@ -97,6 +108,7 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 	partitions = (partition_st*)kmalloc(sizeof(partition_st) * count, GFP_NORMAL_Z);
 	if (partitions == NULL) {
 		kfree(ptable);
+		kfree(sec.data);
 		return NULL;
 	}
 	
@@ -116,7 +128,8 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 
 				exnum   = 5;
 				epart   = part;
-				fsector = epart->LBA_first_sector;
+				estart  = epart->LBA_first_sector;
+				fsector = estart;
 				while(epart->sysid != 0) {
 
 					/* Read the first EBR from extended partition */
@@ -124,16 +137,18 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 					blk_drv.dev_ops->read_sync_block(blk_drv.major, device, &sec);
 					memcpy(&ebr, sec.data, sizeof(ebr));
 				
+					/* Logical partition is relative to its EBR */
 					epart = &ebr.partition;
-					partitions[pos].init   = fsector;
+					partitions[pos].init   = (uint64_t)fsector + epart->LBA_first_sector;
 					partitions[pos].length = (uint64_t)epart->total_sectors;
 					partitions[pos].id     = epart->sysid;
 					partitions[pos].type   = PART_TYPE_LOGIC;
 					partitions[pos].number = exnum++;
 					pos++;
 				
-					epart = &ebr.next_ebr;
-					fsector += epart->LBA_first_sector;
+					/* Next EBR is relative to the extended partition */
+					epart   = &ebr.next_ebr;
+					fsector = estart + epart->LBA_first_sector;
 				}
 			} else {
 				/* Primary */
@@ -148,6 +163,8 @@ part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device)
 	}
 	ptable->partitions = partitions;
 
+	kfree(sec.data);
+
 	return ptable;
 }
 
@@ -171,34 +188,100 @@ void print_partition_table(part_table_st *ptable, char *devstr)
 
 
 /**
- * Translate partition block address to disk sector address.
+ * Add a disk to the table of device numbers of a driver. It should
+ * be added before its partition table is read.
  *
- * \param diskaddr Disk address (sector number converted from partition address).
- * \param ptable Partition table.
- * \param pnumber Partition number.
- * \param paddress Partition address.
- * \return 0 on success (it's a valid partition address), -1 otherwise.
+ * \param driver Driver of the disk.
+ * \param disk Device number of the (whole) disk.
+ * \param sectors Size of the disk.
+ * \return 0 on success, -1 otherwise.
  */
-int translate_part_address(uint64_t *diskaddr, part_table_st *ptable, uint32_t pnumber, uint64_t paddress)
+int blk_add_disk(dev_blk_driver_t *driver, int disk, uint64_t sectors)
+{
+	if (disk < 0 || disk >= MAX_MINOR_DEVICES) {
+		return -1;
+	}
+
+	if (driver->minors == NULL) {
+		driver->minors = (blk_minor_t *)kmalloc(sizeof(blk_minor_t) * MAX_MINOR_DEVICES,
+				GFP_NORMAL_Z);
+		if (driver->minors == NULL) {
+			return -1;
+		}
+		memset(driver->minors, 0, sizeof(blk_minor_t) * MAX_MINOR_DEVICES);
+	}
+
+	driver->minors[disk].start  = 0;
+	driver->minors[disk].length = sectors;
+	driver->minors[disk].disk   = disk;
+
+	return 0;
+}
+
+
+/**
+ * Add the partitions of a disk to the table of device numbers of a
+ * driver: partition N is the device number of the disk plus N.
+ *
+ * \param driver Driver of the disk.
+ * \param disk Device number of the disk (already added).
+ * \param ptable Partition table of the disk.
+ * \param max_parts Device numbers of each disk (partitions are from
+ * 1 to max_parts - 1).
+ */
+void blk_add_partitions(dev_blk_driver_t *driver, int disk,
+		part_table_st *ptable, uint32_t max_parts)
 {
-	uint32_t i;
-	uint64_t newaddr;
 	partition_st *part;
+	blk_minor_t *minor;
+	uint32_t i;
+
+	if (driver->minors == NULL || ptable == NULL) {
+		return;
+	}
 
 	for (i = 0; i < ptable->size; i++) {
 		part = &ptable->partitions[i];
-		if (part->number == pnumber) {
-			/* Check limits */
-			if (paddress > part->length) {
-				return -1;
-			} else {
-				newaddr = part->init + paddress;
-				*diskaddr = newaddr;
-				return 0;
-			}
+		if (part->number == 0 || part->number >= max_parts ||
+				(disk + part->number) >= MAX_MINOR_DEVICES) {
+			kprintf(KERN_WARNING "Partition %d of disk %d:%d can't be used\n",
+					part->number, driver->major, disk);
+			continue;
 		}
+
+		minor = &driver->minors[disk + part->number];
+		minor->start  = part->init;
+		minor->length = part->length;
+		minor->disk   = disk;
 	}
-	
-	return -1;
+}
+
+
+/**
+ * Map a sector of a device (disk or partition) to a disk address.
+ *
+ * \param driver Driver of the device.
+ * \param device Device number.
+ * \param sector Sector address (relative to the device).
+ * \param count Number of sectors (all of them should be inside the device).
+ * \param diskaddr Returns the disk address of the sector.
+ * \return Device number of the disk, -1 if address is not valid.
+ */
+int blk_map_sector(dev_blk_driver_t *driver, int device, uint64_t sector,
+		uint32_t count, uint64_t *diskaddr)
+{
+	blk_minor_t *minor;
+
+	if (driver->minors == NULL || device < 0 || device >= MAX_MINOR_DEVICES) {
+		return -1;
+	}
+
+	minor = &driver->minors[device];
+	if (sector >= minor->length || count > (minor->length - sector)) {
+		return -1;
+	}
+
+	*diskaddr = minor->start + sector;
+	return minor->disk;
 }
 
@@ -26,6 +26,10 @@
 #include <tempos/wait.h>
 #include <fs/vfs.h>
 #include <fs/device.h>
+#include <fs/pagecache.h>
+#include <fs/dcache.h>
+#include <fs/dirindex.h>
+#include <fs/elevator.h>
 #include <arch/io.h>
 
 #ifdef CONFIG_FS_EXT2
@@ -33,13 +37,21 @@
 #endif
 
 
+/** Hash function: position of an i-node into hash table */
+#define INODE_HASH(device, number) \
+	(((number) + ((device).minor << 3) + ((device).major << 7)) & (INODE_HASH_TABLE_SIZE - 1))
+
 /** I-nodes hash queue */
-vfs_inode **inode_hash_table;
+static vfs_inode *inode_hash_table[INODE_HASH_TABLE_SIZE];
+
+/** Unreferenced i-nodes (least recently used first) */
+static vfs_inode free_inodes_head;
+
+/** I-node objects not holding any i-node */
+static vfs_inode unused_inodes_head;
 
-/** Global list of free i-nodes */
-vfs_inode *free_inodes;
-/** Head of the free i-nodes list */
-vfs_inode *free_inodes_head;
+/** Number of i-node objects allocated */
+static uint32_t nr_inodes;
 
 /** Global system file table */
 vfs_file *file_table;
@@ -56,13 +68,19 @@ static int vfs_reg_types = 0;
 /* Prototypes */
 static uint32_t _ipow(uint32_t x, uint32_t y);
 
+static void inode_list_add(vfs_inode *head, vfs_inode *inode);
+
+static void inode_list_remove(vfs_inode *inode);
+
 static vfs_inode *search_inode(dev_t device, uint32_t number);
 
-static void inode_remove_from_freelist(vfs_inode *inode);
+static void inode_hash_add(vfs_inode *inode);
+
+static void inode_hash_remove(vfs_inode *inode);
 
-static void add_inode_htable(vfs_inode *inode);
+static vfs_inode *get_free_inode(void);
 
-static vfs_inode *get_free_inode(vfs_superblock *sb, uint32_t number);
+static uint32_t bmap_run(uint32_t *table, uint32_t index, uint32_t size, uint32_t max);
 
 /**
  * Integer power function.
@@ -97,37 +115,18 @@ static uint32_t _ipow(uint32_t x, uint32_t y)
 void register_all_fs_types(void)
 {
 	int i;
-	vfs_inode *head, *inode, *prev;
-	size_t ht_entries = INODE_HASH_TABLE_SIZE;
 
 	kprintf(KERN_INFO "Initializing VFS...\n");
 
-	free_inodes = (vfs_inode*)kmalloc(sizeof(vfs_inode) * (VFS_MAX_OPEN_FILES+1), GFP_NORMAL_Z);
-	inode_hash_table = (vfs_inode**)kmalloc(sizeof(vfs_inode*) * ht_entries, GFP_NORMAL_Z);
-	if (free_inodes == NULL || inode_hash_table == NULL) {
-		panic("Could not allocate memory for i-node system queue.");
-	}
-
-	/* Initialize i-node hash table */
-	memset(inode_hash_table, 0, sizeof(vfs_inode*) * ht_entries);
-
-	/* Make circular linked list of free i-nodes */
-	head = &free_inodes[0];
-	head->free_next = head;
-	head->free_prev = head;
-	prev = head;
-	
-	for (i = 1; i < VFS_MAX_OPEN_FILES; i++) {
-		inode = &free_inodes[i];
-		inode->free_prev = prev;
-		inode->free_next = head;
-		head->free_prev = inode;
-		prev->free_next = inode;
-		prev = inode;
-	}
-	
-	head->flags = IFLAG_LIST_HEAD;
-	free_inodes_head = head;
+	/* Initialize i-node cache (i-node objects are allocated on demand) */
+	memset(inode_hash_table, 0, sizeof(inode_hash_table));
+	free_inodes_head.free_next   = &free_inodes_head;
+	free_inodes_head.free_prev   = &free_inodes_head;
+	free_inodes_head.flags       = IFLAG_LIST_HEAD;
+	unused_inodes_head.free_next = &unused_inodes_head;
+	unused_inodes_head.free_prev = &unused_inodes_head;
+	unused_inodes_head.flags     = IFLAG_LIST_HEAD;
+	nr_inodes = 0;
 
 	/* Initialize system's file table */
 	file_table = (vfs_file*)kmalloc(sizeof(vfs_file) * VFS_MAX_OPEN_FILES, GFP_NORMAL_Z);
@@ -138,6 +137,18 @@ void register_all_fs_types(void)
 	/* Initialize device drivers interface */
 	init_drivers_interface();
 
+	/* Initialize pool of block requests */
+	init_blk_requests();
+
+	/* Initialize block buffer cache */
+	init_bcache();
+
+	/* Initialize page cache */
+	init_pcache();
+
+	/* Initialize dentry cache */
+	init_dcache();
+
 	for (i = 0; i < VFS_SUPPORTED_FS; i++) {
 		vfs_filesystems[i] = NULL;
 	}
@@ -165,30 +176,62 @@ void register_fs_type(vfs_fs_type *type)
 	vfs_reg_types++;
 }
 
+/**
+ * Insert an i-node at the end of a circular list (free or unused).
+ *
+ * \param head List head.
+ * \param inode i-node.
+ * \note Should be called with interrupts disabled.
+ */
+static void inode_list_add(vfs_inode *head, vfs_inode *inode)
+{
+	vfs_inode *tmp;
+
+	if (inode->free_next != NULL) {
+		/* Already on a list */
+		return;
+	}
+
+	tmp = head->free_prev;
+	inode->free_prev = tmp;
+	inode->free_next = head;
+	head->free_prev  = inode;
+	tmp->free_next   = inode;
+}
+
+/**
+ * Remove i-node from free (or unused) list.
+ *
+ * \param inode i-node.
+ * \note Should be called with interrupts disabled.
+ */
+static void inode_list_remove(vfs_inode *inode)
+{
+	if (inode->free_next == NULL) {
+		return;
+	}
+
+	inode->free_prev->free_next = inode->free_next;
+	inode->free_next->free_prev = inode->free_prev;
+	inode->free_next = NULL;
+	inode->free_prev = NULL;
+}
+
 /**
  * Search for an i-node on i-nodes queue
  *
  * \param device Device which i-node belong.
  * \param number i-node number
  * \return vfs_inode The i-node (if was found), NULL otherwise.
+ * \note Should be called with interrupts disabled.
  */
 static vfs_inode *search_inode(dev_t device, uint32_t number)
 {
-	vfs_inode *head, *tmp;
-	uint32_t pos;
-
-	/* Find position based on i-node number */
-	pos = number % INODE_HASH_TABLE_SIZE;
-	head = inode_hash_table[pos];
+	vfs_inode *tmp;
 
-	if (head == NULL) {
-		return NULL;
-	}
-
-	/* Search for the i-node */
-	tmp = head;
+	tmp = inode_hash_table[INODE_HASH(device, number)];
 	while (tmp != NULL) {
-		if ( DEV_CMP(tmp->device, device) ) {
+		if (tmp->number == number && DEV_CMP(tmp->device, device)) {
 			break;
 		}
 		tmp = tmp->next;
@@ -198,156 +241,97 @@ static vfs_inode *search_inode(dev_t device, uint32_t number)
 }
 
 /**
- * Remove i-node from free list.
+ * Insert i-node into hash queue.
+ *
  * \param inode i-node.
+ * \note Should be called with interrupts disabled.
  */
-static void inode_remove_from_freelist(vfs_inode *inode)
+static void inode_hash_add(vfs_inode *inode)
 {
-	vfs_inode *head, *tmp, *prev, *next;
-
-	head = free_inodes_head;
-	tmp = head->free_next;
-	while (tmp != head) {
-		if ( DEV_CMP(tmp->device, inode->device) ) {
-			break;
-		}
-		tmp = tmp->free_next;
-	}
+	uint32_t pos;
 
-	if (tmp == head) {
-		/* i-node it's not on free list */
-		return;
+	pos = INODE_HASH(inode->device, inode->number);
+	inode->prev = NULL;
+	inode->next = inode_hash_table[pos];
+	if (inode->next != NULL) {
+		inode->next->prev = inode;
 	}
-
-	/* Remove i-node */
-	cli();
-	prev = tmp->free_prev;
-	next = tmp->free_next;
-
-	next->prev = prev;
-	prev->next = next;
-	sti();
-	return;
+	inode_hash_table[pos] = inode;
+	inode->flags |= IFLAG_HASHED;
 }
 
 /**
- * Get new i-node from free list and initialize it.
+ * Remove i-node from hash queue.
  *
- * \param sb Super block associated with i-node.
- * \param number i-node number.
- * \return The new i-node.
+ * \param inode i-node.
+ * \note Should be called with interrupts disabled.
  */
-static vfs_inode *get_free_inode(vfs_superblock *sb, uint32_t number)
+static void inode_hash_remove(vfs_inode *inode)
 {
-	vfs_inode *head, *tmp, *prev, *next;
-
-	head = free_inodes_head;
-	tmp = head->free_next;
-	
-	/* Sanity check */
-	if (tmp == head) {
-		panic("VFS: no i-node object available!");
+	if (!(inode->flags & IFLAG_HASHED)) {
+		return;
 	}
 
-	/* try to find the i-node on the free list */
-	while (tmp != head) {
-		if ( DEV_CMP(tmp->device, sb->device) ) {
-			break;
-		}
-		tmp = tmp->free_next;
+	if (inode->prev == NULL) {
+		inode_hash_table[INODE_HASH(inode->device, inode->number)] = inode->next;
+	} else {
+		inode->prev->next = inode->next;
 	}
-
-	if (tmp == head) {
-		/* i-node it's not on free list, pick up any i-node */
-		tmp = head->free_next;
+	if (inode->next != NULL) {
+		inode->next->prev = inode->prev;
 	}
-
-	/* remove i-node from free list */
-	cli();
-	prev = tmp->free_prev;
-	next = tmp->free_next;
-	prev->free_next = next;
-	next->free_prev = prev;
-	sti();
-
-	/* Initialize i-node */
-	tmp->device.major = sb->device.major;
-	tmp->device.minor = sb->device.minor;
-	tmp->sb = sb;
-	tmp->number = number;
-	tmp->reference = 1;
-	/* Read i-node from device */
-	sb->sb_op->get_inode(tmp);
-
-	return tmp;
+	inode->prev   = NULL;
+	inode->next   = NULL;
+	inode->flags &= ~IFLAG_HASHED;
 }
 
 /**
- * Remove i-node from old hash queue and inser onto new hash queue.
+ * Get an i-node object to hold a new i-node. While the cache is not
+ * full, new objects are allocated (a page at a time), otherwise the
+ * least recently used unreferenced i-node is reused.
  *
- * \param inode i-node.
+ * \return The i-node object (out of any list and cleared), NULL if
+ * all i-nodes are in use.
  */
-static void add_inode_htable(vfs_inode *inode)
+static vfs_inode *get_free_inode(void)
 {
-	vfs_inode *head, *tmp, *prev, *next;
-	uint32_t pos;
-
-	/* Find position based on i-node number */
-	pos = inode->number % INODE_HASH_TABLE_SIZE;
-	head = inode_hash_table[pos];
-
-	if (head != NULL) {
-		/* Search and remove from hash queue */
-		tmp = head;
-		if (tmp->next == NULL) {
-			inode_hash_table[pos] = NULL;
-		} else {
-			while (tmp->next != NULL) {
-				if ( DEV_CMP(tmp->device, inode->device) ) {
-					cli();
-					prev = tmp->prev;
-					if (tmp->next == NULL) {
-						next = NULL;
-					} else {
-						next = tmp->next;
-						next->prev = prev;
-					}
-					prev->next = next;
-					sti();
-				}
-				tmp = tmp->next;
+	vfs_inode *inode, *objs;
+	uint32_t i, n;
+
+	if (unused_inodes_head.free_next == &unused_inodes_head && nr_inodes < INODE_CACHE_MAX) {
+		n    = PAGE_SIZE / sizeof(vfs_inode);
+		objs = (vfs_inode*)kmalloc(n * sizeof(vfs_inode), GFP_NORMAL_Z);
+		if (objs != NULL) {
+			memset(objs, 0, n * sizeof(vfs_inode));
+			cli();
+			for (i = 0; i < n; i++) {
+				inode_list_add(&unused_inodes_head, &objs[i]);
 			}
+			nr_inodes += n;
+			sti();
 		}
 	}
 
-	/* Add to new hash queue */
-	pos = inode->number % INODE_HASH_TABLE_SIZE;
-	head = inode_hash_table[pos];
-
-	if (head == NULL) {
-		inode->next = NULL;
-		inode->prev = NULL;
-		inode_hash_table[pos] = inode;
-		return;
-	} else if (head->next == NULL) {
-		cli();
-		head->next = inode;
-		head->prev = NULL;
-		inode->next = NULL;
-		inode->prev = head;
-		sti();
-		return;
+	cli();
+	inode = unused_inodes_head.free_next;
+	if (inode == &unused_inodes_head) {
+		/* Reuse the least recently used i-node */
+		inode = free_inodes_head.free_next;
+		if (inode == &free_inodes_head) {
+			sti();
+			return NULL;
+		}
+		inode_hash_remove(inode);
 	}
+	inode_list_remove(inode);
+	sti();
 
-	tmp = head;
-	while(tmp->next != NULL)
-		tmp = tmp->next;
+	/* Drop caches of the i-node that used this object before */
+	dir_index_free(inode);
+	vfs_bmap_release(inode);
+	memset(inode, 0, sizeof(vfs_inode));
 
-	cli();
-	inode->prev = tmp;
-	inode->next = NULL;
-	tmp->next   = inode;
-	sti();
+	return inode;
 }
 
 /**
@@ -355,20 +339,31 @@ static void add_inode_htable(vfs_inode *inode)
  *
  * \param sb Super block of associated file system.
  * \param number i-node number.
+ * \return The i-node (referenced), NULL on error.
+ * \note i-node should be released with vfs_iput.
  */
 vfs_inode *vfs_iget(vfs_superblock *sb, uint32_t number)
 {
 	vfs_inode *inode;
-	vfs_superblock *i_sb = sb;
 
 	while(1) {
-	
-		if ( (inode = search_inode(i_sb->device, number)) != NULL ) {
-			
-			/* Block is in hash table, check if is locked */
-			if ( mutex_is_locked(inode->lock) ) {
+
+		cli();
+		if ( (inode = search_inode(sb->device, number)) != NULL ) {
+			/* i-node is cached */
+			if (inode->reference++ == 0) {
+				inode_list_remove(inode);
+			}
+			sti();
+
+			/* Wait if it's being read from device */
+			while ( (inode->flags & IFLAG_LOCKED) ) {
 				sleep_on(WAIT_INODE_BECOMES_UNLOCKED);
-				continue;
+			}
+
+			if ( (inode->flags & IFLAG_ERROR) ) {
+				vfs_iput(inode);
+				return NULL;
 			}
 
 			/* Special processing for mount points */
@@ -376,38 +371,139 @@ vfs_inode *vfs_iget(vfs_superblock *sb, uint32_t number)
 				/* TODO: mount point processing */
 			}
 
-			inode_remove_from_freelist(inode);
 			return inode;
+		}
+		sti();
 
+		/* i-node is not on hash table, get new free i-node */
+		if ((inode = get_free_inode()) == NULL) {
+			panic("VFS: no i-node object available!");
+		}
+
+		cli();
+		if (search_inode(sb->device, number) != NULL) {
+			/* Someone read the i-node meanwhile */
+			inode_list_add(&unused_inodes_head, inode);
+			sti();
+			continue;
+		}
+		inode->device.major = sb->device.major;
+		inode->device.minor = sb->device.minor;
+		inode->sb        = sb;
+		inode->number    = number;
+		inode->reference = 1;
+		inode->flags     = IFLAG_LOCKED;
+		inode_hash_add(inode);
+		sti();
+
+		/* Read i-node from device */
+		if (sb->sb_op->get_inode(inode) == 0) {
+			inode->flags |= IFLAG_ERROR;
+		}
+		inode->flags &= ~IFLAG_LOCKED;
+		wakeup(WAIT_INODE_BECOMES_UNLOCKED);
+
+		if ( (inode->flags & IFLAG_ERROR) ) {
+			vfs_iput(inode);
+			return NULL;
+		}
+
+		return inode;
+	}
+}
+
+/**
+ * Release an i-node got by vfs_iget. Unreferenced i-nodes are kept
+ * in the cache, until their objects are reused.
+ *
+ * \param inode i-node.
+ */
+void vfs_iput(vfs_inode *inode)
+{
+	char unused;
+
+	if (inode == NULL) {
+		return;
+	}
+
+	cli();
+	unused = 0;
+	if (--inode->reference == 0 && !(inode->flags & IFLAG_LOCKED)) {
+		unused = 1;
+		if ( (inode->flags & IFLAG_ERROR) ) {
+			/* Data is not valid, reuse it first */
+			inode_hash_remove(inode);
+			inode_list_add(&unused_inodes_head, inode);
 		} else {
-			/* i-node is not on hash table */
-			
-			/* get new free i-node and initialize it */
-			if ((inode = get_free_inode(i_sb, number)) == NULL) {
-				panic("VFS: free i-nodes list empty!");
-			}
+			inode_list_add(&free_inodes_head, inode);
+		}
+	}
+	sti();
 
-			add_inode_htable(inode);
+	/* Indirect blocks are only cached for i-nodes in use */
+	if (unused) {
+		vfs_bmap_release(inode);
+	}
+}
 
-			return inode;
+/**
+ * Get another reference to an i-node.
+ *
+ * \param inode i-node (already referenced).
+ * \return The i-node.
+ */
+vfs_inode *vfs_idup(vfs_inode *inode)
+{
+	cli();
+	inode->reference++;
+	sti();
+
+	return inode;
+}
+
+/**
+ * Count how many consecutive entries of a block table are contiguous
+ * blocks on device.
+ *
+ * \param table Block table (i-node direct blocks or indirect block).
+ * \param index First entry.
+ * \param size Number of entries of the table.
+ * \param max Maximum count.
+ * \return Number of contiguous blocks (1 for a hole).
+ */
+static uint32_t bmap_run(uint32_t *table, uint32_t index, uint32_t size, uint32_t max)
+{
+	uint32_t n;
+
+	if (table[index] == 0) {
+		return 1;
+	}
+
+	for (n = 1; (index + n) < size && n < max; n++) {
+		if (table[index + n] != (table[index] + n)) {
+			break;
 		}
 	}
+
+	return n;
 }
 
 /**
  * Translate file byte offset into file system block number, block offset, etc.
+ * The last indirect block used at each indirection level is kept in the
+ * i-node, so sequential access reads each indirect block only once.
  *
  * \param inode File i-node.
  * \param offset File byte offset.
- * \return vfs_bmap_t Structure with converted numbers.
+ * \return vfs_bmap_t Structure with converted numbers. blk_number is 0 for
+ * holes, and blk_count is 0 if an indirect block could not be read.
  */
 vfs_bmap_t vfs_bmap(vfs_inode *inode, uint32_t offset)
 {
 	vfs_bmap_t bmap;
-	uint32_t blk_size, n_entries;
-	uint32_t b_ind, b_ind_number, b_ind_index;
-	char *raw_blk;
-	uint32_t *ind_blk;
+	uint32_t blk_size, n_entries, nblocks, max;
+	uint32_t b_ind, b_ind_number, path[VFS_BMAP_LEVELS];
+	uint32_t *ind_blk, *old;
 	int i, ilevel;
 
 	/* Block size (in bytes) */
@@ -418,45 +514,101 @@ vfs_bmap_t vfs_bmap(vfs_inode *inode, uint32_t offset)
 	bmap.blk_offset = offset - (b_ind * blk_size);
 	bmap.blk_breada = 0;
 
+	/* Runs don't go beyond the end of file */
+	nblocks = (inode->i_size + blk_size - 1) / blk_size;
+	max     = (b_ind < nblocks ? nblocks - b_ind : 1);
+
 	/* Check indirection level */
 	if (b_ind < VFS_NDIR_BLOCKS) {
 		bmap.blk_number = inode->i_block[b_ind];
+		bmap.blk_count  = bmap_run(inode->i_block, b_ind, VFS_NDIR_BLOCKS, max);
 		return bmap;
+	}
+
+	/* Calculate how many entries indirect blocks have */
+	n_entries = blk_size / sizeof(inode->i_block[0]);
+	b_ind    -= VFS_NDIR_BLOCKS;
+
+	if (b_ind < n_entries) {
+		/* Single indirection */
+		ilevel  = 1;
+		path[0] = b_ind;
+		b_ind   = VFS_IND_BLOCK;
+	} else if ((b_ind -= n_entries) < _ipow(n_entries, 2)) {
+		/* Double indirection */
+		ilevel  = 2;
+		path[0] = b_ind / n_entries;
+		path[1] = b_ind % n_entries;
+		b_ind   = VFS_DIND_BLOCK;
 	} else {
-		/* Calculate how many entries indirect blocks have */
-		n_entries = blk_size / sizeof(inode->i_block[0]);
-		
-		if (b_ind < (VFS_NDIR_BLOCKS + n_entries)) {
-			/* Single indirection */
-			ilevel = 1;
-			b_ind  = VFS_IND_BLOCK; 
-		} else if (b_ind < (VFS_NDIR_BLOCKS + n_entries + _ipow(n_entries, 2))) {
-			/* Double indirection */
-			ilevel = 2;
-			b_ind  = VFS_DIND_BLOCK;
-		} else {
-			/* Triple indirection */
-			ilevel = 3;
-			b_ind  = VFS_TIND_BLOCK;
-		}
+		/* Triple indirection */
+		b_ind  -= _ipow(n_entries, 2);
+		ilevel  = 3;
+		path[0] = b_ind / _ipow(n_entries, 2);
+		path[1] = (b_ind / n_entries) % n_entries;
+		path[2] = b_ind % n_entries;
+		b_ind   = VFS_TIND_BLOCK;
 	}
 
 	/* Walk into indirect blocks */
-	b_ind_number = inode->i_block[b_ind];
-	for (i = 0; i < ilevel; i++) {
-		raw_blk = inode->sb->sb_op->get_fs_block(inode->sb, b_ind_number);
-		ind_blk = (uint32_t*)raw_blk;
+	bmap.blk_count = 1;
+	b_ind_number   = inode->i_block[b_ind];
+	for (i = 0; i < ilevel && b_ind_number != 0; i++) {
+		old = NULL;
 
-		b_ind_index = (offset - 
-				((VFS_NDIR_BLOCKS + _ipow(n_entries, (ilevel-1)) * blk_size)))
-					/ (n_entries * blk_size);
+		cli();
+		if (inode->bmap_blk[i] != b_ind_number || inode->bmap_data[i] == NULL) {
+			sti();
+			ind_blk = (uint32_t*)inode->sb->sb_op->get_fs_block(inode->sb, b_ind_number);
+			if (ind_blk == NULL) {
+				bmap.blk_number = 0;
+				bmap.blk_count  = 0;
+				return bmap;
+			}
 
-		b_ind_number = ind_blk[b_ind_index];
+			cli();
+			old = inode->bmap_data[i];
+			inode->bmap_data[i] = ind_blk;
+			inode->bmap_blk[i]  = b_ind_number;
+		}
+		ind_blk      = inode->bmap_data[i];
+		b_ind_number = ind_blk[path[i]];
+		if (i == (ilevel - 1)) {
+			bmap.blk_count = bmap_run(ind_blk, path[i], n_entries, max);
+		}
+		sti();
 
-		kfree(raw_blk);
+		if (old != NULL) {
+			kfree(old);
+		}
 	}
 	bmap.blk_number = b_ind_number;
 
 	return bmap;
 }
 
+/**
+ * Release the indirect blocks cached by vfs_bmap.
+ *
+ * \param inode i-node.
+ */
+void vfs_bmap_release(vfs_inode *inode)
+{
+	uint32_t *data[VFS_BMAP_LEVELS];
+	int i;
+
+	cli();
+	for (i = 0; i < VFS_BMAP_LEVELS; i++) {
+		data[i] = inode->bmap_data[i];
+		inode->bmap_data[i] = NULL;
+		inode->bmap_blk[i]  = 0;
+	}
+	sti();
+
+	for (i = 0; i < VFS_BMAP_LEVELS; i++) {
+		if (data[i] != NULL) {
+			kfree(data[i]);
+		}
+	}
+}
+
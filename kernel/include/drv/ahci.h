@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: ahci.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BLK_AHCI_H
+
+	#define BLK_AHCI_H
+
+	#include <unistd.h>
+	#include <fs/bhash.h>
+	#include <fs/elevator.h>
+	#include <fs/blkpoll.h>
+	#include <fs/partition.h>
+
+	/** Maximum number of disks (each one has 16 minor numbers, all
+	    of them should be below MAX_MINOR_DEVICES) */
+	#define AHCI_MAX_DISKS		15
+	#define AHCI_DISK_SHIFT		4
+
+	#define AHCI_MAX_PORTS		32
+	#define AHCI_MAX_SLOTS		32
+
+	/** PRD entries of each command (one per buffer at most) */
+	#define AHCI_MAX_PRDS		BCACHE_CLUSTER_MAX
+
+	/** Space reserved to each command table (128 bytes aligned) */
+	#define AHCI_CMD_TABLE_SIZE	512
+
+	/** Base address register of AHCI registers (ABAR) */
+	#define AHCI_ABAR			5
+
+	/* Host capabilities */
+	#define AHCI_CAP_NCS(cap)	((((cap) >> 8) & 0x1F) + 1)
+	#define AHCI_CAP_SNCQ		0x40000000
+
+	/* Global host control */
+	#define AHCI_GHC_HR			0x00000001
+	#define AHCI_GHC_IE			0x00000002
+	#define AHCI_GHC_AE			0x80000000
+
+	/* Port command and status */
+	#define AHCI_PXCMD_ST		0x0001
+	#define AHCI_PXCMD_SUD		0x0002
+	#define AHCI_PXCMD_POD		0x0004
+	#define AHCI_PXCMD_FRE		0x0010
+	#define AHCI_PXCMD_FR		0x4000
+	#define AHCI_PXCMD_CR		0x8000
+
+	/* Port interrupts */
+	#define AHCI_PXIS_DHRS		0x00000001
+	#define AHCI_PXIS_PSS		0x00000002
+	#define AHCI_PXIS_DSS		0x00000004
+	#define AHCI_PXIS_SDBS		0x00000008
+	#define AHCI_PXIS_IFS		0x08000000
+	#define AHCI_PXIS_HBDS		0x10000000
+	#define AHCI_PXIS_HBFS		0x20000000
+	#define AHCI_PXIS_TFES		0x40000000
+	#define AHCI_PXIS_ERRORS	(AHCI_PXIS_IFS | AHCI_PXIS_HBDS | AHCI_PXIS_HBFS | AHCI_PXIS_TFES)
+
+	/* Port task file data */
+	#define AHCI_TFD_ERR		0x01
+	#define AHCI_TFD_DRQ		0x08
+	#define AHCI_TFD_BSY		0x80
+
+	/* Port SATA status */
+	#define AHCI_SSTS_DET_MASK	0x0F
+	#define AHCI_SSTS_DET_OK	0x03
+
+	/* Port SATA control */
+	#define AHCI_SCTL_DET_MASK	0x0F
+	#define AHCI_SCTL_DET_INIT	0x01
+
+	/** Signature of a SATA disk */
+	#define AHCI_SIG_ATA		0x00000101
+
+	/* Command header flags */
+	#define AHCI_CMD_CFL_MASK	0x001F
+	#define AHCI_CMD_WRITE		0x0040
+
+	/** Host to device register FIS */
+	#define FIS_TYPE_REG_H2D	0x27
+	#define FIS_H2D_CMD			0x80
+
+	/* ATA commands */
+	#define AHCI_ATA_IDENTIFY		0xEC
+	#define AHCI_ATA_READ_DMA_EXT	0x25
+	#define AHCI_ATA_WRITE_DMA_EXT	0x35
+	#define AHCI_ATA_READ_FPDMA		0x60
+	#define AHCI_ATA_WRITE_FPDMA	0x61
+	#define AHCI_ATA_FLUSH_EXT		0xEA
+
+
+	/** Port registers */
+	struct _ahci_port_regs {
+		uint32_t clb;
+		uint32_t clbu;
+		uint32_t fb;
+		uint32_t fbu;
+		uint32_t is;
+		uint32_t ie;
+		uint32_t cmd;
+		uint32_t rsv0;
+		uint32_t tfd;
+		uint32_t sig;
+		uint32_t ssts;
+		uint32_t sctl;
+		uint32_t serr;
+		uint32_t sact;
+		uint32_t ci;
+		uint32_t sntf;
+		uint32_t fbs;
+		uint32_t rsv1[11];
+		uint32_t vendor[4];
+	} __attribute__ ((packed));
+
+	typedef volatile struct _ahci_port_regs ahci_port_regs_t;
+
+	/** HBA memory registers */
+	struct _ahci_hba_regs {
+		uint32_t cap;
+		uint32_t ghc;
+		uint32_t is;
+		uint32_t pi;
+		uint32_t vs;
+		uint32_t ccc_ctl;
+		uint32_t ccc_pts;
+		uint32_t em_loc;
+		uint32_t em_ctl;
+		uint32_t cap2;
+		uint32_t bohc;
+		uint32_t rsv[53];
+		struct _ahci_port_regs ports[AHCI_MAX_PORTS];
+	} __attribute__ ((packed));
+
+	typedef volatile struct _ahci_hba_regs ahci_hba_regs_t;
+
+	/** Command header (command list has one for each slot) */
+	struct _ahci_cmd_header {
+		uint16_t flags;
+		/** Number of PRD entries */
+		uint16_t prdtl;
+		/** Bytes transferred */
+		uint32_t prdbc;
+		/** Command table address */
+		uint32_t ctba;
+		uint32_t ctbau;
+		uint32_t rsv[4];
+	} __attribute__ ((packed));
+
+	typedef volatile struct _ahci_cmd_header ahci_cmd_header_t;
+
+	/** Physical region descriptor */
+	struct _ahci_prd {
+		uint32_t dba;
+		uint32_t dbau;
+		uint32_t rsv;
+		/** Byte count - 1 (bits 0-21) */
+		uint32_t dbc;
+	} __attribute__ ((packed));
+
+	/** Command table */
+	struct _ahci_cmd_table {
+		uchar8_t cfis[64];
+		uchar8_t acmd[16];
+		uchar8_t rsv[48];
+		struct _ahci_prd prdt[AHCI_MAX_PRDS];
+	} __attribute__ ((packed));
+
+	typedef struct _ahci_cmd_table ahci_cmd_table_t;
+
+	/** Host to device register FIS */
+	struct _fis_reg_h2d {
+		uchar8_t type;
+		uchar8_t flags;
+		uchar8_t command;
+		uchar8_t feature_low;
+		uchar8_t lba0;
+		uchar8_t lba1;
+		uchar8_t lba2;
+		uchar8_t device;
+		uchar8_t lba3;
+		uchar8_t lba4;
+		uchar8_t lba5;
+		uchar8_t feature_high;
+		uchar8_t count_low;
+		uchar8_t count_high;
+		uchar8_t icc;
+		uchar8_t control;
+		uchar8_t rsv[4];
+	} __attribute__ ((packed));
+
+	typedef struct _fis_reg_h2d fis_reg_h2d_t;
+
+	/** SATA disk attached to a port */
+	struct _ahci_disk {
+		/** Port number */
+		uint32_t port;
+		/** Port registers */
+		ahci_port_regs_t *regs;
+		/** Disk size (in sectors) */
+		uint64_t sectors;
+		/** Native command queuing is used */
+		char ncq;
+		/** Number of slots used (queue depth) */
+		uint32_t depth;
+		/** Slots in use */
+		uint32_t active;
+		/** Command list (and FIS receive area) */
+		ahci_cmd_header_t *clist;
+		/** Command tables */
+		ahci_cmd_table_t *tables[AHCI_MAX_SLOTS];
+		/** Request of each slot */
+		blk_request_t *slots[AHCI_MAX_SLOTS];
+		/** Pending (or running) cache flush */
+		blk_request_t *flush;
+		/** Port could not be recovered from an error (requests fail) */
+		char dead;
+		/** Requests waiting for a free slot */
+		blk_queue_t queue;
+		/** Polled completion statistics */
+		blk_poll_t poll;
+		/** Partition table */
+		part_table_st *ptable;
+	};
+
+	typedef struct _ahci_disk ahci_disk_t;
+
+	/* Prototypes */
+
+	void init_ahci(void);
+
+	int read_sync_ahci_sector(int major, int device, buff_header_t *buf);
+
+	int read_async_ahci_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_ahci_sector(int major, int device, buff_header_t *buf);
+
+	int write_sync_ahci_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_ahci_sectors(int major, int device, buff_header_t **bufs, int count);
+
+	int read_async_ahci_sectors(int major, int device, buff_header_t **bufs, int count);
+
+#endif /* BLK_AHCI_H */
+
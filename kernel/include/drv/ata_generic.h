@@ -40,6 +40,7 @@
 
 	#define PRESENT			0x01
 	#define LBA48			0x02
+	#define USE_DMA			0x04
 
 
 	/**
@@ -50,8 +51,9 @@
 	  |   |   |   |   |   |   |   |
 	  |   |   |   |   |   |   |   |---> PRESENT (0 = NO, 1 = YES)
 	  |   |   |   |   |   |   |-------> LBA48   (0 = NO, 1 = YES)
-	  |   |   |   |   |   |
-	   --   NOT USED    --
+	  |   |   |   |   |   |-----------> USE_DMA (0 = PIO, 1 = Bus master DMA)
+	  |   |   |   |   |
+	   -- NOT USED  --
 	 \endverbatim
 	 */
 	struct _ata_dev_info {
@@ -71,6 +73,8 @@
 		uint16_t cmds_supported[6];
 		uint16_t ultra_dma;
 		uint16_t max_lba48[4];
+		/** Sectors transferred per interrupt (READ/WRITE MULTIPLE) */
+		uint16_t drq_block;
 	};
 
 	typedef struct _ata_dev_info ata_dev_info;
@@ -87,5 +91,9 @@
 
 	int write_sync_ata_sector(int major, int device, buff_header_t *buf);
 
+	int write_async_ata_sectors(int major, int device, buff_header_t **bufs, int count);
+
+	int read_async_ata_sectors(int major, int device, buff_header_t **bufs, int count);
+
 #endif /* BLK_ATA_GENERIC_H */
 
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: pci.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PCI_H
+
+	#define PCI_H
+
+	#include <unistd.h>
+
+	/* Configuration mechanism #1 */
+	#define PCI_CONFIG_ADDRESS	0xCF8
+	#define PCI_CONFIG_DATA		0xCFC
+	#define PCI_CONFIG_ENABLE	0x80000000
+
+	#define PCI_MAX_BUS			256
+	#define PCI_MAX_DEV			32
+	#define PCI_MAX_FUNC		8
+
+	/** Maximum number of PCI functions known by the kernel */
+	#define PCI_MAX_DEVICES		32
+
+	/* Configuration space registers */
+	#define PCI_VENDOR_ID		0x00
+	#define PCI_DEVICE_ID		0x02
+	#define PCI_COMMAND			0x04
+	#define PCI_STATUS			0x06
+	#define PCI_REVISION		0x08
+	#define PCI_PROG_IF			0x09
+	#define PCI_SUBCLASS		0x0A
+	#define PCI_CLASS			0x0B
+	#define PCI_HEADER_TYPE		0x0E
+	#define PCI_BAR0			0x10
+	#define PCI_SUBSYS_ID		0x2E
+	#define PCI_CAP_PTR			0x34
+	#define PCI_INTERRUPT_LINE	0x3C
+	#define PCI_INTERRUPT_PIN	0x3D
+
+	/* Command register bits */
+	#define PCI_CMD_IO			0x0001
+	#define PCI_CMD_MEMORY		0x0002
+	#define PCI_CMD_MASTER		0x0004
+	#define PCI_CMD_INTX_OFF	0x0400
+
+	/* Status register bits */
+	#define PCI_STATUS_CAP_LIST	0x0010
+
+	/* Header type */
+	#define PCI_HEADER_MULTI	0x80
+	#define PCI_HEADER_MASK		0x7F
+	#define PCI_HEADER_NORMAL	0x00
+
+	/* Base address registers */
+	#define PCI_NUM_BARS		6
+	#define PCI_BAR_IO			0x01
+	#define PCI_BAR_MEM_TYPE	0x06
+	#define PCI_BAR_MEM_64		0x04
+	#define PCI_BAR_PREFETCH	0x08
+	#define PCI_BAR_IO_MASK		0xFFFFFFFC
+	#define PCI_BAR_MEM_MASK	0xFFFFFFF0
+
+	/** Match any ID (vendor, device, class...) */
+	#define PCI_ANY_ID			0xFFFF
+
+	/* Class codes used by drivers */
+	#define PCI_CLASS_STORAGE	0x01
+	#define PCI_SUBCLASS_IDE	0x01
+	#define PCI_SUBCLASS_SATA	0x06
+	#define PCI_CLASS_BRIDGE	0x06
+
+	/* Base address register types (pci_bar_t.type) */
+	#define PCI_BAR_NONE		0x00
+	#define PCI_BAR_TYPE_IO		0x01
+	#define PCI_BAR_TYPE_MEM	0x02
+
+
+	/** Base address register (decoded) */
+	struct _pci_bar_t {
+		/** Base address (port for I/O BARs) */
+		uint32_t base;
+		/** Size in bytes */
+		uint32_t size;
+		/** PCI_BAR_NONE, PCI_BAR_TYPE_IO or PCI_BAR_TYPE_MEM */
+		char type;
+		/** Memory is prefetchable */
+		char prefetch;
+	};
+
+	typedef struct _pci_bar_t pci_bar_t;
+
+	struct _pci_driver_t;
+
+	/** A PCI function */
+	struct _pci_device_t {
+		uchar8_t bus;
+		uchar8_t dev;
+		uchar8_t func;
+		uint16_t vendor_id;
+		uint16_t device_id;
+		uchar8_t class_code;
+		uchar8_t subclass;
+		uchar8_t prog_if;
+		uchar8_t revision;
+		uchar8_t header_type;
+		/** Interrupt line (IRQ) */
+		uchar8_t irq;
+		/** Base address registers */
+		pci_bar_t bars[PCI_NUM_BARS];
+		/** Driver that owns the device (NULL if none) */
+		struct _pci_driver_t *driver;
+	};
+
+	typedef struct _pci_device_t pci_device_t;
+
+	/**
+	 * Device identification used by drivers. Each field can be
+	 * PCI_ANY_ID. A table of IDs ends with an entry where all
+	 * fields are zero.
+	 */
+	struct _pci_device_id_t {
+		uint16_t vendor_id;
+		uint16_t device_id;
+		uint16_t class_code;
+		uint16_t subclass;
+	};
+
+	typedef struct _pci_device_id_t pci_device_id_t;
+
+	/** PCI device driver */
+	struct _pci_driver_t {
+		/** Driver name */
+		const char *name;
+		/** Devices supported by the driver */
+		const pci_device_id_t *id_table;
+		/** probe(): Called for each matching device, should return 0
+		    when the driver takes the device, -1 otherwise */
+		int (*probe) (pci_device_t *, const pci_device_id_t *);
+	};
+
+	typedef struct _pci_driver_t pci_driver_t;
+
+	/* Prototypes */
+
+	void init_pci(void);
+
+	uint32_t pci_read_config_dword(pci_device_t *pdev, uchar8_t reg);
+
+	uint16_t pci_read_config_word(pci_device_t *pdev, uchar8_t reg);
+
+	uchar8_t pci_read_config_byte(pci_device_t *pdev, uchar8_t reg);
+
+	void pci_write_config_dword(pci_device_t *pdev, uchar8_t reg, uint32_t value);
+
+	void pci_write_config_word(pci_device_t *pdev, uchar8_t reg, uint16_t value);
+
+	void pci_write_config_byte(pci_device_t *pdev, uchar8_t reg, uchar8_t value);
+
+	pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *from);
+
+	pci_device_t *pci_find_class(uchar8_t class_code, uchar8_t subclass, pci_device_t *from);
+
+	void pci_enable_device(pci_device_t *pdev, uint16_t flags);
+
+	int pci_register_driver(pci_driver_t *driver);
+
+#endif /* PCI_H */
+
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: ramdisk.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BLK_RAMDISK_H
+
+	#define BLK_RAMDISK_H
+
+	#include <unistd.h>
+	#include <fs/bhash.h>
+
+	/** Maximum number of RAM disks (one minor number each) */
+	#define RAMDISK_MAX		(MBOOT_MODS_MAX + 1)
+
+	/**
+	 * RAM disk: a piece of memory holding a disk image.
+	 */
+	struct _ramdisk {
+		/** Disk data */
+		char *data;
+		/** Disk size (in sectors) */
+		uint32_t sectors;
+	};
+
+	typedef struct _ramdisk ramdisk_t;
+
+	/* Prototypes */
+
+	void init_ramdisk(void);
+
+	int read_sync_ramdisk_sector(int major, int device, buff_header_t *buf);
+
+	int read_async_ramdisk_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_ramdisk_sector(int major, int device, buff_header_t *buf);
+
+	int write_sync_ramdisk_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_ramdisk_sectors(int major, int device, buff_header_t **bufs, int count);
+
+	int read_async_ramdisk_sectors(int major, int device, buff_header_t **bufs, int count);
+
+#endif /* BLK_RAMDISK_H */
+
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: virtio_blk.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BLK_VIRTIO_BLK_H
+
+	#define BLK_VIRTIO_BLK_H
+
+	#include <unistd.h>
+	#include <fs/bhash.h>
+	#include <fs/elevator.h>
+	#include <fs/blkpoll.h>
+	#include <fs/partition.h>
+
+	/** Maximum number of disks (each one has 16 minor numbers, all
+	    of them should be below MAX_MINOR_DEVICES) */
+	#define VIRTIO_BLK_MAX_DISKS	15
+	#define VIRTIO_BLK_DISK_SHIFT	4
+
+	/* PCI IDs (legacy/transitional device) */
+	#define VIRTIO_PCI_VENDOR		0x1AF4
+	#define VIRTIO_PCI_BLK_DEVICE	0x1001
+
+	/* Legacy PCI registers (I/O BAR 0) */
+	#define VIRTIO_PCI_HOST_FEATURES	0x00
+	#define VIRTIO_PCI_GUEST_FEATURES	0x04
+	#define VIRTIO_PCI_QUEUE_PFN		0x08
+	#define VIRTIO_PCI_QUEUE_NUM		0x0C
+	#define VIRTIO_PCI_QUEUE_SEL		0x0E
+	#define VIRTIO_PCI_QUEUE_NOTIFY		0x10
+	#define VIRTIO_PCI_STATUS			0x12
+	#define VIRTIO_PCI_ISR				0x13
+	#define VIRTIO_PCI_CONFIG			0x14
+
+	/* Device status */
+	#define VIRTIO_STATUS_ACK			0x01
+	#define VIRTIO_STATUS_DRIVER		0x02
+	#define VIRTIO_STATUS_DRIVER_OK		0x04
+	#define VIRTIO_STATUS_FAILED		0x80
+
+	/** Device has a write cache and handles flush requests */
+	#define VIRTIO_BLK_F_FLUSH			(1 << 9)
+
+	/** Legacy queues are aligned to pages */
+	#define VIRTIO_PCI_VRING_ALIGN		4096
+
+	/* Descriptor flags */
+	#define VRING_DESC_F_NEXT			0x01
+	#define VRING_DESC_F_WRITE			0x02
+
+	/** Device should not interrupt (avail ring flag) */
+	#define VRING_AVAIL_F_NO_INTERRUPT	0x01
+	/** Driver does not need to notify (used ring flag) */
+	#define VRING_USED_F_NO_NOTIFY		0x01
+
+	/* Request types */
+	#define VIRTIO_BLK_T_IN				0
+	#define VIRTIO_BLK_T_OUT			1
+	#define VIRTIO_BLK_T_FLUSH			4
+
+	/* Request status */
+	#define VIRTIO_BLK_S_OK				0
+	#define VIRTIO_BLK_S_IOERR			1
+	#define VIRTIO_BLK_S_UNSUPP			2
+
+	/** Descriptors used by a request besides data (header and status) */
+	#define VIRTIO_BLK_EXTRA_DESCS		2
+
+
+	/** Ring descriptor */
+	struct _vring_desc {
+		uint64_t addr;
+		uint32_t len;
+		uint16_t flags;
+		uint16_t next;
+	} __attribute__ ((packed));
+
+	/** Available ring (driver to device) */
+	struct _vring_avail {
+		uint16_t flags;
+		uint16_t idx;
+		uint16_t ring[];
+	} __attribute__ ((packed));
+
+	/** Element of used ring */
+	struct _vring_used_elem {
+		uint32_t id;
+		uint32_t len;
+	} __attribute__ ((packed));
+
+	/** Used ring (device to driver) */
+	struct _vring_used {
+		uint16_t flags;
+		uint16_t idx;
+		struct _vring_used_elem ring[];
+	} __attribute__ ((packed));
+
+	/** Request header */
+	struct _virtio_blk_outhdr {
+		uint32_t type;
+		uint32_t ioprio;
+		uint64_t sector;
+	} __attribute__ ((packed));
+
+	/**
+	 * Header and status of the request sent with a descriptor chain
+	 * (there is one for each head descriptor). Aligned, so it never
+	 * crosses a page.
+	 */
+	struct _virtio_blk_req {
+		/** Header (read by device) */
+		struct _virtio_blk_outhdr hdr;
+		/** Status (written by device) */
+		volatile uchar8_t status;
+		/** Block request */
+		blk_request_t *rq;
+	} __attribute__ ((aligned (32)));
+
+	/** A virtio block device */
+	struct _virtio_blk_disk {
+		/** I/O base port */
+		uint16_t iobase;
+		/** Disk size (in sectors) */
+		uint64_t sectors;
+		/** Queue size (number of descriptors) */
+		uint16_t qsize;
+		/** Pages of the queue memory */
+		uint32_t qpages;
+		/** Descriptor table */
+		struct _vring_desc *desc;
+		/** Available ring */
+		volatile struct _vring_avail *avail;
+		/** Used ring */
+		volatile struct _vring_used *used;
+		/** First free descriptor */
+		uint16_t free_head;
+		/** Number of free descriptors */
+		uint16_t num_free;
+		/** Last used ring position seen */
+		uint16_t last_used;
+		/** Request of each head descriptor */
+		struct _virtio_blk_req *reqs;
+		/** Flush was negotiated (device has a write cache) */
+		char wcache;
+		/** Pending (or running) cache flush */
+		blk_request_t *flush;
+		/** Requests waiting for free descriptors */
+		blk_queue_t queue;
+		/** Polled completion statistics */
+		blk_poll_t poll;
+		/** Partition table */
+		part_table_st *ptable;
+	};
+
+	typedef struct _virtio_blk_disk virtio_blk_disk_t;
+
+	/* Prototypes */
+
+	void init_virtio_blk(void);
+
+	int read_sync_virtio_sector(int major, int device, buff_header_t *buf);
+
+	int read_async_virtio_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_virtio_sector(int major, int device, buff_header_t *buf);
+
+	int write_sync_virtio_sector(int major, int device, buff_header_t *buf);
+
+	int write_async_virtio_sectors(int major, int device, buff_header_t **bufs, int count);
+
+	int read_async_virtio_sectors(int major, int device, buff_header_t **bufs, int count);
+
+#endif /* BLK_VIRTIO_BLK_H */
+
@@ -45,6 +45,15 @@
 	/** The buffer contains invalid data (circular list head) */
 	#define BUFF_ST_HEAD 		0x40
 
+	/* Block buffer: flags */
+
+	/** Buffer was filled by a read ahead and was not used yet */
+	#define BUFF_FL_READAHEAD	0x01
+	/** Buffer holds a block (it's in the hash table) */
+	#define BUFF_FL_HASHED		0x02
+	/** Buffer data was changed and should be written to device */
+	#define BUFF_FL_DIRTY		0x04
+
 	/** Buffer size */
 	#define BUFF_SIZE 		512
 
@@ -55,62 +64,173 @@
 	/** Buffer write mark to delayed write */
 	#define BWRITE_DELAYED  0x03
 
-	/** How many blocks has each buffer queue? */
+	/**
+	 * How many buffers the cache has at least? The cache is shared by
+	 * all block devices, it grows while there is free memory and
+	 * shrinks back (up to this size) when memory is needed.
+	 */
 	#ifdef CONFIG_BUFFER_QUEUE_SIZE
-		/** Buffer queue size defined at kernel configuration file */
-		#define BUFF_QUEUE_SIZE CONFIG_BUFFER_QUEUE_SIZE
+		/** Minimum cache size defined at kernel configuration file */
+		#define BCACHE_MIN_BUFFERS CONFIG_BUFFER_QUEUE_SIZE
 	#else
 		#error "CONFIG_BUFFER_QUEUE_SIZE it's not defined. It should be defined at configuration file."
 	#endif
 
-	/** Maximum of buffer queues */
-	#define MAX_BUFFER_QUEUES 50
+	/** Buffers allocated at once when the cache grows */
+	#define BCACHE_CHUNK_BUFFERS	32
+
+	/** Pages of the data slab of each chunk (a whole number of pages) */
+	#define BCACHE_CHUNK_DATA_PAGES	((BCACHE_CHUNK_BUFFERS * BUFF_SIZE) >> PAGE_SHIFT)
+
+	/** Number of entries of the buffer cache hash table (power of 2) */
+	#define BCACHE_HASH_SIZE		1024
+
+	/** How many buffers at the free list are checked to find a victim */
+	#define BCACHE_VICTIM_SCAN		16
+
+	/** Maximum number of consecutive dirty buffers written at once */
+	#define BCACHE_CLUSTER_MAX		16
 
+	/**
+	 * Buffer cache keeps free, for the rest of the system, at least
+	 * (free pages at initialization >> BCACHE_RESERVE_SHIFT) pages.
+	 */
+	#define BCACHE_RESERVE_SHIFT	2
 
-	/** Buffer structure */
+	/**
+	 * Number of slots of latency histograms. Slot n counts operations
+	 * that took from 2^n to 2^(n+1)-1 microseconds, the last slot
+	 * counts all slower operations.
+	 */
+	#define BSTATS_HIST_SLOTS 16
+
+
+	struct _bio;
+
+	/**
+	 * Buffer structure. Headers are kept small (hash and free list walks
+	 * only touch them), the data of the block lives in a separate page
+	 * aligned slab.
+	 */
 	struct _buffer_header_t {
 		/* Block address */
 		uint64_t addr;
 		/* Device number */
 		int device;
+		/* Major number of the device */
+		int major;
 		/* Status of the buffer */
 		char status;
-		/* The data of the block */
-		char data[BUFF_SIZE];
+		/* Flags (see BUFF_FL_*) */
+		char flags;
 		/* links to make a double linked list into hash queue */
 		struct _buffer_header_t *prev;
 		struct _buffer_header_t *next;
 		/* links to make a circular linked list into free list */
 		struct _buffer_header_t *free_prev;
 		struct _buffer_header_t *free_next;
+		/* The data of the block (BUFF_SIZE bytes, never crosses a page) */
+		char *data;
+		/* Block I/O the header belongs to (NULL for cache buffers) */
+		struct _bio *bio;
 	};
 	
 	typedef struct _buffer_header_t buff_header_t;
 
-	/** Buffer hash queue. Each device should have one of this. */
-	struct _buff_hash_queue_t {
-		/** How many position are in hash table. */
-		uint64_t size;
+	/** A chunk of buffers. Buffer cache grows and shrinks by chunks. */
+	struct _bcache_chunk_t {
+		/** Next chunk */
+		struct _bcache_chunk_t *next;
+		/** Data slab (page aligned) */
+		char *data;
+		/** Buffers */
+		struct _buffer_header_t blocks[BCACHE_CHUNK_BUFFERS];
+	};
+
+	typedef struct _bcache_chunk_t bcache_chunk_t;
+
+	/** Buffer cache. There is only one, shared by all block devices. */
+	struct _bcache_t {
 		/** Each position has a linked list of buffer headers. */
-		struct _buffer_header_t **hashtable;
+		struct _buffer_header_t *hashtable[BCACHE_HASH_SIZE];
 		/** Free list head */
-		struct _buffer_header_t *freelist_head;
-		/** Blocks */
-		struct _buffer_header_t blocks[BUFF_QUEUE_SIZE];
+		struct _buffer_header_t freelist_head;
+		/** Chunks of buffers */
+		struct _bcache_chunk_t *chunks;
+		/** Total of buffers */
+		uint32_t nbuffers;
+		/** Number of devices that have blocks in the cache */
+		uint32_t ndevices;
+		/** Free pages that should be left to the rest of the system */
+		uint32_t reserve;
+		/** Cache is growing or shrinking */
+		char resizing;
 	};
 
-	typedef struct _buff_hash_queue_t buff_hashq_t;
+	typedef struct _bcache_t bcache_t;
+
+	/** Buffer cache statistics. Each block device (disk or partition) has one of this. */
+	struct _bcache_stats_t {
+		/** Blocks found (with valid data) in the cache by bread() */
+		uint32_t hits;
+		/** Blocks that bread() had to read from device */
+		uint32_t misses;
+		/** Buffers reused to hold another block */
+		uint32_t evictions;
+		/** Buffers marked to delayed write that were written when evicted */
+		uint32_t flush_evictions;
+		/** Times getblk() slept because free list was empty */
+		uint32_t sleeps_free;
+		/** Times getblk() slept because the block was busy */
+		uint32_t sleeps_busy;
+		/** Blocks requested to be read ahead by breada() */
+		uint32_t ra_issued;
+		/** Blocks read ahead that were used later */
+		uint32_t ra_hits;
+		/** Synchronous reads from device */
+		uint32_t dev_reads;
+		/** Synchronous writes to device */
+		uint32_t dev_writes;
+		/** Write requests issued to flush delayed write buffers */
+		uint32_t wb_writes;
+		/** Delayed write buffers flushed */
+		uint32_t wb_blocks;
+		/** Latency histogram of synchronous reads */
+		uint32_t read_lat[BSTATS_HIST_SLOTS];
+		/** Latency histogram of synchronous writes */
+		uint32_t write_lat[BSTATS_HIST_SLOTS];
+	};
+
+	typedef struct _bcache_stats_t bcache_stats_t;
 
 	/* Prototypes */
-	buff_hashq_t  *create_hash_queue(uint64_t size);
+	void init_bcache(void);
+
+	uint32_t bcache_shrink(uint32_t npages);
 	
+	buff_header_t *getblk(int major, int device, uint64_t blocknum);
+
 	buff_header_t *bread(int major, int device, uint64_t blocknum);
 
 	void brelse(int major, int device, buff_header_t *buff);
 
 	buff_header_t *breada(int major, int device, uint64_t blocknum1, uint64_t blocknum2);
 
+	int breadn(int major, int device, uint64_t blocknum, int count, buff_header_t **buffs);
+
 	int bwrite(int major, int device, buff_header_t *buff, char type);
 
+	int bflush(int major, int device);
+
+	int bsync(int major, int device);
+
+	void bsync_all(void);
+
+	int bcache_get_stats(int major, int device, bcache_stats_t *stats);
+
+	void bcache_reset_stats(int major, int device);
+
+	void bcache_print_stats(int major, int device);
+
 #endif /* BHASH_H */
 
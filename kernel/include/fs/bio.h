@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: bio.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BIO_H
+
+	#define BIO_H
+
+	#include <unistd.h>
+	#include <fs/bhash.h>
+	#include <fs/elevator.h>
+
+	/** Maximum number of segments of a block I/O */
+	#define BIO_MAX_VECS	16
+
+
+	/**
+	 * Segment of a block I/O: a piece of memory (inside a page)
+	 * holding consecutive sectors.
+	 */
+	struct _bio_vec {
+		/** Page (virtual address) */
+		char *page;
+		/** Offset into the page */
+		uint32_t offset;
+		/** Size in bytes (multiple of BUFF_SIZE) */
+		uint32_t len;
+	};
+
+	typedef struct _bio_vec bio_vec_t;
+
+	/**
+	 * Block I/O: transfer of consecutive sectors of a device to (or
+	 * from) a vector of segments.
+	 */
+	struct _bio {
+		/** BLK_READ or BLK_WRITE */
+		char op;
+		/** Major number */
+		int major;
+		/** Device number (disk or partition) */
+		int device;
+		/** First sector */
+		uint64_t sector;
+		/** Number of sectors */
+		uint32_t nsectors;
+		/** Segments */
+		bio_vec_t vecs[BIO_MAX_VECS];
+		/** Number of segments */
+		int nvecs;
+		/** Completion callback (called from interrupt context) */
+		void (*end_io) (struct _bio *, int);
+		/** Private data of the caller */
+		void *private;
+		/** Result: 0 on success, -1 if any sector failed */
+		int error;
+		/** Sectors not done yet */
+		volatile uint32_t remaining;
+		/** Headers of the sectors (used by drivers) */
+		buff_header_t *hdrs;
+	};
+
+	typedef struct _bio bio_t;
+
+
+	/* Prototypes */
+
+	void bio_init(bio_t *bio, char op, int major, int device, uint64_t sector);
+
+	int bio_add_page(bio_t *bio, void *page, uint32_t offset, uint32_t len);
+
+	int submit_bio(bio_t *bio);
+
+	int bio_wait(bio_t *bio);
+
+	void bio_sector_done(bio_t *bio, int error);
+
+#endif /* BIO_H */
+
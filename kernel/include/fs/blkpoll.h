@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: blkpoll.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BLKPOLL_H
+
+	#define BLKPOLL_H
+
+	#include <unistd.h>
+
+	/** Completions slower than this (usecs) are not worth polling */
+	#define BLK_POLL_MAX_USECS	200
+	/** Minimum time spent polling (usecs) */
+	#define BLK_POLL_MIN_USECS	10
+	/** Waits on interrupt before polling the device again, to find out
+	    if it got faster */
+	#define BLK_POLL_PROBE		64
+
+	/* Polling modes */
+	#define BLK_POLL_OFF		0
+	#define BLK_POLL_AUTO		1
+
+
+	/**
+	 * Polling statistics of a device.
+	 */
+	struct _blk_poll {
+		/** BLK_POLL_OFF or BLK_POLL_AUTO */
+		char mode;
+		/** Estimated completion latency (usecs) */
+		uint32_t lat_usecs;
+		/** Waits on interrupt since the last poll */
+		uint32_t skipped;
+		/** Completions found by polling */
+		uint32_t nr_hits;
+		/** Polls that timed out (then waited for interrupt) */
+		uint32_t nr_misses;
+		/** Waits on interrupt without polling */
+		uint32_t nr_sleeps;
+	};
+
+	typedef struct _blk_poll blk_poll_t;
+
+
+	/* Prototypes */
+
+	void blk_poll_init(blk_poll_t *ps);
+
+	void blk_poll_wait(blk_poll_t *ps, volatile char *status,
+			void (*poll)(void *), void *arg, int sleep_addr);
+
+#endif /* BLKPOLL_H */
+
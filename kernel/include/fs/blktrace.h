@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: blktrace.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BLKTRACE_H
+
+	#define BLKTRACE_H
+
+	#include <unistd.h>
+
+	/** Number of events of the ring buffer (power of 2) */
+	#define BLKTRACE_EVENTS		1024
+
+	/** Number of slots of the histograms */
+	#define BLKTRACE_HIST_SLOTS	16
+
+	/* Events */
+	/** Request queued */
+	#define BT_QUEUE		'Q'
+	/** Buffers merged into a queued request */
+	#define BT_MERGE		'M'
+	/** Request sent to device */
+	#define BT_DISPATCH		'D'
+	/** Request completed */
+	#define BT_COMPLETE		'C'
+
+
+	/**
+	 * Event of the trace.
+	 */
+	struct _blk_trace_event {
+		/** Position at the trace plus one (0 while being written) */
+		volatile uint32_t seq;
+		/** Time stamp (usecs) */
+		uint32_t time;
+		/** Disk address of the first sector */
+		uint32_t sector;
+		/** Major number */
+		uint16_t major;
+		/** Device number (disk or partition) */
+		uint16_t device;
+		/** BT_QUEUE, BT_MERGE, BT_DISPATCH or BT_COMPLETE */
+		char action;
+		/** BLK_READ, BLK_WRITE or BLK_FLUSH */
+		char op;
+		/** Number of sectors */
+		uchar8_t count;
+		/** Status (completion) */
+		char status;
+	};
+
+	typedef struct _blk_trace_event blk_trace_event_t;
+
+	/**
+	 * Histograms of a request queue (one for each device).
+	 * Latency slot i counts requests that took from 2^i to
+	 * 2^(i+1) - 1 usecs, depth slot i counts requests that found
+	 * i requests on the queue or at the device (last slot: or more).
+	 */
+	struct _blk_trace_stats {
+		/** Queue to completion latency */
+		uint32_t q2c[BLKTRACE_HIST_SLOTS];
+		/** Dispatch to completion latency (device time) */
+		uint32_t d2c[BLKTRACE_HIST_SLOTS];
+		/** Queue depth seen by new requests */
+		uint32_t depth[BLKTRACE_HIST_SLOTS];
+		/** Requests sent to device and not completed */
+		uint32_t in_flight;
+	};
+
+	typedef struct _blk_trace_stats blk_trace_stats_t;
+
+	struct _blk_queue;
+	struct _blk_request;
+
+	/** Tracing is enabled (blktrace=1 at command line) */
+	extern char blktrace_enabled;
+
+
+	/* Prototypes */
+
+	void init_blktrace(void);
+
+	void blktrace_queue(struct _blk_queue *q, struct _blk_request *rq);
+
+	void blktrace_merge(struct _blk_queue *q, char op, int device,
+			uint64_t sector, int count);
+
+	void blktrace_dispatch(struct _blk_queue *q, struct _blk_request *rq);
+
+	void blktrace_complete(struct _blk_request *rq, char status);
+
+	void blktrace_dump(void);
+
+#endif /* BLKTRACE_H */
+
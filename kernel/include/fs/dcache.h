@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: dcache.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Directory entry cache: name lookups cached by (directory i-node, name).
+ */
+#ifndef DCACHE_H
+
+	#define DCACHE_H
+
+	#include <unistd.h>
+	#include <fs/vfs.h>
+
+	/** Maximum number of entries in the cache */
+	#define DCACHE_MAX_ENTRIES	512
+
+	/** Number of entries of the dentry cache hash table (power of 2) */
+	#define DCACHE_HASH_SIZE	256
+
+	/** Longest name that is cached (longer names always scan the directory) */
+	#define DCACHE_NAME_LEN		32
+
+	/** Entry is in the hash table */
+	#define DCACHE_FL_HASHED	0x01
+
+	/** dcache_lookup: name is not in the cache */
+	#define DCACHE_MISS		-1
+
+
+	/** A cached directory entry */
+	struct _dcache_entry_t {
+		/** Device of the directory */
+		dev_t device;
+		/** Directory i-node number */
+		uint32_t parent;
+		/** i-node number of the name (0 if name does not exist) */
+		uint32_t inumber;
+		/** Hash of the name */
+		uint32_t hash;
+		/** Name length */
+		uchar8_t len;
+		/** Flags (see DCACHE_FL_*) */
+		char flags;
+		/** Name */
+		char name[DCACHE_NAME_LEN];
+		/** links to make a double linked list into hash table */
+		struct _dcache_entry_t *prev;
+		struct _dcache_entry_t *next;
+		/** links to make a circular linked list into LRU list */
+		struct _dcache_entry_t *lru_prev;
+		struct _dcache_entry_t *lru_next;
+	};
+
+	typedef struct _dcache_entry_t dcache_entry_t;
+
+	/** The dentry cache */
+	struct _dcache_t {
+		/** Each position has a linked list of entries */
+		struct _dcache_entry_t *hashtable[DCACHE_HASH_SIZE];
+		/** Entries */
+		struct _dcache_entry_t *entries;
+		/** All entries (least recently used first, unused ones at head) */
+		struct _dcache_entry_t lru_head;
+	};
+
+	typedef struct _dcache_t dcache_t;
+
+
+	/* Prototypes */
+
+	void init_dcache(void);
+
+	int dcache_lookup(vfs_inode *dir, const char *name, uint32_t *inumber);
+
+	void dcache_add(vfs_inode *dir, const char *name, uint32_t inumber);
+
+	void dcache_invalidate(vfs_inode *dir, const char *name);
+
+	void dcache_invalidate_dir(vfs_inode *dir);
+
+	void dcache_purge_dev(dev_t device);
+
+#endif /* DCACHE_H */
+
@@ -69,6 +69,18 @@
 	#define DEVNUM_HDC           0
 	#define DEVNUM_HDD           64
 
+	/* 8 block - SCSI (and SATA) disks, 16 minors per disk */
+	#define DEVNUM_SDA           0
+	#define DEVNUM_SDB           16
+
+	/* 1 block - RAM disks */
+	#define DEVNUM_RAM0          0
+	#define DEVNUM_RAM1          1
+
+	/* 254 block - Virtio block devices, 16 minors per disk */
+	#define DEVNUM_VDA           0
+	#define DEVNUM_VDB           16
+
 	/* 5 char - Alternate TTY devices */
 	#define DEVNUM_TTY           0
 	#define DEVNUM_CONSOLE       1
@@ -76,8 +88,11 @@
 
 	/* Now, the major numbers */
 	#define DEVMAJOR_MEMORY      1
+	#define DEVMAJOR_RAMDISK     1
 	#define DEVMAJOR_ATA_PRI     3
 	#define DEVMAJOR_ATA_SEC     2
+	#define DEVMAJOR_SCSI_DISK   8
+	#define DEVMAJOR_VIRTIO_BLK  254
 
 #endif /* DEVICES_H */
 
@@ -58,6 +58,15 @@
 		int (*write_async_block) (int, int, buff_header_t *);
 		/** write_sync(): Write synchronously */
 		int (*write_sync_block) (int, int, buff_header_t *);
+		/** write_async_blocks(): Write consecutive blocks asynchronously,
+		    with one request (optional) */
+		int (*write_async_blocks) (int, int, buff_header_t **, int);
+		/** read_async_blocks(): Read consecutive blocks asynchronously,
+		    with one request (optional) */
+		int (*read_async_blocks) (int, int, buff_header_t **, int);
+		/** flush(): Flush device write cache (optional, device -1
+		    means all devices of the driver) */
+		int (*flush) (int, int);
 	};
 
 	/** Character device operations */
@@ -70,14 +79,41 @@
 		int major;
 	};
 
+	/**
+	 * Device number (disk or partition) of a block device driver:
+	 * where it lives at the disk.
+	 */
+	struct _blk_minor {
+		/** First sector (disk address) */
+		uint64_t start;
+		/** Size in sectors (0 means there is no such device) */
+		uint64_t length;
+		/** Device number of the disk */
+		int disk;
+	};
+
+	typedef struct _blk_minor blk_minor_t;
+
 	/** Block device driver structure */
 	struct _blk_device_driver_t {
 		/** Major number */
 		int major;
 		/** Device size (for block devices ) */
 		uint64_t size;
-		/** Buffer queue for block devices */
-		buff_hashq_t *buffer_queue;
+		/** Maximum sectors per request (0 means one) */
+		uint32_t max_sectors;
+		/** Maximum physically discontiguous segments per request
+		    (0 means no limit besides max_sectors) */
+		uint32_t max_segments;
+		/** Number of buffers of the cache holding blocks of each device,
+		    indexed by device number (MAX_MINOR_DEVICES entries) */
+		uint32_t *bcache_nbufs;
+		/** Buffer cache statistics, indexed by device number
+		    (MAX_MINOR_DEVICES entries) */
+		bcache_stats_t *bstats;
+		/** Disks and partitions, indexed by device number (see
+		    blk_add_disk; NULL if driver doesn't use them) */
+		blk_minor_t *minors;
 		/** Hash queue for i-nodes */
 		struct _vfs_inode_st *inodes_hash_table[MAX_MINOR_DEVICES];
 		/** Driver operations */
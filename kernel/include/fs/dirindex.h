@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: dirindex.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * In-memory hash index of directory entries: name hash to directory block.
+ */
+#ifndef DIRINDEX_H
+
+	#define DIRINDEX_H
+
+	#include <unistd.h>
+	#include <fs/vfs.h>
+
+	/** Directories with less blocks than this are just scanned */
+	#define DIRINDEX_MIN_BLOCKS	4
+
+	/** Initial number of entries of the index (grows as needed) */
+	#define DIRINDEX_INIT_ENTRIES	256
+
+
+	/** A directory entry in the index */
+	struct _dir_index_entry_t {
+		/** Hash of the name */
+		uint32_t hash;
+		/** Directory block (logical) holding the entry */
+		uint32_t block;
+		/** Next entry in the same bucket (-1 at the end) */
+		int32_t next;
+	};
+
+	typedef struct _dir_index_entry_t dir_index_entry_t;
+
+	/** Hash index of a directory */
+	struct _dir_index_t {
+		/** Directory size when index was built */
+		uint32_t size;
+		/** Directory modification time when index was built */
+		uint32_t mtime;
+		/** Number of buckets (power of 2) */
+		uint32_t nbuckets;
+		/** Number of entries */
+		uint32_t nentries;
+		/** First entry of each bucket (-1 if empty) */
+		int32_t *buckets;
+		/** Entries */
+		dir_index_entry_t *entries;
+	};
+
+	typedef struct _dir_index_t dir_index_t;
+
+
+	/* Prototypes */
+
+	int dir_index_lookup(vfs_inode *dir, const char *name, uint32_t *inumber);
+
+	void dir_index_free(vfs_inode *dir);
+
+#endif /* DIRINDEX_H */
+
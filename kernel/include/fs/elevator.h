@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: elevator.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ELEVATOR_H
+
+	#define ELEVATOR_H
+
+	#include <unistd.h>
+	#include <tempos/timer.h>
+	#include <fs/bhash.h>
+	#include <fs/blktrace.h>
+
+	/* Request operations */
+	#define BLK_READ	0x01
+	#define BLK_WRITE	0x02
+	/** Flush device write cache (barrier: it's dispatched after all
+	    requests queued before it, and before all queued after it) */
+	#define BLK_FLUSH	0x04
+
+	/** Number of requests in the pool (shared by all queues) */
+	#define BLK_REQUEST_POOL	128
+
+	/** Time (in jiffies) a read can wait for dispatch */
+	#define ELV_READ_EXPIRE		(HZ / 2)
+	/** Time (in jiffies) a write can wait for dispatch */
+	#define ELV_WRITE_EXPIRE	(5 * HZ)
+
+
+	/**
+	 * Block request: read or write of consecutive sectors.
+	 */
+	struct _blk_request {
+		/** BLK_READ or BLK_WRITE */
+		char op;
+		/** Device number (disk or partition) */
+		int device;
+		/** Disk address of the first sector */
+		uint64_t sector;
+		/** Buffers (holding consecutive sectors) */
+		buff_header_t *buffs[BCACHE_CLUSTER_MAX];
+		/** Number of buffers */
+		int count;
+		/** Number of buffers already transferred (used by driver) */
+		int done;
+		/** Request should be dispatched until this time (jiffies) */
+		uint32_t deadline;
+		/** Request belongs to the pool */
+		char pooled;
+		/** Where to report the final status too (used by requests
+		    without buffers, like flush) */
+		volatile char *end_status;
+		/** Queue of the request (NULL if not traced) */
+		struct _blk_queue *queue;
+		/** Time stamps (usecs) of queue and dispatch (tracing) */
+		uint32_t queued_at;
+		uint32_t dispatched_at;
+		/** Sorted list (by sector) */
+		struct _blk_request *sort_prev;
+		struct _blk_request *sort_next;
+		/** FIFO list (arrival order) */
+		struct _blk_request *fifo_prev;
+		struct _blk_request *fifo_next;
+	};
+
+	typedef struct _blk_request blk_request_t;
+
+	struct _blk_queue;
+
+	/**
+	 * I/O scheduler.
+	 */
+	struct _elevator {
+		/** Name */
+		const char *name;
+		/** Merge buffers into a queued request (1 if merged, 0 otherwise) */
+		int (*merge) (struct _blk_queue *, char, int, uint64_t, buff_header_t **, int);
+		/** Add a request to the queue */
+		void (*add_request) (struct _blk_queue *, blk_request_t *);
+		/** Remove the next request to be dispatched (NULL if empty) */
+		blk_request_t *(*next_request) (struct _blk_queue *);
+	};
+
+	typedef struct _elevator elevator_t;
+
+	/**
+	 * Queue of requests waiting for dispatch to a device.
+	 */
+	struct _blk_queue {
+		/** I/O scheduler */
+		elevator_t *elv;
+		/** Requests sorted by sector */
+		blk_request_t *sorted;
+		/** Requests in arrival order (for reads and writes) */
+		blk_request_t *fifo_head[2];
+		blk_request_t *fifo_tail[2];
+		/** Sector after the last dispatched request */
+		uint64_t head_pos;
+		/** Pending barrier (waiting for requests queued before it) */
+		blk_request_t *barrier;
+		/** Requests queued after the barrier (arrival order) */
+		blk_request_t *held_head;
+		blk_request_t *held_tail;
+		/** Number of requests at the I/O scheduler */
+		uint32_t nr_requests;
+		/** Number of merges */
+		uint32_t nr_merges;
+		/** Major number of the device */
+		int major;
+		/** Device number of the disk */
+		int disk;
+		/** Latency histograms (tracing) */
+		blk_trace_stats_t trace;
+		/** Queue is at the list of traced queues */
+		char traced;
+		/** Next traced queue */
+		struct _blk_queue *trace_next;
+	};
+
+	typedef struct _blk_queue blk_queue_t;
+
+	/** Check if there is no request on the queue */
+	#define blk_queue_empty(q)	((q)->nr_requests == 0 && (q)->barrier == NULL)
+
+
+	/** Sorted dispatch (C-LOOK) with deadlines, for rotating disks */
+	extern elevator_t elv_deadline;
+
+	/** Arrival order, for devices without seek cost */
+	extern elevator_t elv_noop;
+
+
+	/* Prototypes */
+
+	void init_blk_requests(void);
+
+	void blk_queue_init(blk_queue_t *q, elevator_t *elv, int major, int disk);
+
+	blk_request_t *blk_get_request(void);
+
+	void blk_put_request(blk_request_t *rq);
+
+	void blk_end_request(blk_request_t *rq, char status);
+
+	int blk_queue_bufs(blk_queue_t *q, char op, int device, uint64_t sector,
+			buff_header_t **bufs, int count);
+
+	int blk_queue_flush(blk_queue_t *q, int device, volatile char *status);
+
+	blk_request_t *blk_next_request(blk_queue_t *q);
+
+#endif /* ELEVATOR_H */
+
@@ -52,6 +52,26 @@
 
 	#define EXT2_NAME_LEN 255
 
+	/** Directory has hashed indexes (i_flags) */
+	#define EXT2_INDEX_FL 0x00001000
+
+	/** Compatible feature: directory indexes */
+	#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020
+
+	/** Super block flag: directory hashes use unsigned chars */
+	#define EXT2_FLAGS_UNSIGNED_HASH 0x0002
+
+	/* Directory index hash versions */
+	#define EXT2_HASH_LEGACY          0
+	#define EXT2_HASH_HALF_MD4        1
+	#define EXT2_HASH_TEA             2
+	#define EXT2_HASH_LEGACY_UNSIGNED 3
+	#define EXT2_HASH_HALF_MD4_UNSIGNED 4
+	#define EXT2_HASH_TEA_UNSIGNED    5
+
+	/** Maximum number of index levels of a directory */
+	#define EXT2_HTREE_LEVELS 2
+
 	#define EXT2_BAD_INO          1
 	#define EXT2_ROOT_INO         2
 	#define EXT2_ACL_IDX_INO      3
@@ -138,9 +158,38 @@
 		uchar8_t s_last_mounted[64]; 
 		/** For compression */
 		uint32_t s_algorithm_usage_bitmap;
+		/** Number of blocks to preallocate */
+		uchar8_t s_prealloc_blocks;
+		/** Number of blocks to preallocate for directories */
+		uchar8_t s_prealloc_dir_blocks;
+		/** Padding */
+		uint16_t s_padding1;
+		/** uuid of journal super block */
+		uchar8_t s_journal_uuid[16];
+		/** i-node number of journal file */
+		uint32_t s_journal_inum;
+		/** Device number of journal file */
+		uint32_t s_journal_dev;
+		/** Start of list of i-nodes to delete */
+		uint32_t s_last_orphan;
+		/** Seed of directory index hash */
+		uint32_t s_hash_seed[4];
+		/** Default directory index hash version */
+		uchar8_t s_def_hash_version;
+		/** Padding */
+		uchar8_t s_reserved_char_pad;
+		uint16_t s_reserved_word_pad;
+		/** Default mount options */
+		uint32_t s_default_mount_opts;
+		/** First metablock block group */
+		uint32_t s_first_meta_bg;
+		/** Not used by TempOS (creation time, journal backup, etc) */
+		uint32_t s_reserved_ext[22];
+		/** Miscellaneous flags */
+		uint32_t s_flags;
 		/* --- */
 		/** Padding to 1024 bytes */
-		uint32_t s_reserved[205];  	
+		uint32_t s_reserved[167];
 	};
 
 	/**
@@ -230,10 +279,52 @@
 	};
 
 
+	/**
+	 * EXT2 directory index: root information (block 0 of directory,
+	 * after "." and ".." entries)
+	 */
+	struct _ext2_dx_root_info_st {
+		/** Zero */
+		uint32_t reserved_zero;
+		/** Hash version */
+		uchar8_t hash_version;
+		/** Size of this structure (8) */
+		uchar8_t info_length;
+		/** Number of index levels below root */
+		uchar8_t indirect_levels;
+		/** Flags */
+		uchar8_t unused_flags;
+	};
+
+	/**
+	 * EXT2 directory index entry: first hash of a block. The first
+	 * entry of an index block holds limit and count instead of hash.
+	 */
+	struct _ext2_dx_entry_st {
+		/** Hash (or limit and count, at first entry) */
+		uint32_t hash;
+		/** Directory block (logical) */
+		uint32_t block;
+	};
+
+	/**
+	 * EXT2 directory index: limit and count of entries
+	 */
+	struct _ext2_dx_countlimit_st {
+		/** Maximum number of entries */
+		uint16_t limit;
+		/** Number of entries */
+		uint16_t count;
+	};
+
+
 	typedef struct _ext2_superblock_st ext2_superblock_t;
 	typedef struct _ext2_group_descriptor_st ext2_group_t;
 	typedef struct _ext2_inode_st ext2_inode_t;
 	typedef struct _ext2_directory_st ext2_directory_t;
+	typedef struct _ext2_dx_root_info_st ext2_dx_root_info_t;
+	typedef struct _ext2_dx_entry_st ext2_dx_entry_t;
+	typedef struct _ext2_dx_countlimit_st ext2_dx_countlimit_t;
 
 
 	/* Prototypes */
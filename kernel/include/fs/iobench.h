@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: iobench.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef IOBENCH_H
+
+	#define IOBENCH_H
+
+	#include <unistd.h>
+	#include <fs/bio.h>
+
+	/** Maximum number of I/Os in flight */
+	#define IOBENCH_MAX_QD		32
+
+	/**
+	 * Number of slots of the latency histogram. Each power of 2 is
+	 * split in 8 slots, so percentiles have 1/8 resolution.
+	 */
+	#define IOBENCH_HIST_SLOTS	240
+
+	/* Patterns */
+	#define IOBENCH_SEQ_READ	0x00
+	#define IOBENCH_SEQ_WRITE	0x01
+	#define IOBENCH_RAND_READ	0x02
+	#define IOBENCH_RAND_WRITE	0x03
+
+	/** Pattern writes */
+	#define IOBENCH_IS_WRITE(p)	((p) & 0x01)
+	/** Pattern is random */
+	#define IOBENCH_IS_RAND(p)	((p) & 0x02)
+
+	/* I/O paths */
+	/** Block I/Os submitted to the driver (dev_ops) */
+	#define IOBENCH_PATH_DIRECT	0x00
+	/** Buffer cache (bread/bwrite), one I/O at a time */
+	#define IOBENCH_PATH_BCACHE	0x01
+
+
+	struct _iobench;
+
+	/**
+	 * I/O slot: one I/O in flight.
+	 */
+	struct _iobench_slot {
+		/** Benchmark */
+		struct _iobench *ib;
+		/** Block I/O */
+		bio_t bio;
+		/** Data buffer */
+		char *data;
+		/** Time stamp of submission (usecs) */
+		uint32_t start;
+		/** I/O in flight */
+		volatile char busy;
+	};
+
+	typedef struct _iobench_slot iobench_slot_t;
+
+	/**
+	 * Benchmark parameters and results.
+	 */
+	struct _iobench {
+		/** Major number */
+		int major;
+		/** Device number (disk or partition) */
+		int device;
+		/** Pattern (IOBENCH_SEQ_READ, ...) */
+		int pattern;
+		/** I/O path (IOBENCH_PATH_DIRECT or IOBENCH_PATH_BCACHE) */
+		int path;
+		/** Block size (sectors) */
+		uint32_t bs;
+		/** Queue depth */
+		uint32_t qd;
+		/** Duration (seconds) */
+		uint32_t secs;
+		/** Sectors of the device used by the benchmark (from sector 0) */
+		uint32_t span;
+		/** State of the random generator */
+		uint32_t seed;
+		/** Next sector (sequential patterns) */
+		uint32_t next;
+		/** I/Os completed */
+		uint32_t ios;
+		/** I/Os failed */
+		uint32_t errors;
+		/** Sectors transferred */
+		uint32_t sectors;
+		/** I/Os in flight */
+		volatile uint32_t in_flight;
+		/** Some I/O completed since the last check */
+		volatile char completed;
+		/** Latency histogram */
+		uint32_t lat[IOBENCH_HIST_SLOTS];
+		/** Slots */
+		iobench_slot_t slots[IOBENCH_MAX_QD];
+	};
+
+	typedef struct _iobench iobench_t;
+
+
+	/* Prototypes */
+
+	void run_iobench(void);
+
+#endif /* IOBENCH_H */
+
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2009-2011 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: pagecache.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * Page cache: file data cached by (i-node, page index).
+ */
+#ifndef PAGECACHE_H
+
+	#define PAGECACHE_H
+
+	#include <unistd.h>
+	#include <fs/vfs.h>
+
+	/* Cached page: possible status */
+
+	/** Page is being read from device */
+	#define PCACHE_ST_LOCKED	0x01
+	/** Page contains valid data */
+	#define PCACHE_ST_VALID		0x02
+	/** Error reading page from device */
+	#define PCACHE_ST_ERROR		0x04
+
+	/* Cached page: flags */
+
+	/** Page was read ahead and was not used yet */
+	#define PCACHE_FL_READAHEAD	0x01
+	/** Page is in the hash table */
+	#define PCACHE_FL_HASHED	0x02
+
+	/** Maximum number of pages in the cache */
+	#define PCACHE_MAX_PAGES	1024
+
+	/** Number of entries of the page cache hash table (power of 2) */
+	#define PCACHE_HASH_SIZE	256
+
+	/** How many pages are read ahead on sequential reads */
+	#define PCACHE_READAHEAD	4
+
+	/** Size of the queue of pages waiting to be read ahead */
+	#define PCACHE_RA_QUEUE		16
+
+	/**
+	 * Page cache only takes new pages while there are more than
+	 * (free pages at initialization >> PCACHE_RESERVE_SHIFT) free pages.
+	 */
+	#define PCACHE_RESERVE_SHIFT	2
+
+	/** Number of pages needed to hold size bytes */
+	#define PCACHE_NPAGES(size)	(PAGE_ALIGN(size) >> PAGE_SHIFT)
+
+
+	/** A cached page of a file */
+	struct _pcache_page_t {
+		/** Device of the i-node */
+		dev_t device;
+		/** i-node number */
+		uint32_t inumber;
+		/** Page index into the file */
+		uint32_t index;
+		/** i-node (referenced while the page is being filled, used to
+		    map the page into file system blocks) */
+		struct _vfs_inode_st *inode;
+		/** Page data (page aligned) */
+		char *data;
+		/** Reference count */
+		int count;
+		/** Status of the page */
+		char status;
+		/** Flags (see PCACHE_FL_*) */
+		char flags;
+		/** links to make a double linked list into hash table */
+		struct _pcache_page_t *prev;
+		struct _pcache_page_t *next;
+		/** links to make a circular linked list into LRU (or unused) list */
+		struct _pcache_page_t *lru_prev;
+		struct _pcache_page_t *lru_next;
+	};
+
+	typedef struct _pcache_page_t pcache_page_t;
+
+	/** The page cache */
+	struct _pcache_t {
+		/** Each position has a linked list of pages */
+		struct _pcache_page_t *hashtable[PCACHE_HASH_SIZE];
+		/** Page headers */
+		struct _pcache_page_t *pages;
+		/** Unreferenced pages holding data (least recently used first) */
+		struct _pcache_page_t lru_head;
+		/** Page headers without data */
+		struct _pcache_page_t unused_head;
+		/** Pages waiting to be read ahead */
+		struct _pcache_page_t *ra_queue[PCACHE_RA_QUEUE];
+		/** Read ahead queue positions */
+		uint32_t ra_first, ra_count;
+		/** Number of pages holding data */
+		uint32_t npages;
+		/** Free pages that should be left to the rest of the system */
+		uint32_t reserve;
+	};
+
+	typedef struct _pcache_t pcache_t;
+
+
+	/* Prototypes */
+
+	void init_pcache(void);
+
+	pcache_page_t *pcache_get_page(vfs_inode *inode, uint32_t index);
+
+	void pcache_put_page(pcache_page_t *page);
+
+	uint32_t pcache_read(vfs_inode *inode, uint32_t offset, char *buf, uint32_t len);
+
+	uint32_t pcache_shrink(uint32_t npages);
+
+#endif /* PAGECACHE_H */
+
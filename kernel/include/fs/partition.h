@@ -117,8 +117,14 @@
 	part_table_st *parse_mbr(dev_blk_driver_t blk_drv, int device);
 
 	void print_partition_table(part_table_st *ptable, char *devstr);
-	
-	int translate_part_address(uint64_t *diskaddr, part_table_st *ptable, uint32_t pnumber, uint64_t paddress);
+
+	int blk_add_disk(dev_blk_driver_t *driver, int disk, uint64_t sectors);
+
+	void blk_add_partitions(dev_blk_driver_t *driver, int disk,
+			part_table_st *ptable, uint32_t max_parts);
+
+	int blk_map_sector(dev_blk_driver_t *driver, int device, uint64_t sector,
+			uint32_t count, uint64_t *diskaddr);
 
 #endif /* VFS_PARTITION_H */
 
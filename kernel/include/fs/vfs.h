@@ -46,8 +46,11 @@
 	/** Maximum file system mounted */
 	#define VFS_MAX_MOUNTED_FS 512
 
-	/** I-node hash table entries */
-	#define INODE_HASH_TABLE_SIZE VFS_MAX_OPEN_FILES
+	/** I-node hash table entries (power of 2) */
+	#define INODE_HASH_TABLE_SIZE 1024
+
+	/** Maximum number of i-node objects in memory */
+	#define INODE_CACHE_MAX VFS_MAX_OPEN_FILES
 
 	/** Number of file systems supported by TempOS */
 	#define VFS_SUPPORTED_FS 1
@@ -56,6 +59,15 @@
 	#define IFLAG_MOUNT_POINT  0x01
 	/** Head of linked list */
 	#define IFLAG_LIST_HEAD    0x02
+	/** i-node is being read from device */
+	#define IFLAG_LOCKED       0x04
+	/** i-node is in the hash table */
+	#define IFLAG_HASHED       0x08
+	/** Error reading i-node from device */
+	#define IFLAG_ERROR        0x10
+
+	/** Directory has no index (lookup should scan its blocks) */
+	#define VFS_NO_INDEX       1
 
 	/** 
 	 * As EXT2, TempOS VFS i-nodes has 15 addressing blocks.
@@ -69,6 +81,9 @@
 	#define	VFS_DIND_BLOCK      (VFS_IND_BLOCK + 1)
 	#define	VFS_TIND_BLOCK      (VFS_DIND_BLOCK + 1)
 
+	/** Maximum levels of indirect blocks */
+	#define VFS_BMAP_LEVELS     3
+
 
 	/**
 	 * Super Block structure
@@ -159,11 +174,16 @@
 		/** links to make a double linked list */
 		struct _vfs_inode_st *prev;
 		struct _vfs_inode_st *next;
-		/** links to free list */
+		/** links to free (or unused) list */
 		struct _vfs_inode_st *free_next;
 		struct _vfs_inode_st *free_prev;
 		/** Associated super block */
 		struct _vfs_superblock_st *sb;
+		/** Last indirect block used by vfs_bmap at each level (number and data) */
+		uint32_t bmap_blk[VFS_BMAP_LEVELS];
+		uint32_t *bmap_data[VFS_BMAP_LEVELS];
+		/** Hash index of directory entries (built on first lookup) */
+		struct _dir_index_t *dindex;
 		/** For the use of file system driver */
 		void *fs_driver;
 	};
@@ -236,6 +256,8 @@
 		uint32_t blk_offset;
 		/* Read ahead block number */
 		uint32_t blk_breada;
+		/* Number of blocks (contiguous on device) starting at blk_number */
+		uint32_t blk_count;
 	};
 
 	/**
@@ -256,6 +278,8 @@
 		int (*write_super) (struct _vfs_superblock_st*);
 		/** Retrieve a file system logic block */
 		char *(*get_fs_block) (struct _vfs_superblock_st*, uint32_t blocknum);
+		/** Find a name through directory index of the file system (optional) */
+		int (*lookup) (struct _vfs_inode_st *, const char *, uint32_t *);
 	};
 
 
@@ -269,9 +293,6 @@
 	typedef struct _vfs_bmap_st             vfs_bmap_t;
 
 
-	/** Global free i-nodes queue */
-	extern vfs_inode *free_inodes_head;
-
 	/** Global mount table */
 	extern vfs_mount_table mount_table[VFS_MAX_MOUNTED_FS];
 
@@ -292,9 +313,17 @@
 
 	vfs_inode *vfs_iget(vfs_superblock *sb, uint32_t number);
 
+	void vfs_iput(vfs_inode *inode);
+
+	vfs_inode *vfs_idup(vfs_inode *inode);
+
 	vfs_bmap_t vfs_bmap(vfs_inode *inode, uint32_t offset);
 
+	void vfs_bmap_release(vfs_inode *inode);
+
 	vfs_inode *vfs_namei(const char *pathname);
 
+	uint32_t vfs_dir_find_entry(const char *block, uint32_t size, const char *name, uint32_t len);
+
 #endif /* VFS_H */
 
@@ -59,6 +59,11 @@
 	/** Max memory regions */
 	#define MBOOT_MMAP_MAXREG	  40
 
+	/** Max boot modules */
+	#define MBOOT_MODS_MAX		  4
+	/** Module command line max size */
+	#define MBOOT_MOD_CMDLINE	  64
+
 	/* Memory map structure
 	   Types avaliable:
 	   		0x01 - Avaliable
@@ -79,6 +84,18 @@
 	};
 
 
+	/** Module loaded by bootloader */
+	struct _kmodule {
+		/** Physical address of the first byte */
+		uint32_t start;
+		/** Physical address after the last byte */
+		uint32_t end;
+		/** Virtual address (NULL if module is not mapped) */
+		void *vaddr;
+		/** Command line (module file name and arguments) */
+		uchar8_t cmdline[MBOOT_MOD_CMDLINE];
+	};
+
 	/** Information passed from first stage (karch) */
 	struct _karch_t {
 		uchar8_t            cmdline[CMDLINE_MAX];
@@ -86,6 +103,8 @@
 		uint32_t            mem_upper;
 		uchar8_t			mmap_size;  /* Number of elements */
 		struct _mmap_tentry mmap_table[MBOOT_MMAP_MAXREG];
+		uint32_t            mods_count;
+		struct _kmodule     mods[MBOOT_MODS_MAX];
 	};
 
 	/** Command line argument: key-value pair */
@@ -96,6 +115,7 @@
 
 	typedef struct _karch_t karch_t;
 	typedef struct _mmap_tentry mmap_tentry;
+	typedef struct _kmodule kmodule_t;
 	typedef struct _cmdline_arg cmdline_arg_t;
 
 	int vsprintf(char *str, const char *format, va_list ap);
@@ -108,6 +128,9 @@
 
 	void tempos_main(karch_t kinf);
 
+	/** Information from first stage (copy kept by kernel) */
+	extern karch_t kinfo;
+
 	/* command line functions */
 	int parse_cmdline(char *cmdline);
 
@@ -45,6 +45,7 @@
 	#define GFP_ZEROP		0x04
 
 	#define GFP_USER		0x08
+	#define GFP_CONTIG		0x10
 
 	/** Map of a directory */
 	struct _mem_map {
@@ -62,6 +63,15 @@
 	typedef struct _mem_map mem_map;
 	typedef struct _mregion mregion;
 
+	/** Maximum number of cache shrink functions */
+	#define MM_MAX_SHRINKERS	4
+
+	/**
+	 * Cache shrink function, called when memory is low. It should
+	 * give back up to npages pages and return how many were released.
+	 */
+	typedef uint32_t (*mm_shrinker_t)(uint32_t npages);
+
 	void init_mm(void);
 
 	void bmap_clear(volatile mem_map *map);
@@ -76,6 +86,18 @@
 
 	void kfree(void *ptr);
 
+	void *kmalloc_pages(uint32_t npages, uint16_t flags);
+
+	void kfree_pages(void *ptr, uint32_t npages);
+
+	uint32_t kmem_phys_addr(void *ptr);
+
+	void *kmap_phys(uint32_t paddr, uint32_t size);
+
+	void kunmap_phys(void *ptr, uint32_t size);
+
+	int register_shrinker(mm_shrinker_t shrink);
+
 #endif /* MEM_MANAGER_H */
 
 
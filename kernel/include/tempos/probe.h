@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: probe.h
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PROBE_H
+
+	#define PROBE_H
+
+	#include <unistd.h>
+	#include <tempos/sched.h>
+
+	/** Maximum number of probes running at the same time */
+	#define ASYNC_PROBE_MAX		8
+
+
+	/**
+	 * Device probe running in a kernel thread.
+	 */
+	struct _async_probe {
+		/** Probe function */
+		void (*probe)(void);
+		/** Thread running it (NULL if slot is free) */
+		task_t *thread;
+	};
+
+	typedef struct _async_probe async_probe_t;
+
+	/** Probes run in parallel (async_probe=0 at command line disables it) */
+	extern char async_probe_enabled;
+
+
+	/* Prototypes */
+
+	void init_async_probe(void);
+
+	void async_probe(void (*probe)(void));
+
+	void async_probe_wait(void);
+
+#endif /* PROBE_H */
+
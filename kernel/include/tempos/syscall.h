@@ -25,7 +25,7 @@
 
 	#define SYSCALL_H
 
-	#define SYSCALL_COUNT 5
+	#define SYSCALL_COUNT 6
 
 #ifndef ASM
 	#include <unistd.h>
@@ -37,6 +37,7 @@
 	_pushargs int      sys_execve(const char *filename, char *const argv[], char *const envp[]);
 	_pushargs ssize_t  sys_read(int fd, void *buf, size_t count);
 	_pushargs ssize_t  sys_write(int fd, const void *buf, size_t count);
+	_pushargs int      sys_sync(void);
 #endif
 
 #endif /* SYSCALL_H */
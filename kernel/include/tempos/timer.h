@@ -52,8 +52,33 @@
 
 	typedef struct _alarm_t alarm_t;
 
+	/**
+	 * Kernel timer. Unlike alarms, it's allocated by the caller, so
+	 * it can be (re)armed from interrupt handlers.
+	 */
+	struct _ktimer {
+		/** When timer will expire (jiffies) */
+		uint32_t expires;
+		/** Function executed on expiration (from timer interrupt) */
+		void (*function)(void *);
+		/** Argument to function */
+		void *arg;
+		/** Timer is armed */
+		char pending;
+		/** Next armed timer */
+		struct _ktimer *next;
+	};
+
+	typedef struct _ktimer ktimer_t;
+
 	void init_timer(void);
 	int new_alarm(uint32_t expires, void (*handler)(pt_regs *, void *), void *arg);
+	uint32_t get_usecs(void);
+	uint32_t _get_usecs(void);
+
+	void init_ktimer(ktimer_t *timer, void (*function)(void *), void *arg);
+	void mod_ktimer(ktimer_t *timer, uint32_t expires);
+	void del_ktimer(ktimer_t *timer);
 
 #endif /* TIMER_H */
 
@@ -40,10 +40,15 @@
 	/** Any free block buffer becomes free */
 	#define WAIT_BLOCK_BUFFER_GET_FREE 2
 
-	/** Wait for disk operation at primary IDE */
-	#define WAIT_INT_IDE_PRI  14
-	/** Wait for disk operation at secondary IDE */
-	#define WAIT_INT_IDE_SEC  15
+	/** Wait for disk operation at IDE devices (hda, hdb, hdc and hdd) */
+	#define WAIT_INT_IDE_HDA  18
+	#define WAIT_INT_IDE_HDB  19
+	#define WAIT_INT_IDE_HDC  20
+	#define WAIT_INT_IDE_HDD  21
+	/** Wait for disk operation at AHCI controller */
+	#define WAIT_INT_AHCI     16
+	/** Wait for disk operation at virtio block device */
+	#define WAIT_INT_VIRTIO   17
 
 	/** Wait for proccess */
 	#define WAIT_KERNEL_THREAD 50
@@ -51,6 +56,12 @@
 	/** Wait for i-node becomes unlocked */
 	#define WAIT_INODE_BECOMES_UNLOCKED 3
 
+	/** Wait for a cached page to be read from device */
+	#define WAIT_PCACHE_PAGE_READY 4
+
+	/** Page cache read ahead thread waits for requests */
+	#define WAIT_PCACHE_READAHEAD 5
+
 	/** Keyboard, wait for a key */
 	#define WAIT_KEYBOARD_KEY 40
 
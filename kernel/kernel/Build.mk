@@ -7,5 +7,5 @@
 
 obj-y += sched.o execve.o exit.o fork.o kernel.o read.o \
 		 syscall.o write.o timer.o delay.o thread.o wait.o \
-		 cmdline.o
+		 cmdline.o sync.o probe.o
 
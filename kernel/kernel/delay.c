@@ -28,12 +28,19 @@
 #include <tempos/jiffies.h>
 #include <unistd.h>
 
+/** Ticks counted by calibrate_delay (about 20ms) */
+#define CALIBRATE_TICKS		((HZ / 50) > 0 ? (HZ / 50) : 1)
+
 /** BogoMIPS calculated at system startup */
 uint32_t bogomips;
 
 
 /**
  * Calibrate delay (calculate BogoMIPS)
+ *
+ * The loop starts at a system tick, so counting over a few ticks is
+ * as precise as the old (unaligned) 100ms count, and boot doesn't
+ * wait so long.
  */
 void calibrate_delay(void)
 {
@@ -41,13 +48,17 @@ void calibrate_delay(void)
 	bogomips = 0;
 
 	kprintf(KERN_INFO "Calibrating loop delay...");
-	timeout = jiffies + ((HZ / 10)); /* Calibration takes 100ms */
-	
+
+	/* Wait for a tick */
+	timeout = jiffies;
+	while( jiffies == timeout );
+
+	timeout = jiffies + CALIBRATE_TICKS;
 	while( !time_after_eq(jiffies, timeout) )
 			bogomips++;
 	
 	/* FIXME: 3 it's a factor correction */
-	bogomips = bogomips / 300000; /* microsecond precision (us) */
+	bogomips = bogomips / ((3000000 / HZ) * CALIBRATE_TICKS); /* microsecond precision (us) */
 
 	kprintf(KERN_INFO "%d BogoMIPS\n", bogomips);
 }
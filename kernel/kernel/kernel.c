@@ -29,11 +29,19 @@
 #include <tempos/delay.h>
 #include <tempos/sched.h>
 #include <tempos/wait.h>
+#include <tempos/probe.h>
 #include <drv/i8042.h>
+#include <drv/pci.h>
 #include <drv/ata_generic.h>
+#include <drv/ahci.h>
+#include <drv/virtio_blk.h>
+#include <drv/ramdisk.h>
 #include <drv/serial.h>
 #include <fs/vfs.h>
 #include <fs/device.h>
+#include <fs/pagecache.h>
+#include <fs/blktrace.h>
+#include <fs/iobench.h>
 #include <string.h>
 #include <stdlib.h>
 #include <linkedl.h>
@@ -102,25 +110,16 @@ void thread1(void *arg)
  */
 void kernel_main_thread(void *arg)
 {
-	char rdev_str[10], *rstr, *init;
+	char rdev_str[10], *rstr, *init, *bstats;
 	dev_t rootdev;
-	size_t i, rdev_len;
+	size_t i, j, rdev_len;
 	
 	/* NOTE: keep calling order for the functions below */
 
 	/* Create idle thread */
 	kernel_thread_create(DEFAULT_PRIORITY, idle_thread, NULL);
 
-	/* Initialize Virtual File System layer */
-	register_all_fs_types();
-
-	/* Initialize PID numbers */
-	init_pids();
-
-	/* ATA controller */
-	init_ata_generic();
-
-	/* Show and parse command line */
+	/* Show and parse command line (drivers can read their options) */
 	kprintf(KERN_INFO "Kernel command line: %s\n", kinfo.cmdline);
 	parse_cmdline((char*)kinfo.cmdline);
 
@@ -137,6 +136,33 @@ void kernel_main_thread(void *arg)
 		}
 	}
 
+	/* Block I/O tracing (blktrace=1 at command line) */
+	init_blktrace();
+
+	/* PCI bus (before drivers of PCI devices) */
+	init_pci();
+
+	/* Initialize Virtual File System layer (driver table, block
+	   requests and caches must be ready before drivers register) */
+	register_all_fs_types();
+
+	/* Probe block devices in parallel (async_probe=0 at command
+	   line probes them in turn), they are ready after async_probe_wait */
+	init_async_probe();
+	async_probe(init_ata_generic);
+	async_probe(init_ahci);
+	async_probe(init_virtio_blk);
+	async_probe(init_ramdisk);
+
+	/* Initialize PID numbers */
+	init_pids();
+
+	/* Wait for device probes */
+	async_probe_wait();
+
+	/* I/O benchmark (iobench=... at command line) */
+	run_iobench();
+
 	/* Mount root file system */
 	memset(&rootdev, 0, sizeof(rootdev));
 	rstr = cmdline_get_value("root");
@@ -168,7 +194,6 @@ void kernel_main_thread(void *arg)
 
 	/* Load init */
 	vfs_inode *arq = vfs_namei(init);
-	vfs_bmap_t bk;
 
 
 	if (arq == NULL) {
@@ -176,20 +201,15 @@ void kernel_main_thread(void *arg)
 		panic("init file not found!\n");
 	}
 
-	size_t fblocks = (arq->i_size / arq->sb->s_log_block_size);
-	if ((arq->i_size % arq->sb->s_log_block_size) != 0) fblocks++;
-	
-	char *blocks = kmalloc(fblocks*arq->sb->s_log_block_size, GFP_NORMAL_Z);
-	char *blk;
-	size_t pos = 0;
-	for (i = 0; i < fblocks; i++) {
-		bk  = vfs_bmap(arq, pos);
-		blk = arq->sb->sb_op->get_fs_block(arq->sb, bk.blk_number);
-		memcpy(&blocks[pos], blk, arq->sb->s_log_block_size);
-		pos += arq->sb->s_log_block_size;
+	/* Read the whole file through page cache */
+	uint32_t init_size = arq->i_size;
+	char *blocks = kmalloc(init_size, GFP_NORMAL_Z);
+	if (blocks == NULL || pcache_read(arq, 0, blocks, init_size) != init_size) {
+		panic("Could not read init file!\n");
 	}
+	vfs_iput(arq);
 	
-	_exec_init(blocks, arq->i_size);
+	_exec_init(blocks, init_size);
 
 	/* TEST: Read root directory */
 	/*kprintf("DEBUG:\n");
@@ -269,10 +289,26 @@ void kernel_main_thread(void *arg)
 	 * idle_thread can go away...
 	 */
 	/* thread_done = 1; */
+	bstats = cmdline_get_value("bstats");
 	for(;;) {
 		/* measure system load */
 		mdelay(5000);
 		kprintf("Kernel thread: idle\n");
+
+		/* Show buffer cache statistics (bstats=1 at command line) */
+		if (bstats != NULL && strcmp(bstats, "1") == 0) {
+			for (i = 0; i < MAX_DEVBLOCK_DRIVERS; i++) {
+				if (block_dev_drivers[i] == NULL) {
+					continue;
+				}
+				for (j = 0; j < MAX_MINOR_DEVICES; j++) {
+					bcache_print_stats(i, j);
+				}
+			}
+		}
+
+		/* Dump block I/O trace (scripts/blkparse.sh decodes it) */
+		blktrace_dump();
 	}
 
 	/* tests */
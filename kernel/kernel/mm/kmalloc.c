@@ -23,18 +23,112 @@
  */
 
 #include <tempos/mm.h>
+#include <arch/io.h>
 
 
 /** Kernel Map memory */
 extern mem_map kmem;
 
+/* Prototypes */
+static int _vfind_pages_(mem_map *memm, uint32_t npages, uint32_t *fpage);
+static void *_vmalloc_pages_(mem_map *memm, uint32_t npages, uint16_t flags);
+static void _vfree_pages_(mem_map *memm, uint32_t fpage, uint32_t npages);
+
+
+/** Cache shrink functions */
+static mm_shrinker_t shrinkers[MM_MAX_SHRINKERS];
+
+/** Number of shrink functions registered */
+static uint32_t nshrinkers = 0;
+
+
+/**
+ * Register a function that gives memory of a cache back when
+ * memory is low.
+ *
+ * \param shrink The shrink function.
+ * \return 0 on success, -1 if there is no room for it.
+ */
+int register_shrinker(mm_shrinker_t shrink)
+{
+	uint32_t iflags;
+
+	iflags = irq_save();
+	if (nshrinkers == MM_MAX_SHRINKERS) {
+		irq_restore(iflags);
+		return -1;
+	}
+	shrinkers[nshrinkers++] = shrink;
+	irq_restore(iflags);
+
+	return 0;
+}
+
+
+/**
+ * Memory is low, try to get some pages back from caches. Caches
+ * registered last (built on top of the others) are shrunk first.
+ *
+ * \param npages Number of pages needed.
+ * \return Number of pages released.
+ */
+static uint32_t reclaim_pages(uint32_t npages)
+{
+	uint32_t freed = 0;
+	int i;
+
+	for (i = nshrinkers - 1; i >= 0 && freed < npages; i--) {
+		freed += shrinkers[i](npages - freed);
+	}
+	return(freed);
+}
+
 
 /**
  * Alloc memory =:)
  */
 void *kmalloc(uint32_t size, uint16_t flags)
 {
-	return( _vmalloc_(&kmem, size, flags) );
+	uint32_t iflags;
+	void *ptr;
+
+	iflags = irq_save();
+	ptr    = _vmalloc_(&kmem, size, flags);
+	irq_restore(iflags);
+
+	if (ptr == NULL && reclaim_pages(PAGE_ALIGN(size + sizeof(mregion)) >> PAGE_SHIFT) > 0) {
+		iflags = irq_save();
+		ptr    = _vmalloc_(&kmem, size, flags);
+		irq_restore(iflags);
+	}
+
+	return(ptr);
+}
+
+
+/**
+ * Alloc page aligned memory.
+ *
+ * \param npages Number of pages.
+ * \param flags Flags (GFP_CONTIG for physically contiguous pages)
+ * \note Memory should be released with kfree_pages.
+ */
+void *kmalloc_pages(uint32_t npages, uint16_t flags)
+{
+	uint32_t iflags;
+	void *ptr;
+
+	iflags = irq_save();
+	ptr    = _vmalloc_pages_(&kmem, npages, flags);
+	irq_restore(iflags);
+
+	if (ptr == NULL && reclaim_pages(npages) > 0) {
+		iflags = irq_save();
+		ptr    = _vmalloc_pages_(&kmem, npages, flags);
+		irq_restore(iflags);
+	}
+
+	return(ptr);
 }
 
 
@@ -53,40 +147,49 @@ void *kmalloc(uint32_t size, uint16_t flags)
  */
 void *_vmalloc_(mem_map *memm, uint32_t size, uint16_t flags)
 {
-	uint32_t npages, pstart;
-	uint32_t apages, index;
-	uint32_t size_region;
-	uint32_t newpage;
+	uint32_t npages;
 	uchar8_t *mem_block;
-	uint32_t *table;
 	mregion *mem_area;
-	zone_t mzone;
-	uchar8_t bit, istart;
-	volatile pagedir_t *pgdir;
-	uint32_t i, j;
-	char user_page;
 
-	/* Check flags */
-	if( (flags & GFP_DMA_Z) ) {
-		mzone = DMA_ZONE;
-	} else {
-		mzone = NORMAL_ZONE;
-	}
-	if ( (flags & GFP_USER) ) {
-		user_page = PAGE_USER;
-	} else {
-		user_page = 0x00;
-	}
-	
 	/* Calculate number of pages needed */
-	size_region = sizeof(mregion) + size;
-	npages      = PAGE_ALIGN(size_region) >> PAGE_SHIFT;
+	npages = PAGE_ALIGN(sizeof(mregion) + size) >> PAGE_SHIFT;
+
+	if( (mem_block = _vmalloc_pages_(memm, npages, flags)) == NULL )
+		return(NULL);
+
+	/* Start the block allocated information. The vfree 
+	   function will receive only an address as an argument,
+	   so the trick here is hold an information about the
+	   block just before the block itself. */
+	mem_area               = (mregion *)mem_block;
+	mem_area->memm         = memm;
+	mem_area->initial_addr = ((uint32_t)mem_block >> PAGE_SHIFT);
+	mem_area->size         = npages;
+
+	/* We have done =:) */
+	return((void*)(mem_block + sizeof(mregion)));
+}
+
+
+/**
+ * Look at a memory map bitmap and find npages contiguous free (virtual) pages.
+ *
+ * \param memm Memory allocation bitmap.
+ * \param npages How many pages.
+ * \param fpage Returns the first page found.
+ * \return 0 on success, -1 if there is no space available.
+ */
+static int _vfind_pages_(mem_map *memm, uint32_t npages, uint32_t *fpage)
+{
+	uint32_t pstart, apages;
+	uchar8_t bit, istart;
+	uint32_t i, j;
 
 	/* Search in bitmap */
 	istart = 0;
 	pstart = 0;
 	apages = 0;
-	for(i=0; i<BITMAP_SIZE; i++) {
+	for(i=0; i<BITMAP_SIZE && apages < npages; i++) {
 
 		for(j=0; j<(sizeof(uchar8_t) * 8); j++) {
 			bit = (memm->bitmap[i] & (BITMAP_FBIT >> j));
@@ -113,6 +216,52 @@ void *_vmalloc_(mem_map *memm, uint32_t size, uint16_t flags)
 	}
 
 	if(apages < npages)
+		return(-1);
+
+	*fpage = pstart;
+	return(0);
+}
+
+
+/**
+ * Look at a memory map bitmap, find npages contiguous free (virtual) pages
+ * and map physical pages on them.
+ *
+ * \param memm Memory allocation bitmap.
+ * \param npages How many pages to alloc.
+ * \param flags Flags
+ * \return Address of the first page, NULL if there is no memory available.
+ */
+static void *_vmalloc_pages_(mem_map *memm, uint32_t npages, uint16_t flags)
+{
+	uint32_t pstart;
+	uint32_t apages, index;
+	uint32_t newpage, first;
+	uchar8_t *mem_block;
+	uint32_t *table;
+	zone_t mzone;
+	volatile pagedir_t *pgdir;
+	uint32_t i;
+	char user_page;
+
+	/* Check flags */
+	if( (flags & GFP_DMA_Z) ) {
+		mzone = DMA_ZONE;
+	} else {
+		mzone = NORMAL_ZONE;
+	}
+	if ( (flags & GFP_USER) ) {
+		user_page = PAGE_USER;
+	} else {
+		user_page = 0x00;
+	}
+	
+	if (npages == 0 || _vfind_pages_(memm, npages, &pstart) < 0)
+		return(NULL);
+
+	/* Physically contiguous pages (GFP_CONTIG) are taken at once */
+	first = 0;
+	if ((flags & GFP_CONTIG) && (first = alloc_contig_pages(mzone, npages)) == 0)
 		return(NULL);
 
 	pgdir = memm->pagedir;
@@ -126,17 +275,25 @@ void *_vmalloc_(mem_map *memm, uint32_t size, uint16_t flags)
 
 	/* Now, we need to alloc pages */
 	apages = 0;
-	while(apages <= npages) {
+	while(apages < npages) {
 
-		if( !(newpage = alloc_page(mzone)) ) {
-			goto error;
+		if (first != 0) {
+			newpage = first + (apages * PAGE_SIZE);
+		} else {
+			newpage = alloc_page(mzone);
+		}
+
+		if( !newpage ) {
+			/* Free pages allocated */
+			_vfree_pages_(memm, pstart, apages);
+			return(NULL);
 		} else {
 			bmap_on(memm, (pstart + apages));
 			apages++;
 			table[i] = MAKE_ENTRY(newpage, (PAGE_WRITABLE | PAGE_PRESENT | user_page));
 		}
 
-		if(i < TABLE_SIZE) {
+		if(i < (TABLE_SIZE - 1)) {
 			i++;
 		} else {
 			index++;
@@ -145,44 +302,44 @@ void *_vmalloc_(mem_map *memm, uint32_t size, uint16_t flags)
 		}
 	}
 
-	/* Start the block allocated information. The vfree 
-	   function will receive only an address as an argument,
-	   so the trick here is hold an information about the
-	   block just before the block itself. */
-	mem_block              = (void*)(pstart * PAGE_SIZE);
-	mem_area               = (mregion *)mem_block;
-	mem_area->memm         = memm;
-	mem_area->initial_addr = pstart;
-	mem_area->size         = npages;
-
-	mem_block = (uchar8_t*)((uchar8_t*)mem_block + sizeof(mregion));
+	mem_block = (uchar8_t*)(pstart * PAGE_SIZE);
 
 	if( (flags & GFP_ZEROP) ) {
-		for(i=0; i<((size - sizeof(mregion)) / sizeof(char)); i++) {
+		for(i=0; i<(npages * PAGE_SIZE); i++) {
 			mem_block[i] = 0;
 		}
 	}
 
-	/* We have done =:) */
 	return((void*)mem_block);
+}
 
-error:
-	/* Free pages allocated */
-	while(apages > 0) {
 
-		free_page(table[i]);
-		table[i] = 0;
-		apages--;
+/**
+ * Unmap and free pages.
+ *
+ * \param memm Memory allocation bitmap.
+ * \param fpage First (virtual) page.
+ * \param npages Number of pages.
+ */
+static void _vfree_pages_(mem_map *memm, uint32_t fpage, uint32_t npages)
+{
+	uint32_t *table;
+	volatile pagedir_t *pgdir;
+	uint32_t i, page;
 
-		if(i > 0) {
-			i--;
-		} else {
-			index--;
-			table = pgdir->tables[index];
-			i = TABLE_SIZE - 1;
-		}
+	pgdir = memm->pagedir;
+
+	/* Free pages from the last to the first one, since
+	   the first page holds the region information */
+	for(i=npages; i>0; i--) {
+		page  = fpage + i - 1;
+		table = pgdir->tables[GET_DINDEX(page)];
+
+		free_page(PAGE_PADDR(table[page & (TABLE_SIZE - 1)]));
+		table[page & (TABLE_SIZE - 1)] = 0;
+		invlpg(page << PAGE_SHIFT);
+		bmap_off(memm, page);
 	}
-	return(0);
 }
 
 
@@ -192,33 +349,109 @@ error:
 void kfree(void *ptr)
 {
 	mregion *mem_area = (mregion *)((void*)ptr - sizeof(mregion));
-	mem_map *memm     = mem_area->memm;
-	uint32_t index    = mem_area->initial_addr >> TABLE_SHIFT;
-	uint32_t ffpage   = mem_area->initial_addr - (TABLE_SIZE * index);
-	uint32_t lpage    = ffpage + mem_area->size - 1;
+	uint32_t iflags;
+
+	iflags = irq_save();
+	_vfree_pages_(mem_area->memm, mem_area->initial_addr, mem_area->size);
+	irq_restore(iflags);
+}
+
+
+/**
+ * Get the physical address of memory allocated by kmalloc functions.
+ * Useful to drivers that program devices to access memory (DMA).
+ *
+ * \param ptr Virtual address.
+ * \return Physical address, 0 if address is not mapped.
+ */
+uint32_t kmem_phys_addr(void *ptr)
+{
+	uint32_t page, entry;
 	uint32_t *table;
-	volatile pagedir_t *pgdir;
-	uint32_t i, j, dpages;
 
-	j = index;
-	i = ffpage;
+	page  = (uint32_t)ptr >> PAGE_SHIFT;
+	table = kmem.pagedir->tables[GET_DINDEX(page)];
+	if (table == NULL) {
+		return 0;
+	}
+
+	entry = table[page & (TABLE_SIZE - 1)];
+	if ((entry & PAGE_PRESENT) == 0) {
+		return 0;
+	}
 
-	pgdir  = mem_area->memm->pagedir;
-	dpages = lpage;
-	table  = pgdir->tables[j];
-	while(dpages >= ffpage) {
+	return (PAGE_PADDR(entry) | ((uint32_t)ptr & (PAGE_SIZE - 1)));
+}
 
-		free_page(table[i]);
-		bmap_off(memm, (mem_area->initial_addr + dpages));
-		dpages--;
 
-		if(i > 0) {
-			i--;
-		} else {
-			j--;
-			table = pgdir->tables[j];
-		}
+/**
+ * Map physical memory (usually device registers) into kernel
+ * address space. Pages are mapped with cache disabled.
+ *
+ * \param paddr Physical address.
+ * \param size Size (in bytes) of the region.
+ * \return Virtual address of the region, NULL if there is no space.
+ * \note Region should be unmapped with kunmap_phys.
+ */
+void *kmap_phys(uint32_t paddr, uint32_t size)
+{
+	uint32_t npages, fpage, page, i;
+	uint32_t *table;
+
+	npages = PAGE_ALIGN((paddr & (PAGE_SIZE - 1)) + size) >> PAGE_SHIFT;
+	if (npages == 0 || _vfind_pages_(&kmem, npages, &fpage) < 0) {
+		return NULL;
+	}
+
+	for (i = 0; i < npages; i++) {
+		page  = fpage + i;
+		table = kmem.pagedir->tables[GET_DINDEX(page)];
+		table[page & (TABLE_SIZE - 1)] = MAKE_ENTRY(PAGE_PADDR(paddr) + (i << PAGE_SHIFT),
+				(PAGE_WRITABLE | PAGE_PRESENT | PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH));
+		invlpg(page << PAGE_SHIFT);
+		bmap_on(&kmem, page);
+	}
+
+	return (void*)((fpage << PAGE_SHIFT) | (paddr & (PAGE_SIZE - 1)));
+}
+
+
+/**
+ * Unmap physical memory mapped with kmap_phys.
+ *
+ * \param ptr Address returned by kmap_phys.
+ * \param size Size (the same passed to kmap_phys).
+ */
+void kunmap_phys(void *ptr, uint32_t size)
+{
+	uint32_t npages, fpage, page, i;
+	uint32_t *table;
+
+	fpage  = (uint32_t)ptr >> PAGE_SHIFT;
+	npages = PAGE_ALIGN(((uint32_t)ptr & (PAGE_SIZE - 1)) + size) >> PAGE_SHIFT;
+
+	for (i = 0; i < npages; i++) {
+		page  = fpage + i;
+		table = kmem.pagedir->tables[GET_DINDEX(page)];
+		table[page & (TABLE_SIZE - 1)] = 0;
+		invlpg(page << PAGE_SHIFT);
+		bmap_off(&kmem, page);
 	}
 }
 
 
+/**
+ * Free memory allocated with kmalloc_pages
+ *
+ * \param ptr Address returned by kmalloc_pages.
+ * \param npages Number of pages (the same passed to kmalloc_pages).
+ */
+void kfree_pages(void *ptr, uint32_t npages)
+{
+	uint32_t iflags;
+
+	iflags = irq_save();
+	_vfree_pages_(&kmem, ((uint32_t)ptr >> PAGE_SHIFT), npages);
+	irq_restore(iflags);
+}
+
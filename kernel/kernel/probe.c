@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2009 Renê de Souza Pinto
+ * Tempos - Tempos is an Educational and multi purpose Operating System
+ *
+ * File: probe.c
+ * Desc: Asynchronous device probing: drivers are initialized by kernel
+ *       threads, so slow probes of different devices overlap.
+ *
+ * This file is part of TempOS.
+ *
+ * TempOS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * TempOS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <tempos/kernel.h>
+#include <tempos/sched.h>
+#include <tempos/probe.h>
+#include <string.h>
+
+/** Probes run in parallel */
+char async_probe_enabled = 1;
+
+/** Running probes */
+static async_probe_t probes[ASYNC_PROBE_MAX];
+
+
+static void async_probe_thread(void *arg);
+
+
+/**
+ * Initialize asynchronous probing (async_probe=0 at command line
+ * makes drivers to be probed one after another, at boot order).
+ */
+void init_async_probe(void)
+{
+	char *opt;
+
+	memset(probes, 0, sizeof(probes));
+
+	opt = cmdline_get_value("async_probe");
+	async_probe_enabled = (opt == NULL || strcmp(opt, "0") != 0);
+}
+
+
+/**
+ * Thread of a probe.
+ */
+static void async_probe_thread(void *arg)
+{
+	async_probe_t *ap = (async_probe_t *)arg;
+
+	ap->probe();
+}
+
+
+/**
+ * Run a probe function in a new kernel thread. When asynchronous
+ * probing is disabled (or the thread can't be created), the probe
+ * runs before this function returns.
+ *
+ * \param probe Probe function (usually the init function of a driver).
+ * \note Should be called only by the kernel main thread. Probes
+ * should not depend on each other.
+ */
+void async_probe(void (*probe)(void))
+{
+	int i;
+
+	if (async_probe_enabled) {
+		for (i = 0; i < ASYNC_PROBE_MAX; i++) {
+			if (probes[i].thread != NULL) {
+				continue;
+			}
+
+			probes[i].probe  = probe;
+			probes[i].thread = kernel_thread_create(DEFAULT_PRIORITY,
+					async_probe_thread, &probes[i]);
+			if (probes[i].thread != NULL) {
+				return;
+			}
+			break;
+		}
+	}
+
+	probe();
+}
+
+
+/**
+ * Wait for all probes started by async_probe.
+ */
+void async_probe_wait(void)
+{
+	int i;
+
+	for (i = 0; i < ASYNC_PROBE_MAX; i++) {
+		if (probes[i].thread != NULL) {
+			kernel_thread_wait(probes[i].thread);
+			probes[i].thread = NULL;
+		}
+	}
+}
+
@@ -33,7 +33,8 @@ void *syscall_table[] = {
 	&sys_fork,			/* 1 */
 	&sys_execve,		/* 2 */
 	&sys_read,			/* 3 */
-	&sys_write			/* 4 */
+	&sys_write,			/* 4 */
+	&sys_sync			/* 5 */
 	//&sys_wait
 
 };
@@ -34,9 +34,14 @@
 /** Queue of alarms */
 llist *alarm_queue;
 
+/** Armed kernel timers */
+static ktimer_t *ktimer_list;
+
 
 void timer_handler(int i, pt_regs *regs);
 
+static void run_ktimers(void);
+
 
 /**
  * Contains the number of system clock ticks
@@ -46,12 +51,16 @@ void timer_handler(int i, pt_regs *regs);
  */
 volatile uint32_t jiffies;
 
+/** Last value returned by get_usecs() */
+static uint32_t last_usecs = 0;
+
 /**
  * Initialize time system
  */
 void init_timer(void)
 {
-	jiffies = 0;
+	jiffies     = 0;
+	ktimer_list = NULL;
 
 	kprintf(KERN_INFO "Initializing timer...\n");
 
@@ -74,6 +83,8 @@ void timer_handler(int i, pt_regs *regs)
 
 	jiffies++;
 
+	run_ktimers();
+
 	/*
  	 * Check and execute handlers of expired alarms
  	 */
@@ -131,3 +142,140 @@ int new_alarm(uint32_t expires, void (*handler)(pt_regs *, void *), void *arg)
 }
 
 
+/**
+ * Initialize a kernel timer (not armed).
+ *
+ * \param timer The timer.
+ * \param function Function to be executed when timer expires.
+ * \param arg Argument to be passed to function.
+ */
+void init_ktimer(ktimer_t *timer, void (*function)(void *), void *arg)
+{
+	timer->expires  = 0;
+	timer->function = function;
+	timer->arg      = arg;
+	timer->pending  = 0;
+	timer->next     = NULL;
+}
+
+
+/**
+ * Arm a kernel timer (or change its expiration, if it's armed).
+ *
+ * \param timer The timer.
+ * \param expires When timer will expire (expressed in jiffies).
+ * \note Should be called with interrupts disabled.
+ */
+void mod_ktimer(ktimer_t *timer, uint32_t expires)
+{
+	timer->expires = expires;
+	if (!timer->pending) {
+		timer->pending = 1;
+		timer->next    = ktimer_list;
+		ktimer_list    = timer;
+	}
+}
+
+
+/**
+ * Disarm a kernel timer.
+ *
+ * \param timer The timer.
+ * \note Should be called with interrupts disabled.
+ */
+void del_ktimer(ktimer_t *timer)
+{
+	ktimer_t **tmp;
+
+	if (timer->pending) {
+		for (tmp = &ktimer_list; *tmp != NULL; tmp = &(*tmp)->next) {
+			if (*tmp == timer) {
+				*tmp = timer->next;
+				break;
+			}
+		}
+		timer->pending = 0;
+	}
+}
+
+
+/**
+ * Execute functions of expired kernel timers.
+ * \note Timers can be armed again (or disarmed) by these functions.
+ */
+static void run_ktimers(void)
+{
+	ktimer_t *list, *timer;
+
+	cli();
+	/* Timers armed by the functions go to the new list */
+	list        = ktimer_list;
+	ktimer_list = NULL;
+
+	while ((timer = list) != NULL) {
+		list        = timer->next;
+		timer->next = NULL;
+
+		if (!timer->pending) {
+			/* Disarmed by a previous function */
+			continue;
+		}
+
+		if (time_after_eq(jiffies, timer->expires)) {
+			timer->pending = 0;
+			timer->function(timer->arg);
+			cli();
+		} else {
+			timer->next = ktimer_list;
+			ktimer_list = timer;
+		}
+	}
+	sti();
+}
+
+
+/**
+ * Return a time stamp with (about) microsecond resolution.
+ *
+ * The value is calculated from jiffies plus the time elapsed on
+ * the current system tick, read from the timer counter.
+ *
+ * \return uint32_t Microseconds since timer initialization.
+ * \note The value wraps around after about 71 minutes, so it should
+ *       be used only to measure intervals.
+ */
+uint32_t get_usecs(void)
+{
+	uint32_t usecs;
+
+	cli();
+	usecs = _get_usecs();
+	sti();
+
+	return usecs;
+}
+
+
+/**
+ * Same as get_usecs(), to be called with interrupts disabled
+ * (they are kept disabled).
+ *
+ * \return uint32_t Microseconds since timer initialization.
+ */
+uint32_t _get_usecs(void)
+{
+	uint32_t usecs, elapsed;
+
+	elapsed = PIT_DIVIDER - pit_get_count();
+	usecs   = (jiffies * (1000000 / HZ)) + ((elapsed * 838) / 1000);
+
+	/* Timer IRQ could be pending, keep time stamps monotonic */
+	if ((int32_t)(usecs - last_usecs) < 0) {
+		usecs = last_usecs;
+	} else {
+		last_usecs = usecs;
+	}
+
+	return usecs;
+}
+
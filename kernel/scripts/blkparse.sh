@@ -0,0 +1,101 @@
+#!/bin/bash
+
+#
+# Copyright (C) 2009 Renê de Souza Pinto
+# TempOS - Tempos is an Educational and multi purpose Operating System
+#
+# Decode block I/O trace (kernel booted with blktrace=1) from
+# console or serial output.
+#
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <console_log>"
+	exit 1
+fi
+
+if [ ! -f "$1" ]; then
+	echo "ERROR: $1 not found."
+	exit 1
+fi
+
+awk '
+# blktrace: <seq> <usecs> <major>,<device> <action> <op> <sector> <count> <status>
+$1 == "blktrace:" {
+	dev = $4; act = $5; key = dev " " $6 " " $7
+	actions[dev " " act]++
+	devs[dev] = 1
+
+	if (act == "Q") {
+		queued[key] = $3
+	} else if (act == "D") {
+		if (key in queued) {
+			dispatched[key] = $3
+		}
+	} else if (act == "C" && (key in queued)) {
+		q2c = $3 - queued[key]
+		q2c_sum[dev] += q2c; q2c_n[dev]++
+		if (q2c > q2c_max[dev]) q2c_max[dev] = q2c
+		if (key in dispatched) {
+			d2c = $3 - dispatched[key]
+			q2d_sum[dev] += q2c - d2c
+			d2c_sum[dev] += d2c; d2c_n[dev]++
+			if (d2c > d2c_max[dev]) d2c_max[dev] = d2c
+			delete dispatched[key]
+		}
+		if ($9 != 2) errors[dev]++
+		delete queued[key]
+	}
+	next
+}
+
+$1 == "blklost:" {
+	lost += $2
+	next
+}
+
+# blkhist: <major>,<disk> <name> <slot0> ... <slot15> (last dump wins)
+$1 == "blkhist:" {
+	hkey = $2 " " $3
+	hist[hkey] = $0
+	if (!(hkey in horder)) {
+		horder[hkey] = ++nhist
+		hnames[nhist] = hkey
+	}
+	next
+}
+
+END {
+	printf("%-10s %6s %6s %6s %6s %10s %10s %10s %10s\n", "device", "Q", "M",
+		"D", "C", "Q2D avg", "D2C avg", "D2C max", "Q2C avg")
+	for (dev in devs) {
+		printf("%-10s %6d %6d %6d %6d %10d %10d %10d %10d\n", dev,
+			actions[dev " Q"], actions[dev " M"], actions[dev " D"], actions[dev " C"],
+			(d2c_n[dev] ? q2d_sum[dev] / d2c_n[dev] : 0),
+			(d2c_n[dev] ? d2c_sum[dev] / d2c_n[dev] : 0), d2c_max[dev],
+			(q2c_n[dev] ? q2c_sum[dev] / q2c_n[dev] : 0))
+		if (errors[dev]) {
+			printf("%-10s %d request(s) failed\n", dev, errors[dev])
+		}
+	}
+	if (lost) {
+		printf("\n%d event(s) lost (dump did not keep up)\n", lost)
+	}
+
+	for (i = 1; i <= nhist; i++) {
+		n = split(hist[hnames[i]], f, " ")
+		printf("\n%s %s\n", f[2], f[3])
+		for (s = 4; s <= n; s++) {
+			slot = s - 4
+			if (f[s] == 0) continue
+			if (f[3] == "depth") {
+				label = sprintf("%d%s", slot, (s == n ? "+" : ""))
+			} else if (s == n) {
+				label = sprintf(">= %d us", 2 ^ slot)
+			} else {
+				label = sprintf("%d - %d us", (slot ? 2 ^ slot : 0), 2 ^ (slot + 1) - 1)
+			}
+			printf("  %-20s %d\n", label, f[s])
+		}
+	}
+}
+' "$1"